@@ -0,0 +1,407 @@
+/**
+ * @file
+ * @brief This file implements the bitmap index declared in bitmap_index.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bitmap_index.h"
+
+// words of a container kept as a bitmap
+#define CONTAINER_WORDS (BITMAP_CONTAINER_SLOTS / 64)
+
+int bitmap_index_init(struct bitmap_index* index, int size, int is_int) {
+	memset(index,0,sizeof(struct bitmap_index));
+	index->size = size;
+	index->is_int = is_int;
+	index->capacity = 16;
+	index->values = (char*)calloc(index->capacity,size);
+	index->bitmaps = (struct bitmap*)calloc(index->capacity,sizeof(struct bitmap));
+	index->used = (int*)calloc(index->capacity,sizeof(int));
+	if (index->values == 0 || index->bitmaps == 0 || index->used == 0) {
+		return -1;
+	}
+	return pthread_rwlock_init(&index->lock,0) == 0 ? 0 : -1;
+}
+
+// FNV-1a of the bytes of a value, chars up to their terminator
+static unsigned int hash_value(struct bitmap_index* index, const char* value) {
+	unsigned int hash = 2166136261u;
+	int k;
+	for (k=0; k<index->size && (index->is_int || value[k] != '\0'); k++) {
+		hash ^= (unsigned char)value[k];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int same_value(struct bitmap_index* index, const char* kept,
+		const char* value) {
+	return index->is_int ? memcmp(kept,value,index->size) == 0
+			: strncmp(kept,value,index->size) == 0;
+}
+
+// the position of a value in the table, or the free one it would take
+static int find_position(struct bitmap_index* index, const char* value) {
+	int k = hash_value(index,value) & (index->capacity - 1);
+	while (index->used[k] && !same_value(index,
+			index->values + (size_t)k * index->size,value)) {
+		k = (k + 1) & (index->capacity - 1);
+	}
+	return k;
+}
+
+static struct bitmap* find_bitmap(struct bitmap_index* index,
+		const char* value) {
+	int k = find_position(index,value);
+	return index->used[k] ? &index->bitmaps[k] : 0;
+}
+
+// double the table, the caller holds the lock for writing
+static int grow_values(struct bitmap_index* index) {
+	struct bitmap_index grown = *index;
+	grown.capacity = index->capacity * 2;
+	grown.values = (char*)calloc(grown.capacity,index->size);
+	grown.bitmaps = (struct bitmap*)calloc(grown.capacity,sizeof(struct bitmap));
+	grown.used = (int*)calloc(grown.capacity,sizeof(int));
+	if (grown.values == 0 || grown.bitmaps == 0 || grown.used == 0) {
+		free(grown.values);
+		free(grown.bitmaps);
+		free(grown.used);
+		return -1;
+	}
+	int k;
+	for (k=0; k<index->capacity; k++) {
+		if (index->used[k]) {
+			const char* value = index->values + (size_t)k * index->size;
+			int m = find_position(&grown,value);
+			memcpy(grown.values + (size_t)m * index->size,value,index->size);
+			grown.bitmaps[m] = index->bitmaps[k];
+			grown.used[m] = 1;
+		}
+	}
+	free(index->values);
+	free(index->bitmaps);
+	free(index->used);
+	index->values = grown.values;
+	index->bitmaps = grown.bitmaps;
+	index->used = grown.used;
+	index->capacity = grown.capacity;
+	return 0;
+}
+
+// the set of a value, added empty if the value is new, 0 if failed
+static struct bitmap* add_bitmap(struct bitmap_index* index,
+		const char* value) {
+	struct bitmap* bitmap = find_bitmap(index,value);
+	if (bitmap != 0) {
+		return bitmap;
+	}
+	// at most half full, so probes stay short
+	if ((index->value_count + 1) * 2 > index->capacity
+			&& grow_values(index) != 0) {
+		return 0;
+	}
+	int k = find_position(index,value);
+	char* kept = index->values + (size_t)k * index->size;
+	if (index->is_int) {
+		memcpy(kept,value,index->size);
+	} else {
+		strncpy(kept,value,index->size);
+	}
+	index->used[k] = 1;
+	index->value_count++;
+	return &index->bitmaps[k];
+}
+
+// the first container whose high is not below high
+static int lower_container(struct bitmap* bitmap, unsigned int high) {
+	int low = 0, up = bitmap->count;
+	while (low < up) {
+		int mid = (low + up) / 2;
+		if (bitmap->containers[mid].high < high) {
+			low = mid + 1;
+		} else {
+			up = mid;
+		}
+	}
+	return low;
+}
+
+// the first position of an array whose low 16 bits are not below low
+static int lower_slot(struct bitmap_container* container, unsigned int low) {
+	int first = 0, up = container->count;
+	while (first < up) {
+		int mid = (first + up) / 2;
+		if (container->array[mid] < low) {
+			first = mid + 1;
+		} else {
+			up = mid;
+		}
+	}
+	return first;
+}
+
+// the container of high, added empty if there is none, 0 if failed
+static struct bitmap_container* add_container(struct bitmap* bitmap,
+		unsigned int high) {
+	int pos = lower_container(bitmap,high);
+	if (pos < bitmap->count && bitmap->containers[pos].high == high) {
+		return &bitmap->containers[pos];
+	}
+	if (bitmap->count == bitmap->capacity) {
+		int capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+		struct bitmap_container* containers = (struct bitmap_container*)
+				realloc(bitmap->containers,capacity * sizeof(struct bitmap_container));
+		if (containers == 0) {
+			return 0;
+		}
+		bitmap->containers = containers;
+		bitmap->capacity = capacity;
+	}
+	memmove(&bitmap->containers[pos + 1],&bitmap->containers[pos],
+			(bitmap->count - pos) * sizeof(struct bitmap_container));
+	bitmap->count++;
+	struct bitmap_container* container = &bitmap->containers[pos];
+	memset(container,0,sizeof(struct bitmap_container));
+	container->high = high;
+	return container;
+}
+
+// turn the array of a container into a bitmap, or back
+static int to_words(struct bitmap_container* container) {
+	unsigned long long* words = (unsigned long long*)calloc(CONTAINER_WORDS,
+			sizeof(unsigned long long));
+	if (words == 0) {
+		return -1;
+	}
+	int k;
+	for (k=0; k<container->count; k++) {
+		words[container->array[k] / 64] |= 1ULL << (container->array[k] % 64);
+	}
+	free(container->array);
+	container->array = 0;
+	container->capacity = 0;
+	container->words = words;
+	return 0;
+}
+
+static int to_array(struct bitmap_container* container) {
+	unsigned short* array = (unsigned short*)malloc(BITMAP_ARRAY_MAX
+			* sizeof(unsigned short));
+	if (array == 0) {
+		return -1;
+	}
+	int k, n = 0;
+	for (k=0; k<BITMAP_CONTAINER_SLOTS; k++) {
+		if ((container->words[k / 64] >> (k % 64)) & 1) {
+			array[n++] = k;
+		}
+	}
+	free(container->words);
+	container->words = 0;
+	container->array = array;
+	container->capacity = BITMAP_ARRAY_MAX;
+	return 0;
+}
+
+// add the low 16 bits of a slot to a container
+// return 1 if added, 0 if it was there, -1 if failed
+static int container_add(struct bitmap_container* container, unsigned int low) {
+	if (container->words == 0) {
+		int pos = lower_slot(container,low);
+		if (pos < container->count && container->array[pos] == low) {
+			return 0;
+		}
+		if (container->count == BITMAP_ARRAY_MAX) {
+			if (to_words(container) != 0) {
+				return -1;
+			}
+			return container_add(container,low);
+		}
+		if (container->count == container->capacity) {
+			int capacity = container->capacity ? container->capacity * 2 : 4;
+			unsigned short* array = (unsigned short*)realloc(container->array,
+					capacity * sizeof(unsigned short));
+			if (array == 0) {
+				return -1;
+			}
+			container->array = array;
+			container->capacity = capacity;
+		}
+		memmove(&container->array[pos + 1],&container->array[pos],
+				(container->count - pos) * sizeof(unsigned short));
+		container->array[pos] = low;
+		container->count++;
+		return 1;
+	}
+	unsigned long long bit = 1ULL << (low % 64);
+	if (container->words[low / 64] & bit) {
+		return 0;
+	}
+	container->words[low / 64] |= bit;
+	container->count++;
+	return 1;
+}
+
+// remove the low 16 bits of a slot from a container
+// return 1 if removed, 0 if it was not there
+static int container_remove(struct bitmap_container* container,
+		unsigned int low) {
+	if (container->words == 0) {
+		int pos = lower_slot(container,low);
+		if (pos == container->count || container->array[pos] != low) {
+			return 0;
+		}
+		memmove(&container->array[pos],&container->array[pos + 1],
+				(container->count - pos - 1) * sizeof(unsigned short));
+		container->count--;
+		return 1;
+	}
+	unsigned long long bit = 1ULL << (low % 64);
+	if ((container->words[low / 64] & bit) == 0) {
+		return 0;
+	}
+	container->words[low / 64] &= ~bit;
+	container->count--;
+	// well below the limit, so a slot coming and going does not convert
+	// the container every time; an array keeps the words if it fails
+	if (container->count <= BITMAP_ARRAY_MAX / 2) {
+		to_array(container);
+	}
+	return 1;
+}
+
+int bitmap_index_add(struct bitmap_index* index, const char* value,
+		unsigned long slot) {
+	pthread_rwlock_wrlock(&index->lock);
+	struct bitmap* bitmap = add_bitmap(index,value);
+	struct bitmap_container* container = bitmap != 0 ?
+			add_container(bitmap,slot / BITMAP_CONTAINER_SLOTS) : 0;
+	int added = container != 0 ?
+			container_add(container,slot % BITMAP_CONTAINER_SLOTS) : -1;
+	if (added < 0) {
+		index->failed = 1;
+	} else {
+		bitmap->slots += added;
+	}
+	pthread_rwlock_unlock(&index->lock);
+	return added < 0 ? -1 : 0;
+}
+
+void bitmap_index_remove(struct bitmap_index* index, const char* value,
+		unsigned long slot) {
+	pthread_rwlock_wrlock(&index->lock);
+	struct bitmap* bitmap = find_bitmap(index,value);
+	int pos = bitmap != 0 ?
+			lower_container(bitmap,slot / BITMAP_CONTAINER_SLOTS) : 0;
+	if (bitmap != 0 && pos < bitmap->count
+			&& bitmap->containers[pos].high == slot / BITMAP_CONTAINER_SLOTS) {
+		struct bitmap_container* container = &bitmap->containers[pos];
+		bitmap->slots -= container_remove(container,
+				slot % BITMAP_CONTAINER_SLOTS);
+		if (container->count == 0) {
+			free(container->array);
+			free(container->words);
+			memmove(container,container + 1,
+					(bitmap->count - pos - 1) * sizeof(struct bitmap_container));
+			bitmap->count--;
+		}
+	}
+	pthread_rwlock_unlock(&index->lock);
+}
+
+unsigned long bitmap_index_count(struct bitmap_index* index,
+		const char* value) {
+	pthread_rwlock_rdlock(&index->lock);
+	struct bitmap* bitmap = find_bitmap(index,value);
+	unsigned long slots = bitmap != 0 ? bitmap->slots : 0;
+	pthread_rwlock_unlock(&index->lock);
+	return slots;
+}
+
+unsigned long bitmap_index_next(struct bitmap_index* index, const char* value,
+		unsigned long slot) {
+	pthread_rwlock_rdlock(&index->lock);
+	struct bitmap* bitmap = find_bitmap(index,value);
+	unsigned long next = BITMAP_NONE;
+	unsigned int high = slot / BITMAP_CONTAINER_SLOTS;
+	int pos = bitmap != 0 ? lower_container(bitmap,high) : 0;
+	for (; bitmap != 0 && pos < bitmap->count && next == BITMAP_NONE; pos++) {
+		struct bitmap_container* container = &bitmap->containers[pos];
+		unsigned int low = container->high == high ?
+				slot % BITMAP_CONTAINER_SLOTS : 0;
+		if (container->words == 0) {
+			int k = lower_slot(container,low);
+			if (k < container->count) {
+				next = (unsigned long)container->high * BITMAP_CONTAINER_SLOTS
+						+ container->array[k];
+			}
+			continue;
+		}
+		int w = low / 64;
+		unsigned long long word = container->words[w] & (~0ULL << (low % 64));
+		while (word == 0 && ++w < CONTAINER_WORDS) {
+			word = container->words[w];
+		}
+		if (word != 0) {
+			next = (unsigned long)container->high * BITMAP_CONTAINER_SLOTS
+					+ w * 64 + __builtin_ctzll(word);
+		}
+	}
+	pthread_rwlock_unlock(&index->lock);
+	return next;
+}
+
+int bitmap_index_select(struct bitmap_index* index, const char* value,
+		unsigned long first, int n, unsigned long long* bits) {
+	int words = (n + 63) / 64, w, set = 0;
+	memset(bits,0,words * sizeof(unsigned long long));
+	pthread_rwlock_rdlock(&index->lock);
+	struct bitmap* bitmap = find_bitmap(index,value);
+	unsigned int high = first / BITMAP_CONTAINER_SLOTS;
+	unsigned int low = first % BITMAP_CONTAINER_SLOTS;
+	int pos = bitmap != 0 ? lower_container(bitmap,high) : 0;
+	if (bitmap != 0 && pos < bitmap->count
+			&& bitmap->containers[pos].high == high) {
+		struct bitmap_container* container = &bitmap->containers[pos];
+		if (container->words != 0) {
+			memcpy(bits,container->words + low / 64,
+					words * sizeof(unsigned long long));
+			if (n % 64 != 0) {
+				bits[words - 1] &= (1ULL << (n % 64)) - 1;
+			}
+		} else {
+			int k;
+			for (k=lower_slot(container,low); k<container->count
+					&& container->array[k] < low + n; k++) {
+				unsigned int m = container->array[k] - low;
+				bits[m / 64] |= 1ULL << (m % 64);
+			}
+		}
+	}
+	pthread_rwlock_unlock(&index->lock);
+	for (w=0; w<words; w++) {
+		set += bits[w] != 0;
+	}
+	return set;
+}
+
+size_t bitmap_index_memory(struct bitmap_index* index) {
+	pthread_rwlock_rdlock(&index->lock);
+	size_t bytes = sizeof(struct bitmap_index) + (size_t)index->capacity
+			* (index->size + sizeof(struct bitmap) + sizeof(int));
+	int k, m;
+	for (k=0; k<index->capacity; k++) {
+		struct bitmap* bitmap = &index->bitmaps[k];
+		bytes += bitmap->capacity * sizeof(struct bitmap_container);
+		for (m=0; m<bitmap->count; m++) {
+			struct bitmap_container* container = &bitmap->containers[m];
+			bytes += container->words != 0 ?
+					CONTAINER_WORDS * sizeof(unsigned long long)
+					: container->capacity * sizeof(unsigned short);
+		}
+	}
+	pthread_rwlock_unlock(&index->lock);
+	return bytes;
+}
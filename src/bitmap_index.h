@@ -0,0 +1,131 @@
+/**
+ * @file
+ * @brief This file declares a bitmap index: for each value of a column,
+ * the set of the slots (see column_store.h) whose rows have it.
+ *
+ * The set of a value is a compressed bitmap in the style of roaring
+ * bitmaps: slots are grouped by their high 16 bits, and each group that
+ * has slots is a container holding their low 16 bits, as a sorted array
+ * while it holds up to BITMAP_ARRAY_MAX of them, as a bitmap of all 65536
+ * otherwise. A column with few distinct values thus costs about a bit per
+ * slot and value, and a rare value a few bytes per slot.
+ *
+ * Values are the size bytes of a column in a row: a 64-bit integer, or
+ * chars compared as strncmp does. A value keeps its set once seen, empty
+ * or not. Readers take the index's lock for reading, writers for writing.
+ *
+ * A table adds the slot of an entry to the set of a value before the
+ * first version with the value is committed, and removes it once no
+ * version has it. The set of a value thus holds every slot whose row has
+ * the value in some snapshot, and maybe a few more, which queries recheck.
+ */
+
+#ifndef BITMAP_INDEX_H_
+#define BITMAP_INDEX_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Slots of a container
+ */
+#define BITMAP_CONTAINER_SLOTS 65536
+
+/**
+ * Most slots a container keeps in an array
+ */
+#define BITMAP_ARRAY_MAX 4096
+
+/**
+ * What bitmap_index_next returns past the last slot of a value
+ */
+#define BITMAP_NONE (~0UL)
+
+/**
+ * The slots of a value whose high 16 bits are high
+ */
+struct bitmap_container {
+	unsigned int high;
+	int count;
+	// the low 16 bits of the slots, sorted, while count <= BITMAP_ARRAY_MAX
+	unsigned short* array;
+	int capacity;
+	// BITMAP_CONTAINER_SLOTS bits, once count went over BITMAP_ARRAY_MAX
+	unsigned long long* words;
+};
+
+/**
+ * The slots of a value, in containers sorted by high
+ */
+struct bitmap {
+	struct bitmap_container* containers;
+	int count;
+	int capacity;
+	unsigned long slots;
+};
+
+/**
+ * A bitmap index
+ */
+struct bitmap_index {
+	int size;
+	int is_int;
+	// open-addressing table of the values seen, and of their sets
+	char* values;
+	struct bitmap* bitmaps;
+	int* used;
+	int value_count;
+	int capacity;
+	// set if a change could not be made: the index misses slots
+	volatile int failed;
+	pthread_rwlock_t lock;
+};
+
+/**
+ * Initialize an empty index of values of size bytes, 64-bit integers if
+ * is_int, else chars
+ * Return -1 if failed, 0 if successful
+ */
+int bitmap_index_init(struct bitmap_index* index, int size, int is_int);
+
+/**
+ * Add a slot to the set of a value
+ * Return -1 if failed, and the index is failed from then on
+ */
+int bitmap_index_add(struct bitmap_index* index, const char* value,
+		unsigned long slot);
+
+/**
+ * Remove a slot from the set of a value, if it is there
+ */
+void bitmap_index_remove(struct bitmap_index* index, const char* value,
+		unsigned long slot);
+
+/**
+ * Get the number of slots in the set of a value
+ */
+unsigned long bitmap_index_count(struct bitmap_index* index,
+		const char* value);
+
+/**
+ * Get the first slot from slot on in the set of a value
+ * Return BITMAP_NONE if there is none
+ */
+unsigned long bitmap_index_next(struct bitmap_index* index, const char* value,
+		unsigned long slot);
+
+/**
+ * Set bit k of bits if slot first + k is in the set of a value, for the n
+ * slots from first, which is a multiple of 64 and in the same container
+ * as the n-th slot
+ * Return the number of words with a bit set
+ */
+int bitmap_index_select(struct bitmap_index* index, const char* value,
+		unsigned long first, int n, unsigned long long* bits);
+
+/**
+ * Get the number of bytes allocated by an index
+ */
+size_t bitmap_index_memory(struct bitmap_index* index);
+
+#endif /* BITMAP_INDEX_H_ */
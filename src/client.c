@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "storage.h"
+#include "storage_pipeline.h"
 
 #include "utils.h"
 #include <stdlib.h>
@@ -118,19 +119,47 @@ void bulk_load() {
 	storage_auth(USERNAME,PASSWORD,conn);
 	// bulk load
 	char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN], values[MAX_RECORDS_PER_TABLE][MAX_VALUE_LEN];
+	int k;
+	for (k=0; k<MAX_RECORDS_PER_TABLE; k++) {
+		keys[k][0] = '\0';
+		values[k][0] = '\0';
+	}
 	if (extract_kv_from_file(FILE_NAME,keys,values) != 0) {
 		printf("> Failed\n");
 		return;
 	}
-	// Issue storage_set with loop
-	int k = 0;
-	while (keys[k][0] != '\0' && values[k][0] != '\0') {
-		struct storage_record r;
-		strncpy(r.value, values[k], sizeof values[k]);
-		r.metadata[0] = 0;
-		storage_set(TABLE, keys[k], &r, conn);
-		k++;
+	// Issue storage_set in pipelined batches, one round trip per batch
+	int results[MAX_PIPELINE_DEPTH];
+	int loaded = 0, failed = 0;
+	k = 0;
+	while (k < MAX_RECORDS_PER_TABLE && keys[k][0] != '\0' && values[k][0] != '\0') {
+		int queued = 0;
+		while (queued < MAX_PIPELINE_DEPTH && k < MAX_RECORDS_PER_TABLE
+				&& keys[k][0] != '\0' && values[k][0] != '\0') {
+			struct storage_record r;
+			strncpy(r.value, values[k], sizeof values[k]);
+			r.metadata[0] = 0;
+			if (storage_pipeline_set(TABLE, keys[k], &r, conn) == 0) {
+				queued++;
+			} else {
+				failed++;
+			}
+			k++;
+		}
+		int m, done = storage_pipeline_collect(results, queued, conn);
+		if (done < 0) {
+			failed += queued;
+			break;
+		}
+		for (m=0; m<done; m++) {
+			if (results[m] == 0) {
+				loaded++;
+			} else {
+				failed++;
+			}
+		}
 	}
+	printf("> Loaded %d records, %d failed\n", loaded, failed);
 	// disconnect
 	storage_disconnect(conn);
 }
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * @brief This file implements the column store declared in column_store.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "column_store.h"
+
+int column_store_init(struct column_store* store, int col_count,
+		const int* offsets, const int* sizes, struct dictionary** dictionaries) {
+	memset(store,0,sizeof(struct column_store));
+	store->col_count = col_count;
+	memcpy(store->offsets,offsets,col_count * sizeof(int));
+	memcpy(store->sizes,sizes,col_count * sizeof(int));
+	int m;
+	for (m=0; m<col_count; m++) {
+		store->dictionaries[m] = dictionaries[m];
+		store->widths[m] = dictionaries[m] != 0 ? sizeof(unsigned int) : sizes[m];
+	}
+	return 0;
+}
+
+// allocate chunk k with its columns, the values aligned for vector loads
+static struct column_chunk* add_chunk(struct column_store* store,
+		unsigned long k) {
+	struct column_chunk* chunk = (struct column_chunk*)
+			calloc(1,sizeof(struct column_chunk));
+	if (chunk == 0) {
+		return 0;
+	}
+	int m;
+	for (m=0; m<store->col_count; m++) {
+		if (posix_memalign((void**)&chunk->values[m],64,
+				(size_t)store->widths[m] * COLUMN_CHUNK_ROWS) != 0) {
+			while (m-- > 0) {
+				free(chunk->values[m]);
+			}
+			free(chunk);
+			return 0;
+		}
+	}
+	store->chunks[k] = chunk;
+	return chunk;
+}
+
+long column_store_add(struct column_store* store, void* item) {
+	unsigned long slot;
+	if (store->free_count > 0) {
+		slot = store->free_slots[--store->free_count];
+	} else {
+		slot = store->slots;
+		if (slot == (unsigned long)COLUMN_CHUNK_ROWS * COLUMN_MAX_CHUNKS
+				|| (column_chunk_of(store,slot) == 0
+						&& add_chunk(store,slot / COLUMN_CHUNK_ROWS) == 0)) {
+			return -1;
+		}
+	}
+	struct column_chunk* chunk = column_chunk_of(store,slot);
+	unsigned long k = slot % COLUMN_CHUNK_ROWS;
+	// a write of its own: a batch scan only reads the new version
+	struct column_batch* batch = &chunk->batches[k / COLUMN_BATCH_ROWS];
+	__sync_fetch_and_add(&batch->started,1);
+	chunk->versions[k] = COLUMN_PENDING;
+	chunk->items[k] = item;
+	__sync_fetch_and_add(&batch->ended,1);
+	if (slot == store->slots) {
+		// readers see the slot once it is pending
+		__sync_synchronize();
+		store->slots = slot + 1;
+	}
+	return slot;
+}
+
+void column_store_set_item(struct column_store* store, unsigned long slot,
+		void* item) {
+	column_chunk_of(store,slot)->items[slot % COLUMN_CHUNK_ROWS] = item;
+}
+
+void column_store_begin(struct column_store* store, unsigned long slot,
+		const char* row) {
+	int m;
+	for (m=0; m<store->col_count && row != 0; m++) {
+		if (store->dictionaries[m] != 0) {
+			dictionary_add(store->dictionaries[m],row + store->offsets[m]);
+		}
+	}
+	struct column_chunk* chunk = column_chunk_of(store,slot);
+	unsigned long k = slot % COLUMN_CHUNK_ROWS;
+	__sync_fetch_and_add(&chunk->batches[k / COLUMN_BATCH_ROWS].started,1);
+	chunk->versions[k] = COLUMN_PENDING;
+	__sync_synchronize();
+}
+
+void column_store_end(struct column_store* store, unsigned long slot,
+		const char* key, const char* row, unsigned long long version) {
+	struct column_chunk* chunk = column_chunk_of(store,slot);
+	unsigned long k = slot % COLUMN_CHUNK_ROWS;
+	if (row == 0) {
+		version |= COLUMN_DELETED;
+	} else {
+		strncpy(chunk->keys[k],key,MAX_KEY_LEN);
+		int m;
+		for (m=0; m<store->col_count; m++) {
+			char* value = chunk->values[m] + k * store->widths[m];
+			if (store->dictionaries[m] != 0) {
+				// added by column_store_begin, unless it was full
+				*(unsigned int*)value = dictionary_add(store->dictionaries[m],
+						row + store->offsets[m]);
+			} else {
+				memcpy(value,row + store->offsets[m],store->sizes[m]);
+			}
+		}
+	}
+	__sync_synchronize();
+	chunk->versions[k] = version;
+	struct column_batch* batch = &chunk->batches[k / COLUMN_BATCH_ROWS];
+	unsigned long long newest = batch->version;
+	version &= ~COLUMN_DELETED;
+	while (newest < version && !__sync_bool_compare_and_swap(&batch->version,
+			newest,version)) {
+		newest = batch->version;
+	}
+	__sync_fetch_and_add(&batch->ended,1);
+}
+
+void column_store_free(struct column_store* store, unsigned long slot) {
+	if (store->free_count == store->free_capacity) {
+		size_t capacity = store->free_capacity ? store->free_capacity * 2 : 64;
+		unsigned long* free_slots = (unsigned long*)realloc(store->free_slots,
+				capacity * sizeof(unsigned long));
+		if (free_slots == 0) {
+			// the slot stays deleted
+			return;
+		}
+		store->free_slots = free_slots;
+		store->free_capacity = capacity;
+	}
+	store->free_slots[store->free_count++] = slot;
+}
+
+size_t column_store_memory(struct column_store* store) {
+	size_t row_bytes = 0;
+	int m;
+	for (m=0; m<store->col_count; m++) {
+		row_bytes += store->widths[m];
+	}
+	size_t chunks = (store->slots + COLUMN_CHUNK_ROWS - 1) / COLUMN_CHUNK_ROWS;
+	return chunks * (sizeof(struct column_chunk) + row_bytes * COLUMN_CHUNK_ROWS)
+			+ store->free_capacity * sizeof(unsigned long);
+}
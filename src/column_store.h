@@ -0,0 +1,163 @@
+/**
+ * @file
+ * @brief This file declares a column store: the rows of a table kept
+ * column by column, so a scan reads only the columns it tests.
+ *
+ * Every row has a slot, and each column is an array of fixed-size values
+ * indexed by slot, next to an array of keys, one of versions and one of
+ * items, an opaque pointer the caller keeps with each slot. The arrays
+ * are cut into chunks of COLUMN_CHUNK_ROWS slots, which are allocated as
+ * the store grows and never move. A char column may have a dictionary:
+ * its array then holds the 4-byte code of each value in the dictionary,
+ * DICTIONARY_NO_CODE for a value added once the dictionary was full.
+ *
+ * Readers take no lock. The version of a slot works as a sequence lock:
+ * a writer marks it COLUMN_PENDING before it changes anything, and sets
+ * the version of the new values once they are written. A reader that
+ * reads the same version before and after reading a slot's values read
+ * values of that version. Writers to a slot must be serialized by the
+ * caller, and slots are only added or freed by one writer at a time.
+ *
+ * Each batch of COLUMN_BATCH_ROWS slots also counts the writes started
+ * and ended in it, and keeps the newest version written to it. A reader
+ * that finds no write in progress before reading a batch, and no write
+ * started after, read every slot of the batch at the version it has,
+ * without reading the versions of the slots.
+ *
+ * A table declared "columnar" (see database.h) keeps the newest committed
+ * row of each key here, file rows included: the rows of the table file
+ * take the first slots, and each entry has a slot of its own or the slot
+ * of the file row it shadows. A version is written to the store when it
+ * is installed, and a scan only reads the entry of a slot changed since
+ * its snapshot.
+ */
+
+#ifndef COLUMN_STORE_H_
+#define COLUMN_STORE_H_
+
+#include <stddef.h>
+#include "storage.h"
+#include "dictionary.h"
+
+/**
+ * Slots of a chunk (must be a power of two)
+ */
+#define COLUMN_CHUNK_ROWS 16384
+
+/**
+ * Slots of a batch (must divide COLUMN_CHUNK_ROWS)
+ */
+#define COLUMN_BATCH_ROWS 1024
+
+/**
+ * Largest number of chunks of a store
+ */
+#define COLUMN_MAX_CHUNKS 16384
+
+/**
+ * Version of a slot being written
+ */
+#define COLUMN_PENDING (~0ULL)
+
+/**
+ * Flag of the version of a slot whose row is deleted
+ */
+#define COLUMN_DELETED (1ULL << 62)
+
+/**
+ * The writes to a batch of slots, which has a cache line of its own
+ */
+struct column_batch {
+	volatile unsigned long started;
+	volatile unsigned long ended;
+	// newest version written to a slot of the batch
+	volatile unsigned long long version;
+} __attribute__((aligned(64)));
+
+/**
+ * The arrays of COLUMN_CHUNK_ROWS slots
+ */
+struct column_chunk {
+	struct column_batch batches[COLUMN_CHUNK_ROWS / COLUMN_BATCH_ROWS];
+	volatile unsigned long long versions[COLUMN_CHUNK_ROWS];
+	void* volatile items[COLUMN_CHUNK_ROWS];
+	char keys[COLUMN_CHUNK_ROWS][MAX_KEY_LEN];
+	// the values of column k, widths[k] bytes each
+	char* values[MAX_COLUMNS_PER_TABLE];
+};
+
+/**
+ * A column store
+ */
+struct column_store {
+	int col_count;
+	// offset and size of each column in the rows written to the store
+	int offsets[MAX_COLUMNS_PER_TABLE];
+	int sizes[MAX_COLUMNS_PER_TABLE];
+	// dictionary of each column, 0 if its values are kept as they are
+	struct dictionary* dictionaries[MAX_COLUMNS_PER_TABLE];
+	// bytes of a value in the array of each column
+	int widths[MAX_COLUMNS_PER_TABLE];
+	struct column_chunk* volatile chunks[COLUMN_MAX_CHUNKS];
+	// number of slots, freed ones included
+	volatile unsigned long slots;
+	// slots freed, reused before new ones are added
+	unsigned long* free_slots;
+	size_t free_count;
+	size_t free_capacity;
+};
+
+/**
+ * Get the chunk of a slot
+ */
+#define column_chunk_of(store, slot) \
+	((store)->chunks[(slot) / COLUMN_CHUNK_ROWS])
+
+/**
+ * Initialize an empty store of col_count columns, column k taking
+ * sizes[k] bytes at offsets[k] in the rows written to it, and encoded
+ * with dictionaries[k] unless it is 0
+ * Return -1 if failed, 0 if successful
+ */
+int column_store_init(struct column_store* store, int col_count,
+		const int* offsets, const int* sizes, struct dictionary** dictionaries);
+
+/**
+ * Add a slot holding item, pending until its values are written
+ * Return the slot, -1 if failed
+ */
+long column_store_add(struct column_store* store, void* item);
+
+/**
+ * Set the item of a slot
+ */
+void column_store_set_item(struct column_store* store, unsigned long slot,
+		void* item);
+
+/**
+ * Mark a slot pending, before its values change to those of a row, or it
+ * is deleted if row is 0
+ * The strings of the row get their codes now, so a reader that looks a
+ * code up after a version is committed finds the one its slot will hold
+ */
+void column_store_begin(struct column_store* store, unsigned long slot,
+		const char* row);
+
+/**
+ * Write the key and the values of a row to a slot, or only mark it deleted
+ * if row is 0, and set its version, after column_store_begin
+ */
+void column_store_end(struct column_store* store, unsigned long slot,
+		const char* key, const char* row, unsigned long long version);
+
+/**
+ * Free a deleted slot for reuse, once no reader needs its row
+ */
+void column_store_free(struct column_store* store, unsigned long slot);
+
+/**
+ * Get the number of bytes allocated by a store
+ */
+size_t column_store_memory(struct column_store* store);
+
+#endif /* COLUMN_STORE_H_ */
@@ -5,8 +5,231 @@
  *      Author: choushuo
  */
 
+// for pthread_rwlockattr_setkind_np
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "database.h"
+#include "parse_utils.h"
+#include "scan_kernels.h"
+
+// add/remove the values of a version to/from the ordered and value indexes
+// of its table
+static int index_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version);
+static void unindex_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version);
+// add the slot of an entry to the bitmap indexes of its table for the
+// values of a version about to be installed
+static void bitmap_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version);
+
+// items of value and ordered indexes: entries, or rows of the table file
+// tagged in their low bit, which an entry's address never has
+#define file_row_item(n) ((void*)(((unsigned long)(n) << 1) | 1))
+#define item_is_file_row(item) (((unsigned long)(item) & 1) != 0)
+#define item_file_row(item) ((unsigned long)(item) >> 1)
+
+// initialize the table lock and the lock stripes of a table
+static void init_table_locks(struct data_table* table) {
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	// a steady stream of readers must not starve inserts and deletes
+	pthread_rwlockattr_setkind_np(&attr,
+			PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&table->lock,&attr);
+	pthread_rwlockattr_destroy(&attr);
+	int k;
+	for (k=0; k<TABLE_LOCK_STRIPES; k++) {
+		pthread_mutex_init(&table->stripes[k].lock,NULL);
+	}
+	// 0 marks a free snapshot slot, so versions start at 1
+	table->commit_version = 1;
+	for (k=0; k<MAX_SNAPSHOTS; k++) {
+		table->snapshots[k] = 0;
+	}
+}
+
+// the stripe serializing the SETs of an entry
+static struct lock_stripe* entry_stripe(struct data_table* table,
+		struct data_entry* entry) {
+	return &table->stripes[entry->hash_node.hash & (TABLE_LOCK_STRIPES - 1)];
+}
+
+// take a snapshot of a table: the versions committed so far
+// return the slot the snapshot is registered in, see oldest_snapshot
+static int take_snapshot(struct data_table* table, unsigned long long* snapshot) {
+	while (1) {
+		int k;
+		for (k=0; k<MAX_SNAPSHOTS; k++) {
+			unsigned long long version = table->commit_version;
+			if (table->snapshots[k] != 0
+					|| !__sync_bool_compare_and_swap(&table->snapshots[k],0,version)) {
+				continue;
+			}
+			// a writer that read the slots before they held version may
+			// free what it needs, unless no commit happened in between
+			while (1) {
+				__sync_synchronize();
+				unsigned long long now = table->commit_version;
+				if (now == version) {
+					*snapshot = version;
+					return k;
+				}
+				version = now;
+				table->snapshots[k] = version;
+			}
+		}
+		// every slot is taken, wait for a query to finish
+		sched_yield();
+	}
+}
+
+static void release_snapshot(struct data_table* table, int slot) {
+	__sync_synchronize();
+	table->snapshots[slot] = 0;
+}
+
+// the oldest snapshot a query may read now or later
+static unsigned long long oldest_snapshot(struct data_table* table) {
+	// read before the slots, see take_snapshot
+	unsigned long long oldest = table->commit_version;
+	__sync_synchronize();
+	int k;
+	for (k=0; k<MAX_SNAPSHOTS; k++) {
+		unsigned long long version = table->snapshots[k];
+		if (version != 0 && version < oldest) {
+			oldest = version;
+		}
+	}
+	return oldest;
+}
+
+// the newest version of an entry in a snapshot, tombstones included,
+// 0 if none
+static struct row_version* newest_version(struct data_entry* entry,
+		unsigned long long snapshot) {
+	struct row_version* version = entry->current;
+	while (version != 0 && version->version > snapshot) {
+		version = version->older;
+	}
+	return version;
+}
+
+// the row of an entry in a snapshot, 0 if it did not exist or was deleted
+static struct row_version* snapshot_version(struct data_entry* entry,
+		unsigned long long snapshot) {
+	struct row_version* version = newest_version(entry,snapshot);
+	return version != 0 && version->deleted == 0 ? version : 0;
+}
+
+// retire the versions of an entry older than the one the oldest snapshot
+// reads, the caller holds the entry's stripe lock or the table lock for
+// writing
+static void prune_versions(struct data_table* table, struct data_entry* entry) {
+	unsigned long long oldest = oldest_snapshot(table);
+	struct row_version* keep = newest_version(entry,oldest);
+	if (keep == 0 || keep->older == 0) {
+		return;
+	}
+	struct row_version* version = keep->older;
+	// no snapshot walks past keep, so no reader follows this pointer
+	keep->older = 0;
+	while (version != 0) {
+		struct row_version* older = version->older;
+		unindex_version(table,entry,version);
+		epoch_retire(&table->slab,version,version_size(table));
+		version = older;
+	}
+}
+
+// unlink the deleted entries no snapshot sees any more, and retire them
+// with their versions, the caller holds the table lock for writing
+static void reap_entries(struct data_table* table) {
+	unsigned long long oldest = oldest_snapshot(table);
+	struct data_entry** link = &table->dead;
+	while (*link != 0) {
+		struct data_entry* entry = *link;
+		if (entry->current->version > oldest) {
+			link = &entry->next_dead;
+			continue;
+		}
+		*link = entry->next_dead;
+		// entry->next is kept for the queries standing on the entry
+		if (entry->prev == 0) {
+			table->head = entry->next;
+		} else {
+			entry->prev->next = entry->next;
+		}
+		if (entry->next == 0) {
+			table->tail = entry->prev;
+		} else {
+			entry->next->prev = entry->prev;
+		}
+		// the whole chain goes, so every value loses its node
+		struct row_version* version;
+		int k;
+		for (version=entry->current; version!=0; version=version->older) {
+			for (k=0; k<table->col_count && version->deleted==0; k++) {
+				struct ordered_index* index = table->columns[k]->ordered_index;
+				if (index != 0) {
+					// fails quietly if an older version already removed it
+					ordered_index_remove(index,version_get_int(table,version,k),entry);
+				}
+				struct value_index* values = table->columns[k]->value_index;
+				if (values != 0) {
+					value_index_remove(values,version->row
+							+ table->columns[k]->offset,entry);
+				}
+				struct bitmap_index* bitmap = table->columns[k]->bitmap_index;
+				if (bitmap != 0) {
+					bitmap_index_remove(bitmap,version->row
+							+ table->columns[k]->offset,entry->slot);
+				}
+			}
+		}
+		version = entry->current;
+		while (version != 0) {
+			struct row_version* older = version->older;
+			epoch_retire(&table->slab,version,version_size(table));
+			version = older;
+		}
+		if (table->column_store != 0) {
+			column_store_free(table->column_store,entry->slot);
+		}
+		epoch_retire(&table->slab,entry,sizeof(struct data_entry));
+	}
+}
+
+// make a version of the row the current one, the caller holds the entry's
+// stripe lock or the table lock for writing
+static void install_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version) {
+	// pending in the column store before the version is committed, so a
+	// scan whose snapshot sees it never reads the values it replaces
+	if (table->column_store != 0) {
+		bitmap_version(table,entry,version);
+		column_store_begin(table->column_store,entry->slot,
+				version->deleted ? 0 : version->row);
+	}
+	version->version = VERSION_PENDING;
+	version->older = entry->current;
+	__sync_synchronize();
+	entry->current = version;
+	__sync_synchronize();
+	// committed only once reachable: a query that found it pending has a
+	// snapshot older than the version it gets now
+	version->version = __sync_add_and_fetch(&table->commit_version,1);
+	if (table->column_store != 0) {
+		column_store_end(table->column_store,entry->slot,entry->key,
+				version->deleted ? 0 : version->row,version->version);
+	}
+}
 
 int init_tables(struct table** table_arr) {
 	int k = 0;
@@ -14,6 +237,15 @@ int init_tables(struct table** table_arr) {
 		tables[k] = (struct data_table*)malloc(sizeof(struct data_table));
 		strcpy(tables[k]->name,table_arr[k]->name);
 		tables[k]->head = 0;
+		tables[k]->tail = 0;
+		tables[k]->dead = 0;
+		memset(&tables[k]->file_rows,0,sizeof(struct table_image));
+		tables[k]->shadowed = 0;
+		tables[k]->shadowed_count = 0;
+		tables[k]->shadow_deleted = 0;
+		if (hash_index_init(&tables[k]->index) != 0) {
+			return -1;
+		}
 		tables[k]->col_count = table_arr[k]->col_count;
 		int m;
 		for (m=0; m<table_arr[k]->col_count; m++) {
@@ -21,13 +253,17 @@ int init_tables(struct table** table_arr) {
 					(struct data_column*)malloc(sizeof(struct data_column));
 			strcpy(tables[k]->columns[m]->name,
 					table_arr[k]->columns[m]->name);
+			tables[k]->columns[m]->ordered_index = 0;
+			tables[k]->columns[m]->dictionary = 0;
+			tables[k]->columns[m]->bitmap_index = 0;
+			tables[k]->columns[m]->value_index = 0;
 			if (strcmp(table_arr[k]->columns[m]->type,"int") == 0) {
 				tables[k]->columns[m]->type = INT;
 			} else {
 				tables[k]->columns[m]->type = CHAR;
 				char* l = strchr(table_arr[k]->columns[m]->type,'[');
 				char* r = strchr(table_arr[k]->columns[m]->type,']');
-				char* num;
+				char num[30];
 				strncpy(num,l+1,r-l-1);
 				num[r-l-1] = '\0';
 				int n = atoi(num);
@@ -36,12 +272,117 @@ int init_tables(struct table** table_arr) {
 				}
 				tables[k]->columns[m]->str_len = n;
 			}
+			// an ordered index on an int column, a value index on a char
+			// column, created once the table's allocator is set up
+			if (check_option(table_arr[k]->columns[m]->options,"index") == 0
+					&& tables[k]->columns[m]->type == INT) {
+				tables[k]->columns[m]->ordered_index = (struct ordered_index*)
+						malloc(sizeof(struct ordered_index));
+			}
+			if (check_option(table_arr[k]->columns[m]->options,"index") == 0
+					&& tables[k]->columns[m]->type == CHAR) {
+				tables[k]->columns[m]->value_index = (struct value_index*)
+						malloc(sizeof(struct value_index));
+			}
+			if (check_option(table_arr[k]->columns[m]->options,"dictionary") == 0) {
+				if (tables[k]->columns[m]->type != CHAR
+						|| check_option(table_arr[k]->options,"columnar") != 0) {
+					sprintf(message,"Error: dictionary on column '%s' is not "\
+							"of char type in a columnar table\n",
+							tables[k]->columns[m]->name);
+					logger(server_log,message);
+					return -1;
+				}
+				tables[k]->columns[m]->dictionary = (struct dictionary*)
+						malloc(sizeof(struct dictionary));
+				if (tables[k]->columns[m]->dictionary == 0 || dictionary_init(
+						tables[k]->columns[m]->dictionary,
+						tables[k]->columns[m]->str_len) != 0) {
+					return -1;
+				}
+			}
+			if (check_option(table_arr[k]->columns[m]->options,"bitmap") == 0) {
+				if (check_option(table_arr[k]->options,"columnar") != 0) {
+					sprintf(message,"Error: bitmap on column '%s' is not "\
+							"in a columnar table\n",tables[k]->columns[m]->name);
+					logger(server_log,message);
+					return -1;
+				}
+				int is_int = tables[k]->columns[m]->type == INT;
+				tables[k]->columns[m]->bitmap_index = (struct bitmap_index*)
+						malloc(sizeof(struct bitmap_index));
+				if (tables[k]->columns[m]->bitmap_index == 0 || bitmap_index_init(
+						tables[k]->columns[m]->bitmap_index,
+						is_int ? sizeof(long long) : tables[k]->columns[m]->str_len,
+						is_int) != 0) {
+					return -1;
+				}
+			}
+		}
+		// lay out the row: int columns first so they stay aligned
+		int offset = 0;
+		for (m=0; m<tables[k]->col_count; m++) {
+			if (tables[k]->columns[m]->type == INT) {
+				tables[k]->columns[m]->offset = offset;
+				tables[k]->columns[m]->size = sizeof(long long);
+				offset += sizeof(long long);
+			}
+		}
+		for (m=0; m<tables[k]->col_count; m++) {
+			if (tables[k]->columns[m]->type == CHAR) {
+				tables[k]->columns[m]->offset = offset;
+				tables[k]->columns[m]->size = tables[k]->columns[m]->str_len;
+				offset += tables[k]->columns[m]->str_len;
+			}
+		}
+		tables[k]->row_size = offset;
+		tables[k]->column_store = 0;
+		if (check_option(table_arr[k]->options,"columnar") == 0) {
+			int offsets[MAX_COLUMNS_PER_TABLE], sizes[MAX_COLUMNS_PER_TABLE];
+			struct dictionary* dictionaries[MAX_COLUMNS_PER_TABLE];
+			for (m=0; m<tables[k]->col_count; m++) {
+				offsets[m] = tables[k]->columns[m]->offset;
+				sizes[m] = tables[k]->columns[m]->size;
+				dictionaries[m] = tables[k]->columns[m]->dictionary;
+			}
+			tables[k]->column_store = (struct column_store*)
+					malloc(sizeof(struct column_store));
+			if (tables[k]->column_store == 0 || column_store_init(
+					tables[k]->column_store,tables[k]->col_count,offsets,sizes,
+					dictionaries) != 0) {
+				return -1;
+			}
+		}
+		// size classes of the table: entries, row versions, ordered index
+		// nodes and value index postings
+		size_t sizes[] = {sizeof(struct data_entry),version_size(tables[k]),
+				ordered_node_size(1),ordered_node_size(2),ordered_node_size(4),
+				ordered_node_size(8),ordered_node_size(ORDERED_INDEX_MAX_LEVEL),
+				sizeof(struct value_posting)};
+		if (slab_init(&tables[k]->slab,sizes,sizeof(sizes)/sizeof(sizes[0])) != 0) {
+			return -1;
 		}
+		tables[k]->has_secondary_index = 0;
+		for (m=0; m<tables[k]->col_count; m++) {
+			struct data_column* column = tables[k]->columns[m];
+			if (column->ordered_index != 0 || column->value_index != 0) {
+				tables[k]->has_secondary_index = 1;
+			}
+			if (column->ordered_index != 0
+					&& ordered_index_init(column->ordered_index,
+							&tables[k]->slab) != 0) {
+				return -1;
+			}
+			if (column->value_index != 0
+					&& value_index_init(column->value_index,column->size,
+							&tables[k]->slab) != 0) {
+				return -1;
+			}
+		}
+		init_table_locks(tables[k]);
 		k++;
 	}
-	query_conditions[0] = 0;
 	table_count = k;
-	condition_count = 0;
 	return 0;
 }
 
@@ -59,74 +400,993 @@ struct data_table* find_table(char* table_name) {
 }
 
 struct data_entry* find_entry(struct data_table* table, char* search_key) {
-	struct data_entry* cursor = table->head;
-	// search through linked-list for specified key
-	while (cursor != 0) {
-		if (strcmp(cursor->key,search_key) == 0) {
-			// found, return pointer
-			return cursor;
+	// look up specified key in the hash index
+	struct hash_node* node = hash_index_find(&table->index,search_key,
+			hash_string(search_key));
+	if (node == 0) {
+		// not found, return null
+		return 0;
+	}
+	// found, return pointer
+	return hash_entry(node,struct data_entry,hash_node);
+}
+
+// a slot of a table file: the key, then the version of the row, which is
+// never installed
+#define SLOT_KEY_SIZE ((MAX_KEY_LEN + 7) & ~7)
+
+static size_t slot_size(struct data_table* table) {
+	return (SLOT_KEY_SIZE + version_size(table) + 7) & ~7;
+}
+
+static struct row_version* slot_version(char* slot) {
+	return (struct row_version*)(slot + SLOT_KEY_SIZE);
+}
+
+// whether the row in slot k of the table file is shadowed by an entry
+static int slot_shadowed(struct data_table* table, unsigned long k) {
+	return (((volatile unsigned char*)table->shadowed)[k >> 3] >> (k & 7)) & 1;
+}
+
+struct row_version* get_version(struct data_table* table, char* search_key) {
+	// no lock: the epoch keeps the entries the lookup passes and the
+	// version it returns readable
+	epoch_enter();
+	struct data_entry* entry = find_entry(table,search_key);
+	struct row_version* version = entry != 0 ? entry->current : 0;
+	if (entry == 0 && table->file_rows.rows != 0) {
+		// not changed since the restart, read in place
+		long k = table_image_find(&table->file_rows,search_key,
+				hash_string(search_key));
+		if (k >= 0) {
+			version = slot_version(table_image_slot(&table->file_rows,k));
 		}
-		cursor = cursor->next;
 	}
-	// not found, return null
-	return 0;
+	if (version == 0 || version->deleted) {
+		epoch_exit();
+		return 0;
+	}
+	return version;
 }
 
-int set_entry(struct data_table* table, char* mod_key, char mod_value[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN], int metadata) {
-	// if list is empty
-	if (table->head == 0) {
-		struct data_entry* entry = (struct data_entry*)malloc(sizeof(struct data_entry));
-		strcpy(entry->key,mod_key);
-		fill_entry_with_value(entry,mod_value,table->col_count);
-		entry->metadata = 1;
-		entry->next = 0;
-		table->head = entry;
+void release_version(struct row_version* version) {
+	epoch_exit();
+}
+
+// install a new version of the row of an entry, the caller holds the
+// entry's stripe lock or the table lock for writing, and the table lock
+// for writing if the table has ordered or value indexes
+static int update_entry(struct data_table* table, struct data_entry* entry,
+		struct data_value mod_value[MAX_COLUMNS_PER_TABLE], int metadata) {
+	// a deleted entry shadowing a row of the table file is inserted again
+	int deleted = entry->current->deleted;
+	if (deleted == 0 && metadata != 0 && metadata != entry->current->metadata) {
+		// abort transaction
+		return -1;
+	}
+	struct row_version* version = (struct row_version*)slab_alloc(&table->slab,
+			version_size(table));
+	if (version == 0) {
+		return -1;
+	}
+	fill_version_with_value(table,version,mod_value);
+	version->metadata = deleted ? 1 : entry->current->metadata + 1;
+	version->deleted = 0;
+	if (deleted) {
+		__sync_fetch_and_sub(&table->shadow_deleted,1);
+	}
+	install_version(table,entry,version);
+	int result = index_version(table,entry,version);
+	prune_versions(table,entry);
+	return result;
+}
+
+// link a new entry with its first version, a copy of row file_row of the
+// table file if not -1, the caller holds the table lock for writing
+static struct data_entry* add_entry(struct data_table* table, char* key,
+		struct row_version* version, long file_row) {
+	struct data_entry* entry = (struct data_entry*)slab_alloc(&table->slab,
+			sizeof(struct data_entry));
+	if (entry == 0) {
 		return 0;
 	}
-	// if list is not empty
-	struct data_entry* prev_cursor = table->head;
-	struct data_entry* curr_cursor = table->head;
-	// search through linked-list for specified key
-	while (curr_cursor != 0) {
-		if (strcmp(curr_cursor->key,mod_key) == 0) {
-			// found, modify value
-			if (metadata != 0 && metadata != curr_cursor->metadata) {
-				// abort transaction
-				return -1;
-			}
-			fill_entry_with_value(curr_cursor,mod_value,table->col_count);
-			curr_cursor->metadata++;
+	strcpy(entry->key,key);
+	entry->current = 0;
+	if (table->column_store != 0) {
+		// the rows of the file have the first slots
+		long slot = file_row;
+		if (file_row < 0) {
+			slot = column_store_add(table->column_store,entry);
+		} else {
+			column_store_set_item(table->column_store,file_row,entry);
+		}
+		if (slot < 0) {
+			slab_free(&table->slab,entry,sizeof(struct data_entry));
 			return 0;
 		}
-		prev_cursor = curr_cursor;
-		curr_cursor = curr_cursor->next;
+		entry->slot = slot;
 	}
-	// key does not exist in linked-list, create new entry
-	struct data_entry* entry = (struct data_entry*)malloc(sizeof(struct data_entry));
-	strcpy(entry->key,mod_key);
-	fill_entry_with_value(entry,mod_value,table->col_count);
-	entry->metadata = 1;
+	if (file_row >= 0) {
+		// older than any snapshot
+		version->version = 0;
+		version->older = 0;
+		entry->current = version;
+	} else {
+		install_version(table,entry,version);
+	}
+	entry->next_dead = 0;
+	// append to the tail of linked-list, once complete for queries
 	entry->next = 0;
-	prev_cursor->next = entry;
+	entry->prev = table->tail;
+	__sync_synchronize();
+	if (table->tail == 0) {
+		table->head = entry;
+	} else {
+		table->tail->next = entry;
+	}
+	table->tail = entry;
+	// add to hash index
+	entry->hash_node.key = entry->key;
+	entry->hash_node.hash = hash_string(entry->key);
+	hash_index_insert(&table->index,&entry->hash_node);
+	// deleted entries are reaped as new ones come in
+	reap_entries(table);
+	return entry;
+}
+
+// copy the row of a key in the table file into a new entry, which
+// shadows it from then on, the caller holds the table lock for writing
+// return 1 and the entry if copied, 0 if the file has no such row, -1 if
+// failed
+static int promote_entry(struct data_table* table, char* key,
+		struct data_entry** entry) {
+	long k = table->file_rows.rows != 0 ? table_image_find(&table->file_rows,
+			key,hash_string(key)) : -1;
+	if (k < 0) {
+		return 0;
+	}
+	struct row_version* version = (struct row_version*)slab_alloc(&table->slab,
+			version_size(table));
+	if (version == 0) {
+		return -1;
+	}
+	memcpy(version,slot_version(table_image_slot(&table->file_rows,k)),
+			version_size(table));
+	*entry = add_entry(table,key,version,k);
+	if (*entry == 0) {
+		slab_free(&table->slab,version,version_size(table));
+		return -1;
+	}
+	// queries find the entry before they skip the row, see query
+	__sync_synchronize();
+	__sync_fetch_and_or(&table->shadowed[k >> 3],(unsigned char)(1 << (k & 7)));
+	table->shadowed_count++;
+	return 1;
+}
+
+// set_entry with the table lock held for writing
+static int set_entry_locked(struct data_table* table, char* mod_key, struct data_value mod_value[MAX_COLUMNS_PER_TABLE], int metadata) {
+	struct data_entry* curr_cursor = find_entry(table,mod_key);
+	if (curr_cursor == 0 && promote_entry(table,mod_key,&curr_cursor) < 0) {
+		return -1;
+	}
+	if (curr_cursor != 0) {
+		// found, modify value
+		return update_entry(table,curr_cursor,mod_value,metadata);
+	}
+	// key does not exist in table, create new entry
+	struct row_version* version = (struct row_version*)slab_alloc(&table->slab,
+			version_size(table));
+	if (version == 0) {
+		return -1;
+	}
+	fill_version_with_value(table,version,mod_value);
+	version->metadata = 1;
+	version->deleted = 0;
+	struct data_entry* entry = add_entry(table,mod_key,version,-1);
+	if (entry == 0) {
+		slab_free(&table->slab,version,version_size(table));
+		return -1;
+	}
+	return index_version(table,entry,version);
+}
+
+// kinds of log records
+#define LOG_SET 'S'
+#define LOG_DELETE 'D'
+
+// largest log record: kind, table name, key and the longest row
+#define LOG_RECORD_LEN (3 + MAX_TABLE_LEN + MAX_KEY_LEN \
+		+ MAX_COLUMNS_PER_TABLE * (2 + MAX_VALUE_LEN))
+
+// names of the snapshot files in the log's directory, with the LSN of
+// the log they were taken at in between
+#define SNAPSHOT_PREFIX "snapshot-"
+#define SNAPSHOT_SUFFIX ".db"
+#define SNAPSHOT_TEMP "snapshot.tmp"
+
+static struct wal table_wal;
+
+// one checkpoint at a time
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// LSN of the latest snapshot, if there is one
+static int has_snapshot;
+static unsigned long long snapshot_lsn;
+
+static void snapshot_path(char* path, size_t size, const char* directory,
+		unsigned long long lsn) {
+	snprintf(path,size,"%s/" SNAPSHOT_PREFIX "%020llu" SNAPSHOT_SUFFIX,
+			directory,lsn);
+}
+
+static long long now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// start a record of given kind with the table name and the key, each
+// after a 1-byte length
+static char* encode_key(char* p, char kind, struct data_table* table,
+		char* key) {
+	*p++ = kind;
+	unsigned char len = strlen(table->name);
+	*p++ = len;
+	memcpy(p,table->name,len);
+	p += len;
+	len = strlen(key);
+	*p++ = len;
+	memcpy(p,key,len);
+	return p + len;
+}
+
+// encode a SET, or a delete if values is 0, as a log record: its kind,
+// table name and key, then the value of every column, an int in 8 bytes
+// or a string after a 2-byte length, in host byte order
+static size_t encode_change(char* record, struct data_table* table,
+		char* key, struct data_value values[MAX_COLUMNS_PER_TABLE]) {
+	char* p = encode_key(record,values != 0 ? LOG_SET : LOG_DELETE,table,key);
+	int k;
+	for (k=0; values!=0 && k<table->col_count; k++) {
+		struct data_column* column = table->columns[k];
+		if (column->type == INT) {
+			memcpy(p,&values[k].int_val,sizeof(long long));
+			p += sizeof(long long);
+		} else {
+			// what the row keeps of it
+			unsigned short str_len = strnlen(values[k].str_val,column->size);
+			memcpy(p,&str_len,sizeof str_len);
+			memcpy(p + sizeof str_len,values[k].str_val,str_len);
+			p += sizeof str_len + str_len;
+		}
+	}
+	return p - record;
+}
+
+// read a string of at most size-1 bytes after its length of width bytes
+static int decode_string(const char** p, const char* end, int width,
+		char* str, size_t size) {
+	size_t len = 0;
+	if (end - *p < width) {
+		return -1;
+	}
+	memcpy(&len,*p,width);
+	*p += width;
+	if (len >= size || (size_t)(end - *p) < len) {
+		return -1;
+	}
+	memcpy(str,*p,len);
+	str[len] = '\0';
+	*p += len;
+	return 0;
+}
+
+// apply a change read back from the log, see encode_change
+static int replay_change(const char* record, size_t len, void* arg) {
+	const char* p = record + 1;
+	const char* end = record + len;
+	char name[MAX_TABLE_LEN], key[MAX_KEY_LEN];
+	if (len < 1 || decode_string(&p,end,1,name,sizeof name) != 0
+			|| decode_string(&p,end,1,key,sizeof key) != 0) {
+		logger(server_log,"Error: malformed record in the log\n");
+		return -1;
+	}
+	struct data_table* table = find_table(name);
+	if (table == 0) {
+		sprintf(message,"Error: the log changes unknown table '%s'\n",name);
+		logger(server_log,message);
+		return -1;
+	}
+	(*(unsigned long*)arg)++;
+	if (record[0] == LOG_DELETE) {
+		delete_entry(table,key);
+		return 0;
+	}
+	char strs[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int k;
+	for (k=0; k<table->col_count; k++) {
+		values[k].str_val = strs[k];
+		if (table->columns[k]->type == INT) {
+			if (end - p < (long)sizeof(long long)) {
+				break;
+			}
+			memcpy(&values[k].int_val,p,sizeof(long long));
+			p += sizeof(long long);
+		} else if (decode_string(&p,end,sizeof(unsigned short),strs[k],
+				MAX_VALUE_LEN) != 0) {
+			break;
+		}
+	}
+	if (record[0] != LOG_SET || k < table->col_count || p != end) {
+		sprintf(message,"Error: the log does not match the columns of "\
+				"table '%s'\n",name);
+		logger(server_log,message);
+		return -1;
+	}
+	set_entry(table,key,values,0);
+	return 0;
+}
+
+// records of the log handed to a replay thread at a time
+#define REPLAY_BATCH_SIZE (256 * 1024)
+
+// batches queued for a replay thread before the log's reader waits
+#define REPLAY_QUEUE_LEN 4
+
+// most threads replaying the log
+#define MAX_REPLAY_THREADS 64
+
+// milliseconds between two reports of the progress of a replay
+#define REPLAY_REPORT_MS 1000
+
+// records of the log, each after its length
+struct replay_batch {
+	char* data;
+	size_t used;
+};
+
+// a thread applying the changes of the keys that hash to it, in the order
+// the reader queues them
+struct replay_thread {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	// signalled when a batch is queued or taken, or the reader is done
+	pthread_cond_t changed;
+	struct replay_batch queue[REPLAY_QUEUE_LEN];
+	int head;
+	int count;
+	int done;
+	// the batch the reader fills next
+	struct replay_batch batch;
+	unsigned long changes;
+	volatile int* failed;
+};
+
+// a replay of the log, the changes applied by the reader itself if there
+// is a single thread
+struct replay {
+	struct replay_thread threads[MAX_REPLAY_THREADS];
+	int count;
+	int started;
+	volatile int failed;
+	unsigned long records;
+	unsigned long long bytes;
+	long long start;
+	long long reported;
+};
+
+static void* replay_main(void* arg) {
+	struct replay_thread* t = (struct replay_thread*)arg;
+	pthread_mutex_lock(&t->lock);
+	for (;;) {
+		while (t->count == 0 && t->done == 0) {
+			pthread_cond_wait(&t->changed,&t->lock);
+		}
+		if (t->count == 0) {
+			break;
+		}
+		struct replay_batch batch = t->queue[t->head];
+		t->head = (t->head + 1) % REPLAY_QUEUE_LEN;
+		t->count--;
+		pthread_cond_signal(&t->changed);
+		pthread_mutex_unlock(&t->lock);
+		size_t k = 0;
+		while (k < batch.used) {
+			unsigned int len;
+			memcpy(&len,batch.data + k,sizeof len);
+			k += sizeof len;
+			// once a change failed the rest are only drained
+			if (*t->failed == 0 && replay_change(batch.data + k,len,&t->changes) != 0) {
+				*t->failed = 1;
+			}
+			k += len;
+		}
+		free(batch.data);
+		pthread_mutex_lock(&t->lock);
+	}
+	pthread_mutex_unlock(&t->lock);
 	return 0;
 }
 
+// queue the batch a thread's records are added to, waiting for room
+static void hand_off(struct replay_thread* t) {
+	if (t->batch.used == 0) {
+		return;
+	}
+	pthread_mutex_lock(&t->lock);
+	while (t->count == REPLAY_QUEUE_LEN) {
+		pthread_cond_wait(&t->changed,&t->lock);
+	}
+	t->queue[(t->head + t->count) % REPLAY_QUEUE_LEN] = t->batch;
+	t->count++;
+	pthread_cond_signal(&t->changed);
+	pthread_mutex_unlock(&t->lock);
+	t->batch.data = 0;
+	t->batch.used = 0;
+}
+
+// start replaying the log on up to count threads
+static struct replay* start_replay(int count) {
+	struct replay* replay = (struct replay*)calloc(1,sizeof(struct replay));
+	if (replay == 0) {
+		return 0;
+	}
+	replay->count = count;
+	replay->start = now_ms();
+	replay->reported = replay->start;
+	int k;
+	for (k=0; k<MAX_REPLAY_THREADS; k++) {
+		struct replay_thread* t = &replay->threads[k];
+		pthread_mutex_init(&t->lock,0);
+		pthread_cond_init(&t->changed,0);
+		t->failed = &replay->failed;
+	}
+	while (count > 1 && replay->started < count && pthread_create(
+			&replay->threads[replay->started].thread,0,replay_main,
+			&replay->threads[replay->started]) == 0) {
+		replay->started++;
+	}
+	if (replay->started > 0 && replay->started < count) {
+		// the keys are split between the threads that did start
+		replay->count = replay->started;
+	}
+	return replay;
+}
+
+// wait until every record read is applied, then end the replay
+// return -1 if a change failed, 0 if not, with the number of changes
+static int finish_replay(struct replay* replay, unsigned long* changes) {
+	int k;
+	for (k=0; k<replay->started; k++) {
+		struct replay_thread* t = &replay->threads[k];
+		hand_off(t);
+		pthread_mutex_lock(&t->lock);
+		t->done = 1;
+		pthread_cond_signal(&t->changed);
+		pthread_mutex_unlock(&t->lock);
+		pthread_join(t->thread,0);
+	}
+	*changes = 0;
+	for (k=0; k<MAX_REPLAY_THREADS; k++) {
+		struct replay_thread* t = &replay->threads[k];
+		*changes += t->changes;
+		free(t->batch.data);
+		pthread_mutex_destroy(&t->lock);
+		pthread_cond_destroy(&t->changed);
+	}
+	int result = replay->failed ? -1 : 0;
+	free(replay);
+	return result;
+}
+
+// pass a record of the log to the thread of its key
+static int queue_change(const char* record, size_t len, void* arg) {
+	struct replay* replay = (struct replay*)arg;
+	if (replay->failed) {
+		return -1;
+	}
+	replay->records++;
+	replay->bytes += len;
+	if ((replay->records & 4095) == 0 && now_ms() - replay->reported
+			>= REPLAY_REPORT_MS) {
+		replay->reported = now_ms();
+		sprintf(message,"Replaying the log: %lu changes, %.1f MB read, "\
+				"%.0f changes/s\n",replay->records,replay->bytes / 1e6,
+				replay->records * 1000.0 / (replay->reported - replay->start));
+		logger(server_log,message);
+	}
+	if (replay->started == 0) {
+		return replay_change(record,len,&replay->threads[0].changes);
+	}
+	const char* p = record + 1;
+	char name[MAX_TABLE_LEN], key[MAX_KEY_LEN];
+	if (len < 1 || decode_string(&p,record + len,1,name,sizeof name) != 0
+			|| decode_string(&p,record + len,1,key,sizeof key) != 0) {
+		logger(server_log,"Error: malformed record in the log\n");
+		return -1;
+	}
+	struct replay_thread* t = &replay->threads[hash_string(key) % replay->count];
+	unsigned int n = len;
+	if (t->batch.used + sizeof n + n > REPLAY_BATCH_SIZE) {
+		hand_off(t);
+	}
+	if (t->batch.data == 0) {
+		t->batch.data = (char*)malloc(REPLAY_BATCH_SIZE);
+		if (t->batch.data == 0) {
+			return -1;
+		}
+	}
+	memcpy(t->batch.data + t->batch.used,&n,sizeof n);
+	memcpy(t->batch.data + t->batch.used + sizeof n,record,n);
+	t->batch.used += sizeof n + n;
+	return 0;
+}
+
+// append an encoded change to the log, if any, return its LSN
+static unsigned long long log_change(char* record, size_t len) {
+	return table_log != 0 ? wal_append(table_log,record,len) : 0;
+}
+
+// wait until a change made with given result is durable
+static int commit_change(int result, unsigned long long lsn) {
+	if (result != 0 || table_log == 0) {
+		return result;
+	}
+	return wal_commit(table_log,lsn);
+}
+
+int set_entry(struct data_table* table, char* mod_key, struct data_value mod_value[MAX_COLUMNS_PER_TABLE], int metadata) {
+	// appended under the locks of the change, so the changes of a key are
+	// logged in the order they are made
+	char record[LOG_RECORD_LEN];
+	size_t record_len = table_log != 0 ?
+			encode_change(record,table,mod_key,mod_value) : 0;
+	unsigned long long lsn = 0;
+	int result;
+	if (table->has_secondary_index == 0) {
+		// an existing entry gets a new version under its stripe only
+		pthread_rwlock_rdlock(&table->lock);
+		struct data_entry* curr_cursor = find_entry(table,mod_key);
+		if (curr_cursor != 0) {
+			struct lock_stripe* stripe = entry_stripe(table,curr_cursor);
+			pthread_mutex_lock(&stripe->lock);
+			result = update_entry(table,curr_cursor,mod_value,metadata);
+			if (result == 0) {
+				lsn = log_change(record,record_len);
+			}
+			pthread_mutex_unlock(&stripe->lock);
+			pthread_rwlock_unlock(&table->lock);
+			return commit_change(result,lsn);
+		}
+		pthread_rwlock_unlock(&table->lock);
+	}
+	// new entries and index changes need the whole table
+	pthread_rwlock_wrlock(&table->lock);
+	result = set_entry_locked(table,mod_key,mod_value,metadata);
+	if (result == 0) {
+		lsn = log_change(record,record_len);
+	}
+	pthread_rwlock_unlock(&table->lock);
+	return commit_change(result,lsn);
+}
+
 int delete_entry(struct data_table* table, char* del_key) {
-	struct data_entry* prev_cursor = table->head;
-	struct data_entry* curr_cursor = table->head;
-	// search through linked-list for specified key
-	while (curr_cursor != 0) {
-		if (strcmp(curr_cursor->key,del_key) == 0) {
-			// found, delete entry
-			prev_cursor = curr_cursor->next;
-			free(curr_cursor);
-			return 0;
+	char record[LOG_RECORD_LEN];
+	size_t record_len = table_log != 0 ?
+			encode_change(record,table,del_key,0) : 0;
+	pthread_rwlock_wrlock(&table->lock);
+	struct data_entry* entry = find_entry(table,del_key);
+	// a row of the table file needs an entry to hide it
+	int shadows = entry == 0 ? promote_entry(table,del_key,&entry)
+			: table->file_rows.rows != 0 && table_image_find(&table->file_rows,
+					del_key,entry->hash_node.hash) >= 0;
+	struct row_version* tombstone = entry != 0 && entry->current->deleted == 0 ?
+			(struct row_version*)slab_alloc(&table->slab,version_size(table)) : 0;
+	if (tombstone == 0) {
+		// not found, return -1
+		pthread_rwlock_unlock(&table->lock);
+		return -1;
+	}
+	tombstone->metadata = entry->current->metadata;
+	tombstone->deleted = 1;
+	if (shadows) {
+		// stays in the list and the hash index for good
+		install_version(table,entry,tombstone);
+		__sync_fetch_and_add(&table->shadow_deleted,1);
+		prune_versions(table,entry);
+	} else {
+		// gone for GETs and SETs now, and for snapshots taken from now on
+		hash_index_remove(&table->index,del_key,entry->hash_node.hash);
+		install_version(table,entry,tombstone);
+		entry->next_dead = table->dead;
+		table->dead = entry;
+	}
+	reap_entries(table);
+	unsigned long long lsn = log_change(record,record_len);
+	pthread_rwlock_unlock(&table->lock);
+	return commit_change(0,lsn);
+}
+
+// describe a table as its table file does
+static void describe_table(struct data_table* table, struct table_file_table* desc) {
+	memset(desc,0,sizeof(struct table_file_table));
+	strcpy(desc->name,table->name);
+	desc->col_count = table->col_count;
+	int m;
+	for (m=0; m<table->col_count; m++) {
+		desc->col_types[m] = table->columns[m]->type;
+		desc->col_sizes[m] = table->columns[m]->size;
+	}
+	desc->slot_size = slot_size(table);
+}
+
+// have the tables read their rows from a mapped table file
+static int attach_table_file(struct table_file* file) {
+	unsigned int k;
+	for (k=0; k<file->header->table_count; k++) {
+		struct table_file_table* desc = &file->tables[k];
+		struct table_file_table expected;
+		struct data_table* table = find_table(desc->name);
+		if (table != 0) {
+			describe_table(table,&expected);
+		}
+		if (table == 0 || desc->col_count != expected.col_count
+				|| desc->slot_size != expected.slot_size
+				|| memcmp(desc->col_types,expected.col_types,sizeof expected.col_types)
+				|| memcmp(desc->col_sizes,expected.col_sizes,sizeof expected.col_sizes)) {
+			sprintf(message,"Error: the snapshot does not match table '%s'\n",
+					desc->name);
+			logger(server_log,message);
+			return -1;
+		}
+		table->shadowed = (unsigned char*)calloc(desc->rows / 8 + 1,1);
+		if (table->shadowed == 0) {
+			return -1;
+		}
+		table_file_image(file,k,&table->file_rows);
+		unsigned long n;
+		int m;
+		for (m=0; m<table->col_count; m++) {
+			struct value_index* values = table->columns[m]->value_index;
+			struct ordered_index* index = table->columns[m]->ordered_index;
+			for (n=0; n<desc->rows && (values!=0 || index!=0); n++) {
+				struct row_version* version =
+						slot_version(table_image_slot(&table->file_rows,n));
+				if (values != 0 && value_index_insert(values,version->row
+						+ table->columns[m]->offset,file_row_item(n)) != 0) {
+					return -1;
+				}
+				if (index != 0 && ordered_index_insert(index,
+						version_get_int(table,version,m),file_row_item(n)) != 0) {
+					return -1;
+				}
+			}
+		}
+		// a columnar table copies the rows into its columns, version 0
+		for (n=0; n<desc->rows && table->column_store!=0; n++) {
+			char* slot = table_image_slot(&table->file_rows,n);
+			if (column_store_add(table->column_store,0) < 0) {
+				return -1;
+			}
+			for (m=0; m<table->col_count; m++) {
+				struct bitmap_index* bitmap = table->columns[m]->bitmap_index;
+				if (bitmap != 0 && bitmap_index_add(bitmap,slot_version(slot)->row
+						+ table->columns[m]->offset,n) != 0) {
+					return -1;
+				}
+			}
+			column_store_begin(table->column_store,n,slot_version(slot)->row);
+			column_store_end(table->column_store,n,slot,slot_version(slot)->row,0);
+		}
+	}
+	return 0;
+}
+
+int recover_tables(const char* directory, int durability, int interval_ms,
+		int threads) {
+	char path[MAX_PATH_LEN + 64];
+	unsigned long long lsns[WAL_MAX_SEGMENTS];
+	unsigned long changes = 0;
+	unsigned long long from_lsn = 0;
+	long long start = now_ms();
+	// the latest snapshot, then the log from where it was taken
+	int count = wal_list_files(directory,SNAPSHOT_PREFIX,SNAPSHOT_SUFFIX,
+			lsns,WAL_MAX_SEGMENTS);
+	if (count < 0) {
+		sprintf(message,"Error: cannot read '%s'\n",directory);
+		logger(server_log,message);
+		return -1;
+	}
+	if (count > 0) {
+		// mapped for good, its rows are only read once used
+		static struct table_file file;
+		from_lsn = lsns[count-1];
+		snapshot_path(path,sizeof path,directory,from_lsn);
+		if (table_file_open(&file,path) != 0 || file.header->lsn != from_lsn) {
+			sprintf(message,"Error: cannot map the snapshot '%s'\n",path);
+			logger(server_log,message);
+			return -1;
+		}
+		if (attach_table_file(&file) != 0) {
+			return -1;
+		}
+		sprintf(message,"Mapped the snapshot at LSN %llu, %lu bytes, in %lld ms\n",
+				from_lsn,(unsigned long)file.size,now_ms() - start);
+		logger(server_log,message);
+		has_snapshot = 1;
+		snapshot_lsn = from_lsn;
+	}
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threads = threads < 1 ? 1 : threads;
+	threads = threads > MAX_REPLAY_THREADS ? MAX_REPLAY_THREADS : threads;
+	struct replay* replay = start_replay(threads);
+	if (replay == 0) {
+		return -1;
+	}
+	threads = replay->started > 0 ? replay->count : 1;
+	long long replay_start = now_ms();
+	int opened = wal_open(&table_wal,directory,durability,interval_ms,from_lsn,
+			queue_change,replay) == 0;
+	if (finish_replay(replay,&changes) != 0 || !opened) {
+		if (opened) {
+			wal_close(&table_wal);
+		}
+		sprintf(message,"Error: cannot recover the tables from '%s'\n",directory);
+		logger(server_log,message);
+		return -1;
+	}
+	long long replay_ms = now_ms() - replay_start;
+	sprintf(message,"Recovered %lu changes from '%s' in %lld ms, %.0f changes/s "\
+			"on %d threads\n",changes,directory,now_ms() - start,
+			replay_ms > 0 ? changes * 1000.0 / replay_ms : 0.0,threads);
+	logger(server_log,message);
+	table_log = &table_wal;
+	return 0;
+}
+
+// the number of rows of a table, the caller holds its lock
+static unsigned long table_rows(struct data_table* table) {
+	return hash_index_count(&table->index) - table->shadow_deleted
+			+ table->file_rows.rows - table->shadowed_count;
+}
+
+// write the rows of a table to a table file: those of the entries, then
+// those of the previous table file that no entry shadows
+static int write_table(struct table_file_writer* file, struct data_table* table) {
+	struct table_file_table desc;
+	describe_table(table,&desc);
+	desc.rows = table_rows(table);
+	char* slot = (char*)calloc(1,desc.slot_size);
+	if (slot == 0 || table_file_begin(file,&desc) != 0) {
+		free(slot);
+		return -1;
+	}
+	int result = 0;
+	struct data_entry* entry;
+	for (entry=table->head; entry!=0 && result==0; entry=entry->next) {
+		if (entry->current->deleted == 0) {
+			strcpy(slot,entry->key);
+			struct row_version* version = slot_version(slot);
+			memcpy(version,entry->current,version_size(table));
+			version->version = 0;
+			version->older = 0;
+			result = table_file_add(file,slot,entry->hash_node.hash);
+		}
+	}
+	unsigned long k;
+	for (k=0; k<table->file_rows.rows && result==0; k++) {
+		if (slot_shadowed(table,k) == 0) {
+			char* row = table_image_slot(&table->file_rows,k);
+			result = table_file_add(file,row,hash_string(row));
+		}
+	}
+	free(slot);
+	return table_file_end(file) == 0 ? result : -1;
+}
+
+// write the current rows of every table to a snapshot of the log at lsn,
+// in the child of a checkpoint, which has no other thread and the tables
+// to itself
+static int write_snapshot(unsigned long long lsn) {
+	char path[MAX_PATH_LEN + 64], temp[MAX_PATH_LEN + 64];
+	struct table_file_writer file;
+	snprintf(temp,sizeof temp,"%s/" SNAPSHOT_TEMP,table_log->directory);
+	if (table_file_create(&file,temp,lsn,table_count) != 0) {
+		return -1;
+	}
+	int result = 0;
+	int k;
+	for (k=0; k<table_count && result==0; k++) {
+		result = write_table(&file,tables[k]);
+	}
+	if (table_file_finish(&file) != 0 || result != 0) {
+		unlink(temp);
+		return -1;
+	}
+	// complete once renamed
+	snapshot_path(path,sizeof path,table_log->directory,lsn);
+	int dir = rename(temp,path) == 0 ? open(table_log->directory,O_RDONLY) : -1;
+	if (dir < 0 || fsync(dir) != 0) {
+		return -1;
+	}
+	close(dir);
+	return 0;
+}
+
+int checkpoint_tables() {
+	if (table_log == 0) {
+		return -1;
+	}
+	pthread_mutex_lock(&checkpoint_lock);
+	long long start = now_ms();
+	// with every table locked no change is half made, or made and not
+	// logged yet, so the tables hold exactly the log up to lsn
+	int k;
+	for (k=0; k<table_count; k++) {
+		pthread_rwlock_wrlock(&tables[k]->lock);
+	}
+	unsigned long long lsn;
+	unsigned long rows = 0;
+	pid_t pid = -1;
+	int result = wal_rotate(table_log,&lsn);
+	if (result == 0 && has_snapshot && lsn == snapshot_lsn) {
+		// nothing changed since the latest snapshot
+		for (k=table_count-1; k>=0; k--) {
+			pthread_rwlock_unlock(&tables[k]->lock);
+		}
+		pthread_mutex_unlock(&checkpoint_lock);
+		return 0;
+	}
+	if (result == 0) {
+		for (k=0; k<table_count; k++) {
+			rows += table_rows(tables[k]);
+		}
+		// the child sees the tables as they are now, their pages shared
+		// copy-on-write with the parent, which goes on serving
+		pid = fork();
+		if (pid == 0) {
+			_exit(write_snapshot(lsn) == 0 ? 0 : 1);
+		}
+	}
+	long long paused = now_ms() - start;
+	for (k=table_count-1; k>=0; k--) {
+		pthread_rwlock_unlock(&tables[k]->lock);
+	}
+	int status;
+	if (pid < 0 || waitpid(pid,&status,0) != pid || !WIFEXITED(status)
+			|| WEXITSTATUS(status) != 0) {
+		logger(server_log,"Error: cannot take a snapshot of the tables\n");
+		pthread_mutex_unlock(&checkpoint_lock);
+		return -1;
+	}
+	// the snapshot replaces the older ones and the log before it
+	char path[MAX_PATH_LEN + 64];
+	unsigned long long lsns[WAL_MAX_SEGMENTS];
+	int count = wal_list_files(table_log->directory,SNAPSHOT_PREFIX,
+			SNAPSHOT_SUFFIX,lsns,WAL_MAX_SEGMENTS);
+	for (k=0; k<count && lsns[k]<lsn; k++) {
+		snapshot_path(path,sizeof path,table_log->directory,lsns[k]);
+		unlink(path);
+	}
+	wal_truncate(table_log,lsn);
+	has_snapshot = 1;
+	snapshot_lsn = lsn;
+	sprintf(message,"Snapshot of %lu rows at LSN %llu took %lld ms, "\
+			"SETs paused for %lld ms\n",rows,lsn,now_ms() - start,paused);
+	logger(server_log,message);
+	pthread_mutex_unlock(&checkpoint_lock);
+	return 0;
+}
+
+void close_table_log() {
+	if (table_log != 0) {
+		wal_close(table_log);
+		table_log = 0;
+	}
+}
+
+// check if a version holds the bytes of value in column col
+static int version_holds(struct data_table* table, struct row_version* version,
+		int col, const char* value) {
+	struct data_column* column = table->columns[col];
+	return version->deleted == 0 && (column->type == INT
+			? memcmp(version->row + column->offset,value,column->size) == 0
+			: strncmp(version->row + column->offset,value,column->size) == 0);
+}
+
+// check if a version in a chain of versions holds value in column col,
+// copies of rows of the table file are not indexed so they do not count
+static int chain_has_value(struct data_table* table, struct row_version* version,
+		int col, const char* value) {
+	for (; version!=0; version=version->older) {
+		if (version->version != 0 && version_holds(table,version,col,value)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// check if a version in a chain of versions holds value in column col,
+// copies of rows of the table file included
+static int chain_holds(struct data_table* table, struct row_version* version,
+		int col, const char* value) {
+	for (; version!=0; version=version->older) {
+		if (version_holds(table,version,col,value)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// the node of a value is shared by every version of the entry holding it
+static int index_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version) {
+	int k;
+	for (k=0; k<table->col_count && version->deleted==0; k++) {
+		struct data_column* column = table->columns[k];
+		const char* value = version->row + column->offset;
+		if ((column->ordered_index == 0 && column->value_index == 0)
+				|| chain_has_value(table,version->older,k,value)) {
+			continue;
+		}
+		if (column->ordered_index != 0 && ordered_index_insert(
+				column->ordered_index,version_get_int(table,version,k),entry) != 0) {
+			return -1;
+		}
+		if (column->value_index != 0
+				&& value_index_insert(column->value_index,value,entry) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// version is no longer in the chain of the entry's versions
+static void unindex_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version) {
+	int k;
+	for (k=0; k<table->col_count && version->deleted==0; k++) {
+		struct data_column* column = table->columns[k];
+		const char* value = version->row + column->offset;
+		if ((column->ordered_index == 0 && column->value_index == 0)
+				|| chain_has_value(table,entry->current,k,value)) {
+			continue;
+		}
+		// fails quietly if an older version already removed it
+		if (column->ordered_index != 0) {
+			ordered_index_remove(column->ordered_index,
+					version_get_int(table,version,k),entry);
+		}
+		if (column->value_index != 0) {
+			value_index_remove(column->value_index,value,entry);
+		}
+	}
+	for (k=0; k<table->col_count && version->deleted==0; k++) {
+		struct bitmap_index* bitmap = table->columns[k]->bitmap_index;
+		const char* value = version->row + table->columns[k]->offset;
+		if (bitmap != 0 && chain_holds(table,entry->current,k,value) == 0) {
+			bitmap_index_remove(bitmap,value,entry->slot);
+		}
+	}
+}
+
+// the slot stays in the set of a value while a version of the entry has
+// it, so a snapshot reading any of them finds the slot
+static void bitmap_version(struct data_table* table, struct data_entry* entry,
+		struct row_version* version) {
+	int k;
+	for (k=0; k<table->col_count && version->deleted==0; k++) {
+		struct bitmap_index* bitmap = table->columns[k]->bitmap_index;
+		const char* value = version->row + table->columns[k]->offset;
+		if (bitmap != 0 && chain_holds(table,entry->current,k,value) == 0) {
+			// a failed index is no longer used, see pick_bitmap_condition
+			bitmap_index_add(bitmap,value,entry->slot);
 		}
-		prev_cursor = curr_cursor;
-		curr_cursor = curr_cursor->next;
 	}
-	// not found, return -1
-	return -1;
 }
 
 int get_col_index(struct data_table* table, char* col_name) {
@@ -140,34 +1400,99 @@ int get_col_index(struct data_table* table, char* col_name) {
 }
 
 
-void fill_entry_with_value(struct data_entry* entry, char value[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN], int col_count) {
+size_t entry_size(struct data_table* table) {
+	return sizeof(struct data_entry) + version_size(table);
+}
+
+size_t version_size(struct data_table* table) {
+	return sizeof(struct row_version) + table->row_size;
+}
+
+size_t table_memory_usage(struct data_table* table, unsigned long* rows,
+		size_t* resident) {
+	pthread_rwlock_rdlock(&table->lock);
+	*rows = table_rows(table);
+	size_t used, index_bytes;
+	slab_stats(&table->slab,resident,&used);
+	index_bytes = hash_index_memory(&table->index);
+	if (table->column_store != 0) {
+		index_bytes += column_store_memory(table->column_store);
+	}
+	int m;
+	for (m=0; m<table->col_count; m++) {
+		if (table->columns[m]->dictionary != 0) {
+			index_bytes += dictionary_memory(table->columns[m]->dictionary);
+		}
+		if (table->columns[m]->bitmap_index != 0) {
+			index_bytes += bitmap_index_memory(table->columns[m]->bitmap_index);
+		}
+		if (table->columns[m]->value_index != 0) {
+			index_bytes += value_index_memory(table->columns[m]->value_index);
+		}
+	}
+	pthread_rwlock_unlock(&table->lock);
+	*resident += index_bytes;
+	return used + index_bytes;
+}
+
+long long version_get_int(struct data_table* table, struct row_version* version, int col) {
+	// int columns are laid out first, so they are always aligned
+	return *(long long*)(version->row + table->columns[col]->offset);
+}
+
+void version_get_value(struct data_table* table, struct row_version* version, int col,
+		char value[MAX_VALUE_LEN]) {
+	struct data_column* column = table->columns[col];
+	if (column->type == INT) {
+		sprintf(value,"%lld",version_get_int(table,version,col));
+	} else {
+		// char columns are not null-terminated when full
+		strncpy(value,version->row + column->offset,column->size);
+		value[column->size] = '\0';
+	}
+}
+
+void fill_version_with_value(struct data_table* table, struct row_version* version, struct data_value value[MAX_COLUMNS_PER_TABLE]) {
 	int k=0;
-	for (k=0; k<col_count; k++) {
-		strcpy(entry->value[k],value[k]);
+	for (k=0; k<table->col_count; k++) {
+		struct data_column* column = table->columns[k];
+		if (column->type == INT) {
+			*(long long*)(version->row + column->offset) = value[k].int_val;
+		} else {
+			// pads the rest of the column with '\0'
+			strncpy(version->row + column->offset,value[k].str_val,column->size);
+		}
 	}
 }
 
-void flush_query_params() {
-	int k;
-	for (k=0; k<condition_count; k++) {
-		free(query_conditions[k]);
-		query_conditions[k] = 0;
+void init_query(struct query_context* ctx, struct data_table* table) {
+	ctx->table = table;
+	ctx->condition_count = 0;
+}
+
+// the code of the value a condition compares a dictionary-encoded column
+// with, DICTIONARY_ABSENT if it has none or is too long to be in a row
+static unsigned int find_code(struct data_column* column, const char* value) {
+	if (column->dictionary == 0 || strlen(value) > (size_t)column->size) {
+		return DICTIONARY_ABSENT;
 	}
-	condition_count = 0;
+	return dictionary_find(column->dictionary,value);
 }
 
-int set_query_params(struct data_table* table,
+int set_query_params(struct query_context* ctx,
 		char col_n[MAX_COLNAME_LEN],
 		char operand_t[MAX_VALUE_LEN],
 		char comp_v[MAX_VALUE_LEN]) {
+	struct data_table* table = ctx->table;
 	int index = get_col_index(table,col_n);
 	if (index == -1) {
 		// column name not found
 		return -1;
 	}
-	int k = 0;
-	while (query_conditions[k] !=0 ) {
-		k++;
+	if (ctx->condition_count == MAX_COLUMNS_PER_TABLE
+			|| strlen(comp_v) >= MAX_VALUE_LEN) {
+		// too many conditions, or too long a value
+		return -1;
 	}
 	enum operand_type op;
 	if (strcmp(operand_t,"=") == 0) {
@@ -188,46 +1513,553 @@ int set_query_params(struct data_table* table,
 		// incompatible operand for char type
 		return -1;
 	}
-	query_conditions[k] = (struct query_condition*)
-				malloc(sizeof(struct query_condition));
-	query_conditions[k]->query_col_index = index;
-	query_conditions[k]->query_operand = op;
-	strcpy(query_conditions[k]->query_comp_val,comp_v);
-	condition_count = k+1;
+	struct query_condition* con = &ctx->conditions[ctx->condition_count];
+	con->query_col_index = index;
+	con->query_operand = op;
+	strcpy(con->query_comp_val,comp_v);
+	con->query_comp_int =
+			table->columns[index]->type == INT ? strtoll(comp_v,0,10) : 0;
+	con->query_comp_code = find_code(table->columns[index],comp_v);
+	ctx->condition_count++;
 	return 0;
 }
 
-void query(struct data_table* table, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN], int max_keys, int* keys_acquired) {
-	int k = 0;
-	struct data_entry* cursor = table->head;
-	while (cursor != 0) {
-		int result = check_query_match(table,cursor);
-		if (result == 0) {
-			strcpy(keys[k],cursor->key);
+// check if row n of the table file is the row of its key in a snapshot
+static int file_row_visible(struct data_table* table, unsigned long n,
+		unsigned long long snapshot) {
+	if (slot_shadowed(table,n) == 0) {
+		return 1;
+	}
+	// the entry's row counts, unless the snapshot still reads the copy of
+	// this one the entry started with
+	struct data_entry* entry = find_entry(table,
+			table_image_slot(&table->file_rows,n));
+	struct row_version* version = entry != 0 ?
+			snapshot_version(entry,snapshot) : 0;
+	return version != 0 && version->version == 0;
+}
+
+// add the keys of the rows of the table file that match a query in a
+// snapshot to the k keys found so far, return how many there are then
+static int query_file_rows(struct query_context* ctx,
+		unsigned long long snapshot, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN],
+		int k) {
+	struct data_table* table = ctx->table;
+	unsigned long n;
+	for (n=0; n<table->file_rows.rows && k<MAX_RECORDS_PER_TABLE; n++) {
+		char* slot = table_image_slot(&table->file_rows,n);
+		if (file_row_visible(table,n,snapshot)
+				&& check_query_match(ctx,slot_version(slot)) == 0) {
+			strcpy(keys[k],slot);
 			k++;
 		}
-		cursor = cursor->next;
 	}
-	*keys_acquired = k;
+	return k;
+}
+
+// select the n values of a column that pass a condition
+static void select_column(struct data_table* table, struct query_condition* con,
+		const char* values, int n, unsigned long long* bits) {
+	struct data_column* column = table->columns[con->query_col_index];
+	if (column->dictionary != 0) {
+		// no row has the code DICTIONARY_ABSENT
+		scan_select_code((const unsigned int*)values,n,con->query_comp_code,bits);
+	} else if (column->type == INT) {
+		enum scan_op op = con->query_operand == LESS_THAN ? SCAN_LESS
+				: con->query_operand == EQUAL ? SCAN_EQUAL : SCAN_GREATER;
+		scan_select_int((const long long*)values,n,op,con->query_comp_int,bits);
+	} else {
+		// char columns are only compared for EQUAL, see check_condition_match
+		scan_select_char(values,column->size,n,con->query_comp_val,bits);
+	}
+}
+
+// check if value m of the values of a column passes a condition, as
+// select_column does
+static int value_passes(struct data_table* table, struct query_condition* con,
+		const char* values, int m) {
+	struct data_column* column = table->columns[con->query_col_index];
+	if (column->dictionary != 0) {
+		return ((const unsigned int*)values)[m] == con->query_comp_code;
+	} else if (column->type == INT) {
+		long long value = ((const long long*)values)[m];
+		return con->query_operand == LESS_THAN ? value < con->query_comp_int
+				: con->query_operand == EQUAL ? value == con->query_comp_int
+				: value > con->query_comp_int;
+	}
+	return strlen(con->query_comp_val) <= (size_t)column->size
+			&& strncmp(values + (size_t)m * column->size,con->query_comp_val,
+					column->size) == 0;
+}
+
+// clear the bits of match whose values of a column fail a condition, one
+// value at a time, return the number of words left with a bit set
+static int filter_column(struct data_table* table, struct query_condition* con,
+		const char* values, int n, unsigned long long* match) {
+	int w, left = 0;
+	for (w=0; w<scan_words(n); w++) {
+		unsigned long long word = match[w];
+		while (word != 0) {
+			int m = w * SCAN_WORD_BITS + __builtin_ctzll(word);
+			word &= word - 1;
+			if (!value_passes(table,con,values,m)) {
+				match[w] &= ~(1ULL << (m % SCAN_WORD_BITS));
+			}
+		}
+		left += match[w] != 0;
+	}
+	return left;
+}
+
+// add the key of the entry in slot k of a chunk to keys if its row in a
+// snapshot matches a query, return 1 if added
+static int match_slot_entry(struct query_context* ctx,
+		struct column_chunk* chunk, unsigned long k,
+		unsigned long long snapshot, char key[MAX_KEY_LEN]) {
+	struct data_entry* entry = (struct data_entry*)chunk->items[k];
+	struct row_version* version = entry != 0 ?
+			snapshot_version(entry,snapshot) : 0;
+	if (version == 0 || check_query_match(ctx,version) != 0) {
+		return 0;
+	}
+	strcpy(key,entry->key);
+	return 1;
+}
+
+// candidates of a batch are sparse when at most one in this many slots
+#define SPARSE_CANDIDATES 16
+
+// select the n slots of a chunk from first that pass every condition of
+// a query, the conditions after the first ANDing their bitmaps into match,
+// or every condition ANDing them into candidates if not 0
+static void select_slots(struct query_context* ctx, struct column_chunk* chunk,
+		unsigned long first, int n, const unsigned long long* candidates,
+		unsigned long long* match) {
+	struct column_store* store = ctx->table->column_store;
+	unsigned long long bits[scan_words(COLUMN_BATCH_ROWS)];
+	int c, sparse = 0;
+	if (candidates != 0) {
+		memcpy(match,candidates,scan_words(n) * sizeof(unsigned long long));
+		// a few candidates are checked faster one by one than with kernels
+		int w, count = 0;
+		for (w=0; w<scan_words(n); w++) {
+			count += __builtin_popcountll(candidates[w]);
+		}
+		sparse = count * SPARSE_CANDIDATES <= n;
+	}
+	for (c=0; c<ctx->condition_count; c++) {
+		int col = ctx->conditions[c].query_col_index;
+		const char* values = chunk->values[col] + first * store->widths[col];
+		if (sparse) {
+			if (filter_column(ctx->table,&ctx->conditions[c],values,n,match) == 0) {
+				return;
+			}
+			continue;
+		}
+		if (c == 0 && candidates == 0) {
+			select_column(ctx->table,&ctx->conditions[c],values,n,match);
+			continue;
+		}
+		select_column(ctx->table,&ctx->conditions[c],values,n,bits);
+		if (scan_and(match,bits,scan_words(n)) == 0) {
+			// no slot left to select
+			return;
+		}
+	}
+	if (ctx->condition_count == 0) {
+		memset(match,0xff,scan_words(n) * sizeof(unsigned long long));
+		if (n % SCAN_WORD_BITS != 0) {
+			match[n / SCAN_WORD_BITS] = (1ULL << (n % SCAN_WORD_BITS)) - 1;
+		}
+	}
+}
+
+// whether the slots a query selects must be checked against their entries:
+// a condition compares with a value added to a full dictionary, whose
+// code is DICTIONARY_NO_CODE like the one of every other such value
+static int selects_uncoded(struct query_context* ctx) {
+	int c;
+	for (c=0; c<ctx->condition_count; c++) {
+		if (ctx->conditions[c].query_comp_code == DICTIONARY_NO_CODE) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// whether slot m is set in a bitmap
+#define slot_selected(bits, m) \
+	(((bits)[(m) / SCAN_WORD_BITS] >> ((m) % SCAN_WORD_BITS)) & 1)
+
+// add the keys of the n slots of a chunk from first that match a query in
+// a snapshot, checking the version of each slot, return the keys found
+// only the slots set in candidates are read, if not 0
+static int scan_slots(struct query_context* ctx, struct column_chunk* chunk,
+		unsigned long first, int n, const unsigned long long* candidates,
+		unsigned long long snapshot, char (*keys)[MAX_KEY_LEN], int max_keys) {
+	unsigned long long versions[COLUMN_BATCH_ROWS];
+	unsigned long long match[scan_words(COLUMN_BATCH_ROWS)];
+	int m, k = 0;
+	// the versions before the values, see column_store.h
+	for (m=0; m<n; m++) {
+		versions[m] = chunk->versions[first + m];
+	}
+	__sync_synchronize();
+	select_slots(ctx,chunk,first,n,candidates,match);
+	__sync_synchronize();
+	for (m=0; m<n && k<max_keys; m++) {
+		if (candidates != 0 && slot_selected(candidates,m) == 0) {
+			// the row of the slot in the snapshot fails a condition
+			continue;
+		}
+		unsigned long long version = versions[m];
+		int selected = slot_selected(match,m);
+		// most slots neither match nor changed
+		if ((selected | (version != chunk->versions[first + m])
+				| ((version & ~COLUMN_DELETED) > snapshot)) == 0) {
+			continue;
+		}
+		if (version != chunk->versions[first + m]
+				|| (version & ~COLUMN_DELETED) > snapshot) {
+			// changed meanwhile or since the snapshot: read the entry
+			k += match_slot_entry(ctx,chunk,first + m,snapshot,keys[k]);
+			continue;
+		}
+		if (selected == 0 || (version & COLUMN_DELETED) != 0) {
+			continue;
+		}
+		if (selects_uncoded(ctx)) {
+			k += match_slot_entry(ctx,chunk,first + m,snapshot,keys[k]);
+			continue;
+		}
+		memcpy(keys[k],chunk->keys[first + m],MAX_KEY_LEN);
+		__sync_synchronize();
+		if (version != chunk->versions[first + m]) {
+			k += match_slot_entry(ctx,chunk,first + m,snapshot,keys[k]);
+			continue;
+		}
+		k++;
+	}
+	return k;
+}
+
+// add the keys of the n slots of a batch of a chunk from first that match
+// a query in a snapshot, reading only the versions of the slots that
+// match, return the keys found or -1 if the batch was written since the
+// snapshot or while it was read
+// only the slots set in candidates are read, if not 0
+static int scan_batch(struct query_context* ctx, struct column_chunk* chunk,
+		unsigned long first, int n, const unsigned long long* candidates,
+		unsigned long long snapshot, char (*keys)[MAX_KEY_LEN], int max_keys) {
+	struct column_batch* batch = &chunk->batches[first / COLUMN_BATCH_ROWS];
+	unsigned long long match[scan_words(COLUMN_BATCH_ROWS)];
+	unsigned long started = batch->started;
+	__sync_synchronize();
+	if (batch->ended != started || batch->version > snapshot) {
+		return -1;
+	}
+	select_slots(ctx,chunk,first,n,candidates,match);
+	int uncoded = selects_uncoded(ctx);
+	int w, k = 0;
+	for (w=0; w<scan_words(n) && k<max_keys; w++) {
+		unsigned long long word = match[w];
+		while (word != 0 && k < max_keys) {
+			int m = w * SCAN_WORD_BITS + __builtin_ctzll(word);
+			word &= word - 1;
+			// a slot added and not written yet is pending
+			unsigned long long version = chunk->versions[first + m];
+			if (version == COLUMN_PENDING || uncoded) {
+				k += match_slot_entry(ctx,chunk,first + m,snapshot,keys[k]);
+			} else if ((version & COLUMN_DELETED) == 0) {
+				memcpy(keys[k],chunk->keys[first + m],MAX_KEY_LEN);
+				k++;
+			}
+		}
+	}
+	__sync_synchronize();
+	return batch->started == started ? k : -1;
+}
+
+// the value an equality condition compares its column with, as the
+// column holds it in a row
+static const char* condition_value(struct data_table* table,
+		struct query_condition* con) {
+	return table->columns[con->query_col_index]->type == INT ?
+			(const char*)&con->query_comp_int : con->query_comp_val;
+}
+
+// set bit k of candidates if slot base + k is in the sets of the values of
+// every equality condition on a column with a bitmap index, for the n
+// slots of a batch from base
+// return the number of words with a bit set
+static int select_candidates(struct query_context* ctx, unsigned long base,
+		int n, unsigned long long* candidates) {
+	unsigned long long bits[scan_words(COLUMN_BATCH_ROWS)];
+	int c, first = 1, left = 0;
+	for (c=0; c<ctx->condition_count; c++) {
+		struct query_condition* con = &ctx->conditions[c];
+		struct bitmap_index* bitmap =
+				ctx->table->columns[con->query_col_index]->bitmap_index;
+		if (bitmap == 0 || bitmap->failed || con->query_operand != EQUAL) {
+			continue;
+		}
+		left = bitmap_index_select(bitmap,condition_value(ctx->table,con),
+				base,n,first ? candidates : bits);
+		if (!first) {
+			left = scan_and(candidates,bits,scan_words(n));
+		}
+		if (left == 0) {
+			return 0;
+		}
+		first = 0;
+	}
+	return left;
 }
 
-int check_query_match(struct data_table* table, struct data_entry* entry) {
-	int k, sum = 0;
-	for (k=0; k<condition_count; k++) {
-		struct query_condition* con = query_conditions[k];
-		sum +=check_condition_match(table,entry,con);
+// add the keys of the rows of a columnar table that match a query in a
+// snapshot to the k keys found so far, return how many there are then
+// with a condition picked by pick_bitmap_condition, only the batches
+// holding slots of its value are read
+static int query_columns(struct query_context* ctx,
+		unsigned long long snapshot, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN],
+		int k, int bitmapped) {
+	struct column_store* store = ctx->table->column_store;
+	unsigned long slots = store->slots;
+	unsigned long base;
+	// a value with no code when the condition was set may have one now:
+	// every row of the snapshot had its strings added to the dictionaries
+	// before it was committed
+	int c;
+	for (c=0; c<ctx->condition_count; c++) {
+		struct query_condition* con = &ctx->conditions[c];
+		struct data_column* column = ctx->table->columns[con->query_col_index];
+		if (con->query_comp_code == DICTIONARY_ABSENT && column->dictionary != 0) {
+			con->query_comp_code = find_code(column,con->query_comp_val);
+			if (con->query_comp_code == DICTIONARY_ABSENT
+					&& dictionary_full(column->dictionary)) {
+				con->query_comp_code = DICTIONARY_NO_CODE;
+			}
+		}
 	}
-	return sum == 0 ? 0 : -1;
+	struct bitmap_index* driver = 0;
+	const char* driver_value = 0;
+	unsigned long long candidates[scan_words(COLUMN_BATCH_ROWS)];
+	if (bitmapped != -1) {
+		struct query_condition* con = &ctx->conditions[bitmapped];
+		driver = ctx->table->columns[con->query_col_index]->bitmap_index;
+		driver_value = condition_value(ctx->table,con);
+	}
+	int n;
+	for (base=0; base<slots && k<MAX_RECORDS_PER_TABLE; base+=n) {
+		if (driver != 0) {
+			// on to the batch of the next slot of the picked value
+			unsigned long next = bitmap_index_next(driver,driver_value,base);
+			if (next == BITMAP_NONE || next >= slots) {
+				break;
+			}
+			base = next - next % COLUMN_BATCH_ROWS;
+		}
+		struct column_chunk* chunk = column_chunk_of(store,base);
+		unsigned long first = base % COLUMN_CHUNK_ROWS;
+		n = slots - base < COLUMN_BATCH_ROWS ? slots - base : COLUMN_BATCH_ROWS;
+		if (driver != 0 && select_candidates(ctx,base,n,candidates) == 0) {
+			continue;
+		}
+		int found = scan_batch(ctx,chunk,first,n,driver != 0 ? candidates : 0,
+				snapshot,keys + k,MAX_RECORDS_PER_TABLE - k);
+		if (found < 0) {
+			found = scan_slots(ctx,chunk,first,n,driver != 0 ? candidates : 0,
+					snapshot,keys + k,MAX_RECORDS_PER_TABLE - k);
+		}
+		k += found;
+	}
+	return k;
+}
+
+void query(struct query_context* ctx, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN], int max_keys, int* keys_acquired) {
+	struct data_table* table = ctx->table;
+	epoch_enter();
+	unsigned long long snapshot;
+	int slot = take_snapshot(table,&snapshot);
+	int k = 0;
+	int indexed = pick_indexed_condition(ctx);
+	struct value_index* values = indexed != -1 ?
+			table->columns[ctx->conditions[indexed].query_col_index]->value_index : 0;
+	// every index holds the rows of the file too
+	int bitmapped = table->column_store != 0 && values == 0 ?
+			pick_bitmap_condition(ctx) : -1;
+	if (bitmapped != -1) {
+		indexed = -1;
+	}
+	if (values != 0) {
+		// only visit the entries and rows of the file holding the value
+		struct value_posting* posting =
+				value_index_find(values,ctx->conditions[indexed].query_comp_val);
+		for (; posting!=0 && k<MAX_RECORDS_PER_TABLE;
+				posting=value_index_next(posting)) {
+			if (item_is_file_row(posting->item)) {
+				unsigned long n = item_file_row(posting->item);
+				char* slot = table_image_slot(&table->file_rows,n);
+				if (file_row_visible(table,n,snapshot)
+						&& check_query_match(ctx,slot_version(slot)) == 0) {
+					strcpy(keys[k],slot);
+					k++;
+				}
+				continue;
+			}
+			// an entry has a posting for each value of its versions, only
+			// the one of the snapshot's version matches
+			struct data_entry* entry = (struct data_entry*)posting->item;
+			struct row_version* version = snapshot_version(entry,snapshot);
+			if (version != 0 && version->version != 0
+					&& check_query_match(ctx,version) == 0) {
+				strcpy(keys[k],entry->key);
+				k++;
+			}
+		}
+		*keys_acquired = k;
+	} else if (indexed != -1) {
+		// only visit the entries in the range of the indexed condition
+		struct query_condition* con = &ctx->conditions[indexed];
+		struct ordered_index* index =
+				table->columns[con->query_col_index]->ordered_index;
+		long long comp_val = con->query_comp_int;
+		struct ordered_node* node;
+		switch (con->query_operand) {
+			case GREATER_THAN:
+				node = ordered_index_lower_bound(index,comp_val+1);
+				break;
+			case EQUAL:
+				node = ordered_index_lower_bound(index,comp_val);
+				break;
+			default:
+				node = ordered_index_first(index);
+				break;
+		}
+		while (node != 0) {
+			if ((con->query_operand == EQUAL && node->value != comp_val)
+					|| (con->query_operand == LESS_THAN && node->value >= comp_val)) {
+				// past the end of the range
+				break;
+			}
+			if (item_is_file_row(node->item)) {
+				unsigned long n = item_file_row(node->item);
+				char* slot = table_image_slot(&table->file_rows,n);
+				if (k < MAX_RECORDS_PER_TABLE && file_row_visible(table,n,snapshot)
+						&& check_query_match(ctx,slot_version(slot)) == 0) {
+					strcpy(keys[k],slot);
+					k++;
+				}
+				node = ordered_index_next(node);
+				continue;
+			}
+			// an entry has a node for the value of each of its versions,
+			// only the one of the snapshot's version counts
+			struct data_entry* entry = (struct data_entry*)node->item;
+			struct row_version* version = snapshot_version(entry,snapshot);
+			if (k < MAX_RECORDS_PER_TABLE && version != 0 && version->version != 0
+					&& version_get_int(table,version,con->query_col_index) == node->value
+					&& check_query_match(ctx,version) == 0) {
+				strcpy(keys[k],entry->key);
+				k++;
+			}
+			node = ordered_index_next(node);
+		}
+		*keys_acquired = k;
+	} else if (table->column_store != 0) {
+		// the column store holds the rows of the file too
+		*keys_acquired = query_columns(ctx,snapshot,keys,k,bitmapped);
+	} else {
+		struct data_entry* cursor = table->head;
+		while (cursor != 0) {
+			// copies of rows of the table file are read there
+			struct row_version* version = snapshot_version(cursor,snapshot);
+			if (version != 0 && version->version != 0
+					&& check_query_match(ctx,version) == 0
+					&& k < MAX_RECORDS_PER_TABLE) {
+				strcpy(keys[k],cursor->key);
+				k++;
+			}
+			cursor = cursor->next;
+		}
+	}
+	if (indexed == -1 && table->column_store == 0) {
+		*keys_acquired = query_file_rows(ctx,snapshot,keys,k);
+	}
+	release_snapshot(table,slot);
+	epoch_exit();
+}
+
+int pick_indexed_condition(struct query_context* ctx) {
+	int k, picked = -1;
+	for (k=0; k<ctx->condition_count; k++) {
+		struct query_condition* con = &ctx->conditions[k];
+		struct data_column* column = ctx->table->columns[con->query_col_index];
+		if (column->value_index != 0) {
+			// only char columns have one, and they are only compared for
+			// EQUAL: a posting list holds just the matching rows
+			return k;
+		}
+		if (column->ordered_index == 0) {
+			continue;
+		}
+		if (con->query_operand == EQUAL && (picked == -1
+				|| ctx->conditions[picked].query_operand != EQUAL)) {
+			// equality is the most selective
+			picked = k;
+		} else if (picked == -1) {
+			picked = k;
+		}
+	}
+	return picked;
+}
+
+// a value in more than one in this many slots leaves few batches to skip,
+// the kernels read them faster without the bitmaps
+#define BITMAP_SCAN_SHARE 16
+
+int pick_bitmap_condition(struct query_context* ctx) {
+	int k, picked = -1;
+	unsigned long fewest = 0;
+	for (k=0; k<ctx->condition_count; k++) {
+		struct query_condition* con = &ctx->conditions[k];
+		struct bitmap_index* bitmap =
+				ctx->table->columns[con->query_col_index]->bitmap_index;
+		if (bitmap == 0 || bitmap->failed || con->query_operand != EQUAL) {
+			continue;
+		}
+		unsigned long count = bitmap_index_count(bitmap,
+				condition_value(ctx->table,con));
+		if (picked == -1 || count < fewest) {
+			picked = k;
+			fewest = count;
+		}
+	}
+	if (picked != -1 && fewest > ctx->table->column_store->slots / BITMAP_SCAN_SHARE) {
+		return -1;
+	}
+	return picked;
+}
+
+int check_query_match(struct query_context* ctx, struct row_version* version) {
+	int k;
+	for (k=0; k<ctx->condition_count; k++) {
+		// the first condition that fails rules the row out
+		if (check_condition_match(ctx->table,version,&ctx->conditions[k]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
 }
 
 int check_condition_match(struct data_table* table,
-		struct data_entry* entry,
+		struct row_version* version,
 		struct query_condition* con) {
 	switch (table->columns[con->query_col_index]->type) {
 		case INT:
 		{
-			int data_val = atoi(entry->value[con->query_col_index]);
-			int other_val = atoi(con->query_comp_val);
+			long long data_val = version_get_int(table,version,con->query_col_index);
+			long long other_val = con->query_comp_int;
 			switch (con->query_operand) {
 				case EQUAL:
 				{
@@ -264,7 +2096,10 @@ int check_condition_match(struct data_table* table,
 		case CHAR:
 		{
 			// only possible operand is EQUAL
-			if (strcmp(entry->value[con->query_col_index],con->query_comp_val) == 0) {
+			struct data_column* column = table->columns[con->query_col_index];
+			if (strlen(con->query_comp_val) <= column->size
+					&& strncmp(version->row + column->offset,con->query_comp_val,
+							column->size) == 0) {
 				return 0;
 			} else {
 				return -1;
@@ -10,8 +10,18 @@
 
 #include "storage.h"
 #include "utils.h"
+#include "hash_index.h"
+#include "ordered_index.h"
+#include "slab.h"
+#include "epoch.h"
+#include "wal.h"
+#include "table_file.h"
+#include "column_store.h"
+#include "bitmap_index.h"
+#include "value_index.h"
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /**
  * Number of tables that actually exist
@@ -24,13 +34,70 @@ int table_count;
 struct data_table* tables[MAX_TABLES];
 
 /**
- * A struct that represents a table with its name and head pointed of linked-list
+ * The log of the tables' SETs and deletes, 0 if they are not logged
+ */
+struct wal* table_log;
+
+/**
+ * Number of lock stripes of a table (must be a power of two)
+ */
+#define TABLE_LOCK_STRIPES 256
+
+/**
+ * Max queries reading a snapshot of one table at the same time
+ */
+#define MAX_SNAPSHOTS 64
+
+/**
+ * A lock serializing the SETs of the entries whose key hashes to it.
+ * Each stripe has a cache line of its own.
+ */
+struct lock_stripe {
+	pthread_mutex_t lock;
+} __attribute__((aligned(64)));
+
+/**
+ * A struct that represents a table with its name and head pointed of linked-list,
+ * entries are also indexed by key in a hash index. GETs and queries take no
+ * lock: they run inside an epoch (see epoch.h), and removed nodes are retired.
  */
 struct data_table {
 	char name[MAX_TABLE_LEN];
 	int col_count;
 	struct data_column* columns[MAX_COLUMNS_PER_TABLE];
-	struct data_entry* head;
+	struct data_entry* volatile head;
+	struct data_entry* tail;
+	struct hash_index index;
+	// number of bytes of an entry's row, computed from the columns
+	int row_size;
+	// allocator of the entries and ordered index nodes
+	struct slab_allocator slab;
+	// whether a column has an ordered index or a value index, which SETs
+	// change under the table lock
+	int has_secondary_index;
+	// held for writing to add or remove entries or move one in a secondary
+	// index, for reading with the entry's stripe to install a version
+	pthread_rwlock_t lock;
+	struct lock_stripe stripes[TABLE_LOCK_STRIPES];
+	// version of the last committed row version
+	volatile unsigned long long commit_version;
+	// snapshots read by running queries, 0 for a free slot
+	volatile unsigned long long snapshots[MAX_SNAPSHOTS];
+	// deleted entries a snapshot may still see, linked by next_dead; they
+	// stay in the list until then, their current version a tombstone
+	struct data_entry* dead;
+	// rows of the table file, and a bit per row set once it is shadowed:
+	// a SET or delete of a file row copies it into an entry, which stays
+	// (as a tombstone if deleted) to hide the row. Value and ordered
+	// indexes hold file rows too
+	struct table_image file_rows;
+	unsigned char* shadowed;
+	unsigned long shadowed_count;
+	// entries shadowing a row whose current version is a tombstone
+	volatile unsigned long shadow_deleted;
+	// the rows column by column, 0 unless the table is columnar (see
+	// column_store.h)
+	struct column_store* column_store;
 };
 
 /**
@@ -45,19 +112,73 @@ struct data_column {
 	char name[MAX_COLNAME_LEN];
 	int str_len; // only applicable to char[] type
 	enum col_type type;
+	// position and number of bytes of the column in an entry's row:
+	// int columns hold a 64-bit integer, char[N] columns hold N chars that are
+	// only null-terminated when shorter than N
+	int offset;
+	int size;
+	// ordered index on the column, 0 if not declared with "index"
+	// (only applicable to int type)
+	struct ordered_index* ordered_index;
+	// hash index from the values of the column to the entries and rows of
+	// the table file holding them, 0 if not declared with "index" (only
+	// applicable to char type)
+	struct value_index* value_index;
+	// dictionary of the column in the table's column store, 0 if not
+	// declared with "dictionary" (only applicable to char type)
+	struct dictionary* dictionary;
+	// slots of the table's column store by value, 0 if not declared with
+	// "bitmap"
+	struct bitmap_index* bitmap_index;
 };
 
 /**
- * A struct that represents a node in a linked-list
+ * Version of a row that is still being installed, newer than any snapshot
+ */
+#define VERSION_PENDING (~0ULL)
+
+/**
+ * A version of an entry's row, followed by the row_size bytes of the row.
+ * A version is never changed once installed: a SET installs a new one,
+ * whose metadata is one more than the one it replaces. The rows of a
+ * table file, and their copies in memory, are version 0.
+ */
+struct row_version {
+	// commit_version of the table once committed, VERSION_PENDING before
+	volatile unsigned long long version;
+	int metadata;
+	// 1 for the tombstone a delete installs, whose row is not set
+	int deleted;
+	// the version this one replaced, 0 if none or no longer needed
+	struct row_version* older;
+	char row[];
+};
+
+/**
+ * A struct that represents a node in a doubly linked-list,
+ * with the versions of its row from newest to oldest
  */
 struct data_entry {
 	char key[MAX_KEY_LEN];
-	char value[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
-	int metadata;
-	struct data_entry* next;
+	struct row_version* volatile current;
+	struct data_entry* volatile next;
+	struct data_entry* prev;
+	struct data_entry* next_dead;
+	struct hash_node hash_node;
+	// slot of the entry in the table's column store, if it has one
+	unsigned long slot;
 };
 
 
+/**
+ * A column value given to set_entry: int columns are parsed into int_val
+ * once by the caller, char columns point to their text in str_val
+ */
+struct data_value {
+	long long int_val;
+	char* str_val;
+};
+
 /**
  * Initialize table array
  */
@@ -70,16 +191,29 @@ int init_tables(struct table** table_arr);
 struct data_table* find_table(char* table_name);
 
 /**
- * Get entry from table
+ * Get entry from table, the caller holds the table's lock or is inside
+ * an epoch
  * Return a pointer if found, 0 if not found
  */
 struct data_entry* find_entry(struct data_table* table, char* search_key);
 
+/**
+ * Get the current version of the row of an entry, which stays readable
+ * until release_version is called, whatever SETs and deletes run meanwhile
+ * Return a pointer if found, 0 if not found
+ */
+struct row_version* get_version(struct data_table* table, char* search_key);
+
+/**
+ * Release a version returned by get_version
+ */
+void release_version(struct row_version* version);
+
 /**
  * Insert/modify entry to/in table
  * Return -1 if failed, 0 if successful
  */
-int set_entry(struct data_table* table, char* mod_key, char mod_value[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN], int metadata);
+int set_entry(struct data_table* table, char* mod_key, struct data_value mod_value[MAX_COLUMNS_PER_TABLE], int metadata);
 
 /**
  * Delete entry from table
@@ -87,6 +221,35 @@ int set_entry(struct data_table* table, char* mod_key, char mod_value[MAX_COLUMN
  */
 int delete_entry(struct data_table* table, char* del_key);
 
+/**
+ * Map the latest snapshot kept in directory, a table file whose rows the
+ * tables read in place, and replay the log of SETs and deletes made after
+ * it, then log every SET and delete from now on. A SET or delete returns
+ * once it is as durable as durability (enum wal_durability) asks.
+ *
+ * The log is replayed by threads threads, one per CPU if 0: the changes
+ * of a key all go to the same thread, in the order they were logged, so
+ * the changes of different keys are applied in parallel.
+ * Return -1 if failed, 0 if successful
+ */
+int recover_tables(const char* directory, int durability, int interval_ms,
+		int threads);
+
+/**
+ * Save the rows of every table to a snapshot next to the log, a table
+ * file (see table_file.h), then remove the log before it and older
+ * snapshots. SETs and deletes wait only while the log is synced and the
+ * server forks, a child process writes the snapshot while the server
+ * goes on serving.
+ * Return -1 if failed, 0 if successful
+ */
+int checkpoint_tables();
+
+/**
+ * Write out, sync and close the log of the tables, if any
+ */
+void close_table_log();
+
 /**
  * Get column's index number in a table
  * Return -1 if column name not found
@@ -94,8 +257,37 @@ int delete_entry(struct data_table* table, char* del_key);
 int get_col_index(struct data_table* table, char* col_name);
 
 
+/**
+ * Number of bytes allocated for an entry of a table with one version
+ */
+size_t entry_size(struct data_table* table);
+
+/**
+ * Number of bytes allocated for a version of a row of a table
+ */
+size_t version_size(struct data_table* table);
+
+/**
+ * Get memory used by a table's entries, indexes and hash index
+ * Return the number of bytes in use, set rows to the number of entries
+ * and resident to the number of bytes held from the system
+ */
+size_t table_memory_usage(struct data_table* table, unsigned long* rows,
+		size_t* resident);
+
+/**
+ * Get the value of an int column of a version of a row
+ */
+long long version_get_int(struct data_table* table, struct row_version* version, int col);
+
+/**
+ * Get the value of a column of a version of a row as text
+ */
+void version_get_value(struct data_table* table, struct row_version* version, int col,
+		char value[MAX_VALUE_LEN]);
+
 // helper function
-void fill_entry_with_value(struct data_entry* entry, char value[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN], int col_count);
+void fill_version_with_value(struct data_table* table, struct row_version* version, struct data_value value[MAX_COLUMNS_PER_TABLE]);
 
 
 
@@ -112,35 +304,56 @@ struct query_condition {
 	int query_col_index;
 	enum operand_type query_operand;
 	char query_comp_val[MAX_VALUE_LEN];
+	// query_comp_val parsed once, only applicable to int type
+	long long query_comp_int;
+	// code of query_comp_val in the column's dictionary, looked up once,
+	// only applicable to dictionary-encoded columns
+	unsigned int query_comp_code;
+};
+// a compiled query: its table and its conditions
+// each request builds its own, on its stack, so concurrent queries do not
+// share any state
+struct query_context {
+	struct data_table* table;
+	int condition_count;
+	struct query_condition conditions[MAX_COLUMNS_PER_TABLE];
 };
-// array of query conditions
-struct query_condition* query_conditions[MAX_COLUMNS_PER_TABLE];
-// number of valid conditions
-int condition_count;
 
 
-// delete previously set query parameters
-void flush_query_params();
+// start a query on a table, with no conditions
+void init_query(struct query_context* ctx, struct data_table* table);
 
-// program query parameters
+// add a condition to a query
 // return 0 if parameters are acceptable, else return -1
-int set_query_params(struct data_table* table,
+int set_query_params(struct query_context* ctx,
 		char col_n[MAX_COLNAME_LEN],
 		char operand_t[MAX_VALUE_LEN],
 		char comp_v[MAX_VALUE_LEN]);
 
 // query the table, fill keys array with keys that meet query conditions
+// in a snapshot of the table taken when the query starts
 // should only be used after set_query_params is called
-void query(struct data_table* table, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN], int max_keys, int* keys_acquired);
+void query(struct query_context* ctx, char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN], int max_keys, int* keys_acquired);
+
+// pick the condition whose column has an ordered index or a value index,
+// EQUAL on a value index first, then EQUAL
+// return its index in the query's conditions, or -1 if no condition is indexed
+int pick_indexed_condition(struct query_context* ctx);
+
+// pick the equality condition whose column has a bitmap index and whose
+// value has the fewest slots
+// return its index in the query's conditions, or -1 if there is none or
+// its value has so many slots that a scan is faster
+int pick_bitmap_condition(struct query_context* ctx);
 
-// check if an entry matches the query
+// check if a version of a row matches the query
 // return 0 if matches, else return -1
-int check_query_match(struct data_table* table, struct data_entry* entry);
+int check_query_match(struct query_context* ctx, struct row_version* version);
 
-// check if an entry matches a query condition
+// check if a version of a row matches a query condition
 // return 0 if matches, else return -1
 int check_condition_match(struct data_table* table,
-		struct data_entry* entry,
+		struct row_version* version,
 		struct query_condition* con);
 
 
@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @brief This file implements the dictionary declared in dictionary.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dictionary.h"
+
+int dictionary_init(struct dictionary* dict, int size) {
+	memset(dict,0,sizeof(struct dictionary));
+	dict->size = size;
+	return pthread_mutex_init(&dict->lock,0) == 0 ? 0 : -1;
+}
+
+// FNV-1a of the bytes of a string up to its terminator or size bytes
+static unsigned int hash_value(struct dictionary* dict, const char* value) {
+	unsigned int hash = 2166136261u;
+	int k;
+	for (k=0; k<dict->size && value[k] != '\0'; k++) {
+		hash ^= (unsigned char)value[k];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+const char* dictionary_string(struct dictionary* dict, unsigned int code) {
+	return dict->blocks[code / DICTIONARY_BLOCK_CODES]
+			+ (size_t)(code % DICTIONARY_BLOCK_CODES) * (dict->size + 1);
+}
+
+// the slot of a string, or the empty one it would take
+// the table is never more than half full, so a probe ends
+static unsigned int probe(struct dictionary* dict, const char* value) {
+	unsigned int k = hash_value(dict,value) % DICTIONARY_SLOTS;
+	while (1) {
+		unsigned int code = dict->slots[k];
+		if (code == 0 || strncmp(dictionary_string(dict,code - 1),value,
+				dict->size) == 0) {
+			return k;
+		}
+		k = (k + 1) % DICTIONARY_SLOTS;
+	}
+}
+
+unsigned int dictionary_find(struct dictionary* dict, const char* value) {
+	unsigned int code = dict->slots[probe(dict,value)];
+	return code != 0 ? code - 1 : DICTIONARY_ABSENT;
+}
+
+unsigned int dictionary_add(struct dictionary* dict, const char* value) {
+	unsigned int code = dictionary_find(dict,value);
+	if (code != DICTIONARY_ABSENT) {
+		return code;
+	}
+	pthread_mutex_lock(&dict->lock);
+	// added meanwhile?
+	unsigned int k = probe(dict,value);
+	if (dict->slots[k] != 0) {
+		pthread_mutex_unlock(&dict->lock);
+		return dict->slots[k] - 1;
+	}
+	code = dict->count;
+	if (code == DICTIONARY_MAX_CODES) {
+		pthread_mutex_unlock(&dict->lock);
+		return DICTIONARY_NO_CODE;
+	}
+	if (dict->blocks[code / DICTIONARY_BLOCK_CODES] == 0) {
+		char* block = (char*)malloc((size_t)(dict->size + 1)
+				* DICTIONARY_BLOCK_CODES);
+		if (block == 0) {
+			pthread_mutex_unlock(&dict->lock);
+			return DICTIONARY_NO_CODE;
+		}
+		dict->blocks[code / DICTIONARY_BLOCK_CODES] = block;
+	}
+	char* string = (char*)dictionary_string(dict,code);
+	strncpy(string,value,dict->size);
+	string[dict->size] = '\0';
+	// the string before its code, see dictionary.h
+	__sync_synchronize();
+	dict->slots[k] = code + 1;
+	dict->count = code + 1;
+	pthread_mutex_unlock(&dict->lock);
+	return code;
+}
+
+size_t dictionary_memory(struct dictionary* dict) {
+	size_t blocks = (dict->count + DICTIONARY_BLOCK_CODES - 1)
+			/ DICTIONARY_BLOCK_CODES;
+	return sizeof(struct dictionary)
+			+ blocks * (size_t)(dict->size + 1) * DICTIONARY_BLOCK_CODES;
+}
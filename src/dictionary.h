@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @brief This file declares the dictionary of a char column: the distinct
+ * strings of the column, each with a small integer code.
+ *
+ * A string keeps its code for as long as the dictionary lives: codes are
+ * given in order and never reused, so a code found once can be compared
+ * with the codes of rows written any time after. The strings are kept in
+ * blocks that are allocated as the dictionary grows and never move, and
+ * found through an open-addressing table of codes.
+ *
+ * Lookups take no lock: a string is written before its code is published
+ * in the table. Strings are added under the dictionary's mutex.
+ */
+
+#ifndef DICTIONARY_H_
+#define DICTIONARY_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Largest number of strings of a dictionary
+ */
+#define DICTIONARY_MAX_CODES 65536
+
+/**
+ * Strings of a block
+ */
+#define DICTIONARY_BLOCK_CODES 1024
+
+/**
+ * Slots of the table of codes, twice the codes so probes stay short
+ */
+#define DICTIONARY_SLOTS (2 * DICTIONARY_MAX_CODES)
+
+/**
+ * Code of the strings added once the dictionary is full
+ */
+#define DICTIONARY_NO_CODE (~0U)
+
+/**
+ * What a lookup returns for a string that has no code
+ */
+#define DICTIONARY_ABSENT (~0U - 1)
+
+/**
+ * A dictionary
+ */
+struct dictionary {
+	// the strings are compared as strncmp does on size bytes
+	int size;
+	volatile unsigned int count;
+	// code + 1 of the string hashed to each slot, 0 if empty
+	volatile unsigned int slots[DICTIONARY_SLOTS];
+	// size + 1 bytes a string, null-terminated
+	char* volatile blocks[DICTIONARY_MAX_CODES / DICTIONARY_BLOCK_CODES];
+	pthread_mutex_t lock;
+};
+
+/**
+ * Check if a dictionary has no room left
+ */
+#define dictionary_full(dict) ((dict)->count == DICTIONARY_MAX_CODES)
+
+/**
+ * Initialize an empty dictionary of strings of up to size bytes
+ * Return -1 if failed, 0 if successful
+ */
+int dictionary_init(struct dictionary* dict, int size);
+
+/**
+ * Get the code of a string of up to size bytes, null-terminated if shorter
+ * Return DICTIONARY_ABSENT if it has none
+ */
+unsigned int dictionary_find(struct dictionary* dict, const char* value);
+
+/**
+ * Get the code of a string, adding it if it has none
+ * Return DICTIONARY_NO_CODE if the dictionary is full
+ */
+unsigned int dictionary_add(struct dictionary* dict, const char* value);
+
+/**
+ * Get the string of a code
+ */
+const char* dictionary_string(struct dictionary* dict, unsigned int code);
+
+/**
+ * Get the number of bytes allocated by a dictionary
+ */
+size_t dictionary_memory(struct dictionary* dict);
+
+#endif /* DICTIONARY_H_ */
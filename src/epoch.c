@@ -0,0 +1,182 @@
+/**
+ * @file
+ * @brief This file implements the epoch-based reclamation declared in
+ * epoch.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "epoch.h"
+
+/**
+ * An object waiting for the readers of its epoch to leave. A thread's
+ * objects are retired in epoch order, so the ones ready to be freed are
+ * always the oldest.
+ */
+struct epoch_garbage {
+	void* ptr;
+	struct slab_allocator* slab;
+	size_t size;
+	unsigned long epoch;
+};
+
+/**
+ * A thread's state. Records are never freed: the record of a thread that
+ * exited is taken over, with its retired objects, by the next new thread.
+ * Each record has cache lines of its own, so entering and leaving a
+ * critical section writes nothing other threads read often.
+ */
+struct epoch_thread {
+	// epoch the thread entered its critical section in, 0 outside of one
+	volatile unsigned long epoch;
+	int depth;
+	volatile int in_use;
+	// garbage[head] to garbage[count-1] wait to be freed
+	struct epoch_garbage* garbage;
+	size_t head;
+	size_t count;
+	size_t capacity;
+	unsigned long retired;
+	struct epoch_thread* next;
+} __attribute__((aligned(64)));
+
+// 0 marks a thread outside of a critical section, so epochs start at 1
+static volatile unsigned long global_epoch = 1;
+static struct epoch_thread* volatile threads = 0;
+
+static __thread struct epoch_thread* self = 0;
+static pthread_key_t self_key;
+static pthread_once_t self_key_once = PTHREAD_ONCE_INIT;
+
+// give the record back when its thread exits
+static void thread_exit(void* arg) {
+	struct epoch_thread* t = (struct epoch_thread*)arg;
+	t->epoch = 0;
+	t->depth = 0;
+	__sync_synchronize();
+	t->in_use = 0;
+}
+
+static void self_key_create() {
+	pthread_key_create(&self_key,thread_exit);
+}
+
+// the calling thread's record, taken over or created on first use
+static struct epoch_thread* get_self() {
+	if (self != 0) {
+		return self;
+	}
+	pthread_once(&self_key_once,self_key_create);
+	struct epoch_thread* t;
+	for (t=threads; t!=0; t=t->next) {
+		if (t->in_use == 0 && __sync_bool_compare_and_swap(&t->in_use,0,1)) {
+			break;
+		}
+	}
+	if (t == 0) {
+		if (posix_memalign((void**)&t,__alignof__(struct epoch_thread),
+				sizeof(struct epoch_thread)) != 0) {
+			// a reader cannot run without a record
+			abort();
+		}
+		memset(t,0,sizeof(struct epoch_thread));
+		t->in_use = 1;
+		do {
+			t->next = threads;
+		} while (!__sync_bool_compare_and_swap(&threads,t->next,t));
+	}
+	pthread_setspecific(self_key,t);
+	self = t;
+	return t;
+}
+
+void epoch_enter() {
+	struct epoch_thread* t = get_self();
+	if (t->depth++ == 0) {
+		t->epoch = global_epoch;
+		// published before any shared pointer is read
+		__sync_synchronize();
+	}
+}
+
+void epoch_exit() {
+	struct epoch_thread* t = self;
+	if (--t->depth == 0) {
+		__sync_synchronize();
+		t->epoch = 0;
+	}
+}
+
+// advance the global epoch if every thread in a critical section saw it
+static void try_advance() {
+	unsigned long epoch = global_epoch;
+	__sync_synchronize();
+	struct epoch_thread* t;
+	for (t=threads; t!=0; t=t->next) {
+		unsigned long seen = t->epoch;
+		if (seen != 0 && seen != epoch) {
+			return;
+		}
+	}
+	__sync_bool_compare_and_swap(&global_epoch,epoch,epoch+1);
+}
+
+// free up to max of a thread's oldest objects that no reader can hold
+static void free_ready(struct epoch_thread* t, size_t max) {
+	unsigned long epoch = global_epoch;
+	while (max-- > 0 && t->head < t->count
+			&& t->garbage[t->head].epoch + 2 <= epoch) {
+		struct epoch_garbage* g = &t->garbage[t->head++];
+		if (g->slab != 0) {
+			slab_free(g->slab,g->ptr,g->size);
+		} else {
+			free(g->ptr);
+		}
+	}
+	if (t->head == t->count) {
+		t->head = 0;
+		t->count = 0;
+	}
+}
+
+size_t epoch_reclaim() {
+	struct epoch_thread* t = get_self();
+	try_advance();
+	free_ready(t,t->count);
+	return t->count - t->head;
+}
+
+void epoch_retire(struct slab_allocator* slab, void* ptr, size_t size) {
+	struct epoch_thread* t = get_self();
+	if (t->count == t->capacity && t->head > 0) {
+		// reuse the room of the objects freed already
+		memmove(t->garbage,&t->garbage[t->head],
+				(t->count - t->head) * sizeof(struct epoch_garbage));
+		t->count -= t->head;
+		t->head = 0;
+	}
+	if (t->count == t->capacity) {
+		size_t capacity = t->capacity == 0 ? EPOCH_RECLAIM_BATCH : 2 * t->capacity;
+		struct epoch_garbage* garbage = (struct epoch_garbage*)realloc(
+				t->garbage,capacity * sizeof(struct epoch_garbage));
+		if (garbage == 0) {
+			// leak the object rather than free it under a reader
+			return;
+		}
+		t->garbage = garbage;
+		t->capacity = capacity;
+	}
+	// the object was unlinked before the epoch is read
+	__sync_synchronize();
+	struct epoch_garbage* g = &t->garbage[t->count++];
+	g->ptr = ptr;
+	g->slab = slab;
+	g->size = size;
+	g->epoch = global_epoch;
+	if (++t->retired % EPOCH_RECLAIM_BATCH == 0) {
+		try_advance();
+	}
+	// free as many as are retired, so no single call pays for a batch
+	free_ready(t,2);
+}
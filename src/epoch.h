@@ -0,0 +1,50 @@
+/**
+ * @file
+ * @brief This file declares epoch-based reclamation of memory that
+ * readers may still be reading without holding any lock.
+ *
+ * A reader calls epoch_enter() before following pointers to shared
+ * objects, and epoch_exit() once it is done with them. A writer unlinks an
+ * object so no new reader can reach it, then retires it with
+ * epoch_retire() instead of freeing it. The global epoch only advances
+ * once every thread between epoch_enter() and epoch_exit() has seen the
+ * current one, so an object retired in epoch e is freed once the global
+ * epoch reaches e + 2: every reader that could still reach it has left.
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <stddef.h>
+#include "slab.h"
+
+/**
+ * Objects a thread retires between two attempts to advance the epoch
+ */
+#define EPOCH_RECLAIM_BATCH 64
+
+/**
+ * Enter a read-side critical section, may be nested
+ */
+void epoch_enter();
+
+/**
+ * Leave a read-side critical section
+ */
+void epoch_exit();
+
+/**
+ * Free an object of size bytes allocated from slab (0 for malloc) once no
+ * reader can hold a pointer to it any more. The object must already be
+ * unreachable for new readers.
+ */
+void epoch_retire(struct slab_allocator* slab, void* ptr, size_t size);
+
+/**
+ * Try to advance the global epoch and free the calling thread's retired
+ * objects that no reader can hold any more
+ * Return the number of objects of the calling thread still waiting
+ */
+size_t epoch_reclaim();
+
+#endif /* EPOCH_H_ */
@@ -0,0 +1,352 @@
+/**
+ * @file
+ * @brief This file implements the epoll event loop declared in
+ * event_loop.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "utils.h"
+#include "protocol.h"
+#include "work_queue.h"
+#include "event_loop.h"
+
+/**
+ * A client connection with its read and write buffers
+ */
+struct connection {
+	int sock;
+	struct sockaddr_in addr;
+	// protocol spoken by the client, known once it sent its first byte
+	int protocol;
+	// bytes received but not handled yet
+	struct line_reader reader;
+	// responses not sent yet are out[out_sent..out_len)
+	char* out;
+	size_t out_len;
+	size_t out_sent;
+	size_t out_cap;
+};
+
+// protocols a client can speak, PROTOCOL_HELLO until the binary
+// protocol greeting is answered
+enum {PROTOCOL_UNKNOWN, PROTOCOL_TEXT, PROTOCOL_HELLO, PROTOCOL_BINARY};
+
+static int epfd;
+// a descriptor kept open to be given up when out of descriptors
+static int spare_fd;
+static command_handler handle;
+static frame_handler handle_frame;
+
+// ready connections waiting for a worker, the loop thread stops
+// waiting for events while it is full
+static struct work_queue ready;
+
+static int set_nonblocking(int sock) {
+	int flags = fcntl(sock,F_GETFL,0);
+	if (flags < 0) {
+		return -1;
+	}
+	return fcntl(sock,F_SETFL,flags | O_NONBLOCK);
+}
+
+// wait for the next event of a connection, one-shot so that a single
+// worker owns the connection until it re-arms it
+static int rearm(struct connection* conn, unsigned int events) {
+	struct epoll_event ev;
+	ev.events = events | EPOLLET | EPOLLONESHOT;
+	ev.data.ptr = conn;
+	return epoll_ctl(epfd,EPOLL_CTL_MOD,conn->sock,&ev);
+}
+
+static void close_connection(struct connection* conn) {
+	char msg[MAX_MESSAGE_LEN], host[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET,&conn->addr.sin_addr,host,sizeof host);
+	sprintf(msg,"Closed connection from %s:%d.\n",host,conn->addr.sin_port);
+	logger(server_log,msg);
+	// closing the socket also removes it from the epoll set
+	close(conn->sock);
+	free(conn->out);
+	free(conn);
+}
+
+// make room for len more bytes in the write buffer
+static int reserve_output(struct connection* conn, size_t len) {
+	if (conn->out_len + len > conn->out_cap) {
+		size_t cap = conn->out_cap == 0 ? MAX_CMD_LEN : conn->out_cap;
+		while (conn->out_len + len > cap) {
+			cap *= 2;
+		}
+		char* out = (char*)realloc(conn->out,cap);
+		if (out == 0) {
+			return -1;
+		}
+		conn->out = out;
+		conn->out_cap = cap;
+	}
+	return 0;
+}
+
+// append a response to the write buffer
+static int append_output(struct connection* conn, const char* data, size_t len) {
+	if (reserve_output(conn,len) != 0) {
+		return -1;
+	}
+	memcpy(conn->out + conn->out_len,data,len);
+	conn->out_len += len;
+	return 0;
+}
+
+// send as much of the write buffer as the socket takes
+// return -1 if the connection failed, 0 otherwise
+static int flush_output(struct connection* conn) {
+	while (conn->out_sent < conn->out_len) {
+		ssize_t bytes = send(conn->sock,conn->out + conn->out_sent,
+				conn->out_len - conn->out_sent,MSG_NOSIGNAL);
+		if (bytes > 0) {
+			conn->out_sent += bytes;
+		} else if (bytes < 0 && errno == EINTR) {
+			continue;
+		} else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return 0;
+		} else {
+			return -1;
+		}
+	}
+	conn->out_len = 0;
+	conn->out_sent = 0;
+	return 0;
+}
+
+// handle every complete line of the read buffer
+// return -1 if the connection has to be closed, 0 otherwise
+static int handle_lines(struct connection* conn) {
+	char* line;
+	while (line_reader_next(&conn->reader,&line) >= 0) {
+		// the response goes straight to the write buffer
+		if (reserve_output(conn,MAX_CMD_LEN) != 0) {
+			return -1;
+		}
+		char* response = conn->out + conn->out_len;
+		handle(line,response);
+		size_t len = strlen(response);
+		response[len] = '\n';
+		conn->out_len += len + 1;
+	}
+	return 0;
+}
+
+// answer the greeting of a binary protocol client, then handle every
+// complete frame of the read buffer
+// return -1 if the connection has to be closed, 0 otherwise
+static int handle_frames(struct connection* conn) {
+	if (conn->protocol == PROTOCOL_HELLO) {
+		int version = protocol_take_hello(&conn->reader);
+		if (version <= 0) {
+			return version;
+		}
+		char hello[2] = {(char)PROTOCOL_MAGIC,PROTOCOL_VERSION};
+		if (version != PROTOCOL_VERSION) {
+			// tell the client which version is spoken here, then give up
+			send(conn->sock,hello,sizeof hello,MSG_NOSIGNAL);
+			return -1;
+		}
+		if (append_output(conn,hello,sizeof hello) != 0) {
+			return -1;
+		}
+		conn->protocol = PROTOCOL_BINARY;
+	}
+	char* frame;
+	ssize_t len;
+	while ((len = protocol_next_frame(&conn->reader,&frame)) > 0) {
+		if (reserve_output(conn,MAX_RESPONSE_FRAME_LEN) != 0) {
+			return -1;
+		}
+		conn->out_len += handle_frame(frame,len,conn->out + conn->out_len);
+	}
+	if (len < 0) {
+		logger(server_log,"Error: invalid frame\n");
+		return -1;
+	}
+	return 0;
+}
+
+// handle what the client sent, in the protocol of its first byte
+// return -1 if the connection has to be closed, 0 otherwise
+static int handle_input(struct connection* conn) {
+	if (conn->protocol == PROTOCOL_UNKNOWN) {
+		unsigned char first = conn->reader.buf[conn->reader.start];
+		conn->protocol = first == PROTOCOL_MAGIC ? PROTOCOL_HELLO : PROTOCOL_TEXT;
+	}
+	if (conn->protocol == PROTOCOL_TEXT) {
+		return handle_lines(conn);
+	}
+	return handle_frames(conn);
+}
+
+// serve a ready connection until its socket would block
+// return -1 if the connection has to be closed, 0 otherwise
+static int serve_connection(struct connection* conn) {
+	while (1) {
+		if (flush_output(conn) != 0) {
+			return -1;
+		}
+		if (conn->out_len != 0) {
+			// stop reading until the client takes its responses
+			return rearm(conn,EPOLLOUT);
+		}
+		ssize_t bytes = line_reader_fill(&conn->reader);
+		if (bytes > 0) {
+			if (handle_input(conn) != 0) {
+				return -1;
+			}
+		} else if (bytes == 0) {
+			// the client closed the connection
+			return -1;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return rearm(conn,EPOLLIN);
+		} else {
+			if (errno == EMSGSIZE) {
+				logger(server_log,"Error: command line too long\n");
+			}
+			return -1;
+		}
+	}
+}
+
+static void* worker_main(void* arg) {
+	while (1) {
+		struct connection* conn = (struct connection*)work_queue_pop(&ready);
+		if (serve_connection(conn) != 0) {
+			close_connection(conn);
+		}
+	}
+	return 0;
+}
+
+// accept every pending connection of the listening socket
+static void accept_connections(int listensock) {
+	while (1) {
+		struct sockaddr_in clientaddr;
+		socklen_t clientaddrlen = sizeof clientaddr;
+		int sock = accept(listensock,(struct sockaddr*)&clientaddr,&clientaddrlen);
+		if (sock < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// the backlog is empty
+				return;
+			}
+			char msg[MAX_MESSAGE_LEN];
+			snprintf(msg,sizeof msg,"Error accepting a connection: %s\n",
+					strerror(errno));
+			logger(server_log,msg);
+			if ((errno == EMFILE || errno == ENFILE) && spare_fd >= 0) {
+				// turn the client away rather than leave it in the
+				// backlog, using the spare descriptor to accept it
+				close(spare_fd);
+				sock = accept(listensock,0,0);
+				if (sock >= 0) {
+					close(sock);
+				}
+				spare_fd = open("/dev/null",O_RDONLY);
+				// accept() runs out of descriptors even with an empty
+				// backlog, the spare one tells when it is empty
+				if (sock >= 0) {
+					continue;
+				}
+				return;
+			}
+			// the listening socket is level-triggered, so the rest of
+			// the backlog is tried again on the next wait
+			return;
+		}
+		struct connection* conn =
+				(struct connection*)malloc(sizeof(struct connection));
+		if (conn == 0 || set_nonblocking(sock) != 0) {
+			free(conn);
+			close(sock);
+			continue;
+		}
+		// responses are already batched per read
+		int nodelay = 1;
+		setsockopt(sock,IPPROTO_TCP,TCP_NODELAY,&nodelay,sizeof nodelay);
+		conn->sock = sock;
+		conn->addr = clientaddr;
+		conn->protocol = PROTOCOL_UNKNOWN;
+		line_reader_init(&conn->reader,sock);
+		conn->out = 0;
+		conn->out_len = 0;
+		conn->out_sent = 0;
+		conn->out_cap = 0;
+		struct epoll_event ev;
+		ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+		ev.data.ptr = conn;
+		if (epoll_ctl(epfd,EPOLL_CTL_ADD,sock,&ev) != 0) {
+			free(conn);
+			close(sock);
+			continue;
+		}
+		char msg[MAX_MESSAGE_LEN], host[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET,&clientaddr.sin_addr,host,sizeof host);
+		sprintf(msg,"Got a connection from %s:%d.\n",host,clientaddr.sin_port);
+		logger(server_log,msg);
+	}
+}
+
+int event_loop_run(int listensock, int workers, command_handler handler,
+		frame_handler frames) {
+	handle = handler;
+	handle_frame = frames;
+	epfd = epoll_create1(0);
+	if (epfd < 0 || set_nonblocking(listensock) != 0
+			|| work_queue_init(&ready,EVENT_LOOP_QUEUE_LEN) != 0) {
+		return -1;
+	}
+	spare_fd = open("/dev/null",O_RDONLY);
+	// the listening socket stays armed and level-triggered, so a backlog
+	// left by a failed accept is reported again, its data pointer is 0
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = 0;
+	if (epoll_ctl(epfd,EPOLL_CTL_ADD,listensock,&ev) != 0) {
+		return -1;
+	}
+	int k;
+	for (k=0; k<workers; k++) {
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,worker_main,NULL) != 0) {
+			return -1;
+		}
+		pthread_detach(thread);
+	}
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	while (1) {
+		int count = epoll_wait(epfd,events,EVENT_LOOP_MAX_EVENTS,-1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		for (k=0; k<count; k++) {
+			if (events[k].data.ptr == 0) {
+				accept_connections(listensock);
+			} else {
+				// errors and hang-ups show up when the worker reads
+				work_queue_push(&ready,events[k].data.ptr);
+			}
+		}
+	}
+	return -1;
+}
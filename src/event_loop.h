@@ -0,0 +1,51 @@
+/**
+ * @file
+ * @brief This file declares an edge-triggered epoll event loop that serves
+ * clients with a fixed number of worker threads.
+ *
+ * The loop thread accepts connections and waits for their sockets to
+ * become ready. Sockets are non-blocking and armed one-shot, so a ready
+ * connection is handed to one worker at a time: the worker reads all
+ * that is available into the connection's read buffer, handles every
+ * complete line or frame, writes the responses from the connection's write buffer
+ * and re-arms the socket. Commands of a connection are therefore answered
+ * in order, while different connections are served in parallel.
+ */
+
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <stddef.h>
+
+/**
+ * Max events fetched from epoll at once
+ */
+#define EVENT_LOOP_MAX_EVENTS 64
+
+/**
+ * Max ready connections waiting for a worker
+ */
+#define EVENT_LOOP_QUEUE_LEN 1024
+
+/**
+ * Handle a command line: cmd is the line without its newline, which the
+ * handler may modify, and the response is written to a buffer of
+ * MAX_CMD_LEN bytes
+ */
+typedef void (*command_handler)(char* cmd, char* response);
+
+/**
+ * Handle a binary protocol frame (see protocol.h): write the response
+ * frame to a buffer of MAX_RESPONSE_FRAME_LEN bytes and return its length
+ */
+typedef size_t (*frame_handler)(char* frame, size_t len, char* response);
+
+/**
+ * Serve the clients of a listening socket with given number of workers,
+ * text protocol clients with handler and binary ones with frames
+ * Only returns if the loop could not be set up, with -1
+ */
+int event_loop_run(int listensock, int workers, command_handler handler,
+		frame_handler frames);
+
+#endif /* EVENT_LOOP_H_ */
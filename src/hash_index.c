@@ -0,0 +1,214 @@
+/**
+ * @file
+ * @brief This file implements the split-ordered hash index declared in
+ * hash_index.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hash_index.h"
+
+unsigned int hash_string(const char* key) {
+	unsigned int hash = 2166136261u;
+	while (*key != '\0') {
+		hash ^= (unsigned char)*key;
+		hash *= 16777619u;
+		key++;
+	}
+	return hash;
+}
+
+static unsigned int reverse_bits(unsigned int x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	return __builtin_bswap32(x);
+}
+
+// the nodes of a bucket follow its link in the list: the low bits of
+// their hash are the bucket, reversed they are the high bits of the order,
+// and a bucket's order is even while a node's is odd
+static unsigned long node_order(unsigned int hash) {
+	return ((unsigned long)reverse_bits(hash) << 1) | 1;
+}
+
+static unsigned long bucket_order(unsigned long bucket) {
+	return (unsigned long)reverse_bits((unsigned int)bucket) << 1;
+}
+
+// the index of the highest bit set in bucket, which is not 0
+static int high_bit(unsigned long bucket) {
+	return 63 - __builtin_clzl(bucket);
+}
+
+// the bucket a bucket was split from when the index grew
+static unsigned long parent_bucket(unsigned long bucket) {
+	return bucket & ~(1UL << high_bit(bucket));
+}
+
+static struct hash_link* bucket_link(struct hash_index* index,
+		unsigned long bucket) {
+	if (bucket < HASH_INDEX_INITIAL_SIZE) {
+		return &index->segments[0][bucket];
+	}
+	int bit = high_bit(bucket);
+	int segment = bit - __builtin_ctzl(HASH_INDEX_INITIAL_SIZE) + 1;
+	return &index->segments[segment][bucket - (1UL << bit)];
+}
+
+// bucket 0 is the head, the order of any other bucket is only set once it
+// is in the list
+static int bucket_ready(struct hash_link* link, unsigned long bucket) {
+	return bucket == 0 || *(volatile unsigned long*)&link->order != 0;
+}
+
+// link a link of given order into the list after start
+static void list_insert(struct hash_link* start, struct hash_link* link,
+		unsigned long order) {
+	struct hash_link* pred;
+	struct hash_link* next;
+	do {
+		pred = start;
+		next = pred->next;
+		while (next != 0 && next->order < order) {
+			pred = next;
+			next = pred->next;
+		}
+		// complete before a reader can reach it
+		link->next = next;
+	} while (!__sync_bool_compare_and_swap(&pred->next,next,link));
+}
+
+// the link of a bucket, put into the list on first use
+static struct hash_link* init_bucket(struct hash_index* index,
+		unsigned long bucket) {
+	struct hash_link* link = bucket_link(index,bucket);
+	if (bucket_ready(link,bucket)) {
+		return link;
+	}
+	struct hash_link* start = init_bucket(index,parent_bucket(bucket));
+	list_insert(start,link,bucket_order(bucket));
+	// readers may start from it now, the CAS above ordered the writes; a
+	// reader passing it before sees order 0 and walks on
+	link->order = bucket_order(bucket);
+	return link;
+}
+
+// the link of the closest bucket in the list on the way to hash's,
+// without writing anything
+static struct hash_link* find_start(struct hash_index* index,
+		unsigned int hash) {
+	unsigned long bucket = hash & (index->size - 1);
+	struct hash_link* link;
+	while (!bucket_ready(link = bucket_link(index,bucket),bucket)) {
+		bucket = parent_bucket(bucket);
+	}
+	return link;
+}
+
+// double the number of buckets, the new ones are linked in later
+static void grow(struct hash_index* index) {
+	unsigned long size = index->size;
+	int segment = high_bit(size) - __builtin_ctzl(HASH_INDEX_INITIAL_SIZE) + 1;
+	if (segment >= HASH_INDEX_MAX_SEGMENTS) {
+		return;
+	}
+	if (index->segments[segment] == 0) {
+		struct hash_link* buckets = (struct hash_link*)
+				calloc(size,sizeof(struct hash_link));
+		if (buckets == 0) {
+			// keep the current size, buckets just get longer
+			return;
+		}
+		index->segments[segment] = buckets;
+	}
+	// the segment is there before a reader can pick one of its buckets
+	__sync_synchronize();
+	index->size = size * 2;
+}
+
+int hash_index_init(struct hash_index* index) {
+	memset(index,0,sizeof(struct hash_index));
+	index->segments[0] = (struct hash_link*)
+			calloc(HASH_INDEX_INITIAL_SIZE,sizeof(struct hash_link));
+	if (index->segments[0] == 0) {
+		return -1;
+	}
+	index->size = HASH_INDEX_INITIAL_SIZE;
+	index->next_init = 1;
+	return 0;
+}
+
+void hash_index_destroy(struct hash_index* index) {
+	int k;
+	for (k=0; k<HASH_INDEX_MAX_SEGMENTS; k++) {
+		free(index->segments[k]);
+		index->segments[k] = 0;
+	}
+}
+
+unsigned long hash_index_count(struct hash_index* index) {
+	return index->used;
+}
+
+size_t hash_index_memory(struct hash_index* index) {
+	return index->size * sizeof(struct hash_link);
+}
+
+struct hash_node* hash_index_find(struct hash_index* index, const char* key,
+		unsigned int hash) {
+	unsigned long order = node_order(hash);
+	struct hash_link* link = find_start(index,hash)->next;
+	while (link != 0 && link->order <= order) {
+		if (link->order == order) {
+			struct hash_node* node = hash_entry(link,struct hash_node,link);
+			if (strcmp(node->key,key) == 0) {
+				return node;
+			}
+		}
+		link = link->next;
+	}
+	return 0;
+}
+
+void hash_index_insert(struct hash_index* index, struct hash_node* node) {
+	if (index->used >= index->size) {
+		// load factor reached
+		grow(index);
+	}
+	node->link.order = node_order(node->hash);
+	list_insert(init_bucket(index,node->hash & (index->size - 1)),
+			&node->link,node->link.order);
+	index->used++;
+	// link the buckets in order too, so lookups seldom start from a
+	// parent: all of them are in the list before the index doubles again
+	int k;
+	for (k=0; k<HASH_INDEX_INIT_STEP && index->next_init<index->size; k++) {
+		init_bucket(index,index->next_init++);
+	}
+}
+
+struct hash_node* hash_index_remove(struct hash_index* index, const char* key,
+		unsigned int hash) {
+	unsigned long order = node_order(hash);
+	struct hash_link* start = init_bucket(index,hash & (index->size - 1));
+	struct hash_link* pred = start;
+	struct hash_link* link = pred->next;
+	while (link != 0 && link->order <= order) {
+		struct hash_node* node = hash_entry(link,struct hash_node,link);
+		if (link->order != order || strcmp(node->key,key) != 0) {
+			pred = link;
+			link = link->next;
+			continue;
+		}
+		// link->next stays for the readers standing on node
+		if (__sync_bool_compare_and_swap(&pred->next,link,link->next)) {
+			index->used--;
+			return node;
+		}
+		// the list changed under us, look again
+		pred = start;
+		link = pred->next;
+	}
+	return 0;
+}
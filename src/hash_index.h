@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief This file declares a split-ordered hash index keyed by strings.
+ *
+ * The index is intrusive: callers embed a struct hash_node in their own
+ * records and the index only links those nodes together. All nodes form
+ * a single list sorted by their bit-reversed hash, and every bucket holds
+ * a link of that list where the bucket's nodes start.
+ * Growing the index doubles the number of buckets, and the new buckets
+ * are linked in a few per insert, so nodes never move and no single
+ * operation pays for a rehash. Buckets live in segments that are never
+ * reallocated.
+ *
+ * Lookups take no lock and write no shared memory: a reader only follows
+ * next pointers. Writers must be serialized by the caller, and each of
+ * their changes reaches readers through a single compare-and-swap on a
+ * next pointer. A removed node keeps its next pointer, so a reader
+ * standing on it finds its way back into the list; the caller must not
+ * free or reuse it before such readers are gone.
+ */
+
+#ifndef HASH_INDEX_H_
+#define HASH_INDEX_H_
+
+#include <stddef.h>
+
+/**
+ * Initial number of buckets of an index (must be a power of two)
+ */
+#define HASH_INDEX_INITIAL_SIZE 16
+
+/**
+ * Number of buckets linked into the list ahead of use per insert
+ */
+#define HASH_INDEX_INIT_STEP 2
+
+/**
+ * Number of bucket segments, the index grows up to
+ * HASH_INDEX_INITIAL_SIZE << (HASH_INDEX_MAX_SEGMENTS - 1) buckets
+ */
+#define HASH_INDEX_MAX_SEGMENTS 28
+
+/**
+ * Get the struct that embeds a hash_node
+ */
+#define hash_entry(node, type, member) \
+	((type*)((char*)(node) - offsetof(type, member)))
+
+/**
+ * A link of the list, in a node or a bucket
+ */
+struct hash_link {
+	struct hash_link* volatile next;
+	// position in the list: the bit-reversed hash, even for buckets and
+	// odd for nodes
+	unsigned long order;
+};
+
+/**
+ * A node of the list, embedded in the indexed record
+ */
+struct hash_node {
+	struct hash_link link;
+	unsigned int hash;
+	const char* key;
+};
+
+/**
+ * A hash index. Segment 0 holds the first HASH_INDEX_INITIAL_SIZE buckets
+ * and segment s the next HASH_INDEX_INITIAL_SIZE << (s - 1). Bucket 0 is
+ * the head of the list, any other bucket is in the list once its order is
+ * set.
+ */
+struct hash_index {
+	struct hash_link* volatile segments[HASH_INDEX_MAX_SEGMENTS];
+	volatile unsigned long size;
+	unsigned long used;
+	// next bucket to link into the list ahead of use
+	unsigned long next_init;
+};
+
+/**
+ * Hash a string (FNV-1a)
+ */
+unsigned int hash_string(const char* key);
+
+/**
+ * Initialize an empty index
+ * Return -1 if failed, 0 if successful
+ */
+int hash_index_init(struct hash_index* index);
+
+/**
+ * Free the bucket segments of an index (the nodes are owned by the caller)
+ */
+void hash_index_destroy(struct hash_index* index);
+
+/**
+ * Number of nodes in an index
+ */
+unsigned long hash_index_count(struct hash_index* index);
+
+/**
+ * Bytes used by an index's bucket segments
+ */
+size_t hash_index_memory(struct hash_index* index);
+
+/**
+ * Find the node with given key, safe to call next to a writer
+ * Return a pointer if found, 0 if not found
+ */
+struct hash_node* hash_index_find(struct hash_index* index, const char* key,
+		unsigned int hash);
+
+/**
+ * Insert a node, its hash and key must already be set.
+ * The caller makes sure the key is not already in the index.
+ */
+void hash_index_insert(struct hash_index* index, struct hash_node* node);
+
+/**
+ * Unlink the node with given key
+ * Return the node if found, 0 if not found
+ */
+struct hash_node* hash_index_remove(struct hash_index* index, const char* key,
+		unsigned int hash);
+
+#endif /* HASH_INDEX_H_ */
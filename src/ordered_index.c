@@ -0,0 +1,155 @@
+/**
+ * @file
+ * @brief This file implements the ordered index declared in ordered_index.h.
+ */
+
+#include <stdlib.h>
+#include "ordered_index.h"
+#include "epoch.h"
+
+// allocate a node with given number of levels
+static struct ordered_node* node_alloc(struct ordered_index* index, int level,
+		long long value, void* item) {
+	struct ordered_node* node;
+	if (index->slab != 0) {
+		node = (struct ordered_node*)slab_alloc(index->slab,ordered_node_size(level));
+	} else {
+		node = (struct ordered_node*)malloc(ordered_node_size(level));
+	}
+	if (node == 0) {
+		return 0;
+	}
+	node->value = value;
+	node->item = item;
+	node->level = level;
+	int k;
+	for (k=0; k<level; k++) {
+		node->forward[k] = 0;
+	}
+	return node;
+}
+
+// free a node allocated with node_alloc
+static void node_free(struct ordered_index* index, struct ordered_node* node) {
+	if (index->slab != 0) {
+		slab_free(index->slab,node,ordered_node_size(node->level));
+	} else {
+		free(node);
+	}
+}
+
+// pick a level for a new node, each level is half as likely as the one below
+static int random_level(struct ordered_index* index) {
+	int level = 1;
+	while (level < ORDERED_INDEX_MAX_LEVEL && (rand_r(&index->seed) & 1)) {
+		level++;
+	}
+	return level;
+}
+
+// check if node comes before (value, item)
+static int node_before(struct ordered_node* node, long long value, void* item) {
+	return node->value < value
+			|| (node->value == value && (char*)node->item < (char*)item);
+}
+
+int ordered_index_init(struct ordered_index* index, struct slab_allocator* slab) {
+	index->slab = slab;
+	index->head = node_alloc(index,ORDERED_INDEX_MAX_LEVEL,0,0);
+	if (index->head == 0) {
+		return -1;
+	}
+	index->level = 1;
+	index->count = 0;
+	index->seed = 297;
+	return 0;
+}
+
+void ordered_index_destroy(struct ordered_index* index) {
+	struct ordered_node* node = index->head;
+	while (node != 0) {
+		struct ordered_node* next = node->forward[0];
+		node_free(index,node);
+		node = next;
+	}
+	index->head = 0;
+}
+
+int ordered_index_insert(struct ordered_index* index, long long value, void* item) {
+	struct ordered_node* update[ORDERED_INDEX_MAX_LEVEL];
+	struct ordered_node* cursor = index->head;
+	int k;
+	// find the predecessor at every level
+	for (k=index->level-1; k>=0; k--) {
+		while (cursor->forward[k] != 0
+				&& node_before(cursor->forward[k],value,item)) {
+			cursor = cursor->forward[k];
+		}
+		update[k] = cursor;
+	}
+	int level = random_level(index);
+	if (level > index->level) {
+		for (k=index->level; k<level; k++) {
+			update[k] = index->head;
+		}
+		index->level = level;
+	}
+	struct ordered_node* node = node_alloc(index,level,value,item);
+	if (node == 0) {
+		return -1;
+	}
+	for (k=0; k<level; k++) {
+		node->forward[k] = update[k]->forward[k];
+	}
+	// complete before readers can reach it
+	__sync_synchronize();
+	for (k=0; k<level; k++) {
+		update[k]->forward[k] = node;
+	}
+	index->count++;
+	return 0;
+}
+
+int ordered_index_remove(struct ordered_index* index, long long value, void* item) {
+	struct ordered_node* update[ORDERED_INDEX_MAX_LEVEL];
+	struct ordered_node* cursor = index->head;
+	int k;
+	for (k=index->level-1; k>=0; k--) {
+		while (cursor->forward[k] != 0
+				&& node_before(cursor->forward[k],value,item)) {
+			cursor = cursor->forward[k];
+		}
+		update[k] = cursor;
+	}
+	struct ordered_node* node = cursor->forward[0];
+	if (node == 0 || node->value != value || node->item != item) {
+		// not found
+		return -1;
+	}
+	for (k=0; k<node->level; k++) {
+		update[k]->forward[k] = node->forward[k];
+	}
+	while (index->level > 1 && index->head->forward[index->level-1] == 0) {
+		index->level--;
+	}
+	// readers may still be on the node, its forward pointers stay valid
+	epoch_retire(index->slab,node,ordered_node_size(node->level));
+	index->count--;
+	return 0;
+}
+
+struct ordered_node* ordered_index_lower_bound(struct ordered_index* index,
+		long long value) {
+	struct ordered_node* cursor = index->head;
+	int k;
+	for (k=index->level-1; k>=0; k--) {
+		while (cursor->forward[k] != 0 && cursor->forward[k]->value < value) {
+			cursor = cursor->forward[k];
+		}
+	}
+	return cursor->forward[0];
+}
+
+struct ordered_node* ordered_index_first(struct ordered_index* index) {
+	return index->head->forward[0];
+}
@@ -0,0 +1,95 @@
+/**
+ * @file
+ * @brief This file declares an ordered index (skiplist) mapping integer
+ * values to the records holding them.
+ *
+ * Several records may hold the same value, so nodes are ordered by value
+ * and then by record address, which makes every (value, record) pair
+ * unique and lets a record be removed without scanning its duplicates.
+ *
+ * Writers must be serialized by the caller. Readers may walk the index
+ * at the same time from inside an epoch (see epoch.h): a node is linked
+ * in only once it is complete, and removed nodes are retired, not freed.
+ */
+
+#ifndef ORDERED_INDEX_H_
+#define ORDERED_INDEX_H_
+
+#include "slab.h"
+
+/**
+ * Maximum number of levels of the skiplist
+ */
+#define ORDERED_INDEX_MAX_LEVEL 24
+
+/**
+ * A node of the skiplist, forward has one pointer per level of the node
+ */
+struct ordered_node {
+	long long value;
+	void* item;
+	int level;
+	struct ordered_node* forward[];
+};
+
+/**
+ * Number of bytes of a node with given number of levels
+ */
+#define ordered_node_size(level) \
+	(sizeof(struct ordered_node) + (level) * sizeof(struct ordered_node*))
+
+/**
+ * A skiplist with a sentinel head node
+ */
+struct ordered_index {
+	struct ordered_node* head;
+	int level;
+	unsigned long count;
+	unsigned int seed;
+	// allocator of the nodes, 0 to use malloc
+	struct slab_allocator* slab;
+};
+
+/**
+ * Initialize an empty index whose nodes are allocated from slab
+ * (0 to use malloc)
+ * Return -1 if failed, 0 if successful
+ */
+int ordered_index_init(struct ordered_index* index, struct slab_allocator* slab);
+
+/**
+ * Free all nodes of an index
+ */
+void ordered_index_destroy(struct ordered_index* index);
+
+/**
+ * Insert a (value, item) pair
+ * Return -1 if failed, 0 if successful
+ */
+int ordered_index_insert(struct ordered_index* index, long long value, void* item);
+
+/**
+ * Remove a (value, item) pair
+ * Return -1 if not found, 0 if successful
+ */
+int ordered_index_remove(struct ordered_index* index, long long value, void* item);
+
+/**
+ * Get the first node whose value is greater than or equal to value
+ * Return 0 if there is none
+ */
+struct ordered_node* ordered_index_lower_bound(struct ordered_index* index,
+		long long value);
+
+/**
+ * Get the node with the smallest value
+ * Return 0 if the index is empty
+ */
+struct ordered_node* ordered_index_first(struct ordered_index* index);
+
+/**
+ * Get the node following a node in value order
+ */
+#define ordered_index_next(node) ((node)->forward[0])
+
+#endif /* ORDERED_INDEX_H_ */
@@ -60,6 +60,22 @@ int check_numeric(char* input) {
 	return 0;
 }
 
+int check_option(char* options, char* option) {
+	int len = strlen(option);
+	char* p = options;
+	while (*p != '\0') {
+		int k = 0;
+		while (p[k] != ':' && p[k] != '\0') {
+			k++;
+		}
+		if (k == len && strncmp(p,option,len) == 0) {
+			return 0;
+		}
+		p += p[k] == ':' ? k+1 : k;
+	}
+	return 1;
+}
+
 int parse_predicates(char chunk[1024],
 		char col_name[MAX_COLNAME_LEN],
 		char operand[1],
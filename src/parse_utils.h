@@ -22,6 +22,10 @@ void delete_leading_trailing_spaces(char before[256], char after[256]);
 // return 0 if numeric, 1 if not
 int check_numeric(char* input);
 
+// check if option appears in a colon-separated list of options
+// return 0 if found, 1 if not
+int check_option(char* options, char* option);
+
 // parse predicates
 int parse_predicates(char chunk[1024],
 		char col_name[MAX_COLNAME_LEN],
@@ -0,0 +1,292 @@
+/**
+ * @file
+ * @brief This file implements the binary wire protocol declared in
+ * protocol.h.
+ */
+
+#include <string.h>
+#include "protocol.h"
+
+// read position in a frame's payload
+struct protocol_cursor {
+	char* p;
+	char* end;
+};
+
+static void put_bytes(struct protocol_writer* w, const void* data, size_t len) {
+	if (w->len + len > w->cap) {
+		w->overflow = 1;
+		return;
+	}
+	memcpy(w->buf + w->len,data,len);
+	w->len += len;
+}
+
+static void put_be(struct protocol_writer* w, uint64_t val, int bytes) {
+	unsigned char buf[8];
+	int k;
+	for (k=bytes-1; k>=0; k--) {
+		buf[k] = val & 0xff;
+		val >>= 8;
+	}
+	put_bytes(w,buf,bytes);
+}
+
+static uint64_t get_be(const char* p, int bytes) {
+	const unsigned char* u = (const unsigned char*)p;
+	uint64_t val = 0;
+	int k;
+	for (k=0; k<bytes; k++) {
+		val = (val << 8) | u[k];
+	}
+	return val;
+}
+
+void protocol_writer_init(struct protocol_writer* w, char* buf, size_t cap,
+		int opcode, int status) {
+	w->buf = buf;
+	w->cap = cap;
+	w->len = PROTOCOL_HEADER_LEN;
+	w->count = 0;
+	w->overflow = cap < PROTOCOL_HEADER_LEN;
+	if (!w->overflow) {
+		buf[0] = opcode;
+		buf[1] = status;
+	}
+}
+
+void protocol_put_u32(struct protocol_writer* w, uint32_t val) {
+	put_be(w,val,4);
+}
+
+void protocol_put_str(struct protocol_writer* w, const char* str, size_t len) {
+	if (len > 0xffff) {
+		w->overflow = 1;
+		return;
+	}
+	put_be(w,len,2);
+	put_bytes(w,str,len);
+	put_bytes(w,"",1);
+}
+
+void protocol_put_int_value(struct protocol_writer* w, long long val) {
+	put_be(w,PROTO_INT,1);
+	put_be(w,(uint64_t)val,8);
+}
+
+void protocol_put_str_value(struct protocol_writer* w, const char* str, size_t len) {
+	put_be(w,PROTO_CHAR,1);
+	protocol_put_str(w,str,len);
+}
+
+void protocol_count(struct protocol_writer* w) {
+	w->count++;
+}
+
+size_t protocol_writer_finish(struct protocol_writer* w) {
+	if (w->overflow || w->count > 0xffff) {
+		return 0;
+	}
+	unsigned char* u = (unsigned char*)w->buf;
+	size_t payload = w->len - PROTOCOL_HEADER_LEN;
+	u[2] = w->count >> 8;
+	u[3] = w->count;
+	u[4] = payload >> 24;
+	u[5] = payload >> 16;
+	u[6] = payload >> 8;
+	u[7] = payload;
+	return w->len;
+}
+
+ssize_t protocol_frame_len(const char* buf, size_t len, size_t max_len) {
+	if (len < PROTOCOL_HEADER_LEN) {
+		return 0;
+	}
+	uint64_t frame_len = PROTOCOL_HEADER_LEN + get_be(buf + 4,4);
+	if (buf[0] < PROTO_AUTH || buf[0] > PROTO_QUERY || frame_len > max_len) {
+		return -1;
+	}
+	return frame_len <= len ? (ssize_t)frame_len : 0;
+}
+
+ssize_t protocol_next_frame(struct line_reader* reader, char** frame) {
+	char* head = reader->buf + reader->start;
+	ssize_t len = protocol_frame_len(head,reader->end - reader->start,
+			MAX_REQUEST_FRAME_LEN);
+	if (len > 0) {
+		*frame = head;
+		reader->start += len;
+	}
+	return len;
+}
+
+int protocol_take_hello(struct line_reader* reader) {
+	unsigned char* head = (unsigned char*)reader->buf + reader->start;
+	size_t len = reader->end - reader->start;
+	if (len > 0 && head[0] != PROTOCOL_MAGIC) {
+		return -1;
+	}
+	if (len < 2) {
+		return 0;
+	}
+	reader->start += 2;
+	return head[1] == 0 ? -1 : head[1];
+}
+
+// read a string, which has to be followed by its null byte
+static int get_str(struct protocol_cursor* c, char** str, size_t* len) {
+	if (c->end - c->p < 2) {
+		return -1;
+	}
+	size_t n = get_be(c->p,2);
+	if ((size_t)(c->end - c->p) < 2 + n + 1 || c->p[2 + n] != '\0'
+			|| memchr(c->p + 2,'\0',n) != 0) {
+		return -1;
+	}
+	*str = c->p + 2;
+	if (len != 0) {
+		*len = n;
+	}
+	c->p += 2 + n + 1;
+	return 0;
+}
+
+static int get_value(struct protocol_cursor* c, struct protocol_value* val) {
+	if (c->p >= c->end) {
+		return -1;
+	}
+	val->type = *c->p++;
+	if (val->type == PROTO_INT) {
+		if (c->end - c->p < 8) {
+			return -1;
+		}
+		val->int_val = (long long)get_be(c->p,8);
+		val->str_val = 0;
+		val->str_len = 0;
+		c->p += 8;
+		return 0;
+	} else if (val->type == PROTO_CHAR) {
+		val->int_val = 0;
+		return get_str(c,&val->str_val,&val->str_len);
+	}
+	return -1;
+}
+
+static int get_u32(struct protocol_cursor* c, uint32_t* val) {
+	if (c->end - c->p < 4) {
+		return -1;
+	}
+	*val = get_be(c->p,4);
+	c->p += 4;
+	return 0;
+}
+
+// check the header and set up a cursor over the payload
+static int open_frame(char* frame, size_t len, struct protocol_cursor* c,
+		int* count) {
+	if (len < PROTOCOL_HEADER_LEN
+			|| PROTOCOL_HEADER_LEN + get_be(frame + 4,4) != len) {
+		return -1;
+	}
+	*count = get_be(frame + 2,2);
+	if (*count > MAX_COLUMNS_PER_TABLE && frame[0] != PROTO_QUERY) {
+		return -1;
+	}
+	c->p = frame + PROTOCOL_HEADER_LEN;
+	c->end = frame + len;
+	return 0;
+}
+
+int protocol_parse_request(char* frame, size_t len, struct protocol_request* req) {
+	struct protocol_cursor c;
+	if (open_frame(frame,len,&c,&req->count) != 0) {
+		return -1;
+	}
+	req->opcode = frame[0];
+	uint32_t u;
+	int k;
+	switch (req->opcode) {
+	case PROTO_AUTH:
+		if (get_str(&c,&req->username,0) != 0
+				|| get_str(&c,&req->password,0) != 0) {
+			return -1;
+		}
+		break;
+	case PROTO_GET:
+	case PROTO_DELETE:
+		if (get_str(&c,&req->table,0) != 0 || get_str(&c,&req->key,0) != 0) {
+			return -1;
+		}
+		break;
+	case PROTO_SET:
+		if (get_str(&c,&req->table,0) != 0 || get_str(&c,&req->key,0) != 0
+				|| get_u32(&c,&u) != 0) {
+			return -1;
+		}
+		req->metadata = (int32_t)u;
+		for (k=0; k<req->count; k++) {
+			if (get_value(&c,&req->values[k]) != 0) {
+				return -1;
+			}
+		}
+		break;
+	case PROTO_QUERY:
+		if (req->count > MAX_COLUMNS_PER_TABLE
+				|| get_str(&c,&req->table,0) != 0 || get_u32(&c,&u) != 0
+				|| u > MAX_RECORDS_PER_TABLE) {
+			return -1;
+		}
+		req->max_keys = u;
+		for (k=0; k<req->count; k++) {
+			struct protocol_predicate* pred = &req->predicates[k];
+			if (get_str(&c,&pred->column,0) != 0 || c.p >= c.end) {
+				return -1;
+			}
+			pred->operator = *c.p++;
+			if (get_value(&c,&pred->value) != 0) {
+				return -1;
+			}
+		}
+		break;
+	default:
+		return -1;
+	}
+	// the payload has to be used up exactly
+	return c.p == c.end ? 0 : -1;
+}
+
+int protocol_parse_response(char* frame, size_t len, struct protocol_response* resp) {
+	struct protocol_cursor c;
+	if (open_frame(frame,len,&c,&resp->count) != 0) {
+		return -1;
+	}
+	resp->opcode = frame[0];
+	resp->status = (unsigned char)frame[1];
+	if (resp->status != 0) {
+		return c.p == c.end ? 0 : -1;
+	}
+	uint32_t u;
+	int k;
+	if (resp->opcode == PROTO_GET) {
+		if (get_u32(&c,&u) != 0) {
+			return -1;
+		}
+		resp->metadata = (int32_t)u;
+		for (k=0; k<resp->count; k++) {
+			if (get_value(&c,&resp->values[k]) != 0) {
+				return -1;
+			}
+		}
+	} else if (resp->opcode == PROTO_QUERY) {
+		if (resp->count > MAX_RECORDS_PER_TABLE || get_u32(&c,&u) != 0) {
+			return -1;
+		}
+		resp->matches = u;
+		for (k=0; k<resp->count; k++) {
+			if (get_str(&c,&resp->keys[k],0) != 0) {
+				return -1;
+			}
+		}
+	}
+	return c.p == c.end ? 0 : -1;
+}
@@ -0,0 +1,198 @@
+/**
+ * @file
+ * @brief This file declares the binary wire protocol, which the server
+ * speaks alongside the text protocol.
+ *
+ * A client picks the binary protocol by sending PROTOCOL_MAGIC followed
+ * by PROTOCOL_VERSION as the first two bytes of the connection; text
+ * commands always start with a letter, so the server tells the two apart
+ * from the first byte. The server answers with the same two bytes and
+ * the version it speaks, and closes the connection if the versions
+ * differ.
+ *
+ * After that every request and response is a frame: a header of
+ * PROTOCOL_HEADER_LEN bytes followed by a payload, all integers in
+ * network byte order.
+ *
+ *   u8 opcode | u8 status | u16 count | u32 payload length | payload
+ *
+ * Strings are a u16 length followed by the bytes and a null byte, so the
+ * parser points into the frame without copying. Values are a u8 type,
+ * then an i64 for PROTO_INT or a string for PROTO_CHAR, so they may
+ * contain any byte but '\0'.
+ *
+ * Request payloads, count being the number of values or predicates:
+ *   PROTO_AUTH    username, password
+ *   PROTO_GET     table, key
+ *   PROTO_SET     table, key, i32 metadata, count values in column order
+ *   PROTO_DELETE  table, key
+ *   PROTO_QUERY   table, u32 max keys, count predicates of
+ *                 column, u8 operator ('<', '=' or '>'), value
+ *
+ * A response has the opcode of its request and a status of 0 on success
+ * or one of the ERR_* codes of storage.h. A successful PROTO_GET has an
+ * i32 metadata and count values, a successful PROTO_QUERY a u32 number
+ * of matching keys and the first count of them, at most max keys.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "storage.h"
+#include "utils.h"
+
+/**
+ * @brief First byte sent by a client that speaks the binary protocol.
+ */
+#define PROTOCOL_MAGIC 0xB5
+
+/**
+ * @brief Version of the binary protocol.
+ */
+#define PROTOCOL_VERSION 1
+
+/**
+ * @brief Number of bytes of a frame header.
+ */
+#define PROTOCOL_HEADER_LEN 8
+
+/**
+ * @brief Max bytes of a request frame, which has to fit a reader's buffer.
+ */
+#define MAX_REQUEST_FRAME_LEN MAX_CMD_LEN
+
+/**
+ * @brief Max bytes of a response frame, enough for a query returning
+ * every key of a table.
+ */
+#define MAX_RESPONSE_FRAME_LEN (PROTOCOL_HEADER_LEN + 4 \
+		+ MAX_RECORDS_PER_TABLE * (MAX_KEY_LEN + 3))
+
+enum protocol_opcode {PROTO_AUTH = 1, PROTO_GET, PROTO_SET, PROTO_DELETE,
+	PROTO_QUERY};
+
+enum protocol_type {PROTO_INT, PROTO_CHAR};
+
+/**
+ * A typed value of a frame, str_val points into the frame
+ */
+struct protocol_value {
+	int type;
+	long long int_val;
+	char* str_val;
+	size_t str_len;
+};
+
+/**
+ * A query predicate of a frame
+ */
+struct protocol_predicate {
+	char* column;
+	char operator;
+	struct protocol_value value;
+};
+
+/**
+ * A request parsed from a frame, its strings point into the frame
+ */
+struct protocol_request {
+	int opcode;
+	char* table;
+	char* key;
+	char* username;
+	char* password;
+	int metadata;
+	int max_keys;
+	int count;
+	struct protocol_value values[MAX_COLUMNS_PER_TABLE];
+	struct protocol_predicate predicates[MAX_COLUMNS_PER_TABLE];
+};
+
+/**
+ * A response parsed from a frame, its strings point into the frame
+ */
+struct protocol_response {
+	int opcode;
+	int status;
+	int metadata;
+	// number of keys matching a query, which may be more than count
+	int matches;
+	int count;
+	struct protocol_value values[MAX_COLUMNS_PER_TABLE];
+	char* keys[MAX_RECORDS_PER_TABLE];
+};
+
+/**
+ * Builds a frame in a caller's buffer
+ */
+struct protocol_writer {
+	char* buf;
+	size_t cap;
+	size_t len;
+	int count;
+	// set once the buffer is too small
+	int overflow;
+};
+
+/**
+ * @brief Start a frame with an empty payload.
+ */
+void protocol_writer_init(struct protocol_writer* w, char* buf, size_t cap,
+		int opcode, int status);
+
+void protocol_put_u32(struct protocol_writer* w, uint32_t val);
+void protocol_put_str(struct protocol_writer* w, const char* str, size_t len);
+void protocol_put_int_value(struct protocol_writer* w, long long val);
+void protocol_put_str_value(struct protocol_writer* w, const char* str, size_t len);
+
+/**
+ * @brief Count one more value, predicate or key in the header.
+ */
+void protocol_count(struct protocol_writer* w);
+
+/**
+ * @brief Write the header of the frame.
+ * @return Return the length of the frame, 0 if it did not fit.
+ */
+size_t protocol_writer_finish(struct protocol_writer* w);
+
+/**
+ * @brief Length of the frame at the head of a buffer.
+ * @return Return the length of the frame, 0 if more bytes are needed
+ * to know, -1 if the header is invalid or the frame longer than max_len.
+ */
+ssize_t protocol_frame_len(const char* buf, size_t len, size_t max_len);
+
+/**
+ * @brief Take the next complete frame out of a reader's buffer, without
+ * reading from the socket.
+ *
+ * frame points into the buffer; it stays valid until the next call to
+ * line_reader_fill().
+ * @return Return the length of the frame, 0 if there is no complete
+ * frame, -1 if the frame is invalid.
+ */
+ssize_t protocol_next_frame(struct line_reader* reader, char** frame);
+
+/**
+ * @brief Take the client's greeting out of a reader's buffer.
+ * @return Return the client's version, 0 if it is not complete yet,
+ * -1 if the connection does not start with PROTOCOL_MAGIC.
+ */
+int protocol_take_hello(struct line_reader* reader);
+
+/**
+ * @brief Parse a request frame.
+ * @return Return 0 if the frame is well formed, -1 otherwise.
+ */
+int protocol_parse_request(char* frame, size_t len, struct protocol_request* req);
+
+/**
+ * @brief Parse a response frame.
+ * @return Return 0 if the frame is well formed, -1 otherwise.
+ */
+int protocol_parse_response(char* frame, size_t len, struct protocol_response* resp);
+
+#endif
@@ -0,0 +1,301 @@
+/**
+ * @file
+ * @brief This file implements the scan kernels declared in scan_kernels.h.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "scan_kernels.h"
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static int kernel_supported[SCAN_KERNELS];
+static enum scan_kernel kernel;
+
+static void pick_kernel() {
+	kernel_supported[SCAN_SCALAR] = 1;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	kernel_supported[SCAN_SSE42] = __builtin_cpu_supports("sse4.2");
+	kernel_supported[SCAN_AVX2] = __builtin_cpu_supports("avx2");
+	kernel_supported[SCAN_AVX512] = __builtin_cpu_supports("avx512f");
+#endif
+	kernel = SCAN_KERNELS - 1;
+	while (!kernel_supported[kernel]) {
+		kernel--;
+	}
+}
+
+// set the bits of the full words of values of a type, step values at a
+// time, test giving the bits of the step values from v + k
+#define SELECT_WORDS(type, step, test) \
+	for (w=0; w<words; w++) { \
+		const type* v = values + (size_t)w * SCAN_WORD_BITS; \
+		unsigned long long word = 0; \
+		for (k=0; k<SCAN_WORD_BITS; k+=(step)) { \
+			word |= (unsigned long long)(test) << k; \
+		} \
+		bits[w] = word; \
+	}
+
+// the word of the last n values, fewer than SCAN_WORD_BITS
+static unsigned long long select_tail(const long long* values, int n,
+		enum scan_op op, long long other) {
+	unsigned long long word = 0;
+	int k;
+	for (k=0; k<n; k++) {
+		int pass = op == SCAN_LESS ? values[k] < other
+				: op == SCAN_EQUAL ? values[k] == other : values[k] > other;
+		word |= (unsigned long long)pass << k;
+	}
+	return word;
+}
+
+static void select_int_scalar(const long long* values, int n,
+		enum scan_op op, long long other, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	switch (op) {
+		case SCAN_LESS:
+			SELECT_WORDS(long long,1,v[k] < other);
+			break;
+		case SCAN_EQUAL:
+			SELECT_WORDS(long long,1,v[k] == other);
+			break;
+		default:
+			SELECT_WORDS(long long,1,v[k] > other);
+			break;
+	}
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,op,other);
+	}
+}
+
+#if defined(__x86_64__)
+// the mask of the 64-bit lanes of a compare, one bit per lane
+#define SSE42_MASK(x) _mm_movemask_pd(_mm_castsi128_pd(x))
+#define SSE42_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+
+__attribute__((target("sse4.2")))
+static void select_int_sse42(const long long* values, int n,
+		enum scan_op op, long long other, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m128i o = _mm_set1_epi64x(other);
+	switch (op) {
+		case SCAN_LESS:
+			SELECT_WORDS(long long,2,SSE42_MASK(_mm_cmpgt_epi64(o,SSE42_LOAD(v + k))));
+			break;
+		case SCAN_EQUAL:
+			SELECT_WORDS(long long,2,SSE42_MASK(_mm_cmpeq_epi64(SSE42_LOAD(v + k),o)));
+			break;
+		default:
+			SELECT_WORDS(long long,2,SSE42_MASK(_mm_cmpgt_epi64(SSE42_LOAD(v + k),o)));
+			break;
+	}
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,op,other);
+	}
+}
+
+#define AVX2_MASK(x) _mm256_movemask_pd(_mm256_castsi256_pd(x))
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+
+__attribute__((target("avx2")))
+static void select_int_avx2(const long long* values, int n,
+		enum scan_op op, long long other, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m256i o = _mm256_set1_epi64x(other);
+	switch (op) {
+		case SCAN_LESS:
+			SELECT_WORDS(long long,4,AVX2_MASK(_mm256_cmpgt_epi64(o,AVX2_LOAD(v + k))));
+			break;
+		case SCAN_EQUAL:
+			SELECT_WORDS(long long,4,AVX2_MASK(_mm256_cmpeq_epi64(AVX2_LOAD(v + k),o)));
+			break;
+		default:
+			SELECT_WORDS(long long,4,AVX2_MASK(_mm256_cmpgt_epi64(AVX2_LOAD(v + k),o)));
+			break;
+	}
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,op,other);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void select_int_avx512(const long long* values, int n,
+		enum scan_op op, long long other, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m512i o = _mm512_set1_epi64(other);
+	switch (op) {
+		case SCAN_LESS:
+			SELECT_WORDS(long long,8,_mm512_cmplt_epi64_mask(_mm512_loadu_si512(v + k),o));
+			break;
+		case SCAN_EQUAL:
+			SELECT_WORDS(long long,8,_mm512_cmpeq_epi64_mask(_mm512_loadu_si512(v + k),o));
+			break;
+		default:
+			SELECT_WORDS(long long,8,_mm512_cmpgt_epi64_mask(_mm512_loadu_si512(v + k),o));
+			break;
+	}
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,op,other);
+	}
+}
+#endif
+
+// the word of the last n codes, fewer than SCAN_WORD_BITS
+static unsigned long long select_code_tail(const unsigned int* values, int n,
+		unsigned int code) {
+	unsigned long long word = 0;
+	int k;
+	for (k=0; k<n; k++) {
+		word |= (unsigned long long)(values[k] == code) << k;
+	}
+	return word;
+}
+
+static void select_code_scalar(const unsigned int* values, int n,
+		unsigned int code, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	SELECT_WORDS(unsigned int,1,v[k] == code);
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_code_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,code);
+	}
+}
+
+#if defined(__x86_64__)
+// the mask of the 32-bit lanes of a compare, one bit per lane
+#define SSE42_MASK32(x) _mm_movemask_ps(_mm_castsi128_ps(x))
+
+__attribute__((target("sse4.2")))
+static void select_code_sse42(const unsigned int* values, int n,
+		unsigned int code, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m128i o = _mm_set1_epi32(code);
+	SELECT_WORDS(unsigned int,4,SSE42_MASK32(_mm_cmpeq_epi32(SSE42_LOAD(v + k),o)));
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_code_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,code);
+	}
+}
+
+#define AVX2_MASK32(x) _mm256_movemask_ps(_mm256_castsi256_ps(x))
+
+__attribute__((target("avx2")))
+static void select_code_avx2(const unsigned int* values, int n,
+		unsigned int code, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m256i o = _mm256_set1_epi32(code);
+	SELECT_WORDS(unsigned int,8,AVX2_MASK32(_mm256_cmpeq_epi32(AVX2_LOAD(v + k),o)));
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_code_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,code);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void select_code_avx512(const unsigned int* values, int n,
+		unsigned int code, unsigned long long* bits) {
+	int words = n / SCAN_WORD_BITS, w, k;
+	__m512i o = _mm512_set1_epi32(code);
+	SELECT_WORDS(unsigned int,16,_mm512_cmpeq_epi32_mask(_mm512_loadu_si512(v + k),o));
+	if (n % SCAN_WORD_BITS != 0) {
+		bits[words] = select_code_tail(values + (size_t)words * SCAN_WORD_BITS,
+				n % SCAN_WORD_BITS,code);
+	}
+}
+#endif
+
+void scan_select_int(const long long* values, int n, enum scan_op op,
+		long long other, unsigned long long* bits) {
+	pthread_once(&kernel_once,pick_kernel);
+	switch (kernel) {
+#if defined(__x86_64__)
+		case SCAN_AVX512:
+			select_int_avx512(values,n,op,other,bits);
+			break;
+		case SCAN_AVX2:
+			select_int_avx2(values,n,op,other,bits);
+			break;
+		case SCAN_SSE42:
+			select_int_sse42(values,n,op,other,bits);
+			break;
+#endif
+		default:
+			select_int_scalar(values,n,op,other,bits);
+			break;
+	}
+}
+
+void scan_select_code(const unsigned int* values, int n, unsigned int code,
+		unsigned long long* bits) {
+	pthread_once(&kernel_once,pick_kernel);
+	switch (kernel) {
+#if defined(__x86_64__)
+		case SCAN_AVX512:
+			select_code_avx512(values,n,code,bits);
+			break;
+		case SCAN_AVX2:
+			select_code_avx2(values,n,code,bits);
+			break;
+		case SCAN_SSE42:
+			select_code_sse42(values,n,code,bits);
+			break;
+#endif
+		default:
+			select_code_scalar(values,n,code,bits);
+			break;
+	}
+}
+
+void scan_select_char(const char* values, int size, int n, const char* other,
+		unsigned long long* bits) {
+	memset(bits,0,scan_words(n) * sizeof(unsigned long long));
+	if (strlen(other) > (size_t)size) {
+		return;
+	}
+	int k;
+	for (k=0; k<n; k++) {
+		const char* value = values + (size_t)k * size;
+		// the first byte rules out most strings
+		if (value[0] == other[0] && strncmp(value,other,size) == 0) {
+			bits[k / SCAN_WORD_BITS] |= 1ULL << (k % SCAN_WORD_BITS);
+		}
+	}
+}
+
+int scan_and(unsigned long long* bits, const unsigned long long* other,
+		int words) {
+	int w, left = 0;
+	for (w=0; w<words; w++) {
+		bits[w] &= other[w];
+		left += bits[w] != 0;
+	}
+	return left;
+}
+
+int scan_use_kernel(enum scan_kernel use) {
+	pthread_once(&kernel_once,pick_kernel);
+	if (use < 0 || use >= SCAN_KERNELS || !kernel_supported[use]) {
+		return -1;
+	}
+	kernel = use;
+	return 0;
+}
+
+enum scan_kernel scan_current_kernel() {
+	pthread_once(&kernel_once,pick_kernel);
+	return kernel;
+}
+
+const char* scan_kernel_name(enum scan_kernel use) {
+	static const char* names[SCAN_KERNELS] = {"scalar","sse4.2","avx2",
+			"avx512f"};
+	return use >= 0 && use < SCAN_KERNELS ? names[use] : "unknown";
+}
@@ -0,0 +1,82 @@
+/**
+ * @file
+ * @brief This file declares the kernels that check the values of a column
+ * against a condition, many values per instruction.
+ *
+ * A kernel reads an array of values and writes a selection bitmap: bit k
+ * of word k / 64 is set if value k passes. The conditions of a query then
+ * combine by ANDing their bitmaps. INT values are 64 bits, so an AVX-512
+ * compare checks 8 of them, an AVX2 one 4 and an SSE4.2 one 2; the 32-bit
+ * codes of a dictionary-encoded column go twice as fast. The best
+ * kernel the CPU supports is picked the first time one is called, and the
+ * scalar one runs everywhere else.
+ */
+
+#ifndef SCAN_KERNELS_H_
+#define SCAN_KERNELS_H_
+
+/**
+ * Values whose bits fit in a word of a bitmap
+ */
+#define SCAN_WORD_BITS 64
+
+/**
+ * Get the number of words of the bitmap of n values
+ */
+#define scan_words(n) (((n) + SCAN_WORD_BITS - 1) / SCAN_WORD_BITS)
+
+/**
+ * Comparisons of a value with the one of a condition
+ */
+enum scan_op {SCAN_LESS, SCAN_EQUAL, SCAN_GREATER};
+
+/**
+ * Kernels, from the slowest
+ */
+enum scan_kernel {SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2, SCAN_AVX512,
+	SCAN_KERNELS};
+
+/**
+ * Select the n values that compare with other as op says
+ * The bits past the n-th of the last word are cleared
+ */
+void scan_select_int(const long long* values, int n, enum scan_op op,
+		long long other, unsigned long long* bits);
+
+/**
+ * Select the n codes of a dictionary-encoded column equal to code
+ */
+void scan_select_code(const unsigned int* values, int n, unsigned int code,
+		unsigned long long* bits);
+
+/**
+ * Select the n strings of size bytes each equal to other, compared as
+ * strncmp does
+ */
+void scan_select_char(const char* values, int size, int n, const char* other,
+		unsigned long long* bits);
+
+/**
+ * AND the words of other into bits
+ * Return the number of words left with a bit set
+ */
+int scan_and(unsigned long long* bits, const unsigned long long* other,
+		int words);
+
+/**
+ * Use a kernel instead of the best one
+ * Return -1 if the CPU does not support it, 0 if successful
+ */
+int scan_use_kernel(enum scan_kernel kernel);
+
+/**
+ * Get the kernel in use
+ */
+enum scan_kernel scan_current_kernel();
+
+/**
+ * Get the name of a kernel
+ */
+const char* scan_kernel_name(enum scan_kernel kernel);
+
+#endif /* SCAN_KERNELS_H_ */
@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <assert.h>
 #include <signal.h>
@@ -26,38 +27,52 @@
 #include <time.h>
 #include "database.h"
 #include "parse_utils.h"
+#include "event_loop.h"
+#include "protocol.h"
 #include <pthread.h>
 
 #define MAX_LISTENQUEUELEN 20	///< The maximum number of queued connections.
+#define MAX_RESPONSE_BATCH (MAX_CMD_LEN * 4) ///< Max bytes of responses sent at once.
 
 struct config_params params;
 long accumulated_set_time;
 
 
-// thread subroutine
+// thread subroutines
 void* wait_for_commands();
+void* checkpoint_worker();
 // thread argument structure
 struct thread_data {
 	int clientsock;
 	struct sockaddr_in clientaddr;
 };
+void serve_client(struct thread_data* data);
 // thread count
 int thread_count;
 
 // commands
-void command_set(char* cmd,
+void process_command(char *cmd, char *response);
+size_t process_frame(char *frame, size_t len, char *response);
+void wait_for_frames(int clientsock, struct line_reader *reader);
+int frame_table(struct protocol_request* req, struct data_table** table_p);
+int frame_get(struct protocol_request* req, struct protocol_writer* w);
+int frame_set(struct protocol_request* req);
+int frame_delete(struct protocol_request* req);
+int frame_query(struct protocol_request* req, struct protocol_writer* w);
+void command_set(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char key[MAX_ARG_VAL_LEN],
 		char value[MAX_ARG_VAL_LEN],
 		char metadata[MAX_ARG_VAL_LEN]);
-void command_get(char* cmd,
+void command_get(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char key[MAX_ARG_VAL_LEN]);
-void command_query(char* cmd,
+void command_query(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char max[MAX_ARG_VAL_LEN],
 		char predicates[MAX_ARG_VAL_LEN]);
 // helpers
+void log_memory_usage();
 int table_check(char* table);
 int key_check(char* key);
 int value_check(char* value);
@@ -100,6 +115,9 @@ int main(int argc, char *argv[])
 	// Log: concurrency settings
 	sprintf(message,"Concurrency parameter: %d\n",params.concurrency);
 	logger(server_log,message);
+	sprintf(message,"I/O model: %s\n",
+			params.io_model == IO_THREAD_PER_CLIENT ? "thread_per_client" : "threads");
+	logger(server_log,message);
 
 	// Database: initialize table schema
 	status = init_tables(params.tables);
@@ -129,6 +147,32 @@ int main(int argc, char *argv[])
 		};
 		strcat(message," }\n");
 		logger(server_log,message);
+		sprintf(message,"    %lu bytes per row\n",
+				(unsigned long)entry_size(tables[k]));
+		logger(server_log,message);
+	}
+
+	// Database: replay the log of SETs, and keep logging them
+	if (*(params.data_directory) != '\0') {
+		if (params.durability == WAL_EVERY_MS) {
+			sprintf(message,"Durability: every %d ms\n",params.durability_ms);
+		} else {
+			sprintf(message,"Durability: %s\n",
+					params.durability == WAL_NONE ? "none" : "always");
+		}
+		logger(server_log,message);
+		if (recover_tables(params.data_directory,params.durability,
+				params.durability_ms,params.recovery_threads) != 0) {
+			exit(EXIT_FAILURE);
+		}
+		// Database: snapshot the tables now and then, so the log and the
+		// time a restart takes stay bounded
+		pthread_t checkpointer;
+		if (params.snapshot_interval > 0 && pthread_create(&checkpointer,NULL,
+				checkpoint_worker,NULL) != 0) {
+			printf("Error creating the snapshot thread.\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
 
@@ -166,6 +210,17 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
+	// Serve clients from the event loop's pool of workers, at least one,
+	// which take ready connections one batch of commands at a time.
+	if (params.io_model == IO_THREADS) {
+		int workers = params.concurrency > 0 ? params.concurrency : 1;
+		sprintf(message,"Starting %d worker thread(s)\n",workers);
+		logger(server_log,message);
+		event_loop_run(listensock, workers, process_command, process_frame);
+		printf("Error running the event loop.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	// Listen loop.
 	int wait_for_connections = 1;
 	thread_count = 0;
@@ -174,22 +229,32 @@ int main(int argc, char *argv[])
 		struct sockaddr_in clientaddr;
 		socklen_t clientaddrlen = sizeof clientaddr;
 		int clientsock = accept(listensock, (struct sockaddr*)&clientaddr, &clientaddrlen);
-		if (params.concurrency == 0 && thread_count > 0) {
+		if (clientsock < 0) {
+			logger(server_log,"Error accepting a connection.\n");
+			continue;
+		}
+		if (params.io_model == IO_THREAD_PER_CLIENT
+				&& params.concurrency == 0 && thread_count > 0) {
+			close(clientsock);
 			continue;
 		}
-
-		// Create new thread
-		pthread_t thread;
-		int result;
 		struct thread_data* data =
 				(struct thread_data*)malloc(sizeof(struct thread_data));
 		data->clientaddr = clientaddr;
 		data->clientsock = clientsock;
+
+		// Create new thread
+		pthread_t thread;
+		int result;
 		result = pthread_create(&thread,NULL,wait_for_commands,(void*)data);
 		if (result != 0) {
 			sprintf(message,"Error: failed to create new thread. Returned %d\n",
 					result);
 			logger(server_log,message);
+			close(clientsock);
+			free(data);
+		} else {
+			pthread_detach(thread);
 		}
 	}
 
@@ -212,126 +277,216 @@ void* wait_for_commands(void* thread_arg) {
 			"active thread(s)\n", thread_count);
 	logger(server_log,message);
 
-	struct thread_data* data = (struct thread_data*) thread_arg;
-	int clientsock = data->clientsock;
-	struct sockaddr_in clientaddr= data->clientaddr;
-	if (clientsock < 0) {
-		printf("Error accepting a connection.\n");
-		exit(EXIT_FAILURE);
+	serve_client((struct thread_data*) thread_arg);
+
+	// Log: thread terminated
+	thread_count--;
+	sprintf(message,"Terminating a thread. There are currently %d " \
+			"active thread(s)\n", thread_count);
+	logger(server_log,message);
+
+	pthread_exit(NULL);
+}
+
+void* checkpoint_worker(void* arg) {
+	while (1) {
+		sleep(params.snapshot_interval);
+		checkpoint_tables();
 	}
+	return NULL;
+}
+
+/**
+ * @brief Serve a client until it closes its connection.
+ *
+ * @param data The accepted connection, which is freed.
+ */
+void serve_client(struct thread_data* data)
+{
+	int clientsock = data->clientsock;
+	struct sockaddr_in clientaddr = data->clientaddr;
+	free(data);
 
 	sprintf(message,"Got a connection from %s:%d.\n", inet_ntoa(clientaddr.sin_addr), clientaddr.sin_port);
 	logger(server_log,message);
-
-	// Get commands from client.
-	int wait_for_commands = 1;
-	do {
-		// Read a line from the client.
-		char cmd[MAX_CMD_LEN];
-		int status = recvline(clientsock, cmd, MAX_CMD_LEN);
-		if (status != 0) {
-			// Either an error occurred or the client closed the connection.
-			wait_for_commands = 0;
-		} else {
-			// Handle the command from the client.
-			int status = handle_command(clientsock, cmd);
-			if (status != 0)
+	// Responses are batched below, so send each batch right away.
+	int nodelay = 1;
+	setsockopt(clientsock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+
+	// Get commands from client, through a buffer that keeps what the
+	// client sent past the current command.
+	struct line_reader reader;
+	line_reader_init(&reader, clientsock);
+	// A binary protocol client starts with PROTOCOL_MAGIC, while text
+	// commands start with a letter.
+	int wait_for_commands = line_reader_fill(&reader) > 0;
+	if (wait_for_commands
+			&& (unsigned char)reader.buf[reader.start] == PROTOCOL_MAGIC) {
+		wait_for_frames(clientsock, &reader);
+		wait_for_commands = 0;
+	}
+	// Responses of the commands handled since the last send.
+	char responses[MAX_RESPONSE_BATCH];
+	size_t responses_len = 0;
+	while (wait_for_commands) {
+		// Take the next command the client sent.
+		char *line;
+		ssize_t len = line_reader_next(&reader, &line);
+		if (len < 0) {
+			// No complete command left: answer the ones handled so far
+			// at once, then read more from the client.
+			if (responses_len > 0
+					&& sendall(clientsock, responses, responses_len) != 0) {
+				wait_for_commands = 0;
+			} else if (line_reader_fill(&reader) <= 0) {
+				// Either an error occurred or the client closed the connection.
+				wait_for_commands = 0;
+			}
+			responses_len = 0;
+			continue;
+		}
+		// Handle the command from the client, its response goes right
+		// after the previous ones.
+		if (responses_len + MAX_CMD_LEN > sizeof responses) {
+			if (sendall(clientsock, responses, responses_len) != 0)
 				wait_for_commands = 0; // Oops.  An error occured.
+			responses_len = 0;
 		}
-	} while (wait_for_commands);
+		char *response = responses + responses_len;
+		process_command(line, response);
+		len = strlen(response);
+		response[len] = '\n';
+		responses_len += len + 1;
+	}
 
 	// Close the connection with the client.
 	close(clientsock);
 
 	sprintf(message,"Closed connection from %s:%d.\n", inet_ntoa(clientaddr.sin_addr), clientaddr.sin_port);
 	logger(server_log,message);
+	log_memory_usage();
+}
 
-	// Log: thread terminated
-	thread_count--;
-	sprintf(message,"Terminating a thread. There are currently %d " \
-			"active thread(s)\n", thread_count);
-	logger(server_log,message);
+/**
+ * @brief Serve a binary protocol client, whose greeting is at the head
+ * of the reader's buffer.
+ *
+ * Like text commands, the responses of every frame already received are
+ * sent at once.
+ */
+void wait_for_frames(int clientsock, struct line_reader *reader)
+{
+	// Wait for the whole greeting and answer with the version spoken here.
+	int version;
+	while ((version = protocol_take_hello(reader)) == 0) {
+		if (line_reader_fill(reader) <= 0)
+			return;
+	}
+	char hello[2] = {(char)PROTOCOL_MAGIC, PROTOCOL_VERSION};
+	if (sendall(clientsock, hello, sizeof hello) != 0 || version != PROTOCOL_VERSION)
+		return;
 
-	pthread_exit(NULL);
+	char responses[MAX_RESPONSE_BATCH];
+	size_t responses_len = 0;
+	char response[MAX_RESPONSE_FRAME_LEN];
+	while (1) {
+		// Take the next frame the client sent.
+		char *frame;
+		ssize_t len = protocol_next_frame(reader, &frame);
+		if (len < 0) {
+			logger(server_log, "Error: invalid frame\n");
+			return;
+		}
+		if (len == 0) {
+			// No complete frame left: answer the ones handled so far
+			// at once, then read more from the client.
+			if (responses_len > 0
+					&& sendall(clientsock, responses, responses_len) != 0)
+				return;
+			responses_len = 0;
+			if (line_reader_fill(reader) <= 0)
+				return;
+			continue;
+		}
+		size_t response_len = process_frame(frame, len, response);
+		if (responses_len + response_len > sizeof responses) {
+			if (sendall(clientsock, responses, responses_len) != 0)
+				return;
+			responses_len = 0;
+		}
+		memcpy(responses + responses_len, response, response_len);
+		responses_len += response_len;
+	}
 }
 
 /**
  * @brief Process a command from the client.
  *
- * @param sock The socket connected to the client.
- * @param cmd The command received from the client.
- * @return Returns 0 on success, -1 otherwise.
+ * @param cmd The command received from the client. Its arguments are
+ * split in place, without copying them.
+ * @param response A buffer of MAX_CMD_LEN bytes where the response is
+ * written.
  */
-
-int handle_command(int sock, char *cmd)
+void process_command(char *cmd, char *response)
 {
 
-	sprintf(message,"Processing command '%s'\n", cmd);
+	snprintf(message,sizeof message,"Processing command '%s'\n", cmd);
 	logger(server_log,message);
 
 	// Parse command
-	struct protocol_arg_pair* args[MAX_ARG_NUM];
-	char cmd_buff[MAX_CMD_LEN];
-	strncpy(cmd_buff,cmd,sizeof(cmd));
-	extract_arg_from_line(args,cmd);
+	struct command_args args;
+	if (parse_command_args(cmd,&args) != 0) {
+		logger(server_log,"Error: malformed command\n");
+		strcpy(response,"status=-1#error=1!");
+		return;
+	}
 
 	// Extract argument value
-	char action[MAX_ARG_VAL_LEN];
-	get_arg_val(args,"action",action);
+	char* action = command_arg(&args,"action").ptr;
 
 	if (strcmp(action,"authenticate") == 0) {
 		// authentication
-		char username[MAX_ARG_VAL_LEN], password[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"username",username);
-		get_arg_val(args,"password",password);
-		if (strcmp(params.username,username) == 0
-				&& strcmp(params.password,password) == 0) {
-			cmd = "status=0!";
+		if (strcmp(params.username,command_arg(&args,"username").ptr) == 0
+				&& strcmp(params.password,command_arg(&args,"password").ptr) == 0) {
+			strcpy(response,"status=0!");
 		} else {
-			cmd = "status=-1!";
+			strcpy(response,"status=-1!");
 		}
 	} else if (strcmp(action,"get") == 0) {
 		// get
-		char table[MAX_ARG_VAL_LEN], key[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"table",table);
-		get_arg_val(args,"key",key);
-		command_get(cmd,table,key);
+		command_get(response,
+				command_arg(&args,"table").ptr,
+				command_arg(&args,"key").ptr);
 	} else if (strcmp(action,"set") == 0) {
 		// set
-		char table[MAX_ARG_VAL_LEN], key[MAX_ARG_VAL_LEN], value[MAX_ARG_VAL_LEN], metadata[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"table",table);
-		get_arg_val(args,"key",key);
-		get_arg_val(args,"value",value);
-		get_arg_val(args,"metadata",metadata);
-		command_set(cmd,table,key,value,metadata);
+		command_set(response,
+				command_arg(&args,"table").ptr,
+				command_arg(&args,"key").ptr,
+				command_arg(&args,"value").ptr,
+				command_arg(&args,"metadata").ptr);
 	} else if (strcmp(action,"query") == 0) {
 		// query
-		char table[MAX_ARG_VAL_LEN], max[MAX_ARG_VAL_LEN], predicates[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"table",table);
-		get_arg_val(args,"max",max);
-		get_arg_val(args,"predicates",predicates);
-		command_query(cmd,table,max,predicates);
+		command_query(response,
+				command_arg(&args,"table").ptr,
+				command_arg(&args,"max").ptr,
+				command_arg(&args,"predicates").ptr);
+	} else {
+		strcpy(response,"status=-1#error=1!");
 	}
 
-	sprintf(message,"Response to client: '%s'\n",cmd);
+	snprintf(message,sizeof message,"Response to client: '%s'\n",response);
 	logger(server_log,message);
-
-	// Send response
-	sendall(sock, cmd, strlen(cmd));
-	sendall(sock, "\n", 1);
-
-	return 0;
 }
 
 
 
-void command_set(char* cmd,
+void command_set(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char key[MAX_ARG_VAL_LEN],
 		char value[MAX_ARG_VAL_LEN],
 		char metadata[MAX_ARG_VAL_LEN]) {
 	if (table_check(table_name) != 0 || key_check(key) !=0) {
-		strcpy(cmd,"status=-1#error=1!");
+		strcpy(response,"status=-1#error=1!");
 		return;
 	} else {
 		// find table with given table name
@@ -339,19 +494,24 @@ void command_set(char* cmd,
 		if (table_p == 0) {
 			sprintf(message,"Error: unknown table name '%s'\n",table_name);
 			logger(server_log,message);
-			strcpy(cmd,"status=-1#error=5!");
+			strcpy(response,"status=-1#error=5!");
 			return;
 		} else if (strcmp(value,"{((NULL))}") == 0) {
 			int result = delete_entry(table_p,key);
 			if (result != 0) {
-				strcpy(cmd,"status=-1#error=6!");
+				strcpy(response,"status=-1#error=6!");
 			} else {
-				strcpy(cmd,"status=0!");
+				strcpy(response,"status=0!");
 			}
 			return;
 		} else {
 			// get rid of the leading '{' and trailing '}'
 			char value_buff[256];
+			if (strlen(value) < 2 || strlen(value) - 2 >= sizeof value_buff) {
+				logger(server_log,"Error: value has bad length\n");
+				strcpy(response,"status=-1#error=1!");
+				return;
+			}
 			strncpy(value_buff,&value[1],strlen(value)-2);
 			value_buff[strlen(value)-2] = '\0';
 			// value_arr that will be used to call set_entry function
@@ -366,7 +526,7 @@ void command_set(char* cmd,
 				if (p-&value_buff[0] >= strlen(value_buff)) {
 					if (col_index != table_p->col_count) {
 						logger(server_log,"Error: too few arguments in value\n");
-						strcpy(cmd,"status=-1#error=1");
+						strcpy(response,"status=-1#error=1!");
 						return;
 					}
 					break;
@@ -374,7 +534,7 @@ void command_set(char* cmd,
 				if (col_index >= table_p->col_count) {
 					// too many arguments
 					logger(server_log,"Error: too many arguments in value\n");
-					strcpy(cmd,"status=-1#error=1");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				}
 				// take out trailing and leading white-space
@@ -389,7 +549,7 @@ void command_set(char* cmd,
 					sprintf(message,"Error: unknown column name '%s' at index '%d'\n",
 							col_name,col_index);
 					logger(server_log,message);
-					strcpy(cmd,"status=-1#error=1");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				}
 				// fill value_arr
@@ -400,14 +560,14 @@ void command_set(char* cmd,
 					sprintf(message,"Error: value for column '%s' is not numeric\n",
 							table_p->columns[col_index]->name);
 					logger(server_log,message);
-					strcpy(cmd,"status=-1#error=1");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				} else if (table_p->columns[col_index]->type == CHAR
 						&& strlen(value_arr[col_index]) > table_p->columns[col_index]->str_len) {
 					sprintf(message,"Error: length of value for column '%s' is too long\n",
 							table_p->columns[col_index]->name);
 					logger(server_log,message);
-					strcpy(cmd,"status=-1#error=1");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				}
 				// increment col_index
@@ -415,22 +575,29 @@ void command_set(char* cmd,
 				// go to next chunk
 				p += (k+1);
 			}
-			// at this point, our value_arr is filled
-			int result = set_entry(table_p,key,value_arr,atoi(metadata));
+			// at this point, our value_arr is filled, parse int columns once
+			struct data_value values[MAX_COLUMNS_PER_TABLE];
+			for (col_index=0; col_index<table_p->col_count; col_index++) {
+				values[col_index].int_val =
+						table_p->columns[col_index]->type == INT ?
+						strtoll(value_arr[col_index],0,10) : 0;
+				values[col_index].str_val = value_arr[col_index];
+			}
+			int result = set_entry(table_p,key,values,atoi(metadata));
 			if (result != 0) {
-				strcpy(cmd,"status=-1#error=8!");
+				strcpy(response,"status=-1#error=8!");
 				return;
 			}
-			strcpy(cmd,"status=0!");
+			strcpy(response,"status=0!");
 		}
 	}
 }
 
-void command_get(char* cmd,
+void command_get(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char key[MAX_ARG_VAL_LEN]) {
 	if (table_check(table_name) != 0 || key_check(key) !=0) {
-		strcpy(cmd,"status=-1#error=1!");
+		strcpy(response,"status=-1#error=1!");
 		return;
 	} else {
 		// find table with given table name
@@ -438,42 +605,43 @@ void command_get(char* cmd,
 		if (table_p == 0) {
 			sprintf(message,"Error: unknown table name '%s'\n",table_name);
 			logger(server_log,message);
-			strcpy(cmd,"status=-1#error=5!");
+			strcpy(response,"status=-1#error=5!");
 			return;
 		} else {
-			struct data_entry* entry = find_entry(table_p,key);
-			if (entry == 0) {
+			struct row_version* version = get_version(table_p,key);
+			if (version == 0) {
 				sprintf(message,"Error: key '%s' not found in table '%s'\n",
 						key,table_name);
 				logger(server_log,message);
-				strcpy(cmd,"status=-1#error=6!");
+				strcpy(response,"status=-1#error=6!");
 				return;
 			}
 			char value_buff[MAX_VALUE_LEN];
 			strcpy(value_buff,"");
 			int col_index = 0;
 			for (col_index=0; col_index<table_p->col_count; col_index++) {
-				char temp[MAX_VALUE_LEN];
+				char col_value[MAX_VALUE_LEN], temp[MAX_VALUE_LEN];
+				version_get_value(table_p,version,col_index,col_value);
 				sprintf(temp,"%s %s",
 						table_p->columns[col_index]->name,
-						entry->value[col_index]);
+						col_value);
 				strcat(value_buff,temp);
 				if (col_index < table_p->col_count -1) {
 					strcat(value_buff,", ");
 				}
 			}
-			sprintf(cmd,"status=0#value=%s#metadata=%d!",value_buff,entry->metadata);
+			sprintf(response,"status=0#value=%s#metadata=%d!",value_buff,version->metadata);
+			release_version(version);
 		}
 	}
 }
 
-void command_query(char* cmd,
+void command_query(char* response,
 		char table_name[MAX_ARG_VAL_LEN],
 		char max[MAX_ARG_VAL_LEN],
 		char predicates[MAX_ARG_VAL_LEN]) {
-	flush_query_params();
 	if (table_check(table_name) != 0 || check_numeric(max) !=0) {
-		strcpy(cmd,"status=-1#error=1!");
+		strcpy(response,"status=-1#error=1!");
 	} else {
 		struct data_table* table_p = find_table(table_name);
 		int max_keys = atoi(max);
@@ -482,11 +650,19 @@ void command_query(char* cmd,
 		if (table_p == 0) {
 			sprintf(message,"Error: unknown table name '%s'\n",table_name);
 			logger(server_log,message);
-			strcpy(cmd,"status=-1#error=5!");
+			strcpy(response,"status=-1#error=5!");
 			return;
 		} else {
+			// the query of this request only
+			struct query_context ctx;
+			init_query(&ctx,table_p);
 			// get rid of the leading '{' and trailing '}'
 			char pred_buff[256];
+			if (strlen(predicates) < 2 || strlen(predicates) - 2 >= sizeof pred_buff) {
+				logger(server_log,"Error: predicates have bad length\n");
+				strcpy(response,"status=-1#error=1!");
+				return;
+			}
 			strncpy(pred_buff,&predicates[1],strlen(predicates)-2);
 			pred_buff[strlen(predicates)-2] = '\0';
 			char *p = &pred_buff[0];
@@ -510,21 +686,25 @@ void command_query(char* cmd,
 					sprintf(message,"Error: predicates condition '%s' "\
 							"has bad format\n",temp);
 					logger(server_log,message);
-					strcpy(cmd,"status=-1#error=1!");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				}
-				int result = set_query_params(table_p,col_name,operand,comp_val);
+				int result = set_query_params(&ctx,col_name,operand,comp_val);
 				if (result != 0) {
 					sprintf(message,"Error: predicates condition '%s' "\
 							"has bad content\n",temp);
 					logger(server_log,message);
-					strcpy(cmd,"status=-1#error=1!");
+					strcpy(response,"status=-1#error=1!");
 					return;
 				}
-				p += (k+1);
+				// go to next chunk, without stepping past the terminator
+				p += k;
+				if (*p == ',') {
+					p++;
+				}
 			}
 
-			query(table_p,keys,max_keys,&keys_acquired);
+			query(&ctx,keys,max_keys,&keys_acquired);
 		}
 
 		int k = 0;
@@ -536,7 +716,7 @@ void command_query(char* cmd,
 				strcat(keys_buff,",");
 			}
 		}
-		sprintf(cmd,"status=0#num=%d#keys={%s}!",keys_acquired,keys_buff);
+		sprintf(response,"status=0#num=%d#keys={%s}!",keys_acquired,keys_buff);
 		return;
 	}
 }
@@ -547,12 +727,209 @@ void command_query(char* cmd,
 
 
 
+/**
+ * @brief Process a request frame from a binary protocol client.
+ *
+ * @param frame The request frame, which is parsed in place.
+ * @param len The length of the request frame.
+ * @param response A buffer of MAX_RESPONSE_FRAME_LEN bytes where the
+ * response frame is written.
+ * @return Return the length of the response frame.
+ */
+size_t process_frame(char *frame, size_t len, char *response)
+{
+	sprintf(message,"Processing frame with opcode %d, %lu bytes\n",
+			frame[0],(unsigned long)len);
+	logger(server_log,message);
+
+	struct protocol_request req;
+	struct protocol_writer w;
+	protocol_writer_init(&w,response,MAX_RESPONSE_FRAME_LEN,frame[0],0);
+	int status = ERR_INVALID_PARAM;
+	if (protocol_parse_request(frame,len,&req) != 0) {
+		logger(server_log,"Error: malformed frame\n");
+	} else if (req.opcode == PROTO_AUTH) {
+		status = strcmp(params.username,req.username) == 0
+				&& strcmp(params.password,req.password) == 0 ?
+				0 : ERR_AUTHENTICATION_FAILED;
+	} else if (req.opcode == PROTO_GET) {
+		status = frame_get(&req,&w);
+	} else if (req.opcode == PROTO_SET) {
+		status = frame_set(&req);
+	} else if (req.opcode == PROTO_DELETE) {
+		status = frame_delete(&req);
+	} else if (req.opcode == PROTO_QUERY) {
+		status = frame_query(&req,&w);
+	}
+	size_t response_len = protocol_writer_finish(&w);
+	if (status != 0 || response_len == 0) {
+		// drop the payload, only the status is sent back
+		protocol_writer_init(&w,response,MAX_RESPONSE_FRAME_LEN,frame[0],
+				status != 0 ? status : ERR_UNKNOWN);
+		response_len = protocol_writer_finish(&w);
+	}
+
+	sprintf(message,"Response to client: status %d, %lu bytes\n",
+			response[1],(unsigned long)response_len);
+	logger(server_log,message);
+	return response_len;
+}
+
+/**
+ * Helper function to find the table of a frame, and check its key
+ * Return 0 if found, else the error code
+ */
+int frame_table(struct protocol_request* req, struct data_table** table_p) {
+	if (table_check(req->table) != 0
+			|| (req->key != 0 && key_check(req->key) != 0)) {
+		return ERR_INVALID_PARAM;
+	}
+	*table_p = find_table(req->table);
+	if (*table_p == 0) {
+		sprintf(message,"Error: unknown table name '%s'\n",req->table);
+		logger(server_log,message);
+		return ERR_TABLE_NOT_FOUND;
+	}
+	return 0;
+}
+
+int frame_get(struct protocol_request* req, struct protocol_writer* w) {
+	struct data_table* table_p;
+	int status = frame_table(req,&table_p);
+	if (status != 0) {
+		return status;
+	}
+	struct row_version* version = get_version(table_p,req->key);
+	if (version == 0) {
+		sprintf(message,"Error: key '%s' not found in table '%s'\n",
+				req->key,req->table);
+		logger(server_log,message);
+		return ERR_KEY_NOT_FOUND;
+	}
+	protocol_put_u32(w,version->metadata);
+	int col_index;
+	for (col_index=0; col_index<table_p->col_count; col_index++) {
+		if (table_p->columns[col_index]->type == INT) {
+			protocol_put_int_value(w,version_get_int(table_p,version,col_index));
+		} else {
+			char col_value[MAX_VALUE_LEN];
+			version_get_value(table_p,version,col_index,col_value);
+			protocol_put_str_value(w,col_value,strlen(col_value));
+		}
+		protocol_count(w);
+	}
+	release_version(version);
+	return 0;
+}
+
+int frame_set(struct protocol_request* req) {
+	struct data_table* table_p;
+	int status = frame_table(req,&table_p);
+	if (status != 0) {
+		return status;
+	}
+	if (req->count != table_p->col_count) {
+		logger(server_log,"Error: wrong number of values\n");
+		return ERR_INVALID_PARAM;
+	}
+	// values are typed already, only check them against the columns
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int col_index;
+	for (col_index=0; col_index<table_p->col_count; col_index++) {
+		struct data_column* column = table_p->columns[col_index];
+		struct protocol_value* value = &req->values[col_index];
+		if ((column->type == INT && value->type != PROTO_INT)
+				|| (column->type == CHAR && (value->type != PROTO_CHAR
+				|| value->str_len > column->str_len))) {
+			sprintf(message,"Error: bad value for column '%s'\n",column->name);
+			logger(server_log,message);
+			return ERR_INVALID_PARAM;
+		}
+		values[col_index].int_val = value->int_val;
+		values[col_index].str_val = value->str_val;
+	}
+	if (set_entry(table_p,req->key,values,req->metadata) != 0) {
+		return ERR_TRANSACTION_ABORT;
+	}
+	return 0;
+}
+
+int frame_delete(struct protocol_request* req) {
+	struct data_table* table_p;
+	int status = frame_table(req,&table_p);
+	if (status != 0) {
+		return status;
+	}
+	return delete_entry(table_p,req->key) == 0 ? 0 : ERR_KEY_NOT_FOUND;
+}
+
+int frame_query(struct protocol_request* req, struct protocol_writer* w) {
+	req->key = 0;
+	struct data_table* table_p;
+	int status = frame_table(req,&table_p);
+	if (status != 0) {
+		return status;
+	}
+	struct query_context ctx;
+	init_query(&ctx,table_p);
+	int k;
+	for (k=0; k<req->count; k++) {
+		struct protocol_predicate* pred = &req->predicates[k];
+		char operand[MAX_VALUE_LEN] = {pred->operator, 0};
+		char comp_val[MAX_VALUE_LEN];
+		if (pred->value.type == PROTO_INT) {
+			sprintf(comp_val,"%lld",pred->value.int_val);
+		} else if (pred->value.str_len < MAX_VALUE_LEN) {
+			strcpy(comp_val,pred->value.str_val);
+		} else {
+			return ERR_INVALID_PARAM;
+		}
+		if (strlen(pred->column) >= MAX_COLNAME_LEN
+				|| set_query_params(&ctx,pred->column,operand,comp_val) != 0) {
+			sprintf(message,"Error: predicate on column '%s' has bad content\n",
+					pred->column);
+			logger(server_log,message);
+			return ERR_INVALID_PARAM;
+		}
+	}
+	char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN];
+	int keys_acquired = 0;
+	query(&ctx,keys,req->max_keys,&keys_acquired);
+	// the number of matches, then as many keys as the client asked for
+	protocol_put_u32(w,keys_acquired);
+	for (k=0; k<keys_acquired && k<req->max_keys; k++) {
+		protocol_put_str(w,keys[k],strlen(keys[k]));
+		protocol_count(w);
+	}
+	return 0;
+}
+
+/**
+ * Helper function to log memory used versus held by every table
+ */
+void log_memory_usage() {
+	int k;
+	for (k=0; k<table_count; k++) {
+		unsigned long rows;
+		size_t resident;
+		size_t used = table_memory_usage(tables[k],&rows,&resident);
+		sprintf(message,"Table '%s': %lu rows, %lu bytes used, "\
+				"%lu bytes resident\n",tables[k]->name,rows,
+				(unsigned long)used,(unsigned long)resident);
+		logger(server_log,message);
+	}
+}
+
 /**
  * Helper function to check whether an input for table name has acceptable format
  */
 int table_check(char* table) {
 	char* allowed_characters = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 	char* p = table;
+	if (strlen(table) >= MAX_TABLE_LEN) {
+		logger(server_log,"Input for table is too long\n");
+		return 1;
+	}
 	while (*p != '\0') {
 		if (strchr(allowed_characters,*p) == NULL) {
 			sprintf(message,"Input '%s' for table has unacceptable character(s)\n",table);
@@ -570,6 +947,10 @@ int table_check(char* table) {
 int key_check(char* key) {
 	char* allowed_characters = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 	char* p = key;
+	if (strlen(key) >= MAX_KEY_LEN) {
+		logger(server_log,"Input for key is too long\n");
+		return 1;
+	}
 	while (*p != '\0') {
 		if (strchr(allowed_characters,*p) == NULL) {
 			sprintf(message,"Input '%s' for key has unacceptable character(s)\n",key);
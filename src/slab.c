@@ -0,0 +1,220 @@
+/**
+ * @file
+ * @brief This file implements the slab allocator declared in slab.h.
+ */
+
+#include <stdlib.h>
+#include "slab.h"
+
+// AddressSanitizer only sees the lifetime of objects that come from
+// malloc, so slabs are bypassed when building with it
+#if defined(__SANITIZE_ADDRESS__)
+#define SLAB_USE_MALLOC 1
+#else
+#define SLAB_USE_MALLOC 0
+#endif
+
+/**
+ * A thread's cache of free objects of one class, linked through their
+ * first word
+ */
+struct slab_cache {
+	void* head;
+	int count;
+};
+
+// every class of every allocator, indexed by class id
+static struct slab_class* registry[SLAB_MAX_GLOBAL_CLASSES];
+static int registry_count = 0;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// per-thread caches, given back to their classes when the thread exits
+static __thread struct slab_cache caches[SLAB_MAX_GLOBAL_CLASSES];
+static __thread int caches_registered = 0;
+static pthread_key_t caches_key;
+static pthread_once_t caches_key_once = PTHREAD_ONCE_INIT;
+
+#define NEXT(obj) (*(void**)(obj))
+
+// move up to count objects from a cache to its class
+static void cache_release(struct slab_class* c, struct slab_cache* cache, int count) {
+	if (count == 0) {
+		return;
+	}
+	void* first = cache->head;
+	void* last = first;
+	int k;
+	for (k=1; k<count; k++) {
+		last = NEXT(last);
+	}
+	cache->head = NEXT(last);
+	cache->count -= count;
+	pthread_mutex_lock(&c->lock);
+	NEXT(last) = c->free_list;
+	c->free_list = first;
+	pthread_mutex_unlock(&c->lock);
+}
+
+// give every cached object back when a thread exits
+static void caches_destroy(void* arg) {
+	int k;
+	for (k=0; k<registry_count; k++) {
+		if (caches[k].count > 0) {
+			cache_release(registry[k],&caches[k],caches[k].count);
+		}
+	}
+}
+
+static void caches_key_create() {
+	pthread_key_create(&caches_key,caches_destroy);
+}
+
+// carve a new chunk into objects on the class free list, lock must be held
+static int class_grow(struct slab_class* c) {
+	char* chunk = (char*)malloc(c->chunk_size);
+	if (chunk == 0) {
+		return -1;
+	}
+	// the first object-aligned slot links the chunks together
+	NEXT(chunk) = c->chunks;
+	c->chunks = chunk;
+	c->chunk_count++;
+	// push the objects from the end, so they are handed out in address order
+	size_t count = c->chunk_size / c->obj_size - 1;
+	char* obj = chunk + count * c->obj_size;
+	while (obj > chunk) {
+		NEXT(obj) = c->free_list;
+		c->free_list = obj;
+		obj -= c->obj_size;
+	}
+	return 0;
+}
+
+// fill an empty cache with a batch of objects from its class
+static int cache_refill(struct slab_class* c, struct slab_cache* cache) {
+	pthread_mutex_lock(&c->lock);
+	if (c->free_list == 0 && class_grow(c) != 0) {
+		pthread_mutex_unlock(&c->lock);
+		return -1;
+	}
+	// take a batch from the front of the free list, keeping its order
+	void* last = c->free_list;
+	cache->count = 1;
+	while (cache->count < SLAB_CACHE_SIZE / 2 && NEXT(last) != 0) {
+		last = NEXT(last);
+		cache->count++;
+	}
+	cache->head = c->free_list;
+	c->free_list = NEXT(last);
+	NEXT(last) = 0;
+	pthread_mutex_unlock(&c->lock);
+	return 0;
+}
+
+// find the smallest class that fits size, 0 if none
+static struct slab_class* find_class(struct slab_allocator* slab, size_t size) {
+	int k;
+	for (k=0; k<slab->class_count; k++) {
+		if (slab->classes[k].obj_size >= size) {
+			return &slab->classes[k];
+		}
+	}
+	return 0;
+}
+
+// make sure the calling thread gives its caches back when it exits
+static void register_thread() {
+	if (!caches_registered) {
+		pthread_once(&caches_key_once,caches_key_create);
+		pthread_setspecific(caches_key,(void*)1);
+		caches_registered = 1;
+	}
+}
+
+int slab_init(struct slab_allocator* slab, size_t* sizes, int count) {
+	slab->class_count = 0;
+	int k, m;
+	for (k=0; k<count; k++) {
+		// keep objects aligned for 64-bit values and pointers
+		size_t size = (sizes[k] + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+		if (find_class(slab,size) != 0 && find_class(slab,size)->obj_size == size) {
+			continue;
+		}
+		if (slab->class_count == SLAB_MAX_CLASSES) {
+			return -1;
+		}
+		// insert sorted by object size
+		m = slab->class_count;
+		while (m > 0 && slab->classes[m-1].obj_size > size) {
+			slab->classes[m] = slab->classes[m-1];
+			m--;
+		}
+		struct slab_class* c = &slab->classes[m];
+		c->obj_size = size;
+		c->chunk_size = SLAB_CHUNK_SIZE > 2 * size ? SLAB_CHUNK_SIZE : 2 * size;
+		c->free_list = 0;
+		c->chunks = 0;
+		c->chunk_count = 0;
+		c->used_objs = 0;
+		slab->class_count++;
+	}
+	// register the classes once their positions are final
+	pthread_mutex_lock(&registry_lock);
+	if (registry_count + slab->class_count > SLAB_MAX_GLOBAL_CLASSES) {
+		pthread_mutex_unlock(&registry_lock);
+		return -1;
+	}
+	for (k=0; k<slab->class_count; k++) {
+		struct slab_class* c = &slab->classes[k];
+		pthread_mutex_init(&c->lock,NULL);
+		c->id = registry_count;
+		registry[registry_count++] = c;
+	}
+	pthread_mutex_unlock(&registry_lock);
+	return 0;
+}
+
+void* slab_alloc(struct slab_allocator* slab, size_t size) {
+	struct slab_class* c = find_class(slab,size);
+	if (c == 0 || SLAB_USE_MALLOC) {
+		return malloc(size);
+	}
+	register_thread();
+	struct slab_cache* cache = &caches[c->id];
+	if (cache->count == 0 && cache_refill(c,cache) != 0) {
+		return 0;
+	}
+	void* obj = cache->head;
+	cache->head = NEXT(obj);
+	cache->count--;
+	__sync_fetch_and_add(&c->used_objs,1);
+	return obj;
+}
+
+void slab_free(struct slab_allocator* slab, void* ptr, size_t size) {
+	struct slab_class* c = find_class(slab,size);
+	if (c == 0 || SLAB_USE_MALLOC) {
+		free(ptr);
+		return;
+	}
+	register_thread();
+	struct slab_cache* cache = &caches[c->id];
+	NEXT(ptr) = cache->head;
+	cache->head = ptr;
+	cache->count++;
+	__sync_fetch_and_sub(&c->used_objs,1);
+	if (cache->count >= SLAB_CACHE_SIZE) {
+		cache_release(c,cache,SLAB_CACHE_SIZE / 2);
+	}
+}
+
+void slab_stats(struct slab_allocator* slab, size_t* resident, size_t* used) {
+	*resident = 0;
+	*used = 0;
+	int k;
+	for (k=0; k<slab->class_count; k++) {
+		struct slab_class* c = &slab->classes[k];
+		*resident += c->chunk_count * c->chunk_size;
+		*used += c->used_objs * c->obj_size;
+	}
+}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @brief This file declares a slab allocator for fixed-size objects.
+ *
+ * A slab allocator owns a few size classes. Each class carves large chunks
+ * into objects of one size and keeps freed objects on a free list, so
+ * allocating and freeing never goes back to malloc once the chunks exist.
+ * Every thread keeps a small cache of free objects per class and only
+ * takes the class lock to move a batch of objects in or out of its cache.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * Max size classes of one allocator
+ */
+#define SLAB_MAX_CLASSES 8
+
+/**
+ * Max size classes of all allocators (bounds the per-thread caches)
+ */
+#define SLAB_MAX_GLOBAL_CLASSES 1024
+
+/**
+ * Bytes of memory carved into objects at once
+ */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Max free objects in a thread's cache of a class, half of them are
+ * given back to the class when it is full
+ */
+#define SLAB_CACHE_SIZE 64
+
+/**
+ * A size class: objects of obj_size bytes carved from chunks
+ */
+struct slab_class {
+	int id; // index of the class in every thread's cache array
+	size_t obj_size;
+	size_t chunk_size;
+	pthread_mutex_t lock;
+	void* free_list;
+	void* chunks;
+	unsigned long chunk_count;
+	unsigned long used_objs;
+};
+
+/**
+ * A slab allocator with classes sorted by object size
+ */
+struct slab_allocator {
+	struct slab_class classes[SLAB_MAX_CLASSES];
+	int class_count;
+};
+
+/**
+ * Initialize an allocator with given object sizes (any order, duplicates
+ * are merged)
+ * Return -1 if failed, 0 if successful
+ */
+int slab_init(struct slab_allocator* slab, size_t* sizes, int count);
+
+/**
+ * Allocate an object of at least size bytes
+ * Falls back to malloc if no class is large enough, return 0 if failed
+ */
+void* slab_alloc(struct slab_allocator* slab, size_t size);
+
+/**
+ * Free an object allocated with slab_alloc with the same size
+ */
+void slab_free(struct slab_allocator* slab, void* ptr, size_t size);
+
+/**
+ * Get the bytes of memory held by an allocator's chunks, and the bytes
+ * of the objects currently allocated from them
+ */
+void slab_stats(struct slab_allocator* slab, size_t* resident, size_t* used);
+
+#endif /* SLAB_H_ */
@@ -11,11 +11,44 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "storage.h"
+#include "storage_pipeline.h"
 #include "utils.h"
 #include "parse_utils.h"
 #include <errno.h>
 #include <time.h>
+
+/**
+ * Kinds of operations waiting for a response
+ */
+enum op_type {OP_AUTH, OP_GET, OP_SET, OP_QUERY};
+
+/**
+ * An operation waiting for its response, with where its results go
+ */
+struct pending_op {
+	enum op_type type;
+	struct storage_record *record;
+	char **keys;
+	int max_keys;
+};
+
+/**
+ * A connection to the server: its socket and the buffer of the bytes
+ * received on it, the commands queued but not sent yet, and the
+ * operations waiting for their response in the order they were sent
+ */
+struct storage_conn {
+	struct line_reader reader;
+	char out[MAX_CMD_LEN * 8];
+	size_t out_len;
+	struct pending_op pending[MAX_PIPELINE_DEPTH];
+	int pending_head;
+	int pending_count;
+};
+
 /**
  * @brief This is just a minimal stub implementation.  You should modify it 
  * according to your design.
@@ -61,14 +94,156 @@ void* storage_connect(const char *hostname, const int port)
 		errno = 2;
 		return NULL;
 	}
+	// Commands are already batched by the pipeline, so do not let Nagle's
+	// algorithm hold back the tail of a batch.
+	int nodelay = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof nodelay);
+
+	struct storage_conn* c = (struct storage_conn*)malloc(sizeof(struct storage_conn));
+	if (c == NULL) {
+		close(sock);
+		errno = 7;
+		return NULL;
+	}
+	line_reader_init(&c->reader, sock);
+	c->out_len = 0;
+	c->pending_head = 0;
+	c->pending_count = 0;
+	return c;
+}
+
+
+/**
+ * Queue a command line and the operation waiting for its response.
+ * Return 0 if successful, -1 otherwise with errno set.
+ */
+static int queue_command(struct storage_conn *c, const char *cmd,
+		struct pending_op *op)
+{
+	size_t len = strlen(cmd);
+	if (c->pending_count == MAX_PIPELINE_DEPTH) {
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+	// Make room by sending what is queued.
+	if (c->out_len + len > sizeof c->out) {
+		if (sendall(c->reader.sock, c->out, c->out_len) != 0) {
+			errno = ERR_UNKNOWN;
+			return -1;
+		}
+		c->out_len = 0;
+	}
+	memcpy(c->out + c->out_len, cmd, len);
+	c->out_len += len;
+	c->pending[(c->pending_head + c->pending_count) % MAX_PIPELINE_DEPTH] = *op;
+	c->pending_count++;
+	return 0;
+}
+
+/**
+ * Apply the response of an operation.
+ * Return what the blocking function returns, setting errno on failure.
+ */
+static int complete_op(struct pending_op *op, char *buf)
+{
+	// Log server's response
+	sprintf(message,
+			"Server's response: '%s'\n",
+			buf);
+	logger(client_log,message);
+	// Parse response
+	struct command_args args;
+	if (parse_command_args(buf,&args) != 0) {
+		errno = ERR_UNKNOWN;
+		return -1;
+	}
+	// Get status
+	if (strcmp(command_arg(&args,"status").ptr,"0") != 0) {
+		if (op->type == OP_AUTH) {
+			errno = 4;
+		} else {
+			errno = command_arg(&args,"error").ptr[0] - '0';
+		}
+		return -1;
+	}
+	if (op->type == OP_GET) {
+		struct arg_slice value = command_arg(&args,"value");
+		if (value.len >= sizeof op->record->value) {
+			errno = ERR_UNKNOWN;
+			return -1;
+		}
+		memcpy(op->record->value,value.ptr,value.len + 1);
+		op->record->metadata[0] = atoi(command_arg(&args,"metadata").ptr);
+	} else if (op->type == OP_QUERY) {
+		struct arg_slice keys = command_arg(&args,"keys");
+		int num = atoi(command_arg(&args,"num").ptr);
+		// get rid of the leading '{' and trailing '}'
+		if (keys.len < 2) {
+			errno = ERR_UNKNOWN;
+			return -1;
+		}
+		keys.ptr[keys.len - 1] = '\0';
+		char *save;
+		char *p = strtok_r(keys.ptr + 1,",",&save);
+		int k = 0;
+		while (k < op->max_keys && k < num && p != NULL) {
+			// extract each key
+			op->keys[k] = (char*)malloc(MAX_KEY_LEN * sizeof(char));
+			strncpy(op->keys[k],p,MAX_KEY_LEN - 1);
+			op->keys[k][MAX_KEY_LEN - 1] = '\0';
+			p = strtok_r(NULL,",",&save);
+			k++;
+		}
+		if (op->max_keys > num) {
+			op->keys[num] = (char*)malloc(MAX_KEY_LEN);
+			op->keys[num][0] = '\0';
+		}
+		return num;
+	}
+	return 0;
+}
 
-	return (void*) sock;
+/**
+ * Wait for the response of the oldest operation waiting and apply it.
+ * Return what the blocking function returns, setting errno on failure,
+ * and set failed if the connection failed.
+ */
+static int collect_one(struct storage_conn *c, int *failed)
+{
+	char buf[MAX_CMD_LEN];
+	*failed = 0;
+	if (storage_pipeline_flush(c) != 0
+			|| recvline_buffered(&c->reader, buf, sizeof buf) != 0) {
+		*failed = 1;
+		errno = 7;
+		return -1;
+	}
+	struct pending_op op = c->pending[c->pending_head];
+	c->pending_head = (c->pending_head + 1) % MAX_PIPELINE_DEPTH;
+	c->pending_count--;
+	return complete_op(&op, buf);
 }
 
+/**
+ * Send a command and wait for its response. Refused while pipelined
+ * operations wait, so their results are left for storage_pipeline_collect().
+ * Return what the blocking function returns, setting errno on failure.
+ */
+static int run_command(struct storage_conn *c, const char *cmd,
+		struct pending_op *op)
+{
+	if (c->pending_count > 0) {
+		errno = ERR_INVALID_PARAM;
+		return -1;
+	}
+	if (queue_command(c, cmd, op) != 0)
+		return -1;
+	int failed;
+	return collect_one(c, &failed);
+}
 
 /**
- * @brief This is just a minimal stub implementation.  You should modify it 
- * according to your design.
+ * @brief Authenticate the connection, see storage.h.
  */
 int storage_auth(const char *username, const char *passwd, void *conn)
 {
@@ -88,45 +263,21 @@ int storage_auth(const char *username, const char *passwd, void *conn)
 			passwd);
 	logger(client_log,message);
 
-	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
-
 	// Send some data.
 	char buf[MAX_CMD_LEN];
-	memset(buf, 0, sizeof buf);
 	char *encrypted_passwd = generate_encrypted_password(passwd, NULL);
 	snprintf(buf, sizeof buf,
 			"action=authenticate#username=%s#password=%s!\n",
 			username, encrypted_passwd);
-
-	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
-		// Log server's response
-		sprintf(message,
-				"Server's response: '%s'\n",
-				buf);
-		logger(client_log,message);
-		// Parse response
-		struct protocol_arg_pair* args[MAX_ARG_NUM];
-		extract_arg_from_line(args,buf);
-		// Get status
-		char status[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"status",status);
-		if (strcmp(status,"0") == 0) {
-			return 0;
-		} else {
-			errno = 4;
-			return -1;
-		}
-	}
-	errno = 7;
-	return -1;
+	struct pending_op op = {OP_AUTH, NULL, NULL, 0};
+	return run_command(conn, buf, &op);
 }
 
 /**
- * @brief This is just a minimal stub implementation.  You should modify it 
- * according to your design.
+ * Build a GET command, return 0 if the parameters are valid
  */
-int storage_get(const char *table, const char *key, struct storage_record *record, void *conn)
+static int format_get(char *buf, const char *table, const char *key,
+		struct storage_record *record, void *conn)
 {
 	// Check parameters
 	if (table == NULL
@@ -145,52 +296,39 @@ int storage_get(const char *table, const char *key, struct storage_record *recor
 			key);
 	logger(client_log,message);
 
-	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
-
-	// Send some data.
-	char buf[MAX_CMD_LEN];
-	memset(buf, 0, sizeof buf);
-	snprintf(buf, sizeof buf,
+	snprintf(buf, MAX_CMD_LEN,
 			"action=get#table=%s#key=%s!\n",
 			table, key);
+	return 0;
+}
 
-	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
-		// Log server's response
-		sprintf(message,
-				"Server's response: '%s'\n",
-				buf);
-		logger(client_log,message);
-		// Parse response
-		struct protocol_arg_pair* args[MAX_ARG_NUM];
-		extract_arg_from_line(args,buf);
-		// Get status
-		char status[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"status",status);
-		if (strcmp(status,"0") == 0) {
-			char value[MAX_ARG_VAL_LEN],metadata[MAX_ARG_VAL_LEN];
-			get_arg_val(args,"value",value);
-			get_arg_val(args,"metadata",metadata);
-			strcpy(record->value,value);
-			record->metadata[0] = atoi(metadata);
-			return 0;
-		} else {
-			char error[MAX_ARG_VAL_LEN];
-			get_arg_val(args,"error",error);
-			errno = error[0] - '0';
-			return -1;
-		}
-	}
-	errno = 7;
-	return -1;
+/**
+ * @brief Retrieve the record of a key, see storage.h.
+ */
+int storage_get(const char *table, const char *key, struct storage_record *record, void *conn)
+{
+	char buf[MAX_CMD_LEN];
+	if (format_get(buf, table, key, record, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_GET, record, NULL, 0};
+	return run_command(conn, buf, &op);
 }
 
+int storage_pipeline_get(const char *table, const char *key,
+		struct storage_record *record, void *conn)
+{
+	char buf[MAX_CMD_LEN];
+	if (format_get(buf, table, key, record, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_GET, record, NULL, 0};
+	return queue_command(conn, buf, &op);
+}
 
 /**
- * @brief This is just a minimal stub implementation.  You should modify it 
- * according to your design.
+ * Build a SET command, return 0 if the parameters are valid
  */
-int storage_set(const char *table, const char *key, struct storage_record *record, void *conn)
+static int format_set(char *buf, const char *table, const char *key,
+		struct storage_record *record, void *conn)
 {
 	// Check parameters
 	if (table == NULL
@@ -220,44 +358,40 @@ int storage_set(const char *table, const char *key, struct storage_record *recor
 			value);
 	logger(client_log,message);
 
-	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
-
-	// Send some data.
-	char buf[MAX_CMD_LEN];
-	memset(buf, 0, sizeof buf);
-	snprintf(buf, sizeof buf,
+	snprintf(buf, MAX_CMD_LEN,
 			"action=set#table=%s#key=%s#value={%s}#metadata=%d!\n",
 			table, key, value, md);
+	return 0;
+}
 
-	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
-		// Log server's response
-		sprintf(message,
-				"Server's response: '%s'\n",
-				buf);
-		logger(client_log,message);
-		// Parse response
-		struct protocol_arg_pair* args[MAX_ARG_NUM];
-		extract_arg_from_line(args,buf);
-		// Get status
-		char status[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"status",status);
-		if (strcmp(status,"0") == 0) {
-			return 0;
-		} else {
-			char error[MAX_ARG_VAL_LEN];
-			get_arg_val(args,"error",error);
-			errno = error[0] - '0';
-			return -1;
-		}
-	}
-	errno = 7;
-	return -1;
+/**
+ * @brief Store or delete the record of a key, see storage.h.
+ */
+int storage_set(const char *table, const char *key, struct storage_record *record, void *conn)
+{
+	char buf[MAX_CMD_LEN];
+	if (format_set(buf, table, key, record, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_SET, NULL, NULL, 0};
+	return run_command(conn, buf, &op);
 }
 
+int storage_pipeline_set(const char *table, const char *key,
+		struct storage_record *record, void *conn)
+{
+	char buf[MAX_CMD_LEN];
+	if (format_set(buf, table, key, record, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_SET, NULL, NULL, 0};
+	return queue_command(conn, buf, &op);
+}
 
-int storage_query(const char *table, const char *predicates, char **keys,
-		const int max_keys, void *conn) {
+/**
+ * Build a QUERY command, return 0 if the parameters are valid
+ */
+static int format_query(char *buf, const char *table, const char *predicates,
+		char **keys, const int max_keys, void *conn)
+{
 	// Check parameters
 	if (table == NULL
 			|| predicates == NULL
@@ -277,71 +411,72 @@ int storage_query(const char *table, const char *predicates, char **keys,
 			predicates,
 			max_keys);
 	logger(client_log,message);
-	// Connection is really just a socket file descriptor.
-	int sock = (int)conn;
 
-	// Send some data.
-	char buf[MAX_CMD_LEN];
-	memset(buf, 0, sizeof buf);
-	snprintf(buf,sizeof(buf),
+	snprintf(buf, MAX_CMD_LEN,
 			"action=query#table=%s#max=%d#predicates={%s}!\n",
 			table,max_keys,predicates);
-	if (sendall(sock, buf, strlen(buf)) == 0 && recvline(sock, buf, sizeof buf) == 0) {
-		// Log server's response
+	return 0;
+}
 
-		sprintf(message,
-			"Server's response: '%s'\n",
-			buf);
-		logger(client_log,message);
-
-		// Parse response
-		struct protocol_arg_pair* args[MAX_ARG_NUM];
-		extract_arg_from_line(args,buf);
-
-		// Get status
-		char status[MAX_ARG_VAL_LEN];
-		get_arg_val(args,"status",status);
-
-		if (strcmp(status,"0") == 0) {
-			char keys_temp[MAX_ARG_VAL_LEN],num_str[MAX_ARG_VAL_LEN];
-			get_arg_val(args,"keys",keys_temp);
-			get_arg_val(args,"num",num_str);
-
-			int num = atoi(num_str);
-			// get rid of the leading '{' and trailing '}'
-			char keys_b[256];
-			strncpy(keys_b,&keys_temp[1],strlen(keys_temp)-2);
-			keys_b[strlen(keys_temp)-2] = '\0';
-			char *p = strtok(keys_b,",");
-			int k = 0;
-			while (k < max_keys && k < num) {
-				// extract each key
-				keys[k] = (char*)malloc(MAX_KEY_LEN * sizeof(char));
-				strcpy(keys[k],p);
-				p = strtok(NULL,",");
-				k++;
-			}
-			if (max_keys > num) {
-				keys[num] = (char*)malloc(MAX_KEY_LEN);
-				keys[num][0] = '\0';
-			}
-			return num;
-		} else {
-			char error[MAX_ARG_VAL_LEN];
-			get_arg_val(args,"error",error);
-			errno = error[0] - '0';
+int storage_query(const char *table, const char *predicates, char **keys,
+		const int max_keys, void *conn) {
+	char buf[MAX_CMD_LEN];
+	if (format_query(buf, table, predicates, keys, max_keys, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_QUERY, NULL, keys, max_keys};
+	return run_command(conn, buf, &op);
+}
+
+int storage_pipeline_query(const char *table, const char *predicates,
+		char **keys, const int max_keys, void *conn)
+{
+	char buf[MAX_CMD_LEN];
+	if (format_query(buf, table, predicates, keys, max_keys, conn) != 0)
+		return -1;
+	struct pending_op op = {OP_QUERY, NULL, keys, max_keys};
+	return queue_command(conn, buf, &op);
+}
+
+int storage_pipeline_flush(void *conn)
+{
+	if (conn == NULL) {
+		errno = 1;
+		return -1;
+	}
+	struct storage_conn *c = conn;
+	if (c->out_len > 0) {
+		if (sendall(c->reader.sock, c->out, c->out_len) != 0) {
+			errno = 7;
 			return -1;
 		}
+		c->out_len = 0;
 	}
-	errno = 7;
-	return -1;
+	return 0;
+}
+
+int storage_pipeline_collect(int *results, const int max_results, void *conn)
+{
+	if (conn == NULL || max_results < 0) {
+		errno = 1;
+		return -1;
+	}
+	struct storage_conn *c = conn;
+	int k = 0, failed = 0;
+	while (c->pending_count > 0) {
+		int result = collect_one(c, &failed);
+		if (failed)
+			return -1;
+		if (results != NULL && k < max_results)
+			results[k] = result >= 0 ? result : -errno;
+		k++;
+	}
+	return k;
 }
 
 
 
 /**
- * @brief This is just a minimal stub implementation.  You should modify it 
- * according to your design.
+ * @brief Close the connection, see storage.h.
  */
 int storage_disconnect(void *conn)
 {
@@ -355,8 +490,8 @@ int storage_disconnect(void *conn)
 	logger(client_log,"Received a DISCONNECT command\n");
 
 	// Cleanup
-	int sock = (int)conn;
-	close(sock);
+	close(((struct storage_conn*)conn)->reader.sock);
+	free(conn);
 
 	return 0;
 }
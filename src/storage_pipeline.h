@@ -0,0 +1,84 @@
+/**
+ * @file
+ * @brief This file declares the pipelined interface of the storage client
+ * library.
+ *
+ * The functions of storage.h send a command and wait for its response,
+ * so a connection does at most one operation per round trip. Here
+ * operations are queued on the connection instead: storage_pipeline_flush()
+ * sends every queued command at once and storage_pipeline_collect() reads
+ * their responses, which the server sends back in order.
+ *
+ * The records and key arrays given when queueing are filled when the
+ * responses are collected, so they must stay valid until then. The
+ * blocking functions fail with ERR_INVALID_PARAM while queued operations
+ * are not collected.
+ */
+
+#ifndef STORAGE_PIPELINE_H
+#define STORAGE_PIPELINE_H
+
+#include "storage.h"
+
+/**
+ * @brief Max operations waiting for their response on a connection.
+ *
+ * The server does not read further commands while the client leaves its
+ * responses unread, so a depth of a few hundred small commands is safe.
+ */
+#define MAX_PIPELINE_DEPTH 256
+
+/**
+ * @brief Queue a storage_get() on a connection.
+ * @return Return 0 if queued, and -1 otherwise.
+ *
+ * On error, errno will be set to ERR_INVALID_PARAM, or ERR_UNKNOWN if
+ * MAX_PIPELINE_DEPTH operations are already waiting.
+ */
+int storage_pipeline_get(const char *table, const char *key,
+		struct storage_record *record, void *conn);
+
+/**
+ * @brief Queue a storage_set() on a connection.
+ * @return Return 0 if queued, and -1 otherwise.
+ *
+ * The record is copied into the command, so it can be reused right away.
+ * On error, errno will be set as for storage_pipeline_get().
+ */
+int storage_pipeline_set(const char *table, const char *key,
+		struct storage_record *record, void *conn);
+
+/**
+ * @brief Queue a storage_query() on a connection.
+ * @return Return 0 if queued, and -1 otherwise.
+ *
+ * On error, errno will be set as for storage_pipeline_get().
+ */
+int storage_pipeline_query(const char *table, const char *predicates,
+		char **keys, const int max_keys, void *conn);
+
+/**
+ * @brief Send every queued command that was not sent yet.
+ * @return Return 0 if successful, and -1 otherwise.
+ *
+ * On error, errno will be set to ERR_INVALID_PARAM or ERR_UNKNOWN.
+ */
+int storage_pipeline_flush(void *conn);
+
+/**
+ * @brief Send what is queued and wait for the response of every queued
+ * operation.
+ *
+ * @param results Where the result of the k-th queued operation goes: what
+ * the blocking function returns on success, or minus the error code it
+ * would set errno to on failure. May be NULL.
+ * @param max_results The size of the results array.
+ * @param conn A connection to the server.
+ * @return Return the number of operations completed, and -1 if the
+ * connection failed.
+ *
+ * On error, errno will be set to ERR_INVALID_PARAM or ERR_UNKNOWN.
+ */
+int storage_pipeline_collect(int *results, const int max_results, void *conn);
+
+#endif
@@ -0,0 +1,238 @@
+/**
+ * @file
+ * @brief This file implements the table file declared in table_file.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "table_file.h"
+#include "wal.h"
+
+// bytes of the header and table descriptions at the start of a file
+static unsigned long long descriptions_size(unsigned int table_count) {
+	unsigned long long size = sizeof(struct table_file_header)
+			+ (unsigned long long)table_count * sizeof(struct table_file_table);
+	return (size + TABLE_FILE_ALIGN - 1) & ~(TABLE_FILE_ALIGN - 1ULL);
+}
+
+// write out the buffer
+static int flush(struct table_file_writer* writer) {
+	char* p = writer->buffer;
+	size_t len = writer->used;
+	while (len > 0) {
+		ssize_t n = write(writer->fd,p,len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	writer->used = 0;
+	return 0;
+}
+
+// append bytes to the file, zeros if data is 0
+static int append(struct table_file_writer* writer, const void* data,
+		size_t len) {
+	while (len > 0) {
+		if (writer->used == WAL_BUFFER_SIZE && flush(writer) != 0) {
+			return -1;
+		}
+		size_t n = WAL_BUFFER_SIZE - writer->used;
+		n = n < len ? n : len;
+		if (data != 0) {
+			memcpy(writer->buffer + writer->used,data,n);
+			data = (const char*)data + n;
+		} else {
+			memset(writer->buffer + writer->used,0,n);
+		}
+		writer->used += n;
+		writer->offset += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// pad the file up to the next aligned offset
+static int align(struct table_file_writer* writer) {
+	return append(writer,0,-writer->offset & (TABLE_FILE_ALIGN - 1));
+}
+
+int table_file_create(struct table_file_writer* writer, const char* path,
+		unsigned long long lsn, unsigned int table_count) {
+	memset(writer,0,sizeof(struct table_file_writer));
+	writer->buffer = (char*)malloc(WAL_BUFFER_SIZE);
+	writer->tables = (struct table_file_table*)
+			calloc(table_count + 1,sizeof(struct table_file_table));
+	writer->fd = open(path,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (writer->buffer == 0 || writer->tables == 0 || writer->fd < 0) {
+		free(writer->buffer);
+		free(writer->tables);
+		if (writer->fd >= 0) {
+			close(writer->fd);
+		}
+		return -1;
+	}
+	writer->header.magic = TABLE_FILE_MAGIC;
+	writer->header.lsn = lsn;
+	writer->header.table_count = table_count;
+	// the descriptions are written last, once they are complete
+	return append(writer,0,descriptions_size(table_count));
+}
+
+int table_file_begin(struct table_file_writer* writer,
+		struct table_file_table* table) {
+	if (writer->table == writer->header.table_count
+			|| table->rows >= 0xffffffffULL) {
+		return -1;
+	}
+	unsigned long long buckets = 2;
+	// at most 3/4 full
+	while (buckets * 3 < table->rows * 4) {
+		buckets *= 2;
+	}
+	writer->buckets = (struct table_bucket*)
+			calloc(buckets,sizeof(struct table_bucket));
+	if (writer->buckets == 0 || align(writer) != 0) {
+		return -1;
+	}
+	struct table_file_table* desc = &writer->tables[writer->table];
+	*desc = *table;
+	desc->buckets = buckets;
+	desc->slots_offset = writer->offset;
+	writer->slot = 0;
+	return 0;
+}
+
+int table_file_add(struct table_file_writer* writer, const char* slot,
+		unsigned int hash) {
+	struct table_file_table* desc = &writer->tables[writer->table];
+	if (writer->slot == desc->rows
+			|| append(writer,slot,desc->slot_size) != 0) {
+		return -1;
+	}
+	unsigned long long mask = desc->buckets - 1;
+	unsigned long long k = hash & mask;
+	while (writer->buckets[k].slot != 0) {
+		k = (k + 1) & mask;
+	}
+	writer->buckets[k].slot = ++writer->slot;
+	writer->buckets[k].hash = hash;
+	return 0;
+}
+
+int table_file_end(struct table_file_writer* writer) {
+	struct table_file_table* desc = &writer->tables[writer->table];
+	int result = -1;
+	if (writer->slot == desc->rows && align(writer) == 0) {
+		desc->buckets_offset = writer->offset;
+		result = append(writer,writer->buckets,
+				desc->buckets * sizeof(struct table_bucket));
+	}
+	free(writer->buckets);
+	writer->buckets = 0;
+	writer->table++;
+	return result;
+}
+
+int table_file_finish(struct table_file_writer* writer) {
+	unsigned int count = writer->header.table_count;
+	size_t len = count * sizeof(struct table_file_table);
+	writer->header.crc = crc32c(writer->tables,len);
+	int result = writer->table == count && flush(writer) == 0
+			&& pwrite(writer->fd,&writer->header,sizeof writer->header,0)
+					== sizeof writer->header
+			&& pwrite(writer->fd,writer->tables,len,sizeof writer->header)
+					== (ssize_t)len
+			&& fdatasync(writer->fd) == 0 ? 0 : -1;
+	close(writer->fd);
+	free(writer->buffer);
+	free(writer->tables);
+	return result;
+}
+
+int table_file_open(struct table_file* file, const char* path) {
+	int fd = open(path,O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd,&st) != 0 || st.st_size < (off_t)sizeof(struct table_file_header)) {
+		close(fd);
+		return -1;
+	}
+	file->size = st.st_size;
+	file->map = (char*)mmap(0,file->size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (file->map == MAP_FAILED) {
+		return -1;
+	}
+	file->header = (struct table_file_header*)file->map;
+	file->tables = (struct table_file_table*)(file->header + 1);
+	unsigned int count = file->header->table_count;
+	int valid = file->header->magic == TABLE_FILE_MAGIC
+			&& count <= MAX_TABLES && descriptions_size(count) <= file->size
+			&& crc32c(file->tables,count * sizeof(struct table_file_table))
+					== file->header->crc;
+	unsigned int k;
+	for (k=0; k<count && valid; k++) {
+		struct table_file_table* desc = &file->tables[k];
+		// every slot and bucket is inside the file
+		valid = desc->slot_size >= MAX_KEY_LEN && desc->rows < desc->buckets
+				&& (desc->buckets & (desc->buckets - 1)) == 0
+				&& desc->slots_offset <= file->size
+				&& desc->rows <= (file->size - desc->slots_offset) / desc->slot_size
+				&& desc->buckets_offset <= file->size
+				&& desc->buckets <= (file->size - desc->buckets_offset)
+						/ sizeof(struct table_bucket);
+	}
+	if (!valid) {
+		munmap(file->map,file->size);
+		return -1;
+	}
+	unsigned long long page = sysconf(_SC_PAGESIZE);
+	for (k=0; k<count; k++) {
+		// a lookup reads one bucket, reading ahead around it is wasted
+		struct table_file_table* desc = &file->tables[k];
+		unsigned long long start = desc->buckets_offset & ~(page - 1);
+		madvise(file->map + start,desc->buckets_offset - start
+				+ desc->buckets * sizeof(struct table_bucket),MADV_RANDOM);
+	}
+	return 0;
+}
+
+void table_file_image(struct table_file* file, unsigned int k,
+		struct table_image* image) {
+	struct table_file_table* desc = &file->tables[k];
+	image->slots = file->map + desc->slots_offset;
+	image->buckets = (struct table_bucket*)(file->map + desc->buckets_offset);
+	image->rows = desc->rows;
+	image->mask = desc->buckets - 1;
+	image->slot_size = desc->slot_size;
+}
+
+long table_image_find(struct table_image* image, const char* key,
+		unsigned int hash) {
+	if (image->rows == 0) {
+		return -1;
+	}
+	unsigned long k = hash & image->mask;
+	struct table_bucket* bucket;
+	// a slot is only read once its hash matches
+	while ((bucket = &image->buckets[k])->slot != 0) {
+		if (bucket->hash == hash && bucket->slot <= image->rows
+				&& strcmp(table_image_slot(image,bucket->slot - 1),key) == 0) {
+			return bucket->slot - 1;
+		}
+		k = (k + 1) & image->mask;
+	}
+	return -1;
+}
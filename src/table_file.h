@@ -0,0 +1,169 @@
+/**
+ * @file
+ * @brief This file declares the table file: the rows of tables laid out
+ * to be mapped into memory and read in place.
+ *
+ * A table file starts with a header and a description of each table,
+ * followed by the rows and the hash buckets of each table. Every row of a
+ * table has a slot of the same size, which starts with its
+ * null-terminated key; the rest of a slot is opaque to the file. A bucket
+ * holds the hash of a key and the number of its slot plus one, 0 for an
+ * empty bucket, and a key is found by probing the buckets from its hash
+ * on. Nothing is read when a file is opened but its header, so opening
+ * takes the same time whatever the size of the file, and a page of rows
+ * is only read from disk once a lookup or a scan touches it.
+ */
+
+#ifndef TABLE_FILE_H_
+#define TABLE_FILE_H_
+
+#include <stddef.h>
+#include "storage.h"
+
+/**
+ * First bytes of a table file, "TBLFILE1"
+ */
+#define TABLE_FILE_MAGIC 0x31454c49464c4254ULL
+
+/**
+ * Offsets of the rows and buckets of a table are multiples of this
+ */
+#define TABLE_FILE_ALIGN 64
+
+/**
+ * The header at the start of a table file
+ */
+struct table_file_header {
+	unsigned long long magic;
+	// LSN of the log the file holds the tables at
+	unsigned long long lsn;
+	unsigned int table_count;
+	// CRC32C of the table descriptions that follow the header
+	unsigned int crc;
+};
+
+/**
+ * The description of a table in a table file
+ */
+struct table_file_table {
+	char name[MAX_TABLE_LEN];
+	int col_count;
+	// type and size of each column, to check the rows fit the schema
+	int col_types[MAX_COLUMNS_PER_TABLE];
+	int col_sizes[MAX_COLUMNS_PER_TABLE];
+	unsigned long long slot_size;
+	unsigned long long rows;
+	// number of buckets, a power of two larger than rows
+	unsigned long long buckets;
+	unsigned long long slots_offset;
+	unsigned long long buckets_offset;
+};
+
+/**
+ * A bucket of the hash index of a table
+ */
+struct table_bucket {
+	// number of the slot of the key plus one, 0 if empty
+	unsigned int slot;
+	unsigned int hash;
+};
+
+/**
+ * The rows of a table in a mapped table file, with no rows if zeroed
+ */
+struct table_image {
+	char* slots;
+	struct table_bucket* buckets;
+	unsigned long rows;
+	unsigned long mask;
+	size_t slot_size;
+};
+
+/**
+ * A table file mapped into memory
+ */
+struct table_file {
+	char* map;
+	size_t size;
+	struct table_file_header* header;
+	struct table_file_table* tables;
+};
+
+/**
+ * A table file being written, one table after the other
+ */
+struct table_file_writer {
+	int fd;
+	char* buffer;
+	size_t used;
+	// offset in the file of the end of the buffer
+	unsigned long long offset;
+	struct table_file_header header;
+	struct table_file_table* tables;
+	// the table being written, its buckets and its next slot
+	unsigned int table;
+	struct table_bucket* buckets;
+	unsigned long long slot;
+};
+
+/**
+ * Get slot k of a table
+ */
+#define table_image_slot(image, k) \
+	((image)->slots + (size_t)(k) * (image)->slot_size)
+
+/**
+ * Create a table file of table_count tables at the state of the log at lsn
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_create(struct table_file_writer* writer, const char* path,
+		unsigned long long lsn, unsigned int table_count);
+
+/**
+ * Start writing the next table, described by its name, columns, slot
+ * size and number of rows
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_begin(struct table_file_writer* writer,
+		struct table_file_table* table);
+
+/**
+ * Write the next row of the table, a slot that starts with its key
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_add(struct table_file_writer* writer, const char* slot,
+		unsigned int hash);
+
+/**
+ * Finish writing the table, once all of its rows are written
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_end(struct table_file_writer* writer);
+
+/**
+ * Write out and sync the file, once all of its tables are written, and
+ * close it
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_finish(struct table_file_writer* writer);
+
+/**
+ * Map a table file into memory and check its header
+ * Return -1 if failed, 0 if successful
+ */
+int table_file_open(struct table_file* file, const char* path);
+
+/**
+ * Get the rows of table k of a mapped table file
+ */
+void table_file_image(struct table_file* file, unsigned int k,
+		struct table_image* image);
+
+/**
+ * Find the slot of a key
+ * Return its number, -1 if not found
+ */
+long table_image_find(struct table_image* image, const char* key,
+		unsigned int hash);
+
+#endif /* TABLE_FILE_H_ */
@@ -12,8 +12,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <errno.h>
+#include <crypt.h>
 #include "utils.h"
 #include "parse_utils.h"
+#include "wal.h"
+
+__thread char message[MAX_MESSAGE_LEN];
 
 int sendall(const int sock, const char *buf, const size_t len)
 {
@@ -32,8 +37,8 @@ int sendall(const int sock, const char *buf, const size_t len)
 /**
  * In order to avoid reading more than a line from the stream,
  * this function only reads one byte at a time.  This is very
- * inefficient, and you are free to optimize it or implement your
- * own function.
+ * inefficient: connections that are read from repeatedly should
+ * use a line_reader and recvline_buffered() instead.
  */
 int recvline(const int sock, char *buf, const size_t buflen)
 {
@@ -63,6 +68,65 @@ int recvline(const int sock, char *buf, const size_t buflen)
 	return status;
 }
 
+void line_reader_init(struct line_reader *reader, const int sock)
+{
+	reader->sock = sock;
+	reader->start = 0;
+	reader->end = 0;
+}
+
+ssize_t line_reader_fill(struct line_reader *reader)
+{
+	// Move the partial line to the front to make room after it.
+	if (reader->start > 0) {
+		memmove(reader->buf, reader->buf + reader->start,
+				reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->end == sizeof reader->buf) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	ssize_t bytes;
+	do {
+		bytes = recv(reader->sock, reader->buf + reader->end,
+				sizeof reader->buf - reader->end, 0);
+	} while (bytes < 0 && errno == EINTR);
+	if (bytes > 0)
+		reader->end += bytes;
+	return bytes;
+}
+
+ssize_t line_reader_next(struct line_reader *reader, char **line)
+{
+	char *head = reader->buf + reader->start;
+	char *eol = memchr(head, '\n', reader->end - reader->start);
+	if (eol == NULL)
+		return -1;
+	*eol = 0;
+	*line = head;
+	reader->start += eol - head + 1;
+	return eol - head;
+}
+
+int recvline_buffered(struct line_reader *reader, char *buf, const size_t buflen)
+{
+	char *line;
+	ssize_t len;
+	while ((len = line_reader_next(reader, &line)) < 0) {
+		if (line_reader_fill(reader) <= 0) {
+			*buf = 0;
+			return -1;
+		}
+	}
+	if ((size_t)len >= buflen)
+		len = buflen - 1;
+	memcpy(buf, line, len);
+	buf[len] = 0;
+	return 0;
+}
+
 
 /**
  * @brief Parse and process a line in the config file.
@@ -116,7 +180,29 @@ int process_config_line(char *line, struct config_params *params)
 			return -1;
 		}
 		params->concurrency = atoi(value);
+	} else if (strcmp(name, "io_model") == 0) {
+		if (params->io_model != -1) {
+			logger(server_log,"Config file error: multiple io_model entries\n");
+			return -1;
+		}
+		if (strcmp(value, "threads") == 0 || strcmp(value, "epoll") == 0) {
+			params->io_model = IO_THREADS;
+		} else if (strcmp(value, "thread_per_client") == 0) {
+			params->io_model = IO_THREAD_PER_CLIENT;
+		} else {
+			snprintf(message,sizeof message,"Config file error: unknown io_model '%.64s'\n",value);
+			logger(server_log,message);
+			return -1;
+		}
 	} else if (strcmp(name, "table") == 0) {
+		// columns start after the name, which may be followed by options,
+		// e.g. "census:columnar"
+		size_t cols_start = strlen(name)+strlen(value)+2;
+		char* table_opts = strchr(value,':');
+		if (table_opts != NULL) {
+			*table_opts = '\0';
+			table_opts++;
+		}
 		int k=0;
 		while (params->tables[k]!=0){
 			if (strcmp(params->tables[k]->name,value) == 0) {
@@ -129,16 +215,19 @@ int process_config_line(char *line, struct config_params *params)
 		}
 		params->tables[k] = (struct table*)malloc(sizeof(struct table));
 		strncpy(params->tables[k]->name,value,sizeof params->tables[k]->name);
+		strncpy(params->tables[k]->options,table_opts != NULL ? table_opts : "",
+				sizeof params->tables[k]->options - 1);
+		params->tables[k]->options[sizeof params->tables[k]->options - 1] = '\0';
 		params->tables[k]->col_count = 0;
 		// fill in column information
-		if (strlen(name)+strlen(value)+2 >= strlen(line)) {
+		if (cols_start >= strlen(line)) {
 			// no column information provided
 			sprintf(message,"Error: table '%s' is missing column information\n",name);
 			logger(server_log,message);
 			return -1;
 		}
 		char cols[MAX_CONFIG_LINE_LEN];
-		strcpy(cols,line+strlen(name)+strlen(value)+2);
+		strcpy(cols,line+cols_start);
 		int m=0;
 		char* p = strtok(cols," ,\n");
 		while (p != NULL) {
@@ -146,16 +235,68 @@ int process_config_line(char *line, struct config_params *params)
 			char* dilim = strchr(p,':');
 			strncpy(params->tables[k]->columns[m]->name,p,dilim-p);
 			params->tables[k]->columns[m]->name[dilim-p] = '\0';
-			strcpy(params->tables[k]->columns[m]->type,dilim+1);
+			// type may be followed by options, e.g. "Population:int:index"
+			char* opts = strchr(dilim+1,':');
+			if (opts == NULL) {
+				strcpy(params->tables[k]->columns[m]->type,dilim+1);
+				params->tables[k]->columns[m]->options[0] = '\0';
+			} else {
+				strncpy(params->tables[k]->columns[m]->type,dilim+1,opts-dilim-1);
+				params->tables[k]->columns[m]->type[opts-dilim-1] = '\0';
+				strncpy(params->tables[k]->columns[m]->options,opts+1,
+						sizeof params->tables[k]->columns[m]->options - 1);
+				params->tables[k]->columns[m]->options[
+						sizeof params->tables[k]->columns[m]->options - 1] = '\0';
+			}
 			p = strtok(NULL," ,\n");
 			m++;
 		}
 		params->tables[k]->col_count = m;
-	}
-	// else if (strcmp(name, "data_directory") == 0) {
-	//	strncpy(params->data_directory, value, sizeof params->data_directory);
-	//} 
-	else {
+	} else if (strcmp(name, "data_directory") == 0) {
+		if (*(params->data_directory) != '\0') {
+			logger(server_log,"Config file error: multiple data_directory entries\n");
+			return -1;
+		}
+		strncpy(params->data_directory, value, sizeof params->data_directory - 1);
+	} else if (strcmp(name, "durability") == 0) {
+		if (params->durability != -1) {
+			logger(server_log,"Config file error: multiple durability entries\n");
+			return -1;
+		}
+		if (strcmp(value, "always") == 0) {
+			params->durability = WAL_ALWAYS;
+		} else if (strcmp(value, "none") == 0) {
+			params->durability = WAL_NONE;
+		} else if (strcmp(value, "every_ms") == 0
+				&& sscanf(line, "%*s %*s %d", &params->durability_ms) == 1
+				&& params->durability_ms > 0) {
+			params->durability = WAL_EVERY_MS;
+		} else {
+			snprintf(message,sizeof message,"Config file error: bad durability '%.64s'\n",value);
+			logger(server_log,message);
+			return -1;
+		}
+	} else if (strcmp(name, "snapshot_interval") == 0) {
+		if (params->snapshot_interval != -1) {
+			logger(server_log,"Config file error: multiple snapshot_interval entries\n");
+			return -1;
+		}
+		params->snapshot_interval = atoi(value);
+		if (params->snapshot_interval < 0) {
+			logger(server_log,"Config file error: negative snapshot_interval\n");
+			return -1;
+		}
+	} else if (strcmp(name, "recovery_threads") == 0) {
+		if (params->recovery_threads != -1) {
+			logger(server_log,"Config file error: multiple recovery_threads entries\n");
+			return -1;
+		}
+		params->recovery_threads = atoi(value);
+		if (params->recovery_threads < 0) {
+			logger(server_log,"Config file error: negative recovery_threads\n");
+			return -1;
+		}
+	} else {
 		// Ignore unknown config parameters.
 	}
 	return 0;
@@ -177,6 +318,12 @@ int read_config(const char *config_file, struct config_params *params)
 	*(params->username) = '\0';
 	*(params->password) = '\0';
 	params->concurrency = -1;
+	params->io_model = -1;
+	*(params->data_directory) = '\0';
+	params->durability = -1;
+	params->durability_ms = 0;
+	params->snapshot_interval = -1;
+	params->recovery_threads = -1;
 	int k;
 	for (k=0; k<MAX_TABLES; k++) {
 		params->tables[k] = 0;
@@ -196,6 +343,14 @@ int read_config(const char *config_file, struct config_params *params)
 		else if (!feof(file))
 			error_occurred = 1;
 	}
+	if (params->io_model == -1)
+		params->io_model = IO_THREADS;
+	if (params->durability == -1)
+		params->durability = WAL_ALWAYS;
+	if (params->snapshot_interval == -1)
+		params->snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+	if (params->recovery_threads == -1)
+		params->recovery_threads = 0;
 	return error_occurred ? -1 : 0;
 }
 
@@ -278,59 +433,61 @@ struct tm* get_time_info() {
 /**
  * Communication protocol helper
  */
-void extract_arg_from_line(
-		struct protocol_arg_pair* args[MAX_ARG_NUM],
-		char line[MAX_CMD_LEN]) {
-	//printf("%s\n",line);
-	int k;
-	for (k=0; k<MAX_ARG_NUM; k++) {
-		args[k] = 0;
-	}
-	//printf("0\n");
+int parse_command_args(char* line, struct command_args* args) {
+	args->count = 0;
 	char* head = line;
-	char* tail = line;
-	k = 0;
 	while (*head != TERMINATE_CHAR) {
-		//printf("1 !!%d\n",k);
-		struct protocol_arg_pair* temp_args =
-				(struct protocol_arg_pair*)malloc(sizeof(protocol_arg_pair));
-		while (*head != '=') {
-			head++;
+		if (args->count == MAX_ARG_NUM) {
+			return -1;
 		}
-		//printf("2 !!%d\n",k);
-		strncpy(temp_args->arg_name,tail,head-tail);
-		temp_args->arg_name[head-tail] = '\0';
-		tail = head + 1;
-
-		while (*head != '#' && *head != TERMINATE_CHAR) {
-			head++;
+		// the name runs up to the first '=', the value up to '#' or '!'
+		char* eq = head;
+		while (*eq != '=' && *eq != '#' && *eq != TERMINATE_CHAR && *eq != '\0') {
+			eq++;
+		}
+		if (*eq != '=') {
+			return -1;
+		}
+		char* end = eq + 1;
+		while (*end != '#' && *end != TERMINATE_CHAR && *end != '\0') {
+			end++;
 		}
-		//printf("3 !!%d\n",k);
-		strncpy(temp_args->arg_val,tail,head-tail);
-		temp_args->arg_val[head-tail] = '\0';
-		tail = head + 1;
-		args[k] = temp_args;
-		//printf("4 !!%d\n",k);
-		k++;
+		if (*end == '\0') {
+			return -1;
+		}
+		struct arg_slice* name = &args->names[args->count];
+		struct arg_slice* val = &args->vals[args->count];
+		name->ptr = head;
+		name->len = eq - head;
+		val->ptr = eq + 1;
+		val->len = end - (eq + 1);
+		args->count++;
+		int last = *end == TERMINATE_CHAR;
+		*eq = '\0';
+		*end = '\0';
+		if (last) {
+			return 0;
+		}
+		head = end + 1;
 	}
+	*head = '\0';
+	return 0;
 }
 
 /**
  * Get argument value
  */
-int	get_arg_val(
-		struct protocol_arg_pair* args[MAX_ARG_NUM],
-		char* name,
-		char value[MAX_ARG_VAL_LEN]) {
-	int k = 0;
-	while (args[k] != 0) {
-		if (strcmp(args[k]->arg_name,name) == 0) {
-			strncpy(value,args[k]->arg_val,sizeof(args[k]->arg_val));
-			return 0;
+struct arg_slice command_arg(const struct command_args* args, const char* name) {
+	static char empty[1];
+	size_t len = strlen(name);
+	int k;
+	for (k=0; k<args->count; k++) {
+		if (args->names[k].len == len && memcmp(args->names[k].ptr,name,len) == 0) {
+			return args->vals[k];
 		}
-		k++;
 	}
-	return 1;
+	struct arg_slice missing = {empty, 0};
+	return missing;
 }
 
 
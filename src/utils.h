@@ -8,6 +8,8 @@
 #define UTILS_H
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
 #include "storage.h"
 
 
@@ -64,18 +66,54 @@ struct config_params {
 	// Concurrency for multiple clients
 	int concurrency;
 
-	/// The directory where tables are stored.
-//	char data_directory[MAX_PATH_LEN];
+	/// How client connections are served, one of enum io_model
+	int io_model;
+
+	/// The directory where tables are stored, empty if they are not.
+	char data_directory[MAX_PATH_LEN];
+
+	/// When a SET is on disk, one of enum wal_durability (see wal.h)
+	int durability;
+
+	/// Milliseconds between syncs of the log with durability every_ms
+	int durability_ms;
+
+	/// Seconds between snapshots of the tables, 0 for none
+	int snapshot_interval;
+
+	/// Threads replaying the log at startup, 0 for one per CPU
+	int recovery_threads;
 };
 
+/**
+ * Seconds between snapshots of the tables if the config file does not say
+ */
+#define DEFAULT_SNAPSHOT_INTERVAL 300
+
+/**
+ * @brief How the server serves client connections.
+ *
+ * IO_THREADS, the default ("threads" or "epoll" in the config file),
+ * serves every connection from a pool of concurrency worker threads fed
+ * by an epoll event loop (see event_loop.h): a worker handles the
+ * commands a connection has sent and moves on, so idle clients hold no
+ * worker. IO_THREAD_PER_CLIENT starts a thread for every connection, or
+ * serves a single client if concurrency is 0.
+ */
+enum io_model {IO_THREADS, IO_THREAD_PER_CLIENT};
+
 struct table {
 	char name[MAX_TABLE_LEN];
 	struct column* columns[MAX_COLUMNS_PER_TABLE];
 	int col_count;
+	// colon-separated table options following the name, e.g. "columnar"
+	char options[30];
 };
 struct column {
 	char name[MAX_COLNAME_LEN];
 	char type[30];
+	// colon-separated column options following the type, e.g. "index"
+	char options[30];
 };
 
 /**
@@ -99,11 +137,58 @@ static inline void die(char *msg, int code)
 int sendall(const int sock, const char *buf, const size_t len);
 
 /**
- * @brief Receive an entire line from a socket.
+ * @brief Receive an entire line from a socket, one byte at a time.
  * @return Return 0 on success, -1 otherwise.
  */
 int recvline(const int sock, char *buf, const size_t buflen);
 
+/**
+ * @brief A buffered reader of the lines sent on a socket.
+ *
+ * Each read takes as many bytes as are available, and the bytes past the
+ * end of a line are kept for the next line, so a line usually costs a
+ * single recv() or none at all.
+ */
+struct line_reader {
+	int sock;
+	/// Bytes received but not handed out yet are buf[start..end).
+	size_t start;
+	size_t end;
+	char buf[MAX_CMD_LEN];
+};
+
+/**
+ * @brief Initialize an empty reader of a socket.
+ */
+void line_reader_init(struct line_reader *reader, const int sock);
+
+/**
+ * @brief Read what is available on the socket into the reader's buffer.
+ * @return Return the number of bytes read, 0 if the peer closed the
+ * connection, -1 otherwise with errno set (EAGAIN if a non-blocking
+ * socket has nothing to read, EMSGSIZE if a line does not fit the buffer).
+ */
+ssize_t line_reader_fill(struct line_reader *reader);
+
+/**
+ * @brief Take the next complete line out of the reader's buffer, without
+ * reading from the socket.
+ *
+ * The newline is replaced by a null terminator and line points into the
+ * buffer; it stays valid until the next call to line_reader_fill().
+ * @return Return the length of the line, -1 if there is no complete line.
+ */
+ssize_t line_reader_next(struct line_reader *reader, char **line);
+
+/**
+ * @brief Receive an entire line through a reader, reading from the
+ * socket only when no complete line is buffered.
+ * @return Return 0 on success, -1 otherwise.
+ *
+ * Lines longer than buflen - 1 are truncated.
+ */
+int recvline_buffered(struct line_reader *reader, char *buf, const size_t buflen);
+
 /**
  * @brief Read and load configuration parameters.
  *
@@ -143,9 +228,10 @@ char *generate_encrypted_password(const char *passwd, const char *salt);
 #define MAX_LOG_FILE_NAME_LEN 32
 #define MAX_MESSAGE_LEN 1024
 
-// Log message
+// Log message, one buffer per thread so requests served in parallel do not
+// share it
 #define TIME_STAMP_TEMPLATE "[%Y/%m/%d %H:%M:%S]"
-char message[MAX_MESSAGE_LEN];
+extern __thread char message[MAX_MESSAGE_LEN];
 
 // Client-side logging
 #define CLIENT_LOG_FILE_NAME "Client-%Y-%m-%d-%H-%M-%S.log"
@@ -172,18 +258,38 @@ struct tm* get_time_info();
 #define MAX_ARG_VAL_LEN 800
 #define TERMINATE_CHAR '!'
 
-struct protocol_arg_pair {
-	char arg_name[MAX_ARG_NAME_LEN];
-	char arg_val[MAX_ARG_VAL_LEN];
-} protocol_arg_pair;
-
-void extract_arg_from_line(
-		struct protocol_arg_pair* args[MAX_ARG_NUM],
-		char line[MAX_CMD_LEN]);
-int	get_arg_val(
-		struct protocol_arg_pair* args[MAX_ARG_NUM],
-		char* name,
-		char value[MAX_ARG_VAL_LEN]);
+/**
+ * A slice of a command line: len bytes at ptr, followed by a null byte
+ */
+struct arg_slice {
+	char* ptr;
+	size_t len;
+};
+
+/**
+ * The arguments of a command line, as slices of the line
+ */
+struct command_args {
+	int count;
+	struct arg_slice names[MAX_ARG_NUM];
+	struct arg_slice vals[MAX_ARG_NUM];
+};
+
+/**
+ * Split a "name=value#name=value!" line into arguments in place: the '='
+ * after each name and the '#' or '!' after each value are replaced by
+ * null bytes, so the slices are also C strings. Nothing is allocated or
+ * copied, the slices are valid as long as the line is.
+ * Return 0 on success, -1 if the line has no TERMINATE_CHAR, an argument
+ * without '=' or more than MAX_ARG_NUM arguments
+ */
+int parse_command_args(char* line, struct command_args* args);
+
+/**
+ * Find the value of an argument
+ * Return its slice, or an empty slice if the argument is missing
+ */
+struct arg_slice command_arg(const struct command_args* args, const char* name);
 
 
 
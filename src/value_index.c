@@ -0,0 +1,123 @@
+/**
+ * @file
+ * @brief This file implements the value index declared in value_index.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "value_index.h"
+#include "epoch.h"
+
+// bytes of the list of a value of an index
+#define list_size(index) (sizeof(struct value_list) + (index)->size + 1)
+
+// copy the size chars of a value of an index into key, null-terminated
+static void value_key(struct value_index* index, const char* value, char* key) {
+	strncpy(key,value,index->size);
+	key[index->size] = '\0';
+}
+
+// the list of a null-terminated value, 0 if it was never seen
+static struct value_list* find_list(struct value_index* index, const char* key) {
+	struct hash_node* node = hash_index_find(&index->lists,key,hash_string(key));
+	return node != 0 ? hash_entry(node,struct value_list,node) : 0;
+}
+
+int value_index_init(struct value_index* index, int size,
+		struct slab_allocator* slab) {
+	index->size = size;
+	index->count = 0;
+	index->last_seen = 0;
+	index->slab = slab;
+	return hash_index_init(&index->lists);
+}
+
+void value_index_destroy(struct value_index* index) {
+	while (index->last_seen != 0) {
+		struct value_list* list = index->last_seen;
+		struct value_posting* posting = list->first;
+		while (posting != 0) {
+			struct value_posting* next = posting->next;
+			if (index->slab != 0) {
+				slab_free(index->slab,posting,sizeof(struct value_posting));
+			} else {
+				free(posting);
+			}
+			posting = next;
+		}
+		index->last_seen = list->seen;
+		free(list);
+	}
+	hash_index_destroy(&index->lists);
+	index->count = 0;
+}
+
+int value_index_insert(struct value_index* index, const char* value, void* item) {
+	char key[index->size + 1];
+	value_key(index,value,key);
+	struct value_list* list = find_list(index,key);
+	if (list == 0) {
+		list = (struct value_list*)malloc(list_size(index));
+		if (list == 0) {
+			return -1;
+		}
+		strcpy(list->value,key);
+		list->first = 0;
+		list->seen = index->last_seen;
+		list->node.key = list->value;
+		list->node.hash = hash_string(list->value);
+		hash_index_insert(&index->lists,&list->node);
+		index->last_seen = list;
+	}
+	struct value_posting* posting = index->slab != 0 ?
+			(struct value_posting*)slab_alloc(index->slab,sizeof(struct value_posting))
+			: (struct value_posting*)malloc(sizeof(struct value_posting));
+	if (posting == 0) {
+		return -1;
+	}
+	posting->item = item;
+	posting->next = list->first;
+	// complete before readers can reach it
+	__sync_synchronize();
+	list->first = posting;
+	index->count++;
+	return 0;
+}
+
+int value_index_remove(struct value_index* index, const char* value, void* item) {
+	char key[index->size + 1];
+	value_key(index,value,key);
+	struct value_list* list = find_list(index,key);
+	if (list == 0) {
+		return -1;
+	}
+	struct value_posting* volatile* link = &list->first;
+	while (*link != 0 && (*link)->item != item) {
+		link = &(*link)->next;
+	}
+	struct value_posting* posting = *link;
+	if (posting == 0) {
+		// not found
+		return -1;
+	}
+	*link = posting->next;
+	// readers may still be on the posting, its next pointer stays valid
+	epoch_retire(index->slab,posting,sizeof(struct value_posting));
+	index->count--;
+	return 0;
+}
+
+struct value_posting* value_index_find(struct value_index* index,
+		const char* value) {
+	if (strlen(value) > (size_t)index->size) {
+		// longer than any value of the column
+		return 0;
+	}
+	struct value_list* list = find_list(index,value);
+	return list != 0 ? list->first : 0;
+}
+
+size_t value_index_memory(struct value_index* index) {
+	return hash_index_memory(&index->lists)
+			+ hash_index_count(&index->lists) * list_size(index);
+}
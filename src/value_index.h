@@ -0,0 +1,101 @@
+/**
+ * @file
+ * @brief This file declares a value index: a hash index mapping the
+ * strings of a char column to the records holding them.
+ *
+ * Each value seen has a posting list, a linked list of the records
+ * holding it, found through a hash index (see hash_index.h) keyed by the
+ * value. A value keeps its list once seen, empty or not, so lists are
+ * never unlinked. Records are pushed at the head of a list and removed by
+ * walking it, so the index suits columns whose values each have a few
+ * records.
+ *
+ * Writers must be serialized by the caller. Readers may walk a list at
+ * the same time from inside an epoch (see epoch.h): a posting is linked
+ * in only once it is complete, and removed postings are retired, not
+ * freed.
+ */
+
+#ifndef VALUE_INDEX_H_
+#define VALUE_INDEX_H_
+
+#include "hash_index.h"
+#include "slab.h"
+
+/**
+ * A record holding a value
+ */
+struct value_posting {
+	void* item;
+	struct value_posting* volatile next;
+};
+
+/**
+ * The records holding a value, value null-terminated
+ */
+struct value_list {
+	struct hash_node node;
+	struct value_posting* volatile first;
+	// the list of the value seen before, to free the lists
+	struct value_list* seen;
+	char value[];
+};
+
+/**
+ * An index of values of size chars, compared as strncmp does
+ */
+struct value_index {
+	struct hash_index lists;
+	int size;
+	// number of postings, and the list of the value seen last
+	unsigned long count;
+	struct value_list* last_seen;
+	// allocator of the postings, 0 to use malloc
+	struct slab_allocator* slab;
+};
+
+/**
+ * Initialize an empty index of values of size chars whose postings are
+ * allocated from slab (0 to use malloc)
+ * Return -1 if failed, 0 if successful
+ */
+int value_index_init(struct value_index* index, int size,
+		struct slab_allocator* slab);
+
+/**
+ * Free the lists and postings of an index
+ */
+void value_index_destroy(struct value_index* index);
+
+/**
+ * Add a record to the list of a value, the size chars of a column
+ * Return -1 if failed, 0 if successful
+ */
+int value_index_insert(struct value_index* index, const char* value, void* item);
+
+/**
+ * Remove a record from the list of a value, the size chars of a column
+ * Return -1 if not found, 0 if successful
+ */
+int value_index_remove(struct value_index* index, const char* value, void* item);
+
+/**
+ * Get the first record of the list of a null-terminated value, safe to
+ * call next to a writer
+ * Return 0 if no record holds it
+ */
+struct value_posting* value_index_find(struct value_index* index,
+		const char* value);
+
+/**
+ * Get the posting following a posting in its list
+ */
+#define value_index_next(posting) ((posting)->next)
+
+/**
+ * Get the number of bytes used by an index's lists and hash index, its
+ * postings are counted by their allocator
+ */
+size_t value_index_memory(struct value_index* index);
+
+#endif /* VALUE_INDEX_H_ */
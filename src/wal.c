@@ -0,0 +1,458 @@
+/**
+ * @file
+ * @brief This file implements the write-ahead log declared in wal.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "utils.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/**
+ * Names of the segment files in the log's directory, with the LSN a
+ * segment starts at in between
+ */
+#define WAL_SEGMENT_PREFIX "wal-"
+#define WAL_SEGMENT_SUFFIX ".log"
+
+/**
+ * The frame of a record in the log, followed by its bytes
+ */
+struct wal_header {
+	unsigned int len;
+	unsigned int crc;
+};
+
+static unsigned int crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_hardware;
+
+static void crc32c_init() {
+	unsigned int k, bit;
+	for (k=0; k<256; k++) {
+		unsigned int crc = k;
+		for (bit=0; bit<8; bit++) {
+			// reflected Castagnoli polynomial
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1;
+		}
+		crc32c_table[k] = crc;
+	}
+#if defined(__x86_64__)
+	crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static unsigned int crc32c_software(unsigned int crc, const unsigned char* p,
+		size_t len) {
+	while (len-- > 0) {
+		crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const unsigned char* p,
+		size_t len) {
+	unsigned long long crc64 = crc;
+	while (len >= 8) {
+		unsigned long long word;
+		memcpy(&word,p,8);
+		crc64 = _mm_crc32_u64(crc64,word);
+		p += 8;
+		len -= 8;
+	}
+	crc = (unsigned int)crc64;
+	while (len-- > 0) {
+		crc = _mm_crc32_u8(crc,*p++);
+	}
+	return crc;
+}
+#endif
+
+unsigned int crc32c(const void* data, size_t len) {
+	pthread_once(&crc32c_once,crc32c_init);
+	unsigned int crc = 0xffffffffu;
+#if defined(__x86_64__)
+	if (crc32c_hardware) {
+		return ~crc32c_sse42(crc,(const unsigned char*)data,len);
+	}
+#endif
+	return ~crc32c_software(crc,(const unsigned char*)data,len);
+}
+
+// write all of len bytes
+static int write_all(int fd, const char* p, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd,p,len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// hand the buffered records to a write, and sync the log if sync is set,
+// the caller holds the lock and no write is in progress
+static void write_out(struct wal* wal, int sync) {
+	char* buffer = wal->buffer;
+	size_t used = wal->used;
+	unsigned long long lsn = wal->next_lsn;
+	// appends go on in the other buffer meanwhile
+	wal->buffer = wal->spare;
+	wal->used = 0;
+	wal->spare = buffer;
+	wal->writing = 1;
+	pthread_mutex_unlock(&wal->lock);
+	int result = write_all(wal->fd,buffer,used);
+	if (result == 0 && sync) {
+		result = fdatasync(wal->fd);
+	}
+	pthread_mutex_lock(&wal->lock);
+	wal->writing = 0;
+	if (result != 0) {
+		if (wal->failed == 0) {
+			sprintf(message,"Error: cannot write the log: %s\n",strerror(errno));
+			logger(server_log,message);
+		}
+		wal->failed = 1;
+	} else {
+		wal->written_lsn = lsn;
+		if (sync) {
+			wal->durable_lsn = lsn;
+			wal->syncs++;
+		}
+	}
+	pthread_cond_broadcast(&wal->written);
+}
+
+// write out and sync the log until lsn is durable, or written if sync is
+// not set, the caller holds the lock
+static int wait_for(struct wal* wal, unsigned long long lsn, int sync) {
+	while (wal->failed == 0
+			&& (sync ? wal->durable_lsn : wal->written_lsn) < lsn) {
+		if (wal->writing) {
+			// the write in progress may not hold lsn, look again after it
+			pthread_cond_wait(&wal->written,&wal->lock);
+		} else {
+			// lead a write of every record appended by now
+			write_out(wal,sync);
+		}
+	}
+	return wal->failed ? -1 : 0;
+}
+
+static void* syncer_main(void* arg) {
+	struct wal* wal = (struct wal*)arg;
+	pthread_mutex_lock(&wal->lock);
+	while (wal->stopping == 0) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME,&until);
+		until.tv_sec += wal->interval_ms / 1000;
+		until.tv_nsec += (wal->interval_ms % 1000) * 1000000L;
+		if (until.tv_nsec >= 1000000000L) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000L;
+		}
+		// woken by every write too, wait the whole interval anyway
+		while (wal->stopping == 0 && pthread_cond_timedwait(&wal->written,
+				&wal->lock,&until) != ETIMEDOUT) {
+		}
+		if (wal->durable_lsn < wal->next_lsn) {
+			wait_for(wal,wal->next_lsn,1);
+		}
+	}
+	pthread_mutex_unlock(&wal->lock);
+	return 0;
+}
+
+// pass the complete records of a segment to apply, return the number of
+// bytes they take or -1
+static long long read_segment(const char* path,
+		int (*apply)(const char* record, size_t len, void* arg), void* arg) {
+	FILE* file = fopen(path,"rb");
+	if (file == 0) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	char* record = (char*)malloc(WAL_MAX_RECORD);
+	if (record == 0) {
+		fclose(file);
+		return -1;
+	}
+	long long end = 0;
+	struct wal_header header;
+	while (fread(&header,sizeof header,1,file) == 1) {
+		if (header.len > WAL_MAX_RECORD
+				|| fread(record,1,header.len,file) != header.len
+				|| crc32c(record,header.len) != header.crc) {
+			// torn or corrupt: nothing after it was committed
+			break;
+		}
+		if (apply(record,header.len,arg) != 0) {
+			end = -1;
+			break;
+		}
+		end += sizeof header + header.len;
+	}
+	free(record);
+	fclose(file);
+	return end;
+}
+
+static void segment_path(char* path, size_t size, const char* directory,
+		unsigned long long lsn) {
+	snprintf(path,size,"%s/" WAL_SEGMENT_PREFIX "%020llu" WAL_SEGMENT_SUFFIX,
+			directory,lsn);
+}
+
+// fsync a directory, so the files created or removed in it are too
+static int sync_directory(const char* directory) {
+	int dir = open(directory,O_RDONLY);
+	if (dir < 0) {
+		return -1;
+	}
+	int result = fsync(dir);
+	close(dir);
+	return result;
+}
+
+static int compare_lsns(const void* a, const void* b) {
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+int wal_list_files(const char* directory, const char* prefix,
+		const char* suffix, unsigned long long* lsns, int max) {
+	DIR* dir = opendir(directory);
+	if (dir == 0) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	int count = 0;
+	size_t prefix_len = strlen(prefix);
+	struct dirent* file;
+	while ((file = readdir(dir)) != 0) {
+		char* end;
+		if (strncmp(file->d_name,prefix,prefix_len) != 0
+				|| file->d_name[prefix_len] < '0'
+				|| file->d_name[prefix_len] > '9') {
+			continue;
+		}
+		unsigned long long lsn = strtoull(file->d_name + prefix_len,&end,10);
+		if (strcmp(end,suffix) != 0) {
+			continue;
+		}
+		if (count == max) {
+			count = -1;
+			break;
+		}
+		lsns[count++] = lsn;
+	}
+	closedir(dir);
+	if (count > 0) {
+		qsort(lsns,count,sizeof(unsigned long long),compare_lsns);
+	}
+	return count;
+}
+
+int wal_open(struct wal* wal, const char* directory, int durability,
+		int interval_ms, unsigned long long from_lsn,
+		int (*apply)(const char* record, size_t len, void* arg), void* arg) {
+	char path[MAX_PATH_LEN + 64];
+	unsigned long long lsns[WAL_MAX_SEGMENTS];
+	if (mkdir(directory,0755) != 0 && errno != EEXIST) {
+		return -1;
+	}
+	int count = wal_list_files(directory,WAL_SEGMENT_PREFIX,WAL_SEGMENT_SUFFIX,
+			lsns,WAL_MAX_SEGMENTS);
+	if (count < 0) {
+		return -1;
+	}
+	// the segments before from_lsn were saved, the others must follow on
+	// from it without a gap
+	int first = 0;
+	while (first < count && lsns[first] < from_lsn) {
+		first++;
+	}
+	if (first < count && lsns[first] != from_lsn) {
+		sprintf(message,"Error: the log is missing records from LSN %llu\n",from_lsn);
+		logger(server_log,message);
+		return -1;
+	}
+	unsigned long long end = from_lsn;
+	int k;
+	for (k=first; k<count; k++) {
+		segment_path(path,sizeof path,directory,lsns[k]);
+		long long len = read_segment(path,apply,arg);
+		if (len < 0) {
+			return -1;
+		}
+		end = lsns[k] + len;
+		if (k < count - 1 && end != lsns[k+1]) {
+			// only the last segment can be cut short by a crash
+			sprintf(message,"Error: log segment %llu is damaged at LSN %llu\n",
+					lsns[k],end);
+			logger(server_log,message);
+			return -1;
+		}
+	}
+	for (k=0; k<first; k++) {
+		segment_path(path,sizeof path,directory,lsns[k]);
+		unlink(path);
+	}
+	// appends go right after the last complete record
+	wal->segment_lsn = first < count ? lsns[count-1] : from_lsn;
+	segment_path(path,sizeof path,directory,wal->segment_lsn);
+	wal->fd = open(path,O_WRONLY | O_CREAT | O_APPEND,0644);
+	if (wal->fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(wal->fd,&st) == 0 && (unsigned long long)st.st_size
+			> end - wal->segment_lsn) {
+		sprintf(message,"Log ends with a bad record at LSN %llu\n",end);
+		logger(server_log,message);
+	}
+	if (ftruncate(wal->fd,end - wal->segment_lsn) != 0
+			|| fdatasync(wal->fd) != 0 || sync_directory(directory) != 0) {
+		close(wal->fd);
+		return -1;
+	}
+	strncpy(wal->directory,directory,sizeof wal->directory - 1);
+	wal->directory[sizeof wal->directory - 1] = '\0';
+	wal->durability = durability;
+	wal->interval_ms = interval_ms > 0 ? interval_ms : 1;
+	wal->buffer = (char*)malloc(WAL_BUFFER_SIZE);
+	wal->spare = (char*)malloc(WAL_BUFFER_SIZE);
+	if (wal->buffer == 0 || wal->spare == 0) {
+		free(wal->buffer);
+		free(wal->spare);
+		close(wal->fd);
+		return -1;
+	}
+	wal->used = 0;
+	wal->writing = 0;
+	wal->next_lsn = end;
+	wal->written_lsn = end;
+	wal->durable_lsn = end;
+	wal->failed = 0;
+	wal->syncs = 0;
+	wal->stopping = 0;
+	pthread_mutex_init(&wal->lock,0);
+	pthread_cond_init(&wal->written,0);
+	if (durability == WAL_EVERY_MS
+			&& pthread_create(&wal->syncer,0,syncer_main,wal) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+unsigned long long wal_append(struct wal* wal, const void* record, size_t len) {
+	if (len > WAL_MAX_RECORD) {
+		return 0;
+	}
+	struct wal_header header;
+	header.len = len;
+	// computed before taking the lock
+	header.crc = crc32c(record,len);
+	pthread_mutex_lock(&wal->lock);
+	while (wal->failed == 0 && wal->used + sizeof header + len > WAL_BUFFER_SIZE) {
+		// full, make room by writing it out
+		wait_for(wal,wal->next_lsn,0);
+	}
+	if (wal->failed) {
+		pthread_mutex_unlock(&wal->lock);
+		return 0;
+	}
+	memcpy(wal->buffer + wal->used,&header,sizeof header);
+	memcpy(wal->buffer + wal->used + sizeof header,record,len);
+	wal->used += sizeof header + len;
+	wal->next_lsn += sizeof header + len;
+	unsigned long long lsn = wal->next_lsn;
+	pthread_mutex_unlock(&wal->lock);
+	return lsn;
+}
+
+int wal_commit(struct wal* wal, unsigned long long lsn) {
+	if (lsn == 0) {
+		return -1;
+	}
+	// with WAL_EVERY_MS the record is written, the syncer syncs it later
+	pthread_mutex_lock(&wal->lock);
+	int result = wait_for(wal,lsn,wal->durability == WAL_ALWAYS);
+	pthread_mutex_unlock(&wal->lock);
+	return result;
+}
+
+int wal_rotate(struct wal* wal, unsigned long long* lsn) {
+	pthread_mutex_lock(&wal->lock);
+	int result = wait_for(wal,wal->next_lsn,1);
+	while (wal->writing) {
+		pthread_cond_wait(&wal->written,&wal->lock);
+	}
+	if (result == 0 && wal->next_lsn != wal->segment_lsn) {
+		char path[MAX_PATH_LEN + 64];
+		segment_path(path,sizeof path,wal->directory,wal->next_lsn);
+		int fd = open(path,O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,0644);
+		if (fd < 0 || sync_directory(wal->directory) != 0) {
+			if (fd >= 0) {
+				close(fd);
+				unlink(path);
+			}
+			result = -1;
+		} else {
+			close(wal->fd);
+			wal->fd = fd;
+			wal->segment_lsn = wal->next_lsn;
+		}
+	}
+	*lsn = wal->segment_lsn;
+	pthread_mutex_unlock(&wal->lock);
+	return result;
+}
+
+void wal_truncate(struct wal* wal, unsigned long long lsn) {
+	char path[MAX_PATH_LEN + 64];
+	unsigned long long lsns[WAL_MAX_SEGMENTS];
+	int count = wal_list_files(wal->directory,WAL_SEGMENT_PREFIX,
+			WAL_SEGMENT_SUFFIX,lsns,WAL_MAX_SEGMENTS);
+	int k;
+	// a segment ends where the next one starts
+	for (k=0; k<count-1 && lsns[k+1]<=lsn; k++) {
+		segment_path(path,sizeof path,wal->directory,lsns[k]);
+		unlink(path);
+	}
+	sync_directory(wal->directory);
+}
+
+void wal_close(struct wal* wal) {
+	pthread_mutex_lock(&wal->lock);
+	wait_for(wal,wal->next_lsn,1);
+	wal->stopping = 1;
+	pthread_cond_broadcast(&wal->written);
+	pthread_mutex_unlock(&wal->lock);
+	if (wal->durability == WAL_EVERY_MS) {
+		pthread_join(wal->syncer,0);
+	}
+	close(wal->fd);
+	free(wal->buffer);
+	free(wal->spare);
+	pthread_mutex_destroy(&wal->lock);
+	pthread_cond_destroy(&wal->written);
+}
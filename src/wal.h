@@ -0,0 +1,143 @@
+/**
+ * @file
+ * @brief This file declares an append-only write-ahead log with group
+ * commit.
+ *
+ * Records are opaque to the log. Each is framed with its length and a
+ * CRC32C of its bytes, so a torn or corrupt tail is detected and cut off
+ * when the log is opened again. A record's log sequence number (LSN) is
+ * the log offset just past it.
+ *
+ * The log is kept in segment files named after the LSN they start at. A
+ * checkpoint starts a new segment, and once the state up to that LSN is
+ * saved elsewhere the segments before it are removed, so the log only
+ * holds what came after the last checkpoint.
+ *
+ * Appending only copies a record into a buffer, under a short lock.
+ * Committing waits until the record is written out as the durability
+ * mode asks: the first committer that finds no write in progress writes
+ * out everything appended so far with one write() and one fdatasync(),
+ * and every committer whose record was in that batch returns.
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <stddef.h>
+#include <pthread.h>
+#include "storage.h"
+
+/**
+ * Bytes of records buffered before an append has to write them out
+ */
+#define WAL_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Largest record accepted
+ */
+#define WAL_MAX_RECORD (64 * 1024)
+
+/**
+ * Largest number of segments a log may have
+ */
+#define WAL_MAX_SEGMENTS 1024
+
+/**
+ * When a committed record is on disk
+ *
+ * WAL_ALWAYS: before the commit returns. WAL_EVERY_MS: the commit hands
+ * the record to the operating system, and a background thread syncs the
+ * log within a given number of milliseconds. WAL_NONE: the commit hands
+ * the record to the operating system, which writes it when it likes. With
+ * either, a record survives the server but not the machine crashing.
+ */
+enum wal_durability {WAL_ALWAYS, WAL_EVERY_MS, WAL_NONE};
+
+/**
+ * A write-ahead log, kept in a file of its directory
+ */
+struct wal {
+	char directory[MAX_PATH_LEN];
+	// the segment appended to and the LSN it starts at
+	int fd;
+	unsigned long long segment_lsn;
+	int durability;
+	int interval_ms;
+	pthread_mutex_t lock;
+	// signalled whenever a write of the log completes
+	pthread_cond_t written;
+	// records appended but not handed to a write yet
+	char* buffer;
+	size_t used;
+	// the buffer being written, while writing is set
+	char* spare;
+	int writing;
+	// LSN past the last record appended, written out, and synced
+	unsigned long long next_lsn;
+	unsigned long long written_lsn;
+	unsigned long long durable_lsn;
+	// set once a write failed, every commit fails from then on
+	int failed;
+	// number of fdatasync() calls made
+	unsigned long syncs;
+	// the thread syncing the log every interval_ms with WAL_EVERY_MS
+	pthread_t syncer;
+	int stopping;
+};
+
+/**
+ * Compute the CRC32C of len bytes, with the SSE4.2 instruction if the
+ * CPU has it
+ */
+unsigned int crc32c(const void* data, size_t len);
+
+/**
+ * Open the log in directory, creating both if needed. First every
+ * complete record of the log from LSN from_lsn on is passed, in order, to
+ * apply, which returns 0 or -1 to stop; the log is then cut after the
+ * last complete record, and the segments before from_lsn are removed.
+ * Return -1 if failed, 0 if successful
+ */
+int wal_open(struct wal* wal, const char* directory, int durability,
+		int interval_ms, unsigned long long from_lsn,
+		int (*apply)(const char* record, size_t len, void* arg), void* arg);
+
+/**
+ * Append a record of len bytes
+ * Return its LSN, 0 if failed
+ */
+unsigned long long wal_append(struct wal* wal, const void* record, size_t len);
+
+/**
+ * Wait until the record of given LSN is as durable as the log's
+ * durability mode asks
+ * Return -1 if failed, 0 if successful
+ */
+int wal_commit(struct wal* wal, unsigned long long lsn);
+
+/**
+ * Sync every record appended and start a new segment, the caller makes
+ * sure no record is appended meanwhile
+ * Return -1 if failed, 0 if successful, with the LSN the segment starts at
+ */
+int wal_rotate(struct wal* wal, unsigned long long* lsn);
+
+/**
+ * Remove the segments that end at or before a given LSN
+ */
+void wal_truncate(struct wal* wal, unsigned long long lsn);
+
+/**
+ * Write out and sync every record appended, then close the log
+ */
+void wal_close(struct wal* wal);
+
+/**
+ * Find the LSNs of the files of directory named prefix, a decimal LSN and
+ * suffix, in increasing order
+ * Return how many there are, at most max, or -1 if failed
+ */
+int wal_list_files(const char* directory, const char* prefix,
+		const char* suffix, unsigned long long* lsns, int max);
+
+#endif /* WAL_H_ */
@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @brief This file implements the bounded work queue declared in
+ * work_queue.h.
+ */
+
+#include <stdlib.h>
+#include "work_queue.h"
+
+int work_queue_init(struct work_queue* queue, size_t capacity) {
+	queue->items = (void**)malloc(capacity * sizeof(void*));
+	if (queue->items == 0 || capacity == 0) {
+		free(queue->items);
+		return -1;
+	}
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->count = 0;
+	pthread_mutex_init(&queue->lock,NULL);
+	pthread_cond_init(&queue->not_empty,NULL);
+	pthread_cond_init(&queue->not_full,NULL);
+	return 0;
+}
+
+// append an item, the lock is held and the queue is not full
+static void append(struct work_queue* queue, void* item) {
+	queue->items[(queue->head + queue->count) % queue->capacity] = item;
+	queue->count++;
+	pthread_cond_signal(&queue->not_empty);
+}
+
+void work_queue_push(struct work_queue* queue, void* item) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->capacity) {
+		pthread_cond_wait(&queue->not_full,&queue->lock);
+	}
+	append(queue,item);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+int work_queue_try_push(struct work_queue* queue, void* item) {
+	pthread_mutex_lock(&queue->lock);
+	int full = queue->count == queue->capacity;
+	if (!full) {
+		append(queue,item);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return full ? -1 : 0;
+}
+
+void* work_queue_pop(struct work_queue* queue) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == 0) {
+		pthread_cond_wait(&queue->not_empty,&queue->lock);
+	}
+	void* item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return item;
+}
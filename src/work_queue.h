@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @brief This file declares a bounded queue of work items shared by
+ * producer and consumer threads.
+ *
+ * Any number of threads may push and pop. A push waits while the queue
+ * is full, so a producer that is faster than its consumers is slowed
+ * down to their pace instead of piling up work.
+ */
+
+#ifndef WORK_QUEUE_H_
+#define WORK_QUEUE_H_
+
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * A ring buffer of items with room for capacity of them
+ */
+struct work_queue {
+	void** items;
+	size_t capacity;
+	// items[head] is the oldest item, count items follow it
+	size_t head;
+	size_t count;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+/**
+ * Initialize an empty queue of given capacity
+ * Return 0 if successful, -1 otherwise
+ */
+int work_queue_init(struct work_queue* queue, size_t capacity);
+
+/**
+ * Append an item, waiting while the queue is full
+ */
+void work_queue_push(struct work_queue* queue, void* item);
+
+/**
+ * Append an item if the queue is not full
+ * Return 0 if appended, -1 if the queue is full
+ */
+int work_queue_try_push(struct work_queue* queue, void* item);
+
+/**
+ * Take the oldest item, waiting while the queue is empty
+ */
+void* work_queue_pop(struct work_queue* queue);
+
+#endif /* WORK_QUEUE_H_ */
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <math.h>
 #include "storage.h"
+#include "storage_pipeline.h"
 
 #define TESTTIMEOUT	10		// How long to wait for each test to run.
 #define SERVEREXEC	"./server"	// Server executable file.
@@ -18,6 +19,9 @@
 #define SIMPLETABLES_CONF		"conf-simpletables.conf"	// Server configuration file with simple tables.
 #define COMPLEXTABLES_CONF		"conf-complextables.conf"	// Server configuration file with complex tables.
 #define DUPLICATE_COLUMN_TYPES_CONF     "conf-duplicatetablecoltype.conf"        // Server configuration file with duplicate column types.
+#define DURABLETABLES_CONF		"conf-durabletables.conf"	// Server configuration file with simple tables logged to disk.
+#define SNAPSHOTTABLES_CONF		"conf-snapshottables.conf"	// Server configuration file with simple tables snapshotted to disk.
+#define INDEXTABLES_CONF		"conf-indextables.conf"	// Server configuration file with an indexed char column.
 #define BADTABLE	"bad table"	// A bad table name.
 #define BADKEY		"bad key"	// A bad key name.
 #define KEY		"somekey"	// A key used in the test cases.
@@ -36,7 +40,7 @@
 #define SERVERUSERNAME	"admin"		// The server username
 #define SERVERPASSWORD	"dog4sale"	// The server password
 //#define SERVERPUBLICKEY	"keys/public.pem"	// The server public key
-// #define DATADIR		"./mydata/"	// The data directory.
+#define DATADIR		"./mydata/"	// The data directory.
 #define TABLE		"inttbl"	// The table to use.
 #define INTTABLE	"inttbl"	// The first simple table.
 //#define FLOATTABLE	"floattbl"	// The second simple table.
@@ -46,6 +50,8 @@
 #define SIXCOLSTABLE	"sixcols"	// The third complex table.
 #define MISSINGTABLE	"missingtable"	// A non-existing table.
 #define MISSINGKEY	"missingkey"	// A non-existing key.
+#define INDEXTABLE	"idxtbl"	// The table with an indexed char column.
+#define ORDEREDTABLE	"ordtbl"	// The table with an indexed int column.
 
 #define FLOATTOLERANCE  0.0001		// How much a float value can be off by (due to type conversions).
 
@@ -201,6 +207,17 @@ int kill_server(int pid)
 	return status;
 }
 
+/**
+ * @brief Kill the server with given pid, start it again, and connect to it.
+ * @return A connection to the server if successful.
+ */
+void* restart_connect(int pid, char *config_file, char *serverout_file, int *serverpid)
+{
+	kill_server(pid);
+	waitpid(pid, NULL, 0);
+	return start_connect(config_file, serverout_file, serverpid);
+}
+
 
 /// Connection used by test fixture.
 void *test_conn = NULL;
@@ -218,6 +235,18 @@ void test_setup_simple()
 	fail_unless(test_conn != NULL, "Couldn't start or connect to server.");
 }
 
+/**
+ * @brief Text fixture setup.  Create an empty keys array, the test starts the server itself.
+ */
+void test_setup_keys()
+{
+	int i = 0;
+	for (i = 0; i < MAX_RECORDS_PER_TABLE; i++) {
+		test_keys[i] = (char*)malloc(MAX_KEY_LEN);
+		strncpy(test_keys[i], "", MAX_KEY_LEN);
+	}
+}
+
 /**
  * @brief Text fixture setup.  Start the server and populate the tables.
  */
@@ -695,6 +724,364 @@ END_TEST
 
 
 
+/*
+ * Restart tests with tables stored in the data directory:
+ * 	set, update and delete, kill the server and restart it (pass).
+ * 	set from several connections at once, so their commits are grouped (pass).
+ * 	update and delete after a snapshot is taken (pass).
+ */
+
+/**
+ * @brief Get an int record and check its value.
+ */
+void check_intval(void *conn, char *key, int expected)
+{
+	struct storage_record record;
+	int intval = 0;
+	strncpy(record.value, "", sizeof record.value);
+	int status = storage_get(INTTABLE, key, &record, conn);
+	fail_unless(status == 0, "Error getting a value.");
+	int fields = sscanf(record.value, "col %d", &intval);
+	fail_unless(fields == 1 && intval == expected, "Got wrong value.");
+}
+
+/**
+ * @brief Check that a record is deleted.
+ */
+void check_deleted(void *conn, char *table, char *key)
+{
+	struct storage_record record;
+	int status = storage_get(table, key, &record, conn);
+	fail_unless(status == -1, "storage_get for deleted key should fail.");
+	fail_unless(errno == ERR_KEY_NOT_FOUND, "storage_get for deleted key not setting errno properly.");
+}
+
+START_TEST (test_restart_setdelete)
+{
+	system("rm -rf " DATADIR);
+	int serverpid = 0;
+	void *conn = start_connect(DURABLETABLES_CONF, "test_restart_setdelete.serverout", &serverpid);
+
+	// Set, update and delete a few records.
+	struct storage_record record;
+	memset(&record, 0, sizeof record);
+	int status = 0;
+	strncpy(record.value, "col -2", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY1, &record, conn);
+	strncpy(record.value, "col 2", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY2, &record, conn);
+	strncpy(record.value, "col 4", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY3, &record, conn);
+	strncpy(record.value, "col 8", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY2, &record, conn);
+	status |= storage_set(INTTABLE, KEY1, NULL, conn);
+	strncpy(record.value, "col abc", sizeof record.value);
+	status |= storage_set(STRTABLE, KEY1, &record, conn);
+	strncpy(record.value, "col def", sizeof record.value);
+	status |= storage_set(STRTABLE, KEY1, &record, conn);
+	strncpy(record.value, "col ghi", sizeof record.value);
+	status |= storage_set(STRTABLE, KEY2, &record, conn);
+	status |= storage_set(STRTABLE, KEY2, NULL, conn);
+	fail_unless(status == 0, "Error setting a key/value pair.");
+
+	// Every SET was acknowledged, so it must survive the server dying.
+	conn = restart_connect(serverpid, DURABLETABLES_CONF, "test_restart_setdelete2.serverout", &serverpid);
+	check_deleted(conn, INTTABLE, KEY1);
+	check_intval(conn, KEY2, 8);
+	check_intval(conn, KEY3, 4);
+	check_deleted(conn, STRTABLE, KEY2);
+	strncpy(record.value, "", sizeof record.value);
+	status = storage_get(STRTABLE, KEY1, &record, conn);
+	fail_unless(status == 0, "Error getting a value.");
+	fail_unless(strcmp(trimtrailingspc(record.value), "col def") == 0, "Got wrong value.");
+	int foundkeys = storage_query(INTTABLE, "col > 0", test_keys, MAX_RECORDS_PER_TABLE, conn);
+	fail_unless(foundkeys == 2, "Query didn't find the correct number of keys.");
+
+	// A deleted key can be set again.
+	strncpy(record.value, "col 16", sizeof record.value);
+	status = storage_set(INTTABLE, KEY1, &record, conn);
+	fail_unless(status == 0, "Error setting a key/value pair.");
+	check_intval(conn, KEY1, 16);
+	storage_disconnect(conn);
+}
+END_TEST
+
+#define RESTART_CONNS	4	// Connections setting at once.
+#define RESTART_KEYS	100	// Keys set by each connection.
+
+START_TEST (test_restart_groupcommit)
+{
+	system("rm -rf " DATADIR);
+	int serverpid = 0;
+	void *conns[RESTART_CONNS];
+	conns[0] = start_connect(DURABLETABLES_CONF, "test_restart_groupcommit.serverout", &serverpid);
+	int c, k;
+	for (c = 1; c < RESTART_CONNS; c++) {
+		conns[c] = storage_connect(SERVERHOST, server_port);
+		fail_unless(conns[c] != NULL, "Couldn't connect to server.");
+		fail_unless(storage_auth(SERVERUSERNAME, SERVERPASSWORD, conns[c]) == 0, "Authentication failed.");
+	}
+
+	// Queue the SETs of every connection, send them all, then wait for
+	// them, so the server commits SETs of several connections at once.
+	// Every key is set twice, and every fifth key is then deleted.
+	struct storage_record record;
+	memset(&record, 0, sizeof record);
+	char key[MAX_KEY_LEN];
+	for (c = 0; c < RESTART_CONNS; c++) {
+		for (k = 0; k < RESTART_KEYS; k++) {
+			snprintf(key, sizeof key, "conn%dkey%d", c, k);
+			snprintf(record.value, sizeof record.value, "col %d", k);
+			storage_pipeline_set(INTTABLE, key, &record, conns[c]);
+			snprintf(record.value, sizeof record.value, "col %d", k + 1000);
+			storage_pipeline_set(INTTABLE, key, &record, conns[c]);
+			if (k % 5 == 0)
+				storage_pipeline_set(INTTABLE, key, NULL, conns[c]);
+		}
+	}
+	for (c = 0; c < RESTART_CONNS; c++)
+		fail_unless(storage_pipeline_flush(conns[c]) == 0, "Error sending the SETs.");
+	int results[3 * RESTART_KEYS];
+	for (c = 0; c < RESTART_CONNS; c++) {
+		int done = storage_pipeline_collect(results, 3 * RESTART_KEYS, conns[c]);
+		fail_unless(done == RESTART_KEYS * 2 + RESTART_KEYS / 5, "Not every SET was answered.");
+		for (k = 0; k < done; k++)
+			fail_unless(results[k] == 0, "Error setting a key/value pair.");
+	}
+
+	void *conn = restart_connect(serverpid, DURABLETABLES_CONF, "test_restart_groupcommit2.serverout", &serverpid);
+	for (c = 0; c < RESTART_CONNS; c++) {
+		for (k = 0; k < RESTART_KEYS; k++) {
+			snprintf(key, sizeof key, "conn%dkey%d", c, k);
+			if (k % 5 == 0)
+				check_deleted(conn, INTTABLE, key);
+			else
+				check_intval(conn, key, k + 1000);
+		}
+	}
+	storage_disconnect(conn);
+}
+END_TEST
+
+START_TEST (test_restart_snapshot)
+{
+	system("rm -rf " DATADIR);
+	int serverpid = 0;
+	void *conn = start_connect(SNAPSHOTTABLES_CONF, "test_restart_snapshot.serverout", &serverpid);
+
+	struct storage_record record;
+	memset(&record, 0, sizeof record);
+	int status = 0;
+	strncpy(record.value, "col -2", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY1, &record, conn);
+	strncpy(record.value, "col 2", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY2, &record, conn);
+	strncpy(record.value, "col 4", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY3, &record, conn);
+	fail_unless(status == 0, "Error setting a key/value pair.");
+
+	// Let a snapshot be taken, then change its records in the log only.
+	sleep(2);
+	strncpy(record.value, "col 8", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY2, &record, conn);
+	status |= storage_set(INTTABLE, KEY3, NULL, conn);
+	strncpy(record.value, "col 6", sizeof record.value);
+	status |= storage_set(INTTABLE, KEY4, &record, conn);
+	fail_unless(status == 0, "Error setting a key/value pair.");
+
+	// Durability every_ms only syncs later, but an acknowledged SET is
+	// already written, so it survives the server being killed.
+	conn = restart_connect(serverpid, SNAPSHOTTABLES_CONF, "test_restart_snapshot2.serverout", &serverpid);
+	check_intval(conn, KEY1, -2);
+	check_intval(conn, KEY2, 8);
+	check_deleted(conn, INTTABLE, KEY3);
+	check_intval(conn, KEY4, 6);
+	int foundkeys = storage_query(INTTABLE, "col > 0", test_keys, MAX_RECORDS_PER_TABLE, conn);
+	fail_unless(foundkeys == 2, "Query didn't find the correct number of keys.");
+	storage_disconnect(conn);
+}
+END_TEST
+
+
+
+/*
+ * Query tests on an indexed char column:
+ * 	equality queries after update, delete and reinsert (pass).
+ * 	the same on records read from the table file after a restart (pass).
+ * 	range queries on an indexed int column read from the table file (pass).
+ */
+
+/**
+ * @brief Set the col of a record of the indexed table, or delete it if value is NULL.
+ * @return Return 0 if successful, -1 otherwise.
+ */
+int set_indexed(void *conn, char *key, char *value)
+{
+	struct storage_record record;
+	memset(&record, 0, sizeof record);
+	if (value == NULL)
+		return storage_set(INDEXTABLE, key, NULL, conn);
+	snprintf(record.value, sizeof record.value, "col %s", value);
+	return storage_set(INDEXTABLE, key, &record, conn);
+}
+
+/**
+ * @brief Query the records of the indexed table whose col is value.
+ * @return Return the number of keys found, the keys are in test_keys.
+ */
+int query_indexed(void *conn, char *value)
+{
+	char predicates[MAX_VALUE_LEN];
+	snprintf(predicates, sizeof predicates, "col = %s", value);
+	int i = 0;
+	for (i = 0; i < MAX_RECORDS_PER_TABLE; i++)
+		strncpy(test_keys[i], "", MAX_KEY_LEN);
+	return storage_query(INDEXTABLE, predicates, test_keys, MAX_RECORDS_PER_TABLE, conn);
+}
+
+/**
+ * @brief Check whether the last query found a key.
+ * @return Return 1 if it did, 0 otherwise.
+ */
+int found_key(char *key, int foundkeys)
+{
+	int i = 0;
+	for (i = 0; i < foundkeys; i++) {
+		if (strcmp(test_keys[i], key) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Update, delete and reinsert records, checking the equality queries after each.
+ */
+void check_index_changes(void *conn)
+{
+	int foundkeys = 0;
+
+	// Move a record to another value.
+	fail_unless(set_indexed(conn, KEY1, "def") == 0, "Error updating a value.");
+	foundkeys = query_indexed(conn, "abc");
+	fail_unless(foundkeys == 1 && found_key(KEY2, foundkeys), "The returned keys don't match the query.");
+	foundkeys = query_indexed(conn, "def");
+	fail_unless(foundkeys == 2 && found_key(KEY1, foundkeys) && found_key(KEY3, foundkeys),
+		"The returned keys don't match the query.");
+
+	// Setting the same value again keeps a single match.
+	fail_unless(set_indexed(conn, KEY3, "def") == 0, "Error updating a value.");
+	foundkeys = query_indexed(conn, "def");
+	fail_unless(foundkeys == 2, "Query didn't find the correct number of keys.");
+
+	// Delete the last record holding a value.
+	fail_unless(set_indexed(conn, KEY2, NULL) == 0, "Error deleting the key/value pair.");
+	foundkeys = query_indexed(conn, "abc");
+	fail_unless(foundkeys == 0, "Query didn't find the correct number of keys.");
+
+	// Reinsert it, and a value never seen before.
+	fail_unless(set_indexed(conn, KEY2, "abc") == 0, "Error setting a key/value pair.");
+	fail_unless(set_indexed(conn, KEY4, "ghi") == 0, "Error setting a key/value pair.");
+	foundkeys = query_indexed(conn, "abc");
+	fail_unless(foundkeys == 1 && found_key(KEY2, foundkeys), "The returned keys don't match the query.");
+	foundkeys = query_indexed(conn, "ghi");
+	fail_unless(foundkeys == 1 && found_key(KEY4, foundkeys), "The returned keys don't match the query.");
+	foundkeys = query_indexed(conn, "xyz");
+	fail_unless(foundkeys == 0, "Query didn't find the correct number of keys.");
+}
+
+/**
+ * @brief Query the records of the table with an indexed int column.
+ * @return Return the number of keys found, the keys are in test_keys.
+ */
+int query_ordered(void *conn, char *predicates)
+{
+	int i = 0;
+	for (i = 0; i < MAX_RECORDS_PER_TABLE; i++)
+		strncpy(test_keys[i], "", MAX_KEY_LEN);
+	return storage_query(ORDEREDTABLE, predicates, test_keys, MAX_RECORDS_PER_TABLE, conn);
+}
+
+START_TEST (test_index_setdelete)
+{
+	system("rm -rf " DATADIR);
+	void *conn = start_connect(INDEXTABLES_CONF, "test_index_setdelete.serverout", NULL);
+	int status = 0;
+	status |= set_indexed(conn, KEY1, "abc");
+	status |= set_indexed(conn, KEY2, "abc");
+	status |= set_indexed(conn, KEY3, "def");
+	fail_unless(status == 0, "Error setting a key/value pair.");
+	int foundkeys = query_indexed(conn, "abc");
+	fail_unless(foundkeys == 2 && found_key(KEY1, foundkeys) && found_key(KEY2, foundkeys),
+		"The returned keys don't match the query.");
+	fail_unless(strcmp(test_keys[2], "") == 0, "No extra keys should be modified.\n");
+
+	check_index_changes(conn);
+	storage_disconnect(conn);
+}
+END_TEST
+
+START_TEST (test_index_filerows)
+{
+	system("rm -rf " DATADIR);
+	int serverpid = 0;
+	void *conn = start_connect(INDEXTABLES_CONF, "test_index_filerows.serverout", &serverpid);
+	int status = 0;
+	status |= set_indexed(conn, KEY1, "abc");
+	status |= set_indexed(conn, KEY2, "abc");
+	status |= set_indexed(conn, KEY3, "def");
+	fail_unless(status == 0, "Error setting a key/value pair.");
+
+	// Let a snapshot be taken, so the restarted server reads these
+	// records from the table file.
+	sleep(2);
+	conn = restart_connect(serverpid, INDEXTABLES_CONF, "test_index_filerows2.serverout", &serverpid);
+	int foundkeys = query_indexed(conn, "abc");
+	fail_unless(foundkeys == 2 && found_key(KEY1, foundkeys) && found_key(KEY2, foundkeys),
+		"The returned keys don't match the query.");
+
+	check_index_changes(conn);
+	storage_disconnect(conn);
+}
+END_TEST
+
+START_TEST (test_index_ordered_filerows)
+{
+	system("rm -rf " DATADIR);
+	int serverpid = 0;
+	void *conn = start_connect(INDEXTABLES_CONF, "test_index_ordered_filerows.serverout", &serverpid);
+	struct storage_record record;
+	int status = 0;
+	strncpy(record.value, "num 10", sizeof record.value);
+	status |= storage_set(ORDEREDTABLE, KEY1, &record, conn);
+	strncpy(record.value, "num 20", sizeof record.value);
+	status |= storage_set(ORDEREDTABLE, KEY2, &record, conn);
+	strncpy(record.value, "num 30", sizeof record.value);
+	status |= storage_set(ORDEREDTABLE, KEY3, &record, conn);
+	fail_unless(status == 0, "Error setting a key/value pair.");
+
+	// Let a snapshot be taken, so the restarted server reads these
+	// records from the table file.
+	sleep(2);
+	conn = restart_connect(serverpid, INDEXTABLES_CONF, "test_index_ordered_filerows2.serverout", &serverpid);
+	int foundkeys = query_ordered(conn, "num > 15");
+	fail_unless(foundkeys == 2 && found_key(KEY2, foundkeys) && found_key(KEY3, foundkeys),
+		"The returned keys don't match the query.");
+
+	// Move a record out of the range, and delete another.
+	strncpy(record.value, "num 5", sizeof record.value);
+	fail_unless(storage_set(ORDEREDTABLE, KEY3, &record, conn) == 0, "Error updating a value.");
+	fail_unless(storage_set(ORDEREDTABLE, KEY1, NULL, conn) == 0, "Error deleting the key/value pair.");
+	foundkeys = query_ordered(conn, "num > 15");
+	fail_unless(foundkeys == 1 && found_key(KEY2, foundkeys), "The returned keys don't match the query.");
+	foundkeys = query_ordered(conn, "num < 15");
+	fail_unless(foundkeys == 1 && found_key(KEY3, foundkeys), "The returned keys don't match the query.");
+	foundkeys = query_ordered(conn, "num = 10");
+	fail_unless(foundkeys == 0, "Query didn't find the correct number of keys.");
+
+	storage_disconnect(conn);
+}
+END_TEST
+
 
 /**
  * @brief This runs the marking tests for Assignment 3.
@@ -810,6 +1197,24 @@ int main(int argc, char *argv[])
 	tcase_add_test(tc, test_setcomplex_updatethreecols);
 	suite_add_tcase(s, tc);
 
+	// Restart tests with tables stored on disk
+	tc = tcase_create("restart");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup_keys, NULL);
+	tcase_add_test(tc, test_restart_setdelete);
+	tcase_add_test(tc, test_restart_groupcommit);
+	tcase_add_test(tc, test_restart_snapshot);
+	suite_add_tcase(s, tc);
+
+	// Query tests on an indexed column
+	tc = tcase_create("index");
+	tcase_set_timeout(tc, TESTTIMEOUT);
+	tcase_add_checked_fixture(tc, test_setup_keys, NULL);
+	tcase_add_test(tc, test_index_setdelete);
+	tcase_add_test(tc, test_index_filerows);
+	tcase_add_test(tc, test_index_ordered_filerows);
+	suite_add_tcase(s, tc);
+
 
 	SRunner *sr = srunner_create(s);
 	srunner_set_log(sr, "results.log");
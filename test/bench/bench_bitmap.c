@@ -0,0 +1,171 @@
+/**
+ * @file
+ * @brief Query time and memory of bitmap indexes.
+ *
+ * Loads Population.text over and over (with a numeric suffix on every key,
+ * and the number of the pass as Change) into census_columnar, which has no
+ * bitmap index, and into census_bitmap, whose Province, Change and Rank
+ * columns have one (see census_bitmap.conf). Then reports the memory of the
+ * indexes, times equality queries on both tables, and checks both find the
+ * same keys.
+ *
+ * Usage: bench_bitmap [rows] [config_file] [data_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "census_bitmap.conf"
+#define DEFAULT_DATA "../../src/Population.text"
+#define REPEAT 10		// Scans timed for each query.
+
+struct config_params params;
+
+// A query: two conditions.
+struct bench_query {
+	const char *name;
+	char cols[2][MAX_COLNAME_LEN];
+	char ops[2][MAX_VALUE_LEN];
+	char vals[2][MAX_VALUE_LEN];
+};
+
+// Fewer matches than MAX_RECORDS_PER_TABLE, so every query reads the table
+// to its end.
+static struct bench_query queries[] = {
+	{"Province = Ontario, Change = 7", {"Province", "Change"}, {"=", "="},
+			{"Ontario", "7"}},
+	{"Rank = 2, Change = 9", {"Rank", "Change"}, {"=", "="}, {"2", "9"}},
+	{"Province = Yukon, Change < 500", {"Province", "Change"},
+			{"=", "<"}, {"Yukon", "500"}},
+	{"Province = Quebec, Population > 3000000", {"Province", "Population"},
+			{"=", ">"}, {"Quebec", "3000000"}},
+};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_keys(const void *a, const void *b) {
+	return strcmp(a, b);
+}
+
+// Run a query REPEAT times, return ns per row, with the keys found sorted.
+static double run_query(struct data_table *table, struct bench_query *q,
+		long rows, char (*keys)[MAX_KEY_LEN], int *found) {
+	struct query_context ctx;
+	int c, r;
+	init_query(&ctx, table);
+	for (c = 0; c < 2; c++)
+		set_query_params(&ctx, q->cols[c], q->ops[c], q->vals[c]);
+	long long start = now_ns();
+	for (r = 0; r < REPEAT; r++)
+		query(&ctx, keys, MAX_RECORDS_PER_TABLE, found);
+	double ns = (double)(now_ns() - start) / REPEAT / rows;
+	qsort(keys, *found, MAX_KEY_LEN, compare_keys);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+	char *data_file = argc > 3 ? argv[3] : DEFAULT_DATA;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *plain = find_table("census_columnar");
+	struct data_table *indexed = find_table("census_bitmap");
+	FILE *data = fopen(data_file, "r");
+	if (plain == NULL || indexed == NULL || data == NULL) {
+		printf("Need census_columnar and census_bitmap tables and %s.\n",
+				data_file);
+		return 1;
+	}
+	int change_col = get_col_index(indexed, "Change");
+
+	// Split every line of the data file into a key and column values.
+	static char lines[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN];
+	static char text[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+	static struct data_value values[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE];
+	int line_count = 0;
+	char line[BUFSIZ];
+	while (line_count < MAX_RECORDS_PER_TABLE && fgets(line, sizeof line, data)) {
+		char *p = strtok(line, ",\n");
+		if (p == NULL)
+			continue;
+		// Leave room for the numeric suffix.
+		snprintf(lines[line_count], 9, "%s", p);
+		int col = 0;
+		while (col < indexed->col_count && (p = strtok(NULL, ",\n")) != NULL) {
+			char *space = strchr(p, ' ');
+			strcpy(text[line_count][col], space != NULL ? space + 1 : p);
+			values[line_count][col].int_val = atoll(text[line_count][col]);
+			values[line_count][col].str_val = text[line_count][col];
+			col++;
+		}
+		line_count++;
+	}
+	fclose(data);
+
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[MAX_KEY_LEN];
+		snprintf(key, sizeof key, "%s%ld", lines[k % line_count], k);
+		values[k % line_count][change_col].int_val = k / line_count;
+		if (set_entry(plain, key, values[k % line_count], 0) != 0
+				|| set_entry(indexed, key, values[k % line_count], 0) != 0) {
+			printf("Error: cannot load row %ld.\n", k);
+			return 1;
+		}
+	}
+
+	unsigned long count;
+	size_t resident, bitmap_bytes = 0;
+	size_t plain_bytes = table_memory_usage(plain, &count, &resident);
+	size_t indexed_bytes = table_memory_usage(indexed, &count, &resident);
+	int c;
+	for (c = 0; c < indexed->col_count; c++) {
+		struct bitmap_index *index = indexed->columns[c]->bitmap_index;
+		if (index == NULL)
+			continue;
+		printf("%-8s %6d values, %8.1f KB\n", indexed->columns[c]->name,
+				index->value_count, bitmap_index_memory(index) / 1e3);
+		bitmap_bytes += bitmap_index_memory(index);
+	}
+	printf("%ld rows, tables %.1f MB and %.1f MB, bitmaps %.1f MB (%.2f bytes/row)\n",
+			rows, plain_bytes / 1e6, indexed_bytes / 1e6, bitmap_bytes / 1e6,
+			(double)bitmap_bytes / rows);
+
+	char (*plain_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	char (*indexed_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	printf("%-44s %8s %11s %13s %9s\n", "query", "matches", "scan ns/row",
+			"bitmap ns/row", "speedup");
+	int q, wrong = 0;
+	for (q = 0; q < (int)(sizeof queries / sizeof queries[0]); q++) {
+		int plain_found, indexed_found;
+		double plain_ns = run_query(plain, &queries[q], rows, plain_keys, &plain_found);
+		double indexed_ns = run_query(indexed, &queries[q], rows, indexed_keys,
+				&indexed_found);
+		printf("%-44s %8d %11.2f %13.3f %8.2fx\n", queries[q].name, indexed_found,
+				plain_ns, indexed_ns, plain_ns / indexed_ns);
+		int same = plain_found == indexed_found;
+		for (k = 0; same && k < plain_found; k++)
+			same = strcmp(plain_keys[k], indexed_keys[k]) == 0;
+		wrong += !same;
+	}
+	if (wrong > 0) {
+		printf("Error: %d queries found different keys with and without bitmaps.\n",
+				wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * @file
+ * @brief Throughput of the server under many concurrent clients.
+ *
+ * Starts the server once per I/O model with a census table, then runs
+ * 10, 100 and 1000 clients that each keep one connection open and issue
+ * GETs back to back for a few seconds. Reports requests per second, the
+ * average latency seen by a client and how many clients got answers,
+ * which with the threads model's pool of workers should be all of them.
+ *
+ * Usage: bench_clients [seconds] [server_exec]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_SECONDS 3
+#define DEFAULT_SERVER "../../src/server"
+#define CONFIG_FILE "bench_clients.conf"
+#define WORKERS 4		// Server worker threads (concurrency).
+#define KEYS 100		// Keys loaded and read by the clients.
+#define LINE_LEN 1024
+
+static const char *io_models[] = {"thread_per_client", "threads"};
+static const int client_counts[] = {10, 100, 1000};
+
+static int port;
+static volatile int running;
+
+struct client {
+	pthread_t thread;
+	long requests;
+	long long busy_ns;
+	int failed;
+};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int connect_server() {
+	int sock = socket(PF_INET, SOCK_STREAM, 0);
+	// Time out of connect() and recv() so that waiting clients notice
+	// the end of the run, leaving connect() time for a SYN retry.
+	struct timeval connect_timeout = {2, 0}, recv_timeout = {0, 200000};
+	setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &connect_timeout,
+			sizeof connect_timeout);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof recv_timeout);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof addr) != 0) {
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+// Send a command and read its one-line response, waiting as long as
+// the run goes on.
+static int request(int sock, const char *cmd, char *response) {
+	size_t len = strlen(cmd);
+	if (send(sock, cmd, len, 0) != (ssize_t)len)
+		return -1;
+	size_t got = 0;
+	while (got == 0 || response[got - 1] != '\n') {
+		ssize_t bytes = recv(sock, response + got, LINE_LEN - 1 - got, 0);
+		if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && running)
+			continue;
+		if (bytes <= 0)
+			return -1;
+		got += bytes;
+	}
+	response[got] = '\0';
+	return strncmp(response, "status=0", 8) == 0 ? 0 : -1;
+}
+
+static void *client_main(void *arg) {
+	struct client *c = arg;
+	char cmd[LINE_LEN], response[LINE_LEN];
+	int sock = -1;
+	while (sock < 0 && running)
+		sock = connect_server();
+	if (sock < 0)
+		return NULL;
+	unsigned int seed = (unsigned int)(size_t)c;
+	while (running) {
+		snprintf(cmd, sizeof cmd, "action=get#table=census#key=city%d!\n",
+				rand_r(&seed) % KEYS);
+		long long start = now_ns();
+		if (request(sock, cmd, response) != 0) {
+			c->failed = running;
+			break;
+		}
+		// Only count what was answered during the run.
+		if (!running)
+			break;
+		c->busy_ns += now_ns() - start;
+		c->requests++;
+	}
+	close(sock);
+	return NULL;
+}
+
+static pid_t start_server(const char *server, const char *io_model) {
+	FILE *f = fopen(CONFIG_FILE, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "server_host localhost\nserver_port %d\n", port);
+	fprintf(f, "username admin\npassword xxxnq.BMCifhU\n");
+	fprintf(f, "concurrency %d\nio_model %s\n", WORKERS, io_model);
+	fprintf(f, "table census Province:char[50],Population:int,Change:int,Rank:int\n");
+	fclose(f);
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(server, server, CONFIG_FILE, (char *)NULL);
+		_exit(1);
+	}
+	// Wait until it listens, then load the keys.
+	int k, sock = -1;
+	for (k = 0; k < 100 && sock < 0; k++) {
+		usleep(20000);
+		sock = connect_server();
+	}
+	if (sock < 0)
+		return -1;
+	char cmd[LINE_LEN], response[LINE_LEN];
+	for (k = 0; k < KEYS; k++) {
+		snprintf(cmd, sizeof cmd, "action=set#table=census#key=city%d#value="
+				"{Province Ontario, Population %d, Change 1, Rank %d}"
+				"#metadata=0!\n", k, k * 1000, k);
+		if (request(sock, cmd, response) != 0) {
+			close(sock);
+			return -1;
+		}
+	}
+	close(sock);
+	return pid;
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+	const char *server = argc > 2 ? argv[2] : DEFAULT_SERVER;
+	port = 6000 + getpid() % 2000;
+
+	// Every client and its server side need a descriptor.
+	struct rlimit lim;
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+
+	printf("%18s %8s %14s %14s %8s\n", "io_model", "clients", "requests/s",
+			"avg us/req", "served");
+	int m, n;
+	for (m = 0; m < (int)(sizeof io_models / sizeof io_models[0]); m++) {
+		pid_t pid = start_server(server, io_models[m]);
+		if (pid < 0) {
+			printf("Error starting %s with io_model %s.\n", server, io_models[m]);
+			return 1;
+		}
+		for (n = 0; n < (int)(sizeof client_counts / sizeof client_counts[0]); n++) {
+			int count = client_counts[n];
+			struct client *clients = calloc(count, sizeof(struct client));
+			running = 1;
+			int k;
+			for (k = 0; k < count; k++)
+				pthread_create(&clients[k].thread, NULL, client_main, &clients[k]);
+			sleep(seconds);
+			running = 0;
+			long requests = 0;
+			long long busy = 0;
+			int failed = 0, served = 0;
+			for (k = 0; k < count; k++) {
+				pthread_join(clients[k].thread, NULL);
+				requests += clients[k].requests;
+				busy += clients[k].busy_ns;
+				failed += clients[k].failed;
+				served += clients[k].requests > 0;
+			}
+			printf("%18s %8d %14.0f %14.1f %8d", io_models[m], count,
+					(double)requests / seconds,
+					requests > 0 ? busy / 1000.0 / requests : 0.0, served);
+			if (failed > 0)
+				printf("  (%d clients failed)", failed);
+			printf("\n");
+			fflush(stdout);
+			free(clients);
+		}
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+	unlink(CONFIG_FILE);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file
+ * @brief Scans of a 10-column census table, row by row and by columns.
+ *
+ * Loads the same rows into the census table, stored row by row, and into
+ * census_columnar, declared "columnar" (see census_wide.conf). Then times
+ * queries whose conditions test one or two of the ten columns on both,
+ * and checks both find the same keys. The conditions match few rows, so
+ * every query scans the whole table.
+ *
+ * Usage: bench_columnar [rows] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "census_wide.conf"
+#define REPEAT 10		// Scans timed for each query.
+#define VALUE_RANGE 3000000
+
+struct config_params params;
+
+// A query: up to two conditions.
+struct bench_query {
+	const char *name;
+	char cols[2][MAX_COLNAME_LEN];
+	char ops[2][MAX_VALUE_LEN];
+	char vals[2][MAX_VALUE_LEN];
+	int count;
+};
+
+static struct bench_query queries[] = {
+	{"Population < 1000", {"Population"}, {"<"}, {"1000"}, 1},
+	{"Income = 4242", {"Income"}, {"="}, {"4242"}, 1},
+	{"Region = Nunavut", {"Region"}, {"="}, {"Nunavut"}, 1},
+	{"Area > 2999000, Rank < 1000000", {"Area", "Rank"}, {">", "<"},
+			{"2999000", "1000000"}, 2},
+};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_keys(const void *a, const void *b) {
+	return strcmp(a, b);
+}
+
+// Run a query REPEAT times, return ns per row, with the keys found sorted.
+static double run_query(struct data_table *table, struct bench_query *q,
+		long rows, char (*keys)[MAX_KEY_LEN], int *found) {
+	struct query_context ctx;
+	int c, r;
+	init_query(&ctx, table);
+	for (c = 0; c < q->count; c++)
+		set_query_params(&ctx, q->cols[c], q->ops[c], q->vals[c]);
+	long long start = now_ns();
+	for (r = 0; r < REPEAT; r++)
+		query(&ctx, keys, MAX_RECORDS_PER_TABLE, found);
+	double ns = (double)(now_ns() - start) / REPEAT / rows;
+	qsort(keys, *found, MAX_KEY_LEN, compare_keys);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+	static const char *regions[] = {"Atlantic", "Central", "Prairies", "West",
+			"North"};
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *row_table = find_table("census");
+	struct data_table *col_table = find_table("census_columnar");
+	if (row_table == NULL || col_table == NULL || col_table->column_store == NULL) {
+		printf("Need a census table and a columnar census_columnar table.\n");
+		return 1;
+	}
+
+	unsigned int seed = 297;
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[32];
+		char strs[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+		struct data_value values[MAX_COLUMNS_PER_TABLE];
+		int m;
+		for (m = 0; m < row_table->col_count; m++) {
+			values[m].int_val = rand_r(&seed) % VALUE_RANGE;
+			strcpy(strs[m], m == 0 ? "Ontario" : regions[rand_r(&seed) % 5]);
+			values[m].str_val = strs[m];
+		}
+		snprintf(key, sizeof key, "key%ld", k);
+		if (set_entry(row_table, key, values, 0) != 0
+				|| set_entry(col_table, key, values, 0) != 0) {
+			printf("Error: cannot load row %ld.\n", k);
+			return 1;
+		}
+	}
+
+	char (*row_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	char (*col_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	unsigned long used_rows;
+	size_t resident;
+	size_t row_bytes = table_memory_usage(row_table, &used_rows, &resident);
+	size_t col_bytes = table_memory_usage(col_table, &used_rows, &resident);
+	printf("%ld rows of %d columns, %.0f MB by rows, %.0f MB with the columns\n",
+			rows, row_table->col_count, row_bytes / 1e6, col_bytes / 1e6);
+	printf("%-34s %8s %12s %12s %9s\n", "query", "matches", "rows ns/row",
+			"columns ns/row", "speedup");
+	int q, wrong = 0;
+	for (q = 0; q < (int)(sizeof queries / sizeof queries[0]); q++) {
+		int row_found, col_found;
+		double row_ns = run_query(row_table, &queries[q], rows, row_keys, &row_found);
+		double col_ns = run_query(col_table, &queries[q], rows, col_keys, &col_found);
+		printf("%-34s %8d %12.2f %12.2f %8.2fx\n", queries[q].name, col_found,
+				row_ns, col_ns, row_ns / col_ns);
+		int same = row_found == col_found;
+		for (k = 0; same && k < row_found; k++)
+			same = strcmp(row_keys[k], col_keys[k]) == 0;
+		wrong += !same;
+	}
+	if (wrong > 0) {
+		printf("Error: %d queries found different keys by rows and by columns.\n",
+				wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file
+ * @brief Memory and scan time of a dictionary-encoded Province column.
+ *
+ * Loads Population.text over and over (with a numeric suffix on every key,
+ * and the number of the pass as Change) into census_columnar, whose
+ * Province column keeps its strings, and into census_dictionary, whose
+ * Province column keeps the codes of its strings (see
+ * census_dictionary.conf). Then reports the memory of both tables, times
+ * queries that test Province on both, and checks both find the same keys.
+ *
+ * Usage: bench_dictionary [rows] [config_file] [data_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "census_dictionary.conf"
+#define DEFAULT_DATA "../../src/Population.text"
+#define REPEAT 10		// Scans timed for each query.
+
+struct config_params params;
+
+// A query: two conditions.
+struct bench_query {
+	const char *name;
+	char cols[2][MAX_COLNAME_LEN];
+	char ops[2][MAX_VALUE_LEN];
+	char vals[2][MAX_VALUE_LEN];
+};
+
+static struct bench_query queries[] = {
+	{"Province = Ontario, Change = 7", {"Province", "Change"}, {"=", "="},
+			{"Ontario", "7"}},
+	{"Province = PrinceEdwardIsland, Change < 300", {"Province", "Change"},
+			{"=", "<"}, {"PrinceEdwardIsland", "300"}},
+	{"Province = Quebec, Population > 3000000", {"Province", "Population"},
+			{"=", ">"}, {"Quebec", "3000000"}},
+};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_keys(const void *a, const void *b) {
+	return strcmp(a, b);
+}
+
+// Run a query REPEAT times, return ns per row, with the keys found sorted.
+static double run_query(struct data_table *table, struct bench_query *q,
+		long rows, char (*keys)[MAX_KEY_LEN], int *found) {
+	struct query_context ctx;
+	int c, r;
+	init_query(&ctx, table);
+	for (c = 0; c < 2; c++)
+		set_query_params(&ctx, q->cols[c], q->ops[c], q->vals[c]);
+	long long start = now_ns();
+	for (r = 0; r < REPEAT; r++)
+		query(&ctx, keys, MAX_RECORDS_PER_TABLE, found);
+	double ns = (double)(now_ns() - start) / REPEAT / rows;
+	qsort(keys, *found, MAX_KEY_LEN, compare_keys);
+	return ns;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+	char *data_file = argc > 3 ? argv[3] : DEFAULT_DATA;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *plain = find_table("census_columnar");
+	struct data_table *coded = find_table("census_dictionary");
+	FILE *data = fopen(data_file, "r");
+	if (plain == NULL || coded == NULL || data == NULL) {
+		printf("Need census_columnar and census_dictionary tables and %s.\n",
+				data_file);
+		return 1;
+	}
+	int change_col = get_col_index(coded, "Change");
+
+	// Split every line of the data file into a key and column values.
+	static char lines[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN];
+	static char text[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+	static struct data_value values[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE];
+	int line_count = 0;
+	char line[BUFSIZ];
+	while (line_count < MAX_RECORDS_PER_TABLE && fgets(line, sizeof line, data)) {
+		char *p = strtok(line, ",\n");
+		if (p == NULL)
+			continue;
+		// Leave room for the numeric suffix.
+		snprintf(lines[line_count], 9, "%s", p);
+		int col = 0;
+		while (col < coded->col_count && (p = strtok(NULL, ",\n")) != NULL) {
+			char *space = strchr(p, ' ');
+			strcpy(text[line_count][col], space != NULL ? space + 1 : p);
+			values[line_count][col].int_val = atoll(text[line_count][col]);
+			values[line_count][col].str_val = text[line_count][col];
+			col++;
+		}
+		line_count++;
+	}
+	fclose(data);
+
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[MAX_KEY_LEN];
+		snprintf(key, sizeof key, "%s%ld", lines[k % line_count], k);
+		values[k % line_count][change_col].int_val = k / line_count;
+		if (set_entry(plain, key, values[k % line_count], 0) != 0
+				|| set_entry(coded, key, values[k % line_count], 0) != 0) {
+			printf("Error: cannot load row %ld.\n", k);
+			return 1;
+		}
+	}
+
+	unsigned long count;
+	size_t resident;
+	size_t plain_bytes = table_memory_usage(plain, &count, &resident);
+	size_t coded_bytes = table_memory_usage(coded, &count, &resident);
+	int province = get_col_index(coded, "Province");
+	printf("%ld rows, %u distinct provinces\n", rows,
+			coded->columns[province]->dictionary->count);
+	printf("strings: %.1f MB, codes: %.1f MB, %.1f MB saved (%.1f bytes/row)\n",
+			plain_bytes / 1e6, coded_bytes / 1e6,
+			((double)plain_bytes - coded_bytes) / 1e6,
+			((double)plain_bytes - coded_bytes) / rows);
+
+	char (*plain_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	char (*coded_keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	printf("%-44s %8s %14s %12s %9s\n", "query", "matches", "strings ns/row",
+			"codes ns/row", "speedup");
+	int q, wrong = 0;
+	for (q = 0; q < (int)(sizeof queries / sizeof queries[0]); q++) {
+		int plain_found, coded_found;
+		double plain_ns = run_query(plain, &queries[q], rows, plain_keys, &plain_found);
+		double coded_ns = run_query(coded, &queries[q], rows, coded_keys, &coded_found);
+		printf("%-44s %8d %14.2f %12.2f %8.2fx\n", queries[q].name, coded_found,
+				plain_ns, coded_ns, plain_ns / coded_ns);
+		int same = plain_found == coded_found;
+		for (k = 0; same && k < plain_found; k++)
+			same = strcmp(plain_keys[k], coded_keys[k]) == 0;
+		wrong += !same;
+	}
+	if (wrong > 0) {
+		printf("Error: %d queries found different keys with and without codes.\n",
+				wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file
+ * @brief Multi-threaded GET/SET mix on one table.
+ *
+ * Loads keys into the census table, then runs 1 to 16 threads that each
+ * do 90% GETs of random keys and 10% SETs, for a few seconds. A SET
+ * updates one of the thread's own keys, whose Rank column counts its
+ * updates, and one SET in a hundred deletes and re-inserts a key of the
+ * thread instead, so inserts and deletes take the table lock now and
+ * then. After each run every key must be there, with a Rank that matches
+ * the number of updates its thread made to it.
+ * Reports operations per second and the speedup over one thread.
+ *
+ * Usage: bench_get_set [keys per thread] [seconds] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_KEYS 10000
+#define DEFAULT_SECONDS 2
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_THREADS 16
+
+struct config_params params;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned int seed;
+	long *updates;		// Updates made to each key of the thread.
+	long ops;
+	long errors;
+};
+
+static struct data_table *table;
+static int keys_per_thread;
+static int threads;
+static int rank_col;
+static volatile int running;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Key k of thread t.
+static void make_key(char key[MAX_KEY_LEN], int t, int k) {
+	snprintf(key, MAX_KEY_LEN, "t%dk%d", t % 100, k % 10000000);
+}
+
+// Set a key whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	char key[MAX_KEY_LEN];
+	while (running) {
+		int r = rand_r(&w->seed);
+		if (r % 10 != 0) {
+			// GET a key of any thread.
+			make_key(key, (r >> 4) % threads, (r >> 8) % keys_per_thread);
+			struct row_version *version = get_version(table, key);
+			if (version != NULL) {
+				char value[MAX_VALUE_LEN];
+				int m;
+				for (m = 0; m < table->col_count; m++)
+					version_get_value(table, version, m, value);
+				release_version(version);
+			}
+			// A key being re-inserted by its thread may be missing.
+		} else {
+			int k = (r >> 8) % keys_per_thread;
+			make_key(key, w->id, k);
+			if (r % 1000 == 10) {
+				// Delete and re-insert, which starts the count over.
+				if (delete_entry(table, key) != 0)
+					w->errors++;
+				w->updates[k] = 0;
+			} else {
+				w->updates[k]++;
+			}
+			if (set_rank(key, w->updates[k]) != 0)
+				w->errors++;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+// Check the Rank of every key against its updates, return the mismatches.
+static long check_ranks(struct worker *workers) {
+	long wrong = 0;
+	int t, k;
+	for (t = 0; t < MAX_THREADS; t++) {
+		for (k = 0; k < keys_per_thread; k++) {
+			char key[MAX_KEY_LEN];
+			make_key(key, t, k);
+			struct row_version *version = get_version(table, key);
+			if (version == NULL) {
+				wrong++;
+				continue;
+			}
+			if (version_get_int(table, version, rank_col) != workers[t].updates[k])
+				wrong++;
+			release_version(version);
+		}
+	}
+	return wrong;
+}
+
+int main(int argc, char *argv[])
+{
+	keys_per_thread = argc > 1 ? atoi(argv[1]) : DEFAULT_KEYS;
+	int seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	rank_col = table != NULL ? get_col_index(table, "Rank") : -1;
+	if (rank_col < 0 || table->columns[rank_col]->type != INT) {
+		printf("Need a census table with an int Rank column.\n");
+		return 1;
+	}
+
+	struct worker workers[MAX_THREADS];
+	int t, k;
+	for (t = 0; t < MAX_THREADS; t++) {
+		workers[t].id = t;
+		workers[t].seed = 297 + t;
+		workers[t].updates = calloc(keys_per_thread, sizeof(long));
+		for (k = 0; k < keys_per_thread; k++) {
+			char key[MAX_KEY_LEN];
+			make_key(key, t, k);
+			set_rank(key, 0);
+		}
+	}
+
+	printf("%8s %12s %10s %8s\n", "threads", "ops/s", "speedup", "errors");
+	double single = 0;
+	long errors = 0;
+	for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		running = 1;
+		for (t = 0; t < threads; t++) {
+			workers[t].ops = 0;
+			workers[t].errors = 0;
+			pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+		}
+		long long start = now_ns();
+		struct timespec run_time = {seconds, 0};
+		nanosleep(&run_time, NULL);
+		running = 0;
+		long ops = 0, run_errors = 0;
+		for (t = 0; t < threads; t++) {
+			pthread_join(workers[t].thread, NULL);
+			ops += workers[t].ops;
+			run_errors += workers[t].errors;
+		}
+		double rate = ops * 1e9 / (now_ns() - start);
+		run_errors += check_ranks(workers);
+		if (threads == 1)
+			single = rate;
+		printf("%8d %12.0f %9.2fx %8ld\n", threads, rate, rate / single,
+				run_errors);
+		errors += run_errors;
+	}
+	if (errors > 0) {
+		printf("Error: concurrent operations lost or mixed up updates.\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file
+ * @brief Microbenchmark of the primary-key hash index.
+ *
+ * Inserts up to 10M keys and measures the average and worst insert
+ * latency and the average lookup latency at every power of ten, which
+ * should stay flat as the index grows.
+ *
+ * Usage: bench_hash_index [max_keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "storage.h"
+#include "hash_index.h"
+
+#define DEFAULT_MAX_KEYS 10000000L	// Largest index size measured.
+#define LOOKUPS 1000000L		// Lookups measured at each size.
+
+struct bench_node {
+	char key[MAX_KEY_LEN];
+	struct hash_node hash_node;
+};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	long max_keys = argc > 1 ? atol(argv[1]) : DEFAULT_MAX_KEYS;
+	struct bench_node *nodes = malloc(max_keys * sizeof(struct bench_node));
+	if (nodes == NULL) {
+		printf("Out of memory.\n");
+		return 1;
+	}
+	struct hash_index index;
+	hash_index_init(&index);
+
+	printf("%12s %14s %16s %14s\n", "keys", "insert ns/op",
+			"worst insert ns", "lookup ns/op");
+	long inserted = 0;
+	long step;
+	unsigned int seed = 297;
+	for (step = 1000; step <= max_keys; step *= 10) {
+		// Grow the index to the next power of ten.
+		long long worst = 0, insert_time = 0;
+		long first = inserted;
+		for (; inserted < step; inserted++) {
+			struct bench_node *n = &nodes[inserted];
+			snprintf(n->key, sizeof n->key, "key%ld", inserted);
+			n->hash_node.key = n->key;
+			n->hash_node.hash = hash_string(n->key);
+			long long t = now_ns();
+			hash_index_insert(&index, &n->hash_node);
+			t = now_ns() - t;
+			insert_time += t;
+			if (t > worst)
+				worst = t;
+		}
+
+		// Look up random keys that are present.
+		long found = 0;
+		long k;
+		long long start = now_ns();
+		for (k = 0; k < LOOKUPS; k++) {
+			struct bench_node *n = &nodes[rand_r(&seed) % inserted];
+			if (hash_index_find(&index, n->key, n->hash_node.hash) != NULL)
+				found++;
+		}
+		long long lookup_time = now_ns() - start;
+		if (found != LOOKUPS) {
+			printf("Error: %ld of %ld keys found.\n", found, LOOKUPS);
+			return 1;
+		}
+
+		printf("%12ld %14.1f %16lld %14.1f\n", step,
+				(double)insert_time / (step - first),
+				worst, (double)lookup_time / LOOKUPS);
+	}
+
+	hash_index_destroy(&index);
+	free(nodes);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file
+ * @brief Throughput of the scan kernels, for each one the CPU supports.
+ *
+ * Fills an array of random INT values, then times each kernel selecting
+ * the values less than, equal to and greater than a constant, and the AND
+ * of two bitmaps. Every kernel must select the same values as the scalar
+ * one. With 1M values the array stays in the caches; with 100M (800 MB)
+ * it does not, and the kernels run at the speed of memory.
+ *
+ * Usage: bench_kernels [values ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scan_kernels.h"
+
+#define VALUE_RANGE 3000000
+#define PASSES 300000000L	// Values scanned for each timing.
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char *op_names[] = {"<", "=", ">"};
+static const long long op_values[] = {VALUE_RANGE / 100, 4242, VALUE_RANGE - VALUE_RANGE / 100};
+
+// Time a kernel at an op, return ns per value, with the bits selected.
+static double time_select(long long *values, int n, enum scan_op op,
+		unsigned long long *bits) {
+	int reps = PASSES / n > 3 ? PASSES / n : 3, r;
+	long long start = now_ns();
+	for (r = 0; r < reps; r++)
+		scan_select_int(values, n, op, op_values[op], bits);
+	return (double)(now_ns() - start) / reps / n;
+}
+
+static int run(int n) {
+	long long *values = malloc((size_t)n * sizeof(long long));
+	size_t words = scan_words(n);
+	unsigned long long *expected[3], *bits = malloc(words * 8);
+	unsigned long long *other = malloc(words * 8);
+	unsigned int seed = 42;
+	int k, op, wrong = 0;
+	if (values == NULL || bits == NULL || other == NULL) {
+		printf("Error: cannot allocate %d values.\n", n);
+		return 1;
+	}
+	for (k = 0; k < n; k++)
+		values[k] = rand_r(&seed) % VALUE_RANGE;
+	printf("%d values, %.0f MB\n", n, n * 8 / 1e6);
+	printf("%-8s %3s %12s %10s %9s\n", "kernel", "op", "ns/value", "GB/s", "speedup");
+	double scalar_ns[3];
+	enum scan_kernel kernel;
+	for (kernel = SCAN_SCALAR; kernel < SCAN_KERNELS; kernel++) {
+		if (scan_use_kernel(kernel) != 0)
+			continue;
+		for (op = SCAN_LESS; op <= SCAN_GREATER; op++) {
+			double ns = time_select(values, n, op, bits);
+			if (kernel == SCAN_SCALAR) {
+				scalar_ns[op] = ns;
+				expected[op] = malloc(words * 8);
+				memcpy(expected[op], bits, words * 8);
+			} else {
+				wrong += memcmp(expected[op], bits, words * 8) != 0;
+			}
+			printf("%-8s %3s %12.3f %10.2f %8.2fx\n", scan_kernel_name(kernel),
+					op_names[op], ns, 8 / ns, scalar_ns[op] / ns);
+		}
+	}
+	// AND the bitmaps of < and >, which select different values
+	int reps = PASSES / n > 3 ? PASSES / n : 3, r;
+	long long start = now_ns();
+	for (r = 0; r < reps; r++) {
+		memcpy(bits, expected[SCAN_LESS], words * 8);
+		memcpy(other, expected[SCAN_GREATER], words * 8);
+		wrong += scan_and(bits, other, words) != 0;
+	}
+	printf("AND of two bitmaps, copies included: %.3f ns/value\n\n",
+			(double)(now_ns() - start) / reps / n);
+	for (op = SCAN_LESS; op <= SCAN_GREATER; op++)
+		free(expected[op]);
+	free(values);
+	free(bits);
+	free(other);
+	if (wrong > 0) {
+		printf("Error: %d kernels selected other values than the scalar one.\n",
+				wrong);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int failed = 0, a;
+	printf("Best kernel on this CPU: %s\n\n", scan_kernel_name(scan_current_kernel()));
+	if (argc < 2)
+		return run(1000000) || run(100000000);
+	for (a = 1; a < argc; a++)
+		failed = failed || run(atoi(argv[a]));
+	return failed;
+}
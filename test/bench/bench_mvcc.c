@@ -0,0 +1,189 @@
+/**
+ * @file
+ * @brief SET latency while full-table queries run in the background.
+ *
+ * Loads rows into the census table, then a writer SETs the rows one after
+ * the other, round after round, with Rank set to the round number, and
+ * times every SET. The writer runs alone, then next to threads that
+ * query the whole table in a loop. Reports the SET latency percentiles
+ * of both runs.
+ *
+ * Every query also checks it read a snapshot: the rows the writer has
+ * reached in the current round form a prefix of the table, so the rows
+ * of Rank at least the one of the first row, read just before the query,
+ * must form a prefix too. Only results short enough to be returned whole
+ * are checked.
+ *
+ * Usage: bench_mvcc [rows] [seconds] [query threads] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 100000
+#define DEFAULT_SECONDS 2
+#define DEFAULT_QUERY_THREADS 2
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_QUERY_THREADS 16
+#define MAX_SAMPLES 10000000
+
+struct config_params params;
+
+static struct data_table *table;
+static int rows;
+static int rank_col;
+static volatile int running;
+static long long *samples;
+static long sample_count;
+static long queries;
+static long inconsistent;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void make_key(char key[MAX_KEY_LEN], int k) {
+	snprintf(key, MAX_KEY_LEN, "k%d", k % 100000000);
+}
+
+// Set a row whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+static void *writer_main(void *arg) {
+	long round = 1;
+	while (running) {
+		int k;
+		for (k = 0; k < rows && running; k++) {
+			char key[MAX_KEY_LEN];
+			make_key(key, k);
+			long long start = now_ns();
+			set_rank(key, round);
+			if (sample_count < MAX_SAMPLES)
+				samples[sample_count++] = now_ns() - start;
+		}
+		round++;
+	}
+	return NULL;
+}
+
+static void *query_main(void *arg) {
+	char (*keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	long done = 0, wrong = 0;
+	while (running) {
+		char key[MAX_KEY_LEN];
+		make_key(key, 0);
+		struct row_version *version = get_version(table, key);
+		long long first_rank = version_get_int(table, version, rank_col);
+		release_version(version);
+
+		char col_name[MAX_COLNAME_LEN] = "Rank";
+		char operand[MAX_VALUE_LEN] = ">";
+		char comp_val[MAX_VALUE_LEN];
+		sprintf(comp_val, "%lld", first_rank - 1);
+		struct query_context ctx;
+		init_query(&ctx, table);
+		set_query_params(&ctx, col_name, operand, comp_val);
+		int found = 0;
+		query(&ctx, keys, MAX_RECORDS_PER_TABLE, &found);
+		// The keys come in table or index order, and only the first
+		// MAX_RECORDS_PER_TABLE of them are returned.
+		int k;
+		for (k = 0; k < found && found < MAX_RECORDS_PER_TABLE; k++) {
+			if (atoi(keys[k] + 1) >= found) {
+				wrong++;
+				break;
+			}
+		}
+		done++;
+	}
+	free(keys);
+	pthread_mutex_lock(&stats_lock);
+	queries += done;
+	inconsistent += wrong;
+	pthread_mutex_unlock(&stats_lock);
+	return NULL;
+}
+
+static int compare_samples(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Run the writer next to query_threads query threads, print SET latency.
+static void run(int query_threads, int seconds) {
+	pthread_t writer, readers[MAX_QUERY_THREADS];
+	sample_count = 0;
+	queries = 0;
+	running = 1;
+	pthread_create(&writer, NULL, writer_main, NULL);
+	int t;
+	for (t = 0; t < query_threads; t++)
+		pthread_create(&readers[t], NULL, query_main, NULL);
+	struct timespec run_time = {seconds, 0};
+	nanosleep(&run_time, NULL);
+	running = 0;
+	pthread_join(writer, NULL);
+	for (t = 0; t < query_threads; t++)
+		pthread_join(readers[t], NULL);
+
+	qsort(samples, sample_count, sizeof(long long), compare_samples);
+	printf("%14d %10ld %10ld %8lld %8lld %8lld %10lld\n", query_threads,
+			queries, sample_count, samples[sample_count / 2],
+			samples[sample_count * 99 / 100], samples[sample_count * 999 / 1000],
+			samples[sample_count - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+	int seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+	int query_threads = argc > 3 ? atoi(argv[3]) : DEFAULT_QUERY_THREADS;
+	char *config_file = argc > 4 ? argv[4] : DEFAULT_CONFIG;
+	if (query_threads > MAX_QUERY_THREADS)
+		query_threads = MAX_QUERY_THREADS;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	rank_col = table != NULL ? get_col_index(table, "Rank") : -1;
+	if (rank_col < 0 || table->columns[rank_col]->type != INT) {
+		printf("Need a census table with an int Rank column.\n");
+		return 1;
+	}
+	int k;
+	for (k = 0; k < rows; k++) {
+		char key[MAX_KEY_LEN];
+		make_key(key, k);
+		set_rank(key, 0);
+	}
+	samples = malloc(MAX_SAMPLES * sizeof(long long));
+
+	printf("%14s %10s %10s %8s %8s %8s %10s\n", "query threads", "queries",
+			"sets", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+	run(0, seconds);
+	run(query_threads, seconds);
+	if (inconsistent > 0) {
+		printf("Error: %ld queries did not read a snapshot.\n", inconsistent);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,290 @@
+/**
+ * @file
+ * @brief Allocation and leak check of the text protocol parser.
+ *
+ * Parses 100M commands, a mix of authenticate, get, set and query lines
+ * as a client sends them, with parse_command_args() and looks up the
+ * arguments process_command() uses. malloc(), calloc() and realloc() are
+ * wrapped at link time (-Wl,--wrap=...) to count the calls made while
+ * parsing, and the peak resident size is compared before and after.
+ *
+ * Then sends as many commands to a server over a loopback connection,
+ * pipelined SERVER_DEPTH at a time, so they go through the socket path
+ * and process_command(): SETs and GETs of 1000 keys, queries, and
+ * malformed lines. The server's resident size is read from /proc after a
+ * warm-up and at the end.
+ *
+ * Fails if the parser allocated anything, a command got an unexpected
+ * status, or the server grew by more than SERVER_RSS_SLACK_KB.
+ *
+ * Usage: bench_parser [requests] [server]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "utils.h"
+
+#define DEFAULT_REQUESTS 100000000L
+#define DEFAULT_SERVER "../../src/server"
+#define CONFIG_FILE "bench_parser.conf"
+// Commands sent before reading their responses.
+#define SERVER_DEPTH 64
+// Growth of the server's resident size after the warm-up, which allocator
+// noise stays under while a leak of a few bytes per command does not.
+#define SERVER_RSS_SLACK_KB 4096
+
+static long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+// Count every allocation of the process.
+void *__wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	allocations++;
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __real_realloc(ptr, size);
+}
+
+static const char *commands[] = {
+	"action=authenticate#username=admin#password=xxxnq.BMCifhU!",
+	"action=get#table=census#key=Toronto!",
+	"action=set#table=census#key=Toronto#value={Province Ontario, "
+			"Population 2503281, Change 4, Rank 1}#metadata=3!",
+	"action=query#table=census#max=10#predicates={Province = Ontario, "
+			"Population > 1000000}!",
+};
+
+static const char *names[] = {"action", "username", "password", "table",
+		"key", "value", "metadata", "max", "predicates"};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Peak resident size in kilobytes.
+static long max_rss() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Resident size of a process in kilobytes, -1 if unknown.
+static long process_rss(pid_t pid) {
+	char path[64], line[256];
+	long rss = -1;
+	snprintf(path, sizeof path, "/proc/%d/status", (int)pid);
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof line, f) != NULL)
+		if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+			break;
+	fclose(f);
+	return rss;
+}
+
+// Connect to the server on the loopback interface, -1 if failed.
+static int connect_server(int port) {
+	int sock = socket(PF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof addr);
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof addr) != 0) {
+		if (sock >= 0)
+			close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+// The n-th command sent to the server, and whether it must succeed.
+static size_t server_command(char *buf, size_t size, long n, int *ok) {
+	long key = n % 1000;
+	*ok = 1;
+	switch (n % 8) {
+	case 0:
+	case 1:
+	case 2:
+		return snprintf(buf, size, "action=set#table=census#key=key%ld"
+				"#value={Province Ontario, Population %ld, Change %ld, "
+				"Rank %ld}#metadata=0!\n", key, n, n % 7, key % 100);
+	case 3:
+	case 4:
+		return snprintf(buf, size, "action=get#table=census#key=key%ld!\n",
+				key);
+	case 5:
+		return snprintf(buf, size, "action=query#table=census#max=10"
+				"#predicates={Province = Ontario, Rank < %ld}!\n", key % 100);
+	case 6:
+		// Deleted, and set again the next time round.
+		return snprintf(buf, size, "action=set#table=census#key=key%ld"
+				"#value={((NULL))}#metadata=0!\n", (key + 500) % 1000);
+	default:
+		*ok = 0;
+		return snprintf(buf, size, n % 16 == 7 ? "action=get#table=census!\n"
+				: "action=set#table=missing#key=key%ld#value={x}!\n", key);
+	}
+}
+
+// Send requests commands to the server of pid through sock, and check
+// its resident size stays flat after the first tenth of them.
+// Return 0 if every response was as expected and the server did not grow.
+static int run_server(int sock, pid_t pid, long requests) {
+	struct line_reader reader;
+	line_reader_init(&reader, sock);
+	char out[SERVER_DEPTH * MAX_CMD_LEN];
+	char response[MAX_CMD_LEN];
+	int ok[SERVER_DEPTH];
+	long warmup = requests / 10, failed = 0, n = 0;
+	long rss_warm = process_rss(pid);
+	long long start = now_ns();
+	while (n < requests) {
+		size_t len = 0;
+		int queued, k;
+		for (queued = 0; queued < SERVER_DEPTH && n < requests; queued++, n++)
+			len += server_command(out + len, sizeof out - len, n, &ok[queued]);
+		if (sendall(sock, out, len) != 0)
+			return -1;
+		for (k = 0; k < queued; k++) {
+			if (recvline_buffered(&reader, response, sizeof response) != 0)
+				return -1;
+			// A GET of a deleted key fails too.
+			if (ok[k] && strncmp(response, "status=0", 8) != 0
+					&& strstr(response, "error=6") == NULL)
+				failed++;
+			if (!ok[k] && strncmp(response, "status=0", 8) == 0)
+				failed++;
+		}
+		if (n - queued < warmup && n >= warmup)
+			rss_warm = process_rss(pid);
+	}
+	long long elapsed = now_ns() - start;
+	long rss_end = process_rss(pid);
+
+	printf("%12s %12s %12s %14s %10s\n", "requests", "ns/request",
+			"server kB", "rss growth kB", "failed");
+	printf("%12ld %12.1f %12ld %14ld %10ld\n", requests,
+			(double)elapsed / requests, rss_end, rss_end - rss_warm, failed);
+	if (failed > 0 || rss_warm < 0 || rss_end - rss_warm > SERVER_RSS_SLACK_KB)
+		return -1;
+	return 0;
+}
+
+// Start a server, run the commands through it and stop it.
+// Return 0 if successful.
+static int check_server(const char *server, long requests) {
+	int port = 6000 + getpid() % 2000;
+	FILE *f = fopen(CONFIG_FILE, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "server_host localhost\nserver_port %d\n", port);
+	fprintf(f, "username admin\npassword xxxnq.BMCifhU\nconcurrency 1\n");
+	fprintf(f, "table census Province:char[50],Population:int,Change:int,Rank:int\n");
+	fclose(f);
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(server, server, CONFIG_FILE, (char *)NULL);
+		_exit(1);
+	}
+	int sock = -1, k;
+	for (k = 0; k < 100 && sock < 0; k++) {
+		usleep(20000);
+		sock = connect_server(port);
+	}
+	const char auth[] = "action=authenticate#username=admin#password=xxxnq.BMCifhU!\n";
+	char response[MAX_CMD_LEN];
+	struct line_reader reader;
+	line_reader_init(&reader, sock);
+	int status = -1;
+	if (sock < 0 || sendall(sock, auth, sizeof auth - 1) != 0
+			|| recvline_buffered(&reader, response, sizeof response) != 0
+			|| strncmp(response, "status=0", 8) != 0) {
+		printf("Error connecting to %s.\n", server);
+	} else {
+		status = run_server(sock, pid, requests);
+	}
+	if (sock >= 0)
+		close(sock);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(CONFIG_FILE);
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	long requests = argc > 1 ? atol(argv[1]) : DEFAULT_REQUESTS;
+	const char *server = argc > 2 ? argv[2] : DEFAULT_SERVER;
+	int count = sizeof commands / sizeof commands[0];
+	size_t lens[sizeof commands / sizeof commands[0]];
+	int k;
+	for (k = 0; k < count; k++)
+		lens[k] = strlen(commands[k]) + 1;
+
+	char line[MAX_CMD_LEN];
+	size_t bytes = 0;
+	long failed = 0;
+	long rss_before = max_rss();
+	allocations = 0;
+	long long start = now_ns();
+	long n;
+	for (n = 0; n < requests; n++) {
+		// The line as line_reader_next() hands it out.
+		memcpy(line, commands[n % count], lens[n % count]);
+		struct command_args args;
+		if (parse_command_args(line, &args) != 0) {
+			failed++;
+			continue;
+		}
+		int m;
+		for (m = 0; m < (int)(sizeof names / sizeof names[0]); m++)
+			bytes += command_arg(&args, names[m]).len;
+	}
+	long long elapsed = now_ns() - start;
+	long parse_allocations = allocations;
+	long rss_after = max_rss();
+
+	printf("%12s %12s %12s %14s %10s\n", "requests", "ns/request",
+			"allocations", "rss growth kB", "failed");
+	printf("%12ld %12.1f %12ld %14ld %10ld\n", requests,
+			(double)elapsed / requests, parse_allocations,
+			rss_after - rss_before, failed);
+	// Keep the lookups from being optimized away.
+	if (bytes == 0 || failed > 0 || parse_allocations > 0) {
+		printf("Error: the parser failed or allocated memory.\n");
+		return 1;
+	}
+
+	if (check_server(server, requests) != 0) {
+		printf("Error: a command failed or the server grew.\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file
+ * @brief Throughput of one connection with pipelined SETs.
+ *
+ * Starts the server with a census table and issues SETs on a single
+ * connection through libstorage.a: one at a time with storage_set(), then
+ * in batches of increasing depth with storage_pipeline_set() and one
+ * storage_pipeline_collect() per batch.
+ *
+ * Usage: bench_pipeline [requests] [server_exec]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "storage.h"
+#include "storage_pipeline.h"
+
+#define DEFAULT_REQUESTS 100000L
+#define DEFAULT_SERVER "../../src/server"
+#define CONFIG_FILE "bench_pipeline.conf"
+
+static const int depths[] = {1, 4, 16, 64, 256};
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill_record(struct storage_record *r, long k) {
+	snprintf(r->value, sizeof r->value,
+			"Province Ontario, Population %ld, Change 1, Rank %ld", k, k % 100);
+	r->metadata[0] = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long requests = argc > 1 ? atol(argv[1]) : DEFAULT_REQUESTS;
+	const char *server = argc > 2 ? argv[2] : DEFAULT_SERVER;
+	int port = 6000 + getpid() % 2000;
+
+	FILE *f = fopen(CONFIG_FILE, "w");
+	if (f == NULL)
+		return 1;
+	fprintf(f, "server_host localhost\nserver_port %d\n", port);
+	fprintf(f, "username admin\npassword xxxnq.BMCifhU\nconcurrency 1\n");
+	fprintf(f, "table census Province:char[50],Population:int,Change:int,Rank:int\n");
+	fclose(f);
+	pid_t pid = fork();
+	if (pid == 0) {
+		execl(server, server, CONFIG_FILE, (char *)NULL);
+		_exit(1);
+	}
+	void *conn = NULL;
+	int k;
+	for (k = 0; k < 100 && conn == NULL; k++) {
+		usleep(20000);
+		conn = storage_connect("localhost", port);
+	}
+	if (conn == NULL || storage_auth("admin", "dog4sale", conn) != 0) {
+		printf("Error connecting to %s.\n", server);
+		kill(pid, SIGTERM);
+		return 1;
+	}
+
+	printf("%10s %12s %14s\n", "depth", "requests", "requests/s");
+	struct storage_record r;
+	char key[MAX_KEY_LEN];
+	long n;
+	long long start = now_ns();
+	for (n = 0; n < requests; n++) {
+		snprintf(key, sizeof key, "key%ld", n % 1000);
+		fill_record(&r, n);
+		if (storage_set("census", key, &r, conn) != 0) {
+			printf("Error: SET failed.\n");
+			break;
+		}
+	}
+	printf("%10s %12ld %14.0f\n", "blocking", n,
+			n * 1e9 / (now_ns() - start));
+
+	int d;
+	int results[MAX_PIPELINE_DEPTH];
+	for (d = 0; d < (int)(sizeof depths / sizeof depths[0]); d++) {
+		long failed = 0;
+		start = now_ns();
+		for (n = 0; n < requests; ) {
+			int queued;
+			for (queued = 0; queued < depths[d] && n < requests; queued++, n++) {
+				snprintf(key, sizeof key, "key%ld", n % 1000);
+				fill_record(&r, n);
+				storage_pipeline_set("census", key, &r, conn);
+			}
+			int done = storage_pipeline_collect(results, queued, conn);
+			for (k = 0; k < done; k++)
+				failed += results[k] != 0;
+			if (done != queued)
+				failed += queued;
+		}
+		printf("%10d %12ld %14.0f", depths[d], n, n * 1e9 / (now_ns() - start));
+		if (failed > 0)
+			printf("  (%ld failed)", failed);
+		printf("\n");
+	}
+
+	storage_disconnect(conn);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	unlink(CONFIG_FILE);
+	return 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file
+ * @brief Parse throughput of the text and binary protocols.
+ *
+ * Parses the same census SET command both ways until the column values
+ * are ready for set_entry(): the text path runs parse_command_args() and
+ * command_arg() as process_command() does, then splits the value on
+ * commas and parses the int columns like command_set(); the binary path
+ * runs protocol_parse_request() on a frame, whose values are typed
+ * already.
+ *
+ * Usage: bench_protocol [commands]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "parse_utils.h"
+#include "protocol.h"
+
+#define DEFAULT_COMMANDS 1000000L
+#define COLUMNS 4
+
+static const char *text_cmd = "action=set#table=census#key=Toronto#value="
+		"{Province Ontario, Population 2503281, Change 4, Rank 1}#metadata=3!";
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Parse a text SET into column values, return the sum of its ints.
+static long long parse_text(const char *cmd) {
+	char line[MAX_CMD_LEN];
+	strcpy(line, cmd);
+	struct command_args args;
+	if (parse_command_args(line, &args) != 0)
+		return -1;
+	char *value = command_arg(&args, "value").ptr;
+	char *metadata = command_arg(&args, "metadata").ptr;
+	if (strcmp(command_arg(&args, "action").ptr, "set") != 0
+			|| command_arg(&args, "table").len == 0
+			|| command_arg(&args, "key").len == 0)
+		return -1;
+
+	// Strip the braces, then take "name value" chunks between commas.
+	char value_buff[256];
+	size_t len = strlen(value);
+	strncpy(value_buff, &value[1], len - 2);
+	value_buff[len - 2] = '\0';
+	char value_arr[COLUMNS][MAX_VALUE_LEN];
+	long long sum = atoi(metadata);
+	char *p = value_buff;
+	int col;
+	for (col = 0; col < COLUMNS; col++) {
+		char chunk[256], trimmed[256], col_name[256];
+		int n = get_next_text_chunk(p, ',', chunk);
+		delete_leading_trailing_spaces(chunk, trimmed);
+		get_next_text_chunk(trimmed, ' ', col_name);
+		strcpy(value_arr[col], &trimmed[strlen(col_name) + 1]);
+		if (col > 0 && check_numeric(value_arr[col]) == 0)
+			sum += strtoll(value_arr[col], 0, 10);
+		p += n + 1;
+	}
+	return sum;
+}
+
+// Parse a SET frame into column values, return the sum of its ints.
+static long long parse_binary(const char *frame, size_t len) {
+	char buf[MAX_REQUEST_FRAME_LEN];
+	memcpy(buf, frame, len);
+	struct protocol_request req;
+	if (protocol_parse_request(buf, len, &req) != 0)
+		return -1;
+	long long sum = req.metadata;
+	int col;
+	for (col = 0; col < req.count; col++)
+		sum += req.values[col].int_val;
+	return sum;
+}
+
+int main(int argc, char *argv[])
+{
+	long commands = argc > 1 ? atol(argv[1]) : DEFAULT_COMMANDS;
+
+	char frame[MAX_REQUEST_FRAME_LEN];
+	struct protocol_writer w;
+	protocol_writer_init(&w, frame, sizeof frame, PROTO_SET, 0);
+	protocol_put_str(&w, "census", 6);
+	protocol_put_str(&w, "Toronto", 7);
+	protocol_put_u32(&w, 3);
+	protocol_put_str_value(&w, "Ontario", 7);
+	protocol_put_int_value(&w, 2503281);
+	protocol_put_int_value(&w, 4);
+	protocol_put_int_value(&w, 1);
+	int col;
+	for (col = 0; col < COLUMNS; col++)
+		protocol_count(&w);
+	size_t frame_len = protocol_writer_finish(&w);
+
+	if (parse_text(text_cmd) != parse_binary(frame, frame_len)) {
+		printf("Error: the protocols parsed different values.\n");
+		return 1;
+	}
+
+	printf("%10s %8s %12s %14s\n", "protocol", "bytes", "ns/command",
+			"commands/s");
+	int binary;
+	for (binary = 0; binary <= 1; binary++) {
+		volatile long long sink = 0;
+		long long start = now_ns();
+		long n;
+		for (n = 0; n < commands; n++)
+			sink += binary ? parse_binary(frame, frame_len) : parse_text(text_cmd);
+		long long elapsed = now_ns() - start;
+		printf("%10s %8lu %12.1f %14.0f\n", binary ? "binary" : "text",
+				binary ? (unsigned long)frame_len : (unsigned long)strlen(text_cmd),
+				(double)elapsed / commands, commands * 1e9 / elapsed);
+	}
+	return 0;
+}
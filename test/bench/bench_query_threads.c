@@ -0,0 +1,153 @@
+/**
+ * @file
+ * @brief Concurrent query benchmark of per-request query contexts.
+ *
+ * Loads rows into the census table, then runs queries from 1 to 8
+ * threads at once. Each thread builds its own query_context with a
+ * Population threshold of its own and checks every result against the
+ * count a single thread got for that threshold, so a query that sees
+ * another thread's predicates is caught. Reports queries per second and
+ * the number of wrong results for each thread count.
+ *
+ * Usage: bench_query_threads [rows] [seconds] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 100000L
+#define DEFAULT_SECONDS 2
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_THREADS 8
+#define MAX_POPULATION 3000000
+
+struct config_params params;
+
+struct worker {
+	pthread_t thread;
+	struct data_table *table;
+	char threshold[MAX_VALUE_LEN];
+	int expected;		// Matches a lone query found.
+	long queries;
+	long wrong;
+};
+
+static volatile int running;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Run "Population > threshold" once, return the number of matches.
+static int run_query(struct data_table *table, char threshold[MAX_VALUE_LEN],
+		char keys[][MAX_KEY_LEN]) {
+	char col_name[MAX_COLNAME_LEN] = "Population";
+	char operand[MAX_VALUE_LEN] = ">";
+	struct query_context ctx;
+	init_query(&ctx, table);
+	if (set_query_params(&ctx, col_name, operand, threshold) != 0)
+		return -1;
+	int found = 0;
+	query(&ctx, keys, MAX_RECORDS_PER_TABLE, &found);
+	return found;
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	char (*keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	while (running) {
+		if (run_query(w->table, w->threshold, keys) != w->expected)
+			w->wrong++;
+		w->queries++;
+	}
+	free(keys);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	int seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *table = find_table("census");
+	if (table == NULL || get_col_index(table, "Population") < 0) {
+		printf("Need a census table with a Population column.\n");
+		return 1;
+	}
+
+	unsigned int seed = 297;
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[32];
+		char cols[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+		struct data_value values[MAX_COLUMNS_PER_TABLE];
+		int m;
+		for (m = 0; m < table->col_count; m++) {
+			if (table->columns[m]->type == INT)
+				sprintf(cols[m], "%d", rand_r(&seed) % MAX_POPULATION);
+			else
+				strcpy(cols[m], "Ontario");
+			values[m].int_val = atoll(cols[m]);
+			values[m].str_val = cols[m];
+		}
+		snprintf(key, sizeof key, "key%ld", k);
+		set_entry(table, key, values, 0);
+	}
+
+	// A different threshold, and so a different result, for every thread.
+	struct worker workers[MAX_THREADS];
+	char (*keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	int t;
+	for (t = 0; t < MAX_THREADS; t++) {
+		workers[t].table = table;
+		sprintf(workers[t].threshold, "%d", MAX_POPULATION / (t + 2));
+		workers[t].expected = run_query(table, workers[t].threshold, keys);
+	}
+	free(keys);
+
+	printf("%8s %12s %12s %8s\n", "threads", "queries/s", "speedup", "wrong");
+	double single = 0;
+	long wrong = 0;
+	int threads;
+	for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		running = 1;
+		for (t = 0; t < threads; t++) {
+			workers[t].queries = 0;
+			workers[t].wrong = 0;
+			pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+		}
+		long long start = now_ns();
+		struct timespec run_time = {seconds, 0};
+		nanosleep(&run_time, NULL);
+		running = 0;
+		long queries = 0, run_wrong = 0;
+		for (t = 0; t < threads; t++) {
+			pthread_join(workers[t].thread, NULL);
+			queries += workers[t].queries;
+			run_wrong += workers[t].wrong;
+		}
+		double rate = queries * 1e9 / (now_ns() - start);
+		if (threads == 1)
+			single = rate;
+		printf("%8d %12.0f %11.2fx %8ld\n", threads, rate, rate / single,
+				run_wrong);
+		wrong += run_wrong;
+	}
+	if (wrong > 0) {
+		printf("Error: concurrent queries returned wrong results.\n");
+		return 1;
+	}
+	return 0;
+}
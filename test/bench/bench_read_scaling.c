@@ -0,0 +1,144 @@
+/**
+ * @file
+ * @brief Read scaling of GETs of one hot key, from 1 to 32 threads.
+ *
+ * Follows the access pattern of client_repeat_get: every thread sets the
+ * same key once, then GETs it back to back and reads every column of the
+ * row, with no delay in between. Runs each thread count twice: with the
+ * lock-free lookup GETs use, and with the table read lock taken around
+ * it, as GETs did before, which makes every reader write the lock's
+ * cache line. Reports GETs per second and the speedup over one thread.
+ *
+ * Usage: bench_read_scaling [seconds] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_SECONDS 1
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_THREADS 32
+#define KEY "key1"
+
+struct config_params params;
+
+struct worker {
+	pthread_t thread;
+	long gets;
+	long errors;
+} __attribute__((aligned(64)));
+
+static struct data_table *table;
+static int locked;
+static volatile int running;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Set the key to "Province val1, Population 1, Change 1, Rank 1".
+static int set_key() {
+	char province[MAX_VALUE_LEN] = "val1";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = 1;
+		values[m].str_val = province;
+	}
+	return set_entry(table, KEY, values, 0);
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	char key[MAX_KEY_LEN] = KEY;
+	if (set_key() != 0)
+		w->errors++;
+	while (running) {
+		if (locked)
+			pthread_rwlock_rdlock(&table->lock);
+		struct row_version *version = get_version(table, key);
+		if (locked)
+			pthread_rwlock_unlock(&table->lock);
+		if (version == NULL) {
+			w->errors++;
+		} else {
+			char value[MAX_VALUE_LEN];
+			int m;
+			for (m = 0; m < table->col_count; m++) {
+				version_get_value(table, version, m, value);
+				if (strcmp(value, table->columns[m]->type == INT ? "1" : "val1") != 0)
+					w->errors++;
+			}
+			release_version(version);
+		}
+		w->gets++;
+	}
+	return NULL;
+}
+
+// Run threads readers for seconds, return GETs per second.
+static double run(int threads, int seconds, long *errors) {
+	struct worker workers[MAX_THREADS];
+	int t;
+	running = 1;
+	for (t = 0; t < threads; t++) {
+		workers[t].gets = 0;
+		workers[t].errors = 0;
+		pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+	}
+	long long start = now_ns();
+	struct timespec run_time = {seconds, 0};
+	nanosleep(&run_time, NULL);
+	running = 0;
+	long gets = 0;
+	for (t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		gets += workers[t].gets;
+		*errors += workers[t].errors;
+	}
+	return gets * 1e9 / (now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	if (table == NULL) {
+		printf("Need a census table.\n");
+		return 1;
+	}
+
+	printf("%8s %14s %9s %14s %9s\n", "threads", "lock-free/s", "speedup",
+			"read lock/s", "speedup");
+	double single[2] = {0, 0};
+	long errors = 0;
+	int threads;
+	for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		double rate[2];
+		for (locked = 0; locked < 2; locked++) {
+			rate[locked] = run(threads, seconds, &errors);
+			if (threads == 1)
+				single[locked] = rate[locked];
+		}
+		printf("%8d %14.0f %8.2fx %14.0f %8.2fx\n", threads, rate[0],
+				rate[0] / single[0], rate[1], rate[1] / single[1]);
+	}
+	if (errors > 0) {
+		printf("Error: %ld GETs failed or read wrong values.\n", errors);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file
+ * @brief Deletes and updates next to lock-free reads, built with
+ * AddressSanitizer.
+ *
+ * Loads rows k0 to kN into the census table, row kI with Rank I. Writer
+ * threads then delete, re-insert and update random rows, always with the
+ * same Rank, so every old version and deleted entry goes through the epoch
+ * reclamation, while reader threads GET random rows and query the table
+ * both whole and for one Rank. A read must never see a row with the wrong
+ * Rank, and a query for Rank I must find at most row kI. A reader that
+ * follows a freed entry, version or index node makes AddressSanitizer
+ * stop the benchmark. Reports the operations made and the errors found.
+ *
+ * Usage: bench_reclaim [rows] [seconds] [writers] [readers] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 20000
+#define DEFAULT_SECONDS 2
+#define DEFAULT_WRITERS 2
+#define DEFAULT_READERS 2
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_THREADS 16
+
+struct config_params params;
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	long ops;
+	long errors;
+};
+
+static struct data_table *table;
+static int rows;
+static int rank_col;
+static volatile int running;
+
+static void make_key(char key[MAX_KEY_LEN], int k) {
+	snprintf(key, MAX_KEY_LEN, "k%d", k % 100000000);
+}
+
+// Set row k with its Rank.
+static int set_row(int k) {
+	char key[MAX_KEY_LEN];
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	make_key(key, k);
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? k : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+static void *writer_main(void *arg) {
+	struct worker *w = arg;
+	while (running) {
+		int r = rand_r(&w->seed);
+		int k = (r >> 4) % rows;
+		if (r % 4 == 0) {
+			char key[MAX_KEY_LEN];
+			make_key(key, k);
+			// Another writer may have deleted it already.
+			delete_entry(table, key);
+		}
+		if (set_row(k) != 0)
+			w->errors++;
+		w->ops++;
+	}
+	return NULL;
+}
+
+// Query "Rank op value", return the number of keys found.
+static int run_query(char *op, int value, char keys[][MAX_KEY_LEN]) {
+	char col_name[MAX_COLNAME_LEN] = "Rank";
+	char operand[MAX_VALUE_LEN];
+	char comp_val[MAX_VALUE_LEN];
+	strcpy(operand, op);
+	sprintf(comp_val, "%d", value);
+	struct query_context ctx;
+	init_query(&ctx, table);
+	set_query_params(&ctx, col_name, operand, comp_val);
+	int found = 0;
+	query(&ctx, keys, MAX_RECORDS_PER_TABLE, &found);
+	return found;
+}
+
+static void *reader_main(void *arg) {
+	struct worker *w = arg;
+	char (*keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	while (running) {
+		int r = rand_r(&w->seed);
+		int k = (r >> 4) % rows;
+		if (r % 64 == 0) {
+			if (run_query(">", -1, keys) > rows)
+				w->errors++;
+		} else if (r % 8 == 0) {
+			int found = run_query("=", k, keys);
+			if (found > 1 || (found == 1 && atoi(keys[0] + 1) != k))
+				w->errors++;
+		} else {
+			char key[MAX_KEY_LEN];
+			make_key(key, k);
+			struct row_version *version = get_version(table, key);
+			if (version != NULL) {
+				if (version_get_int(table, version, rank_col) != k)
+					w->errors++;
+				release_version(version);
+			}
+		}
+		w->ops++;
+	}
+	free(keys);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+	int seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+	int writers = argc > 3 ? atoi(argv[3]) : DEFAULT_WRITERS;
+	int readers = argc > 4 ? atoi(argv[4]) : DEFAULT_READERS;
+	char *config_file = argc > 5 ? argv[5] : DEFAULT_CONFIG;
+	if (rows < 1)
+		rows = 1;
+	if (writers + readers > MAX_THREADS) {
+		printf("At most %d threads.\n", MAX_THREADS);
+		return 1;
+	}
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	rank_col = table != NULL ? get_col_index(table, "Rank") : -1;
+	if (rank_col < 0 || table->columns[rank_col]->type != INT) {
+		printf("Need a census table with an int Rank column.\n");
+		return 1;
+	}
+	int k;
+	for (k = 0; k < rows; k++)
+		set_row(k);
+
+	struct worker workers[MAX_THREADS];
+	int t;
+	running = 1;
+	for (t = 0; t < writers + readers; t++) {
+		workers[t].seed = 297 + t;
+		workers[t].ops = 0;
+		workers[t].errors = 0;
+		pthread_create(&workers[t].thread, NULL,
+				t < writers ? writer_main : reader_main, &workers[t]);
+	}
+	struct timespec run_time = {seconds, 0};
+	nanosleep(&run_time, NULL);
+	running = 0;
+	long writes = 0, reads = 0, errors = 0;
+	for (t = 0; t < writers + readers; t++) {
+		pthread_join(workers[t].thread, NULL);
+		if (t < writers)
+			writes += workers[t].ops;
+		else
+			reads += workers[t].ops;
+		errors += workers[t].errors;
+	}
+
+	// Every row is back once the writers stopped.
+	unsigned long count = 0;
+	size_t resident = 0;
+	table_memory_usage(table, &count, &resident);
+	if (count != (unsigned long)rows)
+		errors++;
+	for (k = 0; k < rows; k++) {
+		char key[MAX_KEY_LEN];
+		make_key(key, k);
+		struct row_version *version = get_version(table, key);
+		if (version == NULL || version_get_int(table, version, rank_col) != k)
+			errors++;
+		if (version != NULL)
+			release_version(version);
+	}
+
+	printf("%8s %8s %12s %12s %8s\n", "writers", "readers", "writes",
+			"reads", "errors");
+	printf("%8d %8d %12ld %12ld %8ld\n", writers, readers, writes, reads,
+			errors);
+	if (errors > 0) {
+		printf("Error: rows were lost or read with the wrong values.\n");
+		return 1;
+	}
+	return 0;
+}
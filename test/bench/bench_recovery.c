@@ -0,0 +1,212 @@
+/**
+ * @file
+ * @brief Time to replay a log at startup, per number of replay threads.
+ *
+ * Logs SETs and deletes of the census table with durability none, with no
+ * snapshot, in a process of its own: every key is set LOAD_PASSES times,
+ * and one key in ten is deleted after it. Then for 1, 2, 4 and 8 threads,
+ * a new process recovers the tables from the log alone, and reports how
+ * long that took and how many changes it replayed per second. Every key
+ * must be back with the Rank of its last SET, and the deleted ones gone.
+ *
+ * The threads replay the changes of different keys in parallel, so the
+ * time should go down with threads as long as there are cores to run
+ * them.
+ *
+ * Usage: bench_recovery [rows] [directory] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000
+#define DEFAULT_DIRECTORY "."
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define LOAD_PASSES 3
+#define DELETE_EVERY 10
+
+struct config_params params;
+
+// What a phase reports back.
+struct result {
+	double recover_ms;
+	long wrong;
+	int failed;
+};
+
+static struct data_table *table;
+static int rank_col;
+static int rows;
+static int threads;
+static char directory[MAX_PATH_LEN];
+static struct result result;
+
+// Current time in milliseconds.
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Set a key whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+// Start from empty tables and recover them from the directory.
+static int open_tables() {
+	if (init_tables(params.tables) != 0)
+		return -1;
+	table = find_table("census");
+	return recover_tables(directory, WAL_NONE, 0, threads);
+}
+
+static void load() {
+	char key[MAX_KEY_LEN];
+	int k, pass;
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	for (pass = 1; pass <= LOAD_PASSES; pass++) {
+		for (k = 0; k < rows; k++) {
+			snprintf(key, sizeof key, "k%d", k);
+			if (set_rank(key, pass) != 0)
+				result.failed = 1;
+		}
+	}
+	for (k = 0; k < rows; k += DELETE_EVERY) {
+		snprintf(key, sizeof key, "k%d", k);
+		if (delete_entry(table, key) != 0)
+			result.failed = 1;
+	}
+	close_table_log();
+}
+
+static void recover() {
+	char key[MAX_KEY_LEN];
+	int k;
+	double start = now_ms();
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	result.recover_ms = now_ms() - start;
+	for (k = 0; k < rows; k++) {
+		snprintf(key, sizeof key, "k%d", k);
+		struct row_version *version = get_version(table, key);
+		if (k % DELETE_EVERY == 0) {
+			result.wrong += version != NULL;
+		} else if (version == NULL) {
+			result.wrong++;
+			continue;
+		} else {
+			result.wrong += version_get_int(table, version, rank_col) != LOAD_PASSES
+					|| version->metadata != LOAD_PASSES;
+		}
+		if (version != NULL)
+			release_version(version);
+	}
+	close_table_log();
+}
+
+// Run a phase in a child process and get its result.
+static int run_phase(void (*phase)()) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return -1;
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		phase();
+		if (write(fds[1], &result, sizeof result) != sizeof result)
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	int status;
+	int got = read(fds[0], &result, sizeof result) == sizeof result;
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !got || result.failed)
+		return -1;
+	return 0;
+}
+
+// Remove the files of the directory, then the directory.
+static void remove_files() {
+	DIR *dir = opendir(directory);
+	struct dirent *file;
+	char path[MAX_PATH_LEN + 512];
+	while (dir != NULL && (file = readdir(dir)) != NULL) {
+		snprintf(path, sizeof path, "%s/%s", directory, file->d_name);
+		if (file->d_name[0] != '.')
+			unlink(path);
+	}
+	if (dir != NULL)
+		closedir(dir);
+	rmdir(directory);
+}
+
+int main(int argc, char *argv[])
+{
+	rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+	char *parent = argc > 2 ? argv[2] : DEFAULT_DIRECTORY;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+	int thread_counts[4] = {1, 2, 4, 8};
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	if (table == NULL || (rank_col = get_col_index(table, "Rank")) < 0) {
+		printf("Need a census table with a Rank column.\n");
+		return 1;
+	}
+	snprintf(directory, sizeof directory, "%s/bench_recoveryXXXXXX", parent);
+	if (mkdtemp(directory) == NULL) {
+		printf("Error: cannot create a directory in %s.\n", parent);
+		return 1;
+	}
+
+	threads = 1;
+	int failed = run_phase(load);
+	long changes = (long)rows * LOAD_PASSES + (rows + DELETE_EVERY - 1) / DELETE_EVERY;
+	if (!failed)
+		printf("Logged %ld changes to %d rows, with %d CPUs online.\n", changes,
+				rows, (int)sysconf(_SC_NPROCESSORS_ONLN));
+	printf("%8s %12s %14s %10s\n", "threads", "recover ms", "changes/s", "speedup");
+	double single_ms = 0;
+	long wrong = 0;
+	int t;
+	for (t = 0; t < 4 && !failed; t++) {
+		threads = thread_counts[t];
+		failed = run_phase(recover);
+		if (failed)
+			break;
+		if (t == 0)
+			single_ms = result.recover_ms;
+		printf("%8d %12.0f %14.0f %9.2fx\n", threads, result.recover_ms,
+				changes * 1e3 / result.recover_ms, single_ms / result.recover_ms);
+		wrong += result.wrong;
+	}
+	remove_files();
+	if (failed || wrong > 0) {
+		printf("Error: a phase failed or %ld rows were recovered wrong.\n", wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @brief Syscall count of reading command lines from a socket.
+ *
+ * A writer thread sends SET commands of about 100 bytes over a socket
+ * pair, one send() per command, and the reader takes them line by line
+ * with the byte-at-a-time recvline() and with a line_reader. recv() is
+ * wrapped at link time (-Wl,--wrap=recv) to count the calls.
+ *
+ * Usage: bench_recvline [lines]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "utils.h"
+
+#define DEFAULT_LINES 200000L
+
+static long lines;
+static long recv_calls;
+
+ssize_t __real_recv(int sock, void *buf, size_t len, int flags);
+
+// Count every recv() made by utils.o.
+ssize_t __wrap_recv(int sock, void *buf, size_t len, int flags)
+{
+	recv_calls++;
+	return __real_recv(sock, buf, len, flags);
+}
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *writer_main(void *arg) {
+	int sock = *(int *)arg;
+	char cmd[MAX_CMD_LEN];
+	long k;
+	for (k = 0; k < lines; k++) {
+		snprintf(cmd, sizeof cmd, "action=set#table=census#key=city%ld#value="
+				"{Province Ontario, Population %ld, Change 1, Rank 1}#metadata=0!\n",
+				k, k);
+		sendall(sock, cmd, strlen(cmd));
+	}
+	return NULL;
+}
+
+// Read every line with one of the two readers, return 0 if all arrived.
+static int run(int buffered, long long *elapsed) {
+	int socks[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) != 0)
+		return -1;
+	pthread_t writer;
+	pthread_create(&writer, NULL, writer_main, &socks[1]);
+	struct line_reader reader;
+	line_reader_init(&reader, socks[0]);
+	char line[MAX_CMD_LEN];
+	long k;
+	recv_calls = 0;
+	long long start = now_ns();
+	for (k = 0; k < lines; k++) {
+		int status = buffered ? recvline_buffered(&reader, line, sizeof line)
+				: recvline(socks[0], line, sizeof line);
+		if (status != 0 || strncmp(line, "action=set", 10) != 0)
+			break;
+	}
+	*elapsed = now_ns() - start;
+	pthread_join(writer, NULL);
+	close(socks[0]);
+	close(socks[1]);
+	return k == lines ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	lines = argc > 1 ? atol(argv[1]) : DEFAULT_LINES;
+
+	printf("%10s %10s %14s %12s\n", "reader", "lines", "recv()/line", "ns/line");
+	int buffered;
+	for (buffered = 0; buffered <= 1; buffered++) {
+		long long elapsed;
+		if (run(buffered, &elapsed) != 0) {
+			printf("Error: lines were lost.\n");
+			return 1;
+		}
+		printf("%10s %10ld %14.2f %12.0f\n", buffered ? "buffered" : "recvline",
+				lines, (double)recv_calls / lines, (double)elapsed / lines);
+	}
+	return 0;
+}
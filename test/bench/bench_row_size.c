@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @brief Memory-per-row report for the census workload.
+ *
+ * Loads Population.text into the census table over and over (with a
+ * numeric suffix on every key) until the requested number of rows is
+ * reached, then reports the memory used per row next to what the old
+ * fixed 8 KB entry would have cost.
+ *
+ * Usage: bench_row_size [rows] [config_file] [data_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define DEFAULT_DATA "../../src/Population.text"
+
+struct config_params params;
+
+// Resident set size of this process in bytes.
+static long resident_bytes() {
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+	char *data_file = argc > 3 ? argv[3] : DEFAULT_DATA;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *table = find_table("census");
+	FILE *data = fopen(data_file, "r");
+	if (table == NULL || data == NULL) {
+		printf("Need a census table and %s.\n", data_file);
+		return 1;
+	}
+
+	// Split every line of the data file into a key and column values.
+	static char lines[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN];
+	static char text[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+	static struct data_value values[MAX_RECORDS_PER_TABLE][MAX_COLUMNS_PER_TABLE];
+	int line_count = 0;
+	char line[BUFSIZ];
+	while (line_count < MAX_RECORDS_PER_TABLE && fgets(line, sizeof line, data)) {
+		char *p = strtok(line, ",\n");
+		if (p == NULL)
+			continue;
+		// Leave room for the numeric suffix.
+		snprintf(lines[line_count], 9, "%s", p);
+		int col = 0;
+		while (col < table->col_count && (p = strtok(NULL, ",\n")) != NULL) {
+			char *space = strchr(p, ' ');
+			strcpy(text[line_count][col], space != NULL ? space + 1 : p);
+			values[line_count][col].int_val = atoll(text[line_count][col]);
+			values[line_count][col].str_val = text[line_count][col];
+			col++;
+		}
+		line_count++;
+	}
+	fclose(data);
+
+	long before = resident_bytes();
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[MAX_KEY_LEN];
+		snprintf(key, sizeof key, "%s%ld", lines[k % line_count], k);
+		set_entry(table, key, values[k % line_count], 0);
+	}
+	long after = resident_bytes();
+
+	unsigned long count;
+	size_t resident;
+	size_t bytes = table_memory_usage(table, &count, &resident);
+	size_t old_entry = MAX_KEY_LEN + MAX_COLUMNS_PER_TABLE * MAX_VALUE_LEN
+			+ sizeof(int) + sizeof(void*);
+	printf("rows:                      %lu\n", count);
+	printf("row bytes (schema):        %d\n", table->row_size);
+	printf("entry bytes:               %lu\n", (unsigned long)entry_size(table));
+	printf("entry bytes (fixed 8 KB):  %lu\n", (unsigned long)old_entry);
+	printf("table bytes per row:       %.1f\n", (double)bytes / count);
+	printf("table resident per row:    %.1f\n", (double)resident / count);
+	printf("resident bytes per row:    %.1f\n", (double)(after - before) / count);
+	printf("fixed layout would need:   %.1f MB\n", (double)old_entry * count / 1e6);
+	printf("schema layout uses:        %.1f MB\n", (double)bytes / 1e6);
+	return 0;
+}
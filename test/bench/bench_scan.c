@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @brief Scan benchmark of int predicates at 1M rows.
+ *
+ * Compares the old inner loop of query(), which ran atoi on the row's
+ * text value and on the comparison value for every row, with the current
+ * one that compares integers parsed once at SET and at query setup.
+ *
+ * Usage: bench_scan [rows] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define REPEAT 10		// Scans timed for each loop.
+#define TEXT_LEN 16		// Bytes of a text int value.
+
+struct config_params params;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *table = find_table("census");
+	int pop_col = table != NULL ? get_col_index(table, "Population") : -1;
+	if (pop_col < 0) {
+		printf("Need a census table with a Population column.\n");
+		return 1;
+	}
+
+	// Text copy of the Population column, as the old rows stored it.
+	char (*text)[TEXT_LEN] = malloc(rows * sizeof *text);
+	unsigned int seed = 297;
+	long k;
+	for (k = 0; k < rows; k++) {
+		char key[32];
+		char cols[MAX_COLUMNS_PER_TABLE][MAX_VALUE_LEN];
+		struct data_value values[MAX_COLUMNS_PER_TABLE];
+		int m;
+		for (m = 0; m < table->col_count; m++) {
+			if (table->columns[m]->type == INT)
+				sprintf(cols[m], "%d", rand_r(&seed) % 3000000);
+			else
+				strcpy(cols[m], "Ontario");
+			values[m].int_val = atoll(cols[m]);
+			values[m].str_val = cols[m];
+		}
+		strcpy(text[k], cols[pop_col]);
+		snprintf(key, sizeof key, "key%ld", k);
+		set_entry(table, key, values, 0);
+	}
+
+	// Before: parse both sides of the comparison on every row.
+	char col_name[MAX_COLNAME_LEN] = "Population";
+	char operand[MAX_VALUE_LEN] = ">";
+	char comp_val[MAX_VALUE_LEN] = "3000000";
+	long matches = 0;
+	long long start = now_ns();
+	int r;
+	for (r = 0; r < REPEAT; r++) {
+		for (k = 0; k < rows; k++) {
+			if (atoi(text[k]) > atoi(comp_val))
+				matches++;
+		}
+	}
+	double before = (double)(now_ns() - start) / REPEAT / rows;
+
+	// After: query() over the same rows, no row matches.
+	struct query_context ctx;
+	init_query(&ctx, table);
+	set_query_params(&ctx, col_name, operand, comp_val);
+	char (*keys)[MAX_KEY_LEN] = malloc(MAX_RECORDS_PER_TABLE * MAX_KEY_LEN);
+	int found = 0;
+	start = now_ns();
+	for (r = 0; r < REPEAT; r++) {
+		query(&ctx, keys, MAX_RECORDS_PER_TABLE, &found);
+		matches += found;
+	}
+	double after = (double)(now_ns() - start) / REPEAT / rows;
+
+	printf("rows:                    %ld\n", rows);
+	printf("atoi per row (before):   %.2f ns/row\n", before);
+	printf("int compare (after):     %.2f ns/row\n", after);
+	printf("speedup:                 %.2fx\n", before / after);
+	return matches != 0;
+}
@@ -0,0 +1,263 @@
+/**
+ * @file
+ * @brief Snapshot duration and restart time of a large table.
+ *
+ * Runs three phases, each in a process of its own so only one copy of
+ * the table is in memory at a time:
+ *  1. loads rows into the census table and updates them twice, logged
+ *     with durability none, so the log holds three SETs per row;
+ *  2. restarts from the log alone, then takes a snapshot while a thread
+ *     keeps inserting rows, and updates 1% of the rows after it;
+ *  3. restarts from the snapshot and the log after it, and checks that
+ *     every row is back with the right Rank and metadata.
+ * Reports how long each takes, how long the SETs made during the
+ * snapshot waited at most, and the size of the files.
+ *
+ * Usage: bench_snapshot [rows] [directory] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000
+#define DEFAULT_DIRECTORY "."
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define LOAD_PASSES 3
+
+struct config_params params;
+
+// What a phase reports back.
+struct result {
+	double load_ms;
+	double log_restart_ms;
+	double snapshot_ms;
+	double max_set_ms;
+	long inserts;
+	double restart_ms;
+	long wrong;
+	int failed;
+};
+
+static struct data_table *table;
+static int rank_col;
+static int rows;
+static char directory[MAX_PATH_LEN];
+static volatile int running;
+static struct result result;
+
+// Current time in milliseconds.
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Set a key whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+// Start from empty tables and recover them from the directory.
+static int open_tables() {
+	if (init_tables(params.tables) != 0)
+		return -1;
+	table = find_table("census");
+	return recover_tables(directory, WAL_NONE, 0, 0);
+}
+
+static void load() {
+	char key[MAX_KEY_LEN];
+	int k;
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	double start = now_ms();
+	int pass;
+	for (pass = 1; pass <= LOAD_PASSES; pass++) {
+		for (k = 0; k < rows; k++) {
+			snprintf(key, sizeof key, "k%d", k);
+			if (set_rank(key, pass) != 0)
+				result.failed = 1;
+		}
+	}
+	result.load_ms = now_ms() - start;
+	close_table_log();
+}
+
+// Insert rows until the snapshot is done, timing each.
+static void *insert_main(void *arg) {
+	char key[MAX_KEY_LEN];
+	while (running) {
+		snprintf(key, sizeof key, "w%ld", result.inserts);
+		double start = now_ms();
+		if (set_rank(key, 1) != 0)
+			result.failed = 1;
+		double took = now_ms() - start;
+		if (took > result.max_set_ms)
+			result.max_set_ms = took;
+		result.inserts++;
+	}
+	return NULL;
+}
+
+static void snapshot() {
+	char key[MAX_KEY_LEN];
+	pthread_t inserter;
+	int k;
+	double start = now_ms();
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	result.log_restart_ms = now_ms() - start;
+	running = 1;
+	pthread_create(&inserter, NULL, insert_main, NULL);
+	start = now_ms();
+	if (checkpoint_tables() != 0)
+		result.failed = 1;
+	result.snapshot_ms = now_ms() - start;
+	running = 0;
+	pthread_join(inserter, NULL);
+	// The log after the snapshot.
+	for (k = 0; k < rows / 100; k++) {
+		snprintf(key, sizeof key, "k%d", k);
+		if (set_rank(key, LOAD_PASSES + 1) != 0)
+			result.failed = 1;
+	}
+	close_table_log();
+}
+
+// Count a key missing or whose Rank and metadata are not rank.
+static long check_key(char *key, long rank) {
+	struct row_version *version = get_version(table, key);
+	if (version == NULL)
+		return 1;
+	long wrong = version_get_int(table, version, rank_col) != rank
+			|| version->metadata != rank;
+	release_version(version);
+	return wrong;
+}
+
+static void restart() {
+	char key[MAX_KEY_LEN];
+	long k;
+	double start = now_ms();
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	result.restart_ms = now_ms() - start;
+	for (k = 0; k < rows; k++) {
+		snprintf(key, sizeof key, "k%ld", k);
+		result.wrong += check_key(key, k < rows / 100 ? LOAD_PASSES + 1 : LOAD_PASSES);
+	}
+	for (k = 0; k < result.inserts; k++) {
+		snprintf(key, sizeof key, "w%d", (int)k);
+		result.wrong += check_key(key, 1);
+	}
+	close_table_log();
+}
+
+// Run a phase in a child process and get its result.
+static int run_phase(void (*phase)()) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return -1;
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		phase();
+		if (write(fds[1], &result, sizeof result) != sizeof result)
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	int status;
+	int got = read(fds[0], &result, sizeof result) == sizeof result;
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !got || result.failed)
+		return -1;
+	return 0;
+}
+
+// Print the size of the files of the directory, and remove them if asked.
+static void list_files(int remove) {
+	DIR *dir = opendir(directory);
+	struct dirent *file;
+	char path[MAX_PATH_LEN + 512];
+	while (dir != NULL && (file = readdir(dir)) != NULL) {
+		struct stat st;
+		snprintf(path, sizeof path, "%s/%s", directory, file->d_name);
+		if (file->d_name[0] == '.' || stat(path, &st) != 0)
+			continue;
+		if (remove)
+			unlink(path);
+		else
+			printf("  %-36s %8.1f MB\n", file->d_name, st.st_size / 1e6);
+	}
+	if (dir != NULL)
+		closedir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+	rows = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+	char *parent = argc > 2 ? argv[2] : DEFAULT_DIRECTORY;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	if (table == NULL || (rank_col = get_col_index(table, "Rank")) < 0) {
+		printf("Need a census table with a Rank column.\n");
+		return 1;
+	}
+	snprintf(directory, sizeof directory, "%s/bench_snapshotXXXXXX", parent);
+	if (mkdtemp(directory) == NULL) {
+		printf("Error: cannot create a directory in %s.\n", parent);
+		return 1;
+	}
+
+	int failed = run_phase(load);
+	if (!failed)
+		printf("Loaded %d rows in %d passes in %.0f ms.\n", rows, LOAD_PASSES,
+				result.load_ms);
+	failed = failed || run_phase(snapshot);
+	if (!failed) {
+		printf("Restarted from the log alone in %.0f ms.\n", result.log_restart_ms);
+		printf("Took a snapshot in %.0f ms, %ld rows inserted meanwhile, "
+				"the slowest in %.1f ms.\n", result.snapshot_ms,
+				result.inserts, result.max_set_ms);
+		list_files(0);
+	}
+	failed = failed || run_phase(restart);
+	if (!failed)
+		printf("Restarted from the snapshot and %d logged SETs in %.0f ms.\n",
+				rows / 100, result.restart_ms);
+	list_files(1);
+	rmdir(directory);
+	if (failed || result.wrong > 0) {
+		printf("Error: a phase failed or %ld rows were recovered wrong.\n",
+				result.wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * @file
+ * @brief Startup time from a table file, for tables of growing size.
+ *
+ * For 100000 rows and ten times as many up to the given number, loads the
+ * census table in a process of its own, writes it to a table file with a
+ * checkpoint and updates 1000 rows after it, so the log has a tail to
+ * replay. The pages of the files are then dropped from the page cache,
+ * and another process starts from them: it reports how long the tables
+ * took to be ready, how long 1000 GETs of random keys took right after,
+ * each reading its row from disk, and how much memory it holds then. Every
+ * key read must have the Rank it was last set to.
+ *
+ * Usage: bench_startup [max_rows] [directory] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "database.h"
+
+#define DEFAULT_MAX_ROWS 1000000
+#define MIN_ROWS 100000
+#define DEFAULT_DIRECTORY "."
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define TAIL_SETS 1000
+#define GETS 1000
+
+struct config_params params;
+
+// What a phase reports back.
+struct result {
+	double load_ms;
+	double ready_ms;
+	double gets_ms;
+	double resident_mb;
+	long wrong;
+	int failed;
+};
+
+static struct data_table *table;
+static int rank_col;
+static int rows;
+static char directory[MAX_PATH_LEN];
+static struct result result;
+
+// Current time in milliseconds.
+static double now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Set a key whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+// Start from empty tables and recover them from the directory.
+static int open_tables() {
+	if (init_tables(params.tables) != 0)
+		return -1;
+	table = find_table("census");
+	return recover_tables(directory, WAL_NONE, 0, 0);
+}
+
+static void load() {
+	char key[MAX_KEY_LEN];
+	int k;
+	double start = now_ms();
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	for (k = 0; k < rows; k++) {
+		snprintf(key, sizeof key, "k%d", k);
+		if (set_rank(key, 1) != 0)
+			result.failed = 1;
+	}
+	if (checkpoint_tables() != 0)
+		result.failed = 1;
+	for (k = 0; k < TAIL_SETS; k++) {
+		snprintf(key, sizeof key, "k%d", k);
+		if (set_rank(key, 2) != 0)
+			result.failed = 1;
+	}
+	close_table_log();
+	result.load_ms = now_ms() - start;
+}
+
+// Resident memory of the process in MB.
+static double resident_mb() {
+	long size = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm != NULL) {
+		if (fscanf(statm, "%ld %ld", &size, &resident) != 2)
+			resident = 0;
+		fclose(statm);
+	}
+	return resident * (double)sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+static void start() {
+	char key[MAX_KEY_LEN];
+	int k;
+	double start = now_ms();
+	if (open_tables() != 0) {
+		result.failed = 1;
+		return;
+	}
+	result.ready_ms = now_ms() - start;
+	srand(rows);
+	start = now_ms();
+	for (k = 0; k < GETS; k++) {
+		long n = ((long)rand() * RAND_MAX + rand()) % rows;
+		snprintf(key, sizeof key, "k%ld", n);
+		struct row_version *version = get_version(table, key);
+		if (version == NULL) {
+			result.wrong++;
+			continue;
+		}
+		result.wrong += version_get_int(table, version, rank_col)
+				!= (n < TAIL_SETS ? 2 : 1);
+		release_version(version);
+	}
+	result.gets_ms = now_ms() - start;
+	result.resident_mb = resident_mb();
+	close_table_log();
+}
+
+// Run a phase in a child process and get its result.
+static int run_phase(void (*phase)()) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return -1;
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		phase();
+		if (write(fds[1], &result, sizeof result) != sizeof result)
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	int status;
+	int got = read(fds[0], &result, sizeof result) == sizeof result;
+	close(fds[0]);
+	if (pid < 0 || waitpid(pid, &status, 0) != pid || !got || result.failed)
+		return -1;
+	return 0;
+}
+
+// Drop the pages of the files of the directory from the page cache, or
+// remove the files, and return their size in MB.
+static double drop_files(int remove) {
+	DIR *dir = opendir(directory);
+	struct dirent *file;
+	char path[MAX_PATH_LEN + 512];
+	double size = 0;
+	while (dir != NULL && (file = readdir(dir)) != NULL) {
+		struct stat st;
+		snprintf(path, sizeof path, "%s/%s", directory, file->d_name);
+		if (file->d_name[0] == '.' || stat(path, &st) != 0)
+			continue;
+		size += st.st_size / 1e6;
+		if (remove) {
+			unlink(path);
+			continue;
+		}
+		int fd = open(path, O_RDONLY);
+		if (fd >= 0) {
+			fdatasync(fd);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	if (dir != NULL)
+		closedir(dir);
+	return size;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_rows = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_ROWS;
+	char *parent = argc > 2 ? argv[2] : DEFAULT_DIRECTORY;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	if (table == NULL || (rank_col = get_col_index(table, "Rank")) < 0) {
+		printf("Need a census table with a Rank column.\n");
+		return 1;
+	}
+
+	printf("%10s %10s %10s %10s %12s %12s\n", "rows", "file MB", "load ms",
+			"ready ms", "1000 GETs ms", "resident MB");
+	int failed = 0;
+	long wrong = 0;
+	for (rows = MIN_ROWS; rows <= max_rows && !failed; rows *= 10) {
+		snprintf(directory, sizeof directory, "%s/bench_startupXXXXXX", parent);
+		if (mkdtemp(directory) == NULL) {
+			printf("Error: cannot create a directory in %s.\n", parent);
+			return 1;
+		}
+		failed = run_phase(load);
+		double load_ms = result.load_ms;
+		double size = drop_files(0);
+		failed = failed || run_phase(start);
+		if (!failed)
+			printf("%10d %10.1f %10.0f %10.1f %12.1f %12.1f\n", rows, size,
+					load_ms, result.ready_ms, result.gets_ms, result.resident_mb);
+		wrong += result.wrong;
+		drop_files(1);
+		rmdir(directory);
+	}
+	if (failed || wrong > 0) {
+		printf("Error: a phase failed or %ld keys were read wrong.\n", wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+/**
+ * @file
+ * @brief Query and SET time of a value index on a char column.
+ *
+ * Loads rows with a distinct name each into subwayLines, whose name column
+ * has no index, and into subwayLines_indexed, whose name column has a
+ * value index (see subway_index.conf). Then times the SETs of both tables,
+ * and queries for a name, alone and with an int condition, on both, and
+ * checks both find the same keys. Renames a row on both and checks its
+ * old name is gone and its new one found.
+ *
+ * Usage: bench_value_index [rows] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "database.h"
+
+#define DEFAULT_ROWS 1000000L
+#define DEFAULT_CONFIG "subway_index.conf"
+#define QUERIES 100		// Names queried, on the unindexed table.
+#define INDEXED_QUERIES 100000	// Names queried on the indexed table.
+
+struct config_params params;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// SET the row of line k of a table, named with its number and a suffix.
+static int set_line(struct data_table *table, long k, const char *suffix) {
+	char key[MAX_KEY_LEN], name[MAX_VALUE_LEN];
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	snprintf(key, sizeof key, "line%d", (int)k);
+	snprintf(name, sizeof name, "Line %ld%s", k, suffix);
+	values[0].str_val = name;
+	values[1].int_val = k % 40;
+	values[2].int_val = k % 100;
+	return set_entry(table, key, values, 0);
+}
+
+// Query for the name of line k, with stops < 20 if ranged, return the
+// number of keys found, the first one in key.
+static int query_line(struct data_table *table, long k, const char *suffix,
+		int ranged, char key[MAX_KEY_LEN]) {
+	static char keys[MAX_RECORDS_PER_TABLE][MAX_KEY_LEN];
+	char cols[2][MAX_COLNAME_LEN] = {"name", "stops"};
+	char ops[2][MAX_VALUE_LEN] = {"=", "<"};
+	char vals[2][MAX_VALUE_LEN] = {"", "20"};
+	struct query_context ctx;
+	int c, found;
+	snprintf(vals[0], sizeof vals[0], "Line %ld%s", k, suffix);
+	init_query(&ctx, table);
+	for (c = 0; c < 1 + ranged; c++)
+		set_query_params(&ctx, cols[c], ops[c], vals[c]);
+	query(&ctx, keys, MAX_RECORDS_PER_TABLE, &found);
+	strcpy(key, found > 0 ? keys[0] : "");
+	return found;
+}
+
+// Time count queries for the names of random lines, return us per query,
+// with the number of keys found and the sum of their lengths to compare.
+static double time_queries(struct data_table *table, long rows, int count,
+		int ranged, long *found, long *key_bytes) {
+	unsigned int seed = 297;
+	char key[MAX_KEY_LEN];
+	int q;
+	*found = *key_bytes = 0;
+	long long start = now_ns();
+	for (q = 0; q < count; q++) {
+		*found += query_line(table, rand_r(&seed) % rows, "", ranged, key);
+		*key_bytes += strlen(key);
+	}
+	return (double)(now_ns() - start) / count / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+	long rows = argc > 1 ? atol(argv[1]) : DEFAULT_ROWS;
+	char *config_file = argc > 2 ? argv[2] : DEFAULT_CONFIG;
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	struct data_table *plain = find_table("subwayLines");
+	struct data_table *indexed = find_table("subwayLines_indexed");
+	if (plain == NULL || indexed == NULL) {
+		printf("Need subwayLines and subwayLines_indexed tables.\n");
+		return 1;
+	}
+
+	struct data_table *tables[] = {plain, indexed};
+	double set_ns[2];
+	size_t bytes[2];
+	int t;
+	long k;
+	for (t = 0; t < 2; t++) {
+		long long start = now_ns();
+		for (k = 0; k < rows; k++) {
+			if (set_line(tables[t], k, "") != 0) {
+				printf("Error: cannot load row %ld.\n", k);
+				return 1;
+			}
+		}
+		set_ns[t] = (double)(now_ns() - start) / rows;
+		unsigned long count;
+		size_t resident;
+		bytes[t] = table_memory_usage(tables[t], &count, &resident);
+	}
+	printf("%ld rows, SET %.0f ns without the index, %.0f ns with it\n", rows,
+			set_ns[0], set_ns[1]);
+	printf("memory %.1f MB without the index, %.1f MB with it (%.1f bytes/row)\n",
+			bytes[0] / 1e6, bytes[1] / 1e6,
+			((double)bytes[1] - bytes[0]) / rows);
+
+	printf("%-30s %8s %12s %12s %9s\n", "query", "matches", "scan us",
+			"index us", "speedup");
+	int ranged, wrong = 0;
+	for (ranged = 0; ranged < 2; ranged++) {
+		long plain_found, indexed_found, plain_bytes, indexed_bytes;
+		double plain_us = time_queries(plain, rows, QUERIES, ranged,
+				&plain_found, &plain_bytes);
+		// the same names first, to compare the keys found
+		time_queries(indexed, rows, QUERIES, ranged, &indexed_found,
+				&indexed_bytes);
+		wrong += plain_found != indexed_found || plain_bytes != indexed_bytes;
+		double indexed_us = time_queries(indexed, rows, INDEXED_QUERIES, ranged,
+				&indexed_found, &indexed_bytes);
+		printf("%-30s %8ld %12.1f %12.2f %8.0fx\n",
+				ranged ? "name = X, stops < 20" : "name = X", plain_found,
+				plain_us, indexed_us, plain_us / indexed_us);
+	}
+
+	// a renamed line is only found by its new name
+	char key[MAX_KEY_LEN], deleted[MAX_KEY_LEN] = "line8";
+	for (t = 0; t < 2; t++) {
+		if (set_line(tables[t], 7, " renamed") != 0
+				|| query_line(tables[t], 7, "", 0, key) != 0
+				|| query_line(tables[t], 7, " renamed", 0, key) != 1
+				|| delete_entry(tables[t], deleted) != 0
+				|| query_line(tables[t], 8, "", 0, key) != 0)
+			wrong++;
+	}
+	if (wrong > 0) {
+		printf("Error: %d checks found different keys with and without the index.\n",
+				wrong);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,222 @@
+/**
+ * @file
+ * @brief SET throughput with the write-ahead log, per durability mode.
+ *
+ * For each of the modes always, every_ms 10 and none, logs into a new
+ * directory and runs 1, 4 and 16 threads that each SET their own keys
+ * over and over for a few seconds, the Rank column counting the updates
+ * of a key. Reports SETs per second and the SETs sharing each fsync,
+ * which is what group commit buys with durability always. Then closes
+ * the log, starts from empty tables and recovers them from the log:
+ * every key must be back with the Rank of its last update.
+ *
+ * The log directories are made in the given directory, whose file system
+ * decides what an fsync costs.
+ *
+ * Usage: bench_wal [seconds] [directory] [config_file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "database.h"
+
+#define DEFAULT_SECONDS 1
+#define DEFAULT_DIRECTORY "."
+#define DEFAULT_CONFIG "../../src/census.conf"
+#define MAX_THREADS 16
+#define KEYS_PER_THREAD 1000
+#define EVERY_MS 10
+
+struct config_params params;
+
+struct worker {
+	pthread_t thread;
+	int run;
+	int id;
+	long updates[KEYS_PER_THREAD];	// Updates made to each key.
+	long sets;
+	long errors;
+};
+
+static struct data_table *table;
+static int rank_col;
+static volatile int running;
+
+// Current time in nanoseconds.
+static long long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Key k of thread t in run r.
+static void make_key(char key[MAX_KEY_LEN], int r, int t, int k) {
+	snprintf(key, MAX_KEY_LEN, "r%dt%dk%d", r, t, k);
+}
+
+// Set a key whose Rank column is rank.
+static int set_rank(char *key, long rank) {
+	char province[MAX_VALUE_LEN] = "Ontario";
+	struct data_value values[MAX_COLUMNS_PER_TABLE];
+	int m;
+	for (m = 0; m < table->col_count; m++) {
+		values[m].int_val = m == rank_col ? rank : m;
+		values[m].str_val = province;
+	}
+	return set_entry(table, key, values, 0);
+}
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	char key[MAX_KEY_LEN];
+	int k = 0;
+	while (running) {
+		make_key(key, w->run, w->id, k);
+		if (set_rank(key, w->updates[k] + 1) == 0)
+			w->updates[k]++;
+		else
+			w->errors++;
+		w->sets++;
+		k = (k + 1) % KEYS_PER_THREAD;
+	}
+	return NULL;
+}
+
+// Run threads writers for seconds, return SETs per second.
+static double run(struct worker *workers, int r, int threads, int seconds,
+		long *sets, long *errors) {
+	int t;
+	running = 1;
+	for (t = 0; t < threads; t++) {
+		memset(&workers[t], 0, sizeof(struct worker));
+		workers[t].run = r;
+		workers[t].id = t;
+		pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]);
+	}
+	long long start = now_ns();
+	struct timespec run_time = {seconds, 0};
+	nanosleep(&run_time, NULL);
+	running = 0;
+	*sets = 0;
+	for (t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		*sets += workers[t].sets;
+		*errors += workers[t].errors;
+	}
+	return *sets * 1e9 / (now_ns() - start);
+}
+
+// Count the keys of a run missing or with the wrong Rank.
+static long check_run(struct worker *workers, int r, int threads) {
+	long wrong = 0;
+	char key[MAX_KEY_LEN];
+	int t, k;
+	for (t = 0; t < threads; t++) {
+		for (k = 0; k < KEYS_PER_THREAD; k++) {
+			if (workers[t].updates[k] == 0)
+				continue;
+			make_key(key, r, t, k);
+			struct row_version *version = get_version(table, key);
+			if (version == NULL) {
+				wrong++;
+				continue;
+			}
+			if (version_get_int(table, version, rank_col) != workers[t].updates[k])
+				wrong++;
+			release_version(version);
+		}
+	}
+	return wrong;
+}
+
+// Start from empty tables and recover them from directory.
+static int reopen(char *directory, int durability) {
+	if (init_tables(params.tables) != 0)
+		return -1;
+	table = find_table("census");
+	return recover_tables(directory, durability, EVERY_MS, 0);
+}
+
+// Remove the files of a log directory, then the directory.
+static void remove_files(char *directory) {
+	DIR *dir = opendir(directory);
+	struct dirent *file;
+	char path[MAX_PATH_LEN + 512];
+	while (dir != NULL && (file = readdir(dir)) != NULL) {
+		snprintf(path, sizeof path, "%s/%s", directory, file->d_name);
+		if (file->d_name[0] != '.')
+			unlink(path);
+	}
+	if (dir != NULL)
+		closedir(dir);
+	rmdir(directory);
+}
+
+int main(int argc, char *argv[])
+{
+	int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+	char *parent = argc > 2 ? argv[2] : DEFAULT_DIRECTORY;
+	char *config_file = argc > 3 ? argv[3] : DEFAULT_CONFIG;
+	static struct worker workers[3][MAX_THREADS];
+	int thread_counts[3] = {1, 4, 16};
+	int modes[3] = {WAL_ALWAYS, WAL_EVERY_MS, WAL_NONE};
+	const char *mode_names[3] = {"always", "every_ms 10", "none"};
+
+	if (read_config(config_file, &params) != 0 || init_tables(params.tables) != 0) {
+		printf("Error processing config file %s.\n", config_file);
+		return 1;
+	}
+	table = find_table("census");
+	if (table == NULL || (rank_col = get_col_index(table, "Rank")) < 0) {
+		printf("Need a census table with a Rank column.\n");
+		return 1;
+	}
+
+	printf("%12s %8s %12s %14s\n", "durability", "threads", "SETs/s", "SETs/fsync");
+	long errors = 0, wrong = 0;
+	int d, r;
+	for (d = 0; d < 3; d++) {
+		char directory[MAX_PATH_LEN];
+		snprintf(directory, sizeof directory, "%s/bench_walXXXXXX", parent);
+		if (mkdtemp(directory) == NULL || reopen(directory, modes[d]) != 0) {
+			printf("Error: cannot log into %s.\n", directory);
+			return 1;
+		}
+		for (r = 0; r < 3; r++) {
+			unsigned long syncs = table_log->syncs;
+			long sets;
+			double rate = run(workers[r], r, thread_counts[r], seconds, &sets, &errors);
+			syncs = table_log->syncs - syncs;
+			if (syncs > 0)
+				printf("%12s %8d %12.0f %14.1f\n", mode_names[d],
+						thread_counts[r], rate, (double)sets / syncs);
+			else
+				printf("%12s %8d %12.0f %14s\n", mode_names[d],
+						thread_counts[r], rate, "-");
+		}
+
+		// Every SET of every run must come back from the log.
+		close_table_log();
+		long long start = now_ns();
+		if (reopen(directory, modes[d]) != 0) {
+			printf("Error: cannot recover from %s.\n", directory);
+			return 1;
+		}
+		printf("%12s recovered in %.0f ms\n", "", (now_ns() - start) / 1e6);
+		for (r = 0; r < 3; r++)
+			wrong += check_run(workers[r], r, thread_counts[r]);
+		close_table_log();
+
+		remove_files(directory);
+	}
+	if (errors > 0 || wrong > 0) {
+		printf("Error: %ld SETs failed, %ld keys recovered wrong.\n", errors, wrong);
+		return 1;
+	}
+	return 0;
+}